@@ -94,10 +94,29 @@ enum ectl_log_components {
 	L_COUNT,
 };
 
+// interrupt latency histograms: bucket 0 counts zero latencies,
+// bucket n counts latencies in [2^(n-1), 2^n), last bucket is open-ended
+#define ECTL_INT_LAT_BUCKETS 32
+
+enum ectl_int_latency_units {
+	ECTL_INT_LAT_NS = 0,
+	ECTL_INT_LAT_INSTRUCTIONS,
+	ECTL_INT_LAT_UNITS
+};
+
 // maintenance
 int ectl_init();
 void ectl_shutdown();
 
+// machines and CPUs (all other calls work on the selected machine and CPU,
+// selecting a machine selects its CPU 0)
+int ectl_machine_count();
+int ectl_machine_get();
+int ectl_machine_select(int num);
+int ectl_cpu_count();
+int ectl_cpu_get();
+int ectl_cpu_select(int num);
+
 // registers
 const char * ectl_reg_name(unsigned id);
 int ectl_reg_get_id(char *name);
@@ -108,6 +127,7 @@ int ectl_reg_set(unsigned id, uint16_t val);
 // memory
 bool ectl_mem_read_n(int seg, uint16_t addr, uint16_t *dest, unsigned count);
 bool ectl_mem_write_n(int seg, uint16_t addr, uint16_t *src, unsigned count);
+int ectl_mem_find(int seg, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max);
 int ectl_mem_map(int seg);
 int ectl_mem_cfg(int nb, int ab, int mp, int seg);
 bool ectl_load(FILE *f, const char *name, int seg, uint16_t saddr);
@@ -130,6 +150,8 @@ void ectl_oprq();
 int ectl_int_set(unsigned interrupt);
 int ectl_int_clear(unsigned interrupt);
 uint32_t ectl_int_get32();
+int ectl_int_latency_get(unsigned interrupt, unsigned unit, unsigned long *hist, unsigned long *sum);
+void ectl_int_latency_reset();
 
 // informational, other
 const char * ectl_version();
@@ -40,6 +40,7 @@
 	#define atom_store_release(ptr, val)	__atomic_store_n(ptr, val, __ATOMIC_RELEASE)
 	#define atom_or_release(ptr, val)		__atomic_or_fetch(ptr, val, __ATOMIC_RELEASE)
 	#define atom_and_release(ptr, val)		__atomic_and_fetch(ptr, val, __ATOMIC_RELEASE)
+	#define atom_add_release(ptr, val)		__atomic_add_fetch(ptr, val, __ATOMIC_RELEASE)
 	#define atom_full_fence()				__atomic_thread_fence(__ATOMIC_SEQ_CST)
 // old GCC atomics on x86
 #elif defined(ATOMIC_H_GCC_OLD_X86)
@@ -47,6 +48,7 @@
 	#define atom_store_release(ptr, val)	*(ptr) = (val); asm volatile("" ::: "memory")
 	#define atom_or_release(ptr, val)		__sync_or_and_fetch(ptr, val)
 	#define atom_and_release(ptr, val)		__sync_and_and_fetch(ptr, val)
+	#define atom_add_release(ptr, val)		__sync_add_and_fetch(ptr, val)
 	#define atom_full_fence()				asm volatile("mfence" ::: "memory")
 // old GCC atomics
 #elif defined(ATOMIC_H_GCC_OLD_ANY)
@@ -54,6 +56,7 @@
 	#define atom_store_release(ptr, val)	__sync_val_compare_and_swap(ptr, *ptr, val)
 	#define atom_or_release(ptr, val)		__sync_or_and_fetch(ptr, val)
 	#define atom_and_release(ptr, val)		__sync_and_and_fetch(ptr, val)
+	#define atom_add_release(ptr, val)		__sync_add_and_fetch(ptr, val)
 	#define atom_full_fence()				__sync_synchronize()
 // other architectures and compilers
 #else
@@ -27,10 +27,18 @@ typedef dictionary em400_cfg;
 #define CFG_DEFAULT_LOG_COMPONENTS "em4h"
 #define CFG_DEFAULT_LOG_LINE_BUFFERED 1
 #define CFG_DEFAULT_LOG_ENABLED 0
+#define CFG_DEFAULT_LOG_FILTER_NB -1
+#define CFG_DEFAULT_LOG_FILTER_IC NULL
+#define CFG_DEFAULT_LOG_FILTER_PROCESS NULL
+#define CFG_DEFAULT_LOG_FILTER_CHAN -1
+#define CFG_DEFAULT_LOG_FILTER_LINE -1
+#define CFG_DEFAULT_LOG_RATE_LIMIT NULL
 
 #define CFG_DEFAULT_CPU_MODIFICATIONS 0
 #define CFG_DEFAULT_CPU_FPGA 0
+#define CFG_DEFAULT_CPU_COUNT 1
 #define CFG_DEFAULT_CPU_AWP 1
+#define CFG_DEFAULT_CPU_AWP_NATIVE 1
 #define CFG_DEFAULT_CPU_KB 0
 #define CFG_DEFAULT_CPU_IO_USER_ILLEGAL 1
 #define CFG_DEFAULT_CPU_STOP_ON_NOMEM 1
@@ -39,6 +47,10 @@ typedef dictionary em400_cfg;
 #define CFG_DEFAULT_CPU_SPEED_FACTOR 1.0f
 #define CFG_DEFAULT_CPU_CLOCK_PERIOD 10
 #define CFG_DEFAULT_CPU_CLOCK_START 0
+#define CFG_DEFAULT_CPU_IDLE_DETECT 0
+#define CFG_DEFAULT_CPU_IDLE_THRESHOLD 64
+#define CFG_DEFAULT_CPU_IDLE_PARK_MAX 1000
+#define CFG_DEFAULT_CPU_PUBLISH_INTERVAL 4096
 
 #define CFG_DEFAULT_MEMORY_ELWRO_MODULES 1
 #define CFG_DEFAULT_MEMORY_MEGA_MODULES 0
@@ -46,9 +58,37 @@ typedef dictionary em400_cfg;
 #define CFG_DEFAULT_MEMORY_MEGA_PROM NULL
 #define CFG_DEFAULT_MEMORY_MEGA_BOOT 0
 #define CFG_DEFAULT_MEMORY_PRELOAD NULL
+#define CFG_DEFAULT_MEMORY_HUGETLB 0
+#define CFG_DEFAULT_MEMORY_LOCK 0
+#define CFG_DEFAULT_MEMORY_SHM_NAME NULL
+
+#define CFG_DEFAULT_METRICS_PORT 0
+
+#define CFG_DEFAULT_MACHINES_COUNT 1
+#define CFG_DEFAULT_MACHINES_WORKERS 0
+#define CFG_DEFAULT_MACHINES_QUANTUM 10000
+
+#define CFG_DEFAULT_BATCH_ENABLED 0
+#define CFG_DEFAULT_BATCH_HALT_MIN 040
+#define CFG_DEFAULT_BATCH_SECOND_CPU_IC -1
+#define CFG_DEFAULT_BATCH_REGS_DUMP NULL
+#define CFG_DEFAULT_BATCH_MEM_DUMP NULL
+#define CFG_DEFAULT_BATCH_MEM_RANGES NULL
+
+#define CFG_DEFAULT_IOTESTER_INT_RATE 0
+#define CFG_DEFAULT_IOTESTER_INT_SPEC 0
+#define CFG_DEFAULT_IOTESTER_EN_RATIO 0
+#define CFG_DEFAULT_IOTESTER_LATENCY 0
+#define CFG_DEFAULT_IOTESTER_DMA_RATE 0
+#define CFG_DEFAULT_IOTESTER_DMA_WORDS 256
+#define CFG_DEFAULT_IOTESTER_DMA_NB 0
+#define CFG_DEFAULT_IOTESTER_DMA_ADDR 0xf000
+#define CFG_DEFAULT_IOTESTER_BASELINE 0
+#define CFG_DEFAULT_IOTESTER_REPORT 0
 
 #define CFG_DEFAULT_FPGA_DEVICE "/dev/ttyUSB0"
 #define CFG_DEFAULT_FPGA_SPEED 1000000
+#define CFG_DEFAULT_FPGA_WINDOW 1
 
 #define CFG_DEFAULT_SOUND_ENABLED 0
 #define CFG_DEFAULT_SOUND_DRIVER "pulseaudio"
@@ -21,10 +21,12 @@
 
 #include "mem/mem.h"
 #include "cpu/alu.h"
+#include "cpu/awp_native.h"
 #include "cpu/cpu.h"
 #include "cpu/interrupts.h"
 
 #include "log.h"
+#include "cfg.h"
 
 #define AWP_DISPATCH_TAB_ADDR 100
 
@@ -39,105 +41,68 @@
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void alu_16_set_LEG(int32_t a, int32_t b)
+void alu_16_set_LEG(struct cpu *cpu, int32_t a, int32_t b)
 {
-	if (a == b) {
-		FSET(FL_E);
-		FCLR(FL_G | FL_L);
-	} else {
-		if (a < b) {
-			FSET(FL_L);
-			FCLR(FL_E | FL_G);
-		} else {
-			FCLR(FL_E | FL_L);
-			FSET(FL_G);
-		}
-	}
+	FPUT(FL_L | FL_E | FL_G, (a == b) ? FL_E : (a < b) ? FL_L : FL_G);
 }
 
 // -----------------------------------------------------------------------
-void alu_16_set_Z_bool(uint16_t z)
+void alu_16_set_Z_bool(struct cpu *cpu, uint16_t z)
 {
-	if (z == 0) FSET(FL_Z);
-	else FCLR(FL_Z);
+	FPUT(FL_Z, z ? 0 : FL_Z);
 }
 
 // -----------------------------------------------------------------------
-void alu_16_add(int16_t reg, int16_t n, unsigned carry)
+void alu_16_add(struct cpu *cpu, int16_t reg, int16_t n, unsigned carry)
 {
 	int sres = reg + n + carry;
 	unsigned ures = (uint16_t) reg + (uint16_t) n + carry;
 
-	if (sres == 0) {
-		FSET(FL_Z);
-	} else {
-		FCLR(FL_Z);
-	}
+	// all flags are computed first and stored into r[0] with a single write
 
-	if (ures & BIT_MINUS_1) {
-		FSET(FL_C);
-	} else {
-		FCLR(FL_C);
-	}
+	unsigned c = (ures & BIT_MINUS_1) >> 16;
 
 	// Straight from the schematic:
 	// Set M when one of the following is true:
 	//  * C=1 and n[0] == r[0]
 	//  * C=0 and n[0] != r[0]
-	int diff_bit_zero = ((reg ^ n) & BIT_0) >> 15;
-	if (FGET(FL_C) != diff_bit_zero) {
-		FSET(FL_M);
-	} else {
-		FCLR(FL_M);
-	}
+	unsigned diff_bit_zero = ((reg ^ n) & BIT_0) >> 15;
+	unsigned m = c ^ diff_bit_zero;
 
 	// NOTE: straight from the schematic
-	if (((ures & BIT_0) >> 15) ^ FGET(FL_M)) {
-		FSET(FL_V);
-	} else {
-		// V is never cleared
-	}
+	unsigned v = ((ures & BIT_0) >> 15) ^ m;
+
+	// V is never cleared
+	FPUT(FL_Z | FL_M | FL_C, (sres ? 0 : FL_Z) | (m ? FL_M : 0) | (v ? FL_V : 0) | (c ? FL_C : 0));
 
 	REG_RESTRICT_WRITE(IR_A, ures);
 }
 
 
 // -----------------------------------------------------------------------
-void alu_16_sub(int16_t reg, int16_t n)
+void alu_16_sub(struct cpu *cpu, int16_t reg, int16_t n)
 {
 	int sres = reg - n;
 	unsigned ures = (uint16_t) reg + (uint16_t) -n;
 
-	if (sres == 0) {
-		FSET(FL_Z);
-	} else {
-		FCLR(FL_Z);
-	}
+	// all flags are computed first and stored into r[0] with a single write
 
 	// NOTE: x-0 always sets carry
-	if ((ures & BIT_MINUS_1) || (n == 0)) {
-		FSET(FL_C);
-	} else {
-		FCLR(FL_C);
-	}
+	unsigned c = ((ures & BIT_MINUS_1) >> 16) | (n == 0);
 
 	// straight from the schematic
 	// Set M when one of the following is true:
 	//  * C=1 and n[0] != r[0]
 	//  * C=0 and n[0] == r[0]
-	int diff_bit_zero = ((reg ^ n) & BIT_0) >> 15;
-	if (FGET(FL_C) == diff_bit_zero) {
-		FSET(FL_M);
-	} else {
-		FCLR(FL_M);
-	}
+	unsigned diff_bit_zero = ((reg ^ n) & BIT_0) >> 15;
+	unsigned m = !(c ^ diff_bit_zero);
 
 	// NOTE: straight from the schematic
-	if (((ures & BIT_0) >> 15) ^ FGET(FL_M)) {
-		FSET(FL_V);
-	} else {
-		// V is never cleared
-	}
+	unsigned v = ((ures & BIT_0) >> 15) ^ m;
+
+	// V is never cleared
+	FPUT(FL_Z | FL_M | FL_C, (sres ? 0 : FL_Z) | (m ? FL_M : 0) | (v ? FL_V : 0) | (c ? FL_C : 0));
+
 	REG_RESTRICT_WRITE(IR_A, ures);
 }
 
@@ -146,7 +111,44 @@ void alu_16_sub(int16_t reg, int16_t n)
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void awp_dispatch(int op, uint16_t arg)
+static int awp_emawp(int op, uint16_t *regs, uint16_t *n)
+{
+	switch (op) {
+		case AWP_NRF0:
+		case AWP_NRF1:
+		case AWP_NRF2:
+		case AWP_NRF3:
+			return awp_float_norm(regs);
+		case AWP_AD:
+			return awp_dword_add(regs, n);
+		case AWP_SD:
+			return awp_dword_sub(regs, n);
+		case AWP_MW:
+			return awp_dword_mul(regs, n[0]);
+		case AWP_DW:
+			return awp_dword_div(regs, n[0]);
+		case AWP_AF:
+			return awp_float_add(regs, n);
+		case AWP_SF:
+			return awp_float_sub(regs, n);
+		case AWP_MF:
+			return awp_float_mul(regs, n);
+		case AWP_DF:
+			return awp_float_div(regs, n);
+	}
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+int awp_init(struct cpu *cpu, em400_cfg *cfg)
+{
+	cpu->awp_native = cfg_getbool(cfg, "cpu:awp_native", CFG_DEFAULT_CPU_AWP_NATIVE);
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void awp_dispatch(struct cpu *cpu, int op, uint16_t arg)
 {
 	assert(op >= AWP_NRF0);
 	assert(op <= AWP_DF);
@@ -166,62 +168,31 @@ void awp_dispatch(int op, uint16_t arg)
 		3, // AWP_DF
 	};
 
-	if (awp_enabled) {
+	if (cpu->awp_enabled) {
 		uint16_t n[3];
-		for (int i=0 ; i<awp_arg_count[op] ; i++) {
-			if (!cpu_mem_read_1(q, arg+i, n+i)) return;
-		}
-		int res = 0;
-		switch (op) {
-			case AWP_NRF0:
-			case AWP_NRF1:
-			case AWP_NRF2:
-			case AWP_NRF3:
-				res = awp_float_norm(r);
-				break;
-			case AWP_AD:
-				res = awp_dword_add(r, n);
-				break;
-			case AWP_SD:
-				res = awp_dword_sub(r, n);
-				break;
-			case AWP_MW:
-				res = awp_dword_mul(r, n[0]);
-				break;
-			case AWP_DW:
-				res = awp_dword_div(r, n[0]);
-				break;
-			case AWP_AF:
-				res = awp_float_add(r, n);
-				break;
-			case AWP_SF:
-				res = awp_float_sub(r, n);
-				break;
-			case AWP_MF:
-				res = awp_float_mul(r, n);
-				break;
-			case AWP_DF:
-				res = awp_float_div(r, n);
-				break;
+		if (!cpu_mem_read_n(cpu, cpu->q, arg, n, awp_arg_count[op])) return;
+		int res = cpu->awp_native ? awp_native(op, cpu->r, n) : AWP_FALLBACK;
+		if (res == AWP_FALLBACK) {
+			res = awp_emawp(op, cpu->r, n);
 		}
 
 		switch (res) {
 			case AWP_FP_UF:
-				int_set(INT_FP_UF);
+				int_set(cpu, INT_FP_UF);
 				break;
 			case AWP_FP_OF:
-				int_set(INT_FP_OF);
+				int_set(cpu, INT_FP_OF);
 				break;
 			case AWP_DIV_OF:
-				int_set(INT_DIV_OF);
+				int_set(cpu, INT_DIV_OF);
 				break;
 			case AWP_FP_ERR:
-				int_set(INT_FP_ERR);
+				int_set(cpu, INT_FP_ERR);
 				break;
 		}
 	} else {
-		if (!cpu_mem_read_1(false, AWP_DISPATCH_TAB_ADDR+op, &ar)) return;
-		cpu_ctx_switch(arg, ar, MASK_9);
+		if (!cpu_mem_read_1(cpu, false, AWP_DISPATCH_TAB_ADDR+op, &cpu->ar)) return;
+		cpu_ctx_switch(cpu, arg, cpu->ar, MASK_9);
 	}
 }
 
@@ -20,22 +20,29 @@
 
 #include <inttypes.h>
 
+#include "cfg.h"
+
 enum alu_awp_ops {
 	AWP_NRF0 = 0, AWP_NRF1 = 1, AWP_NRF2 = 2, AWP_NRF3 = 3, // NRFs need to be at positions 0-3
 	AWP_AD, AWP_SD, AWP_MW, AWP_DW,
 	AWP_AF, AWP_SF, AWP_MF, AWP_DF,
 };
 
-void alu_16_add(int16_t r, int16_t n, unsigned carry);
-void alu_16_sub(int16_t r, int16_t n);
-void alu_16_set_LEG(int32_t a, int32_t b);
-void alu_16_set_Z_bool(uint16_t z);
+struct cpu;
+
+void alu_16_add(struct cpu *cpu, int16_t r, int16_t n, unsigned carry);
+void alu_16_sub(struct cpu *cpu, int16_t r, int16_t n);
+void alu_16_set_LEG(struct cpu *cpu, int32_t a, int32_t b);
+void alu_16_set_Z_bool(struct cpu *cpu, uint16_t z);
 
-void awp_dispatch(int op, uint16_t arg);
+int awp_init(struct cpu *cpu, em400_cfg *cfg);
+void awp_dispatch(struct cpu *cpu, int op, uint16_t arg);
 
-#define FGET(x) (r[0] & (x) ? 1 : 0)
-#define FSET(x) (r[0] |= (x))
-#define FCLR(x) (r[0] &= ~(x))
+// flag access macros work on the CPU pointed to by 'cpu' in the current scope
+#define FGET(x) (cpu->r[0] & (x) ? 1 : 0)
+#define FSET(x) (cpu->r[0] |= (x))
+#define FCLR(x) (cpu->r[0] &= ~(x))
+#define FPUT(mask, x) (cpu->r[0] = (cpu->r[0] & ~(mask)) | (x))
 
 #endif
 
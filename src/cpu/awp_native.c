@@ -0,0 +1,329 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <emawp.h>
+
+#include "cpu/awp_native.h"
+#include "cpu/alu.h"
+#include "cpu/cpu.h"
+
+// Native AWP operations. Each one either computes a result bit-exact
+// with emawp, or returns AWP_FALLBACK without touching any register,
+// leaving the case for emawp. tests/awp/awp_native.c checks that.
+
+// -----------------------------------------------------------------------
+// ---- 32-bit fixed point -----------------------------------------------
+// -----------------------------------------------------------------------
+
+// -----------------------------------------------------------------------
+static int awp_native_dword_add(uint16_t *regs, uint16_t *n)
+{
+	uint32_t a = (regs[1] << 16) | regs[2];
+	uint32_t b = (n[0] << 16) | n[1];
+	int64_t sres = (int64_t) (int32_t) a + (int32_t) b;
+	uint64_t ures = (uint64_t) a + b;
+
+	// same as alu_16_add(), but 32-bit wide
+	unsigned c = (ures >> 32) & 1;
+	unsigned m = c ^ (((a ^ b) >> 31) & 1);
+	unsigned v = ((ures >> 31) & 1) ^ m;
+
+	// V is never cleared, Z is set only when the full (not truncated) result is 0
+	regs[0] = (regs[0] & ~(FL_Z | FL_M | FL_C)) | (sres ? 0 : FL_Z) | (m ? FL_M : 0) | (v ? FL_V : 0) | (c ? FL_C : 0);
+	regs[1] = ures >> 16;
+	regs[2] = ures;
+
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+static int awp_native_dword_sub(uint16_t *regs, uint16_t *n)
+{
+	uint32_t a = (regs[1] << 16) | regs[2];
+	uint32_t b = (n[0] << 16) | n[1];
+	int64_t sres = (int64_t) (int32_t) a - (int32_t) b;
+	uint64_t ures = (uint64_t) a + (uint32_t) -b;
+
+	// same as alu_16_sub(), but 32-bit wide (x-0 always sets carry)
+	unsigned c = ((ures >> 32) & 1) | (b == 0);
+	unsigned m = !(c ^ (((a ^ b) >> 31) & 1));
+	unsigned v = ((ures >> 31) & 1) ^ m;
+
+	regs[0] = (regs[0] & ~(FL_Z | FL_M | FL_C)) | (sres ? 0 : FL_Z) | (m ? FL_M : 0) | (v ? FL_V : 0) | (c ? FL_C : 0);
+	regs[1] = ures >> 16;
+	regs[2] = ures;
+
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+static int awp_native_dword_mul(uint16_t *regs, uint16_t *n)
+{
+	// 16x16 bit product always fits, V is never touched
+	int32_t res = (int16_t) regs[2] * (int16_t) n[0];
+
+	regs[0] = (regs[0] & ~(FL_Z | FL_M)) | (res ? 0 : FL_Z) | (res < 0 ? FL_M : 0);
+	regs[1] = (uint32_t) res >> 16;
+	regs[2] = res;
+
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+static int awp_native_dword_div(uint16_t *regs, uint16_t *n)
+{
+	int32_t a = (int32_t) ((regs[1] << 16) | regs[2]);
+	int16_t d = n[0];
+
+	// division by 0, overflows and the way hardware handles them are left for emawp
+	if ((d == 0) || ((d == -1) && (a == INT32_MIN))) {
+		return AWP_FALLBACK;
+	}
+	int32_t quot = a / d;
+	int32_t rem = a % d;
+	if ((quot < -32767) || (quot > 32767) || ((quot == 0) && rem)) {
+		return AWP_FALLBACK;
+	}
+
+	regs[0] = (regs[0] & ~(FL_Z | FL_M)) | (quot ? 0 : FL_Z) | (quot < 0 ? FL_M : 0);
+	regs[1] = rem;
+	regs[2] = quot;
+
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+// ---- floating point ---------------------------------------------------
+// -----------------------------------------------------------------------
+
+// Only the well-known paths are done natively:
+//  * AF/SF: no bits lost when aligning arguments, or arguments so far apart
+//    that the smaller one doesn't count,
+//  * MF: full product rounded half-up to 40 bits, except for exact ties,
+//  * DF: quotient of magnitudes truncated to 40 bits.
+// Zero and denormalized arguments, exponent overflows and underflows,
+// and results that don't come out normalized all go to emawp.
+
+#define FP_M_MAX ((int64_t) 1 << 39)
+
+// -----------------------------------------------------------------------
+static inline int64_t awp_float_m(const uint16_t *d)
+{
+	// 40-bit mantissa, sign-extended
+	return (int64_t) (((uint64_t) d[0] << 48) | ((uint64_t) d[1] << 32) | ((uint64_t) (d[2] & 0xff00) << 16)) >> 24;
+}
+
+// -----------------------------------------------------------------------
+static inline int awp_float_e(const uint16_t *d)
+{
+	return (int8_t) (d[2] & 0xff);
+}
+
+// -----------------------------------------------------------------------
+static inline bool awp_float_normalized(int64_t m)
+{
+	// mantissa fits in 40 bits and its bits 0 and 1 differ (so it's not 0 either)
+	return (m >= -FP_M_MAX) && (m < FP_M_MAX) && (((m >> 39) ^ (m >> 38)) & 1);
+}
+
+// -----------------------------------------------------------------------
+static int awp_float_store(uint16_t *regs, int64_t m, int e, unsigned c)
+{
+	if (!awp_float_normalized(m) || (e < -128) || (e > 127)) {
+		return AWP_FALLBACK;
+	}
+
+	uint64_t um = m;
+	regs[0] = (regs[0] & ~(FL_Z | FL_M | FL_C)) | (m < 0 ? FL_M : 0) | (c ? FL_C : 0);
+	regs[1] = um >> 24;
+	regs[2] = um >> 8;
+	regs[3] = (um << 8) | (e & 0xff);
+
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+static int awp_native_float_addsub(uint16_t *regs, uint16_t *n, bool sub)
+{
+	int64_t m1 = awp_float_m(regs+1);
+	int64_t m2 = awp_float_m(n);
+	int e1 = awp_float_e(regs+1);
+	int e2 = awp_float_e(n);
+
+	if (!awp_float_normalized(m1) || !awp_float_normalized(m2)) {
+		return AWP_FALLBACK;
+	}
+
+	if (sub) {
+		// -(-1) doesn't fit in the mantissa
+		if (m2 == -FP_M_MAX) {
+			return AWP_FALLBACK;
+		}
+		m2 = -m2;
+	}
+
+	// argument with the larger exponent goes first
+	if (e1 < e2) {
+		int64_t mt = m1; m1 = m2; m2 = mt;
+		int et = e1; e1 = e2; e2 = et;
+	}
+	int d = e1 - e2;
+
+	// arguments this far apart: the result is the larger one, as it is
+	if (d > 40) {
+		return awp_float_store(regs, m1, e1, 0);
+	}
+
+	// any bit shifted out when aligning would need rounding
+	if ((d == 40) || (m2 & (((int64_t) 1 << d) - 1))) {
+		return AWP_FALLBACK;
+	}
+
+	int64_t m = m1 + (m2 >> d);
+	int e = e1;
+	unsigned c = 0;
+
+	if ((m >= FP_M_MAX) || (m < -FP_M_MAX)) {
+		// mantissa overflow: bit shifted out when normalizing rounds the result and goes to C
+		c = m & 1;
+		if (c && (m < 0)) {
+			return AWP_FALLBACK;
+		}
+		m = (m >> 1) + c;
+		e++;
+	} else if (m == 0) {
+		return AWP_FALLBACK;
+	} else {
+		while (!awp_float_normalized(m)) {
+			m *= 2;
+			e--;
+		}
+	}
+
+	return awp_float_store(regs, m, e, c);
+}
+
+// -----------------------------------------------------------------------
+static int awp_native_float_mul(uint16_t *regs, uint16_t *n)
+{
+	int64_t m1 = awp_float_m(regs+1);
+	int64_t m2 = awp_float_m(n);
+	int e = awp_float_e(regs+1) + awp_float_e(n);
+
+	if (!awp_float_normalized(m1) || !awp_float_normalized(m2)) {
+		return AWP_FALLBACK;
+	}
+
+	// -1 * -1 doesn't fit in the mantissa
+	if ((m1 == -FP_M_MAX) && (m2 == -FP_M_MAX)) {
+		return AWP_FALLBACK;
+	}
+
+	// 79-bit product p = t * 2^20 + low, computed in 64 bits:
+	// m2 is split into its upper (signed) and lower 20 bits
+	int64_t a = m1 * (m2 >> 20);
+	int64_t b = m1 * (m2 & 0xfffff);
+	int64_t t = a + (b >> 20);
+	uint64_t low = b & 0xfffff;
+
+	// product of normalized mantissas needs at most one left shift to be normalized
+	int shift = 39;
+	if (!awp_float_normalized(t >> (shift - 20))) {
+		shift--;
+		e--;
+	}
+
+	int64_t m = t >> (shift - 20);
+	uint64_t rest = (((uint64_t) t & (((uint64_t) 1 << (shift - 20)) - 1)) << 20) | low;
+	uint64_t half = (uint64_t) 1 << (shift - 1);
+
+	// leave exact ties for emawp
+	if (rest == half) {
+		return AWP_FALLBACK;
+	}
+
+	// round half-up, C is the rounding bit
+	unsigned c = rest > half;
+
+	return awp_float_store(regs, m + c, e, c);
+}
+
+// -----------------------------------------------------------------------
+static int awp_native_float_div(uint16_t *regs, uint16_t *n)
+{
+	int64_t m1 = awp_float_m(regs+1);
+	int64_t m2 = awp_float_m(n);
+	int e = awp_float_e(regs+1) - awp_float_e(n);
+
+	if (!awp_float_normalized(m1) || !awp_float_normalized(m2)) {
+		return AWP_FALLBACK;
+	}
+
+	bool minus = (m1 < 0) != (m2 < 0);
+	uint64_t a = m1 < 0 ? -m1 : m1;
+	uint64_t b = m2 < 0 ? -m2 : m2;
+
+	// dividend not less than divisor is halved first, but only if no bit is lost
+	if (a >= b) {
+		if (a & 1) {
+			return AWP_FALLBACK;
+		}
+		a >>= 1;
+		e++;
+		if (a >= b) {
+			return AWP_FALLBACK;
+		}
+	}
+
+	// a/b is in [0.5, 1), truncated 40-bit quotient is floor(a * 2^39 / b), done in two steps
+	uint64_t q = (a << 23) / b;
+	uint64_t r = (a << 23) % b;
+	int64_t m = (q << 16) | ((r << 16) / b);
+
+	// C is always cleared
+	return awp_float_store(regs, minus ? -m : m, e, 0);
+}
+
+// -----------------------------------------------------------------------
+int awp_native(int op, uint16_t *regs, uint16_t *n)
+{
+	switch (op) {
+		case AWP_AD:
+			return awp_native_dword_add(regs, n);
+		case AWP_SD:
+			return awp_native_dword_sub(regs, n);
+		case AWP_MW:
+			return awp_native_dword_mul(regs, n);
+		case AWP_DW:
+			return awp_native_dword_div(regs, n);
+		case AWP_AF:
+			return awp_native_float_addsub(regs, n, false);
+		case AWP_SF:
+			return awp_native_float_addsub(regs, n, true);
+		case AWP_MF:
+			return awp_native_float_mul(regs, n);
+		case AWP_DF:
+			return awp_native_float_div(regs, n);
+		default:
+			// NRF is left for emawp
+			return AWP_FALLBACK;
+	}
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
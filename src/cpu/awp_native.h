@@ -0,0 +1,30 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef AWP_NATIVE_H
+#define AWP_NATIVE_H
+
+#include <inttypes.h>
+
+// native AWP operation can't handle the case, emawp needs to do it
+#define AWP_FALLBACK -1
+
+int awp_native(int op, uint16_t *regs, uint16_t *n);
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -15,11 +15,19 @@
 //  Foundation, Inc.,
 //  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <inttypes.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "sound/sound.h"
 #include "external/biquad/biquad.h"
+#include "atomic.h"
 #include "cfg.h"
 #include "log.h"
 
@@ -27,16 +35,43 @@
 #define SPEAKER_HP 400.0f // 350 Hz
 #define SPEAKER_LP 3500.0f // -10dB @ 4500 Hz
 
+// level changes recorded within a single throttle slice
+#define BUZZER_EVENTS_MAX 1024
+
+struct buzzer_event {
+	unsigned long time;
+	float level;
+};
+
 static const struct snd_drv *snd;
 
 static float sample_period;
 static unsigned buffer_len;
 static unsigned volume;
 
-static float *snd_buf_tmp;
+// CPU thread side: level changes in the current slice
+static struct buzzer_event events[BUZZER_EVENTS_MAX];
+static unsigned events_count;
+static unsigned long slice_time;
+static double sample_time;
+static float level = 1;
+static float slice_level = 1;
+static float level_prev = 1;
+static unsigned overruns;
+
+// single producer (CPU), single consumer (audio thread) sample ring
+static float *ring;
+static unsigned ring_mask;
+static unsigned ring_head;
+static unsigned ring_tail;
+
+// audio thread side
+static pthread_t buzzer_th;
+static int buzzer_th_running;
+static int quit;
+static int playing;
+
 static float *snd_buf_in;
-static float *snd_buf_in_end;
-static float *snd_buf_in_pos;
 
 static int speaker_filter;
 static sf_biquad_state_st bq_lp;
@@ -44,31 +79,150 @@ static sf_biquad_state_st bq_hp;
 
 static int16_t *output_buffer;
 
+// -----------------------------------------------------------------------
+static void buzzer_filter(float *buf, unsigned len)
+{
+	// both speaker filters in one pass, same as two sf_biquad_process() calls
+	float hb0 = bq_hp.b0, hb1 = bq_hp.b1, hb2 = bq_hp.b2, ha1 = bq_hp.a1, ha2 = bq_hp.a2;
+	float hx1 = bq_hp.xn1, hx2 = bq_hp.xn2, hy1 = bq_hp.yn1, hy2 = bq_hp.yn2;
+	float lb0 = bq_lp.b0, lb1 = bq_lp.b1, lb2 = bq_lp.b2, la1 = bq_lp.a1, la2 = bq_lp.a2;
+	float lx1 = bq_lp.xn1, lx2 = bq_lp.xn2, ly1 = bq_lp.yn1, ly2 = bq_lp.yn2;
+
+	for (unsigned i=0 ; i<len ; i++) {
+		float x = buf[i];
+		float h = hb0*x + hb1*hx1 + hb2*hx2 - ha1*hy1 - ha2*hy2;
+		hx2 = hx1; hx1 = x;
+		hy2 = hy1; hy1 = h;
+		float l = lb0*h + lb1*lx1 + lb2*lx2 - la1*ly1 - la2*ly2;
+		lx2 = lx1; lx1 = h;
+		ly2 = ly1; ly1 = l;
+		buf[i] = l;
+	}
+
+	bq_hp.xn1 = hx1; bq_hp.xn2 = hx2; bq_hp.yn1 = hy1; bq_hp.yn2 = hy2;
+	bq_lp.xn1 = lx1; bq_lp.xn2 = lx2; bq_lp.yn1 = ly1; bq_lp.yn2 = ly2;
+}
+
+// -----------------------------------------------------------------------
+static void buzzer_convert(const float * restrict in, int16_t * restrict out, unsigned len)
+{
+	// stereo 16-bit signed sample output at given volume
+	// (branchless, so the compiler can vectorize it)
+	const float gain = volume * 32767.0f / 100.0f / 3.0f;
+
+	for (unsigned i=0 ; i<len ; i++) {
+		float v = in[i] * gain;
+		v = v > 32767.0f ? 32767.0f : v;
+		v = v < -32767.0f ? -32767.0f : v;
+		int16_t s = v;
+		out[2*i] = s;
+		out[2*i+1] = s;
+	}
+}
+
 // -----------------------------------------------------------------------
 static void buzzer_flush()
 {
-	// apply filter
 	if (speaker_filter) {
-		sf_biquad_process(&bq_hp, buffer_len, snd_buf_in, snd_buf_tmp);
-		sf_biquad_process(&bq_lp, buffer_len, snd_buf_tmp, snd_buf_in);
+		buzzer_filter(snd_buf_in, buffer_len);
 	}
 
-	// prepare final sample output
-	for (int i=0 ; i<buffer_len ; i++) {
-		// stereo 16-bit signed sample output at given volume
-		int v = (snd_buf_in[i]/3.0f) * volume * 32767/100;
-		output_buffer[2*i] = v;
-		output_buffer[2*i+1] = v;
-	}
+	buzzer_convert(snd_buf_in, output_buffer, buffer_len);
 
-	// play the buffer
+	// play the buffer, drop what's left of it if the driver fails
+	// (recovered or not) or if the sound has been stopped meanwhile
 	int written = 0;
-	while (written != buffer_len) {
-		int res = snd->play(output_buffer+written, buffer_len-written);
-		if (res > 0) {
-			written += res;
+	while ((written != buffer_len) && !atom_load_acquire(&quit) && atom_load_acquire(&playing)) {
+		int res = snd->play(output_buffer+2*written, buffer_len-written);
+		if (res < 0) {
+			break;
+		}
+		written += res;
+	}
+}
+
+// -----------------------------------------------------------------------
+static void * buzzer_thread(void *ptr)
+{
+	int is_playing = 0;
+	unsigned tail = 0;
+	// poll at half the buffer duration when starving
+	const struct timespec starve_sleep = {
+		.tv_sec = 0,
+		.tv_nsec = sample_period * buffer_len / 2
+	};
+
+	while (!atom_load_acquire(&quit)) {
+		int want = atom_load_acquire(&playing);
+		unsigned head = atom_load_acquire(&ring_head);
+
+		if (!want) {
+			// samples left over after stop are not played
+			tail = head;
+			atom_store_release(&ring_tail, tail);
+			if (is_playing) {
+				snd->stop();
+				is_playing = 0;
+			}
+			nanosleep(&starve_sleep, NULL);
+			continue;
+		} else if (!is_playing) {
+			snd->start();
+			is_playing = 1;
+		}
+
+		if (head - tail < buffer_len) {
+			nanosleep(&starve_sleep, NULL);
+			continue;
+		}
+
+		for (unsigned i=0 ; i<buffer_len ; i++) {
+			snd_buf_in[i] = ring[(tail+i) & ring_mask];
 		}
+		tail += buffer_len;
+		atom_store_release(&ring_tail, tail);
+
+		buzzer_flush();
+	}
+
+	pthread_exit(NULL);
+}
+
+// -----------------------------------------------------------------------
+void buzzer_sync()
+{
+	unsigned e = 0;
+	float lvl = slice_level;
+	unsigned head = ring_head;
+	unsigned free_samples = ring_mask + 1 - (head - atom_load_acquire(&ring_tail));
+
+	// generate all samples that fit in the slice
+	while (sample_time <= slice_time) {
+		while ((e < events_count) && (events[e].time < sample_time)) {
+			lvl = events[e++].level;
+		}
+		if (free_samples > 0) {
+			// *0.5 for slightly less aliasing
+			ring[head++ & ring_mask] = level_prev + (lvl - level_prev) * 0.5f;
+			free_samples--;
+		} else {
+			overruns++;
+		}
+		level_prev = lvl;
+		sample_time += sample_period;
+	}
+
+	atom_store_release(&ring_head, head);
+
+	if (overruns >= 1000) {
+		LOG(L_CPU, "Sound ring overrun, %u samples dropped", overruns);
+		overruns = 0;
 	}
+
+	sample_time -= slice_time;
+	slice_time = 0;
+	slice_level = level;
+	events_count = 0;
 }
 
 // -----------------------------------------------------------------------
@@ -76,51 +230,47 @@ void buzzer_update(int ir, unsigned instruction_time)
 {
 	static int cnt;
 	static int pir;
-	static double time_pool;
-	static float level = 1;
-	static float level_prev = 1;
 
 	// update current level (freq divider)
 	if ((ir ^ pir) & 0x8000) {
 		if (++cnt >= 16) {
 			cnt = 0;
 			level *= -1;
+			events[events_count].time = slice_time;
+			events[events_count].level = level;
+			if (++events_count >= BUZZER_EVENTS_MAX) {
+				buzzer_sync();
+			}
 		}
 	}
 	pir = ir;
 
-	// fill the sound buffer with available samples
-	time_pool += instruction_time;
-	while (time_pool >= sample_period) {
-		time_pool -= sample_period;
-		// *0.5 for slightly less aliasing
-		*snd_buf_in_pos++ = level_prev + (level - level_prev) * 0.5;
-		level_prev = level;
-
-		// if buffer is full, flush it
-		if (snd_buf_in_pos >= snd_buf_in_end) {
-			snd_buf_in_pos = snd_buf_in;
-			buzzer_flush();
-		}
-	}
+	// samples are generated once per throttle slice, see buzzer_sync()
+	slice_time += instruction_time;
 }
 
 // -----------------------------------------------------------------------
 void buzzer_start()
 {
-	snd->start();
+	atom_store_release(&playing, 1);
 }
 
 // -----------------------------------------------------------------------
 void buzzer_stop()
 {
-	snd->stop();
+	buzzer_sync();
+	atom_store_release(&playing, 0);
 }
 
 // -----------------------------------------------------------------------
 void buzzer_shutdown()
 {
-	free(snd_buf_tmp);
+	if (buzzer_th_running) {
+		atom_store_release(&quit, 1);
+		pthread_join(buzzer_th, NULL);
+		buzzer_th_running = 0;
+	}
+	free(ring);
 	free(snd_buf_in);
 	free(output_buffer);
 	if (snd) snd->shutdown();
@@ -133,6 +283,7 @@ int buzzer_init(em400_cfg *cfg)
 	speaker_filter = cfg_getbool(cfg, "sound:filter", CFG_DEFAULT_SOUND_FILTER);
 	int sample_rate = cfg_getint(cfg, "sound:rate", CFG_DEFAULT_SOUND_RATE);
 	sample_period = 1000000000.0f / sample_rate;
+	sample_time = sample_period;
 	buffer_len = cfg_getint(cfg, "sound:buffer_len", CFG_DEFAULT_SOUND_BUFFER_LEN);
 
 	if (volume > 100) {
@@ -143,24 +294,28 @@ int buzzer_init(em400_cfg *cfg)
 		volume = 0;
 	}
 
+	// ring holds at least 1/5 s of sound and a few output buffers
+	unsigned ring_len = 1;
+	while ((ring_len < sample_rate / 5) || (ring_len < 4 * buffer_len)) {
+		ring_len <<= 1;
+	}
+	ring_mask = ring_len - 1;
+
 	output_buffer = malloc(sizeof(int16_t) * 2 * buffer_len);
 	if (!output_buffer) {
 		LOGERR("Cannot allocate memory for output sound buffer.");
 		goto cleanup;
 	}
-	snd_buf_tmp = malloc(sizeof(float) * buffer_len);
-	if (!snd_buf_tmp) {
-		LOGERR("Cannot allocate memory for temporary sound buffer.");
-		goto cleanup;
-	}
 	snd_buf_in = malloc(sizeof(float) * buffer_len);
 	if (!snd_buf_in) {
 		LOGERR("Cannot allocate memory for input sound buffer.");
 		goto cleanup;
 	}
-
-	snd_buf_in_pos = snd_buf_in;
-	snd_buf_in_end = snd_buf_in + buffer_len;
+	ring = malloc(sizeof(float) * ring_len);
+	if (!ring) {
+		LOGERR("Cannot allocate memory for sound ring buffer.");
+		goto cleanup;
+	}
 
 	snd = snd_init(cfg);
 	if (!snd) {
@@ -171,7 +326,14 @@ int buzzer_init(em400_cfg *cfg)
 	sf_highpass(&bq_hp, sample_rate, SPEAKER_HP, 2.0f);
 	sf_lowpass(&bq_lp, sample_rate, SPEAKER_LP, 0.0f);
 
-	LOG(L_CPU, "Buzzer enabled. Volume: %i, speaker filter: %s, buffer length: %i frames", volume, speaker_filter ? "enabled" : "disabled", buffer_len);
+	if (pthread_create(&buzzer_th, NULL, buzzer_thread, NULL)) {
+		LOGERR("Failed to spawn sound output thread.");
+		goto cleanup;
+	}
+	pthread_setname_np(buzzer_th, "buzzer");
+	buzzer_th_running = 1;
+
+	LOG(L_CPU, "Buzzer enabled. Volume: %i, speaker filter: %s, buffer length: %i frames, ring: %i samples", volume, speaker_filter ? "enabled" : "disabled", buffer_len, ring_len);
 
 	return E_OK;
 
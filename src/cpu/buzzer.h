@@ -24,6 +24,7 @@
 void buzzer_silence();
 int buzzer_init(em400_cfg *cfg);
 void buzzer_update(int ir, unsigned instruction_time);
+void buzzer_sync();
 void buzzer_stop();
 void buzzer_start();
 void buzzer_shutdown();
@@ -24,18 +24,18 @@
 #include <time.h>
 
 #include "cpu/clock.h"
+#include "cpu/cpu.h"
 #include "cpu/interrupts.h"
+#include "machine.h"
 
 #include "log.h"
 #include "cfg.h"
 #include "atomic.h"
 
-int clock_enabled;
 pthread_t clock_th;
 sem_t clock_quit;
 
 int clock_period = 10;
-int clock_int = INT_CLOCK;
 
 // -----------------------------------------------------------------------
 void * clock_thread(void *ptr)
@@ -52,8 +52,14 @@ void * clock_thread(void *ptr)
 		if (!sem_timedwait(&clock_quit, &ts)) {
 			break;
 		}
-		if (atom_load_acquire(&clock_enabled)) {
-			int_set(atom_load_acquire(&clock_int));
+		// single clock source ticks CPUs of all machines
+		for (int i=0 ; i<machine_count ; i++) {
+			for (int c=0 ; c<machines[i].cpu_count ; c++) {
+				struct cpu *cpu = machines[i].cpu + c;
+				if (atom_load_acquire(&cpu->clock_enabled)) {
+					int_set(cpu, atom_load_acquire(&cpu->clock_int));
+				}
+			}
 		}
 	}
 
@@ -69,11 +75,15 @@ int clock_init(em400_cfg *cfg)
 		return LOGERR("Clock period should be between 2 and 100 miliseconds, not %i.", clock_period);
 	}
 
-	const int cfg_clock_start = cfg_getbool(cfg, "cpu:clock_start", CFG_DEFAULT_CPU_CLOCK_START);
-	if (cfg_clock_start) {
-		clock_on();
-	} else {
-		clock_off();
+	for (int i=0 ; i<machine_count ; i++) {
+		struct em400_machine *m = machines + i;
+		for (int c=0 ; c<m->cpu_count ; c++) {
+			if (cfg_getbool(m->cfg, "cpu:clock_start", CFG_DEFAULT_CPU_CLOCK_START)) {
+				clock_on(m->cpu + c);
+			} else {
+				clock_off(m->cpu + c);
+			}
+		}
 	}
 
 	sem_init(&clock_quit, 0, 0);
@@ -83,7 +93,7 @@ int clock_init(em400_cfg *cfg)
 
 	pthread_setname_np(clock_th, "clock");
 
-	LOG(L_CPU, "Clock initialized (%s). Period: %i ms", cfg_clock_start ? "started" : "stopped", clock_period);
+	LOG(L_CPU, "Clock initialized. Period: %i ms", clock_period);
 
 	return E_OK;
 }
@@ -100,29 +110,29 @@ void clock_shutdown()
 }
 
 // -----------------------------------------------------------------------
-void clock_on()
+void clock_on(struct cpu *cpu)
 {
 	LOG(L_CPU, "Starting clock");
-	atom_store_release(&clock_enabled, 1);
+	atom_store_release(&cpu->clock_enabled, 1);
 }
 
 // -----------------------------------------------------------------------
-void clock_off()
+void clock_off(struct cpu *cpu)
 {
 	LOG(L_CPU, "Stopping clock");
-	atom_store_release(&clock_enabled, 0);
+	atom_store_release(&cpu->clock_enabled, 0);
 }
 
 // -----------------------------------------------------------------------
-int clock_get_state()
+int clock_get_state(struct cpu *cpu)
 {
-	return atom_load_acquire(&clock_enabled);
+	return atom_load_acquire(&cpu->clock_enabled);
 }
 
 // -----------------------------------------------------------------------
-void clock_set_int(int interrupt)
+void clock_set_int(struct cpu *cpu, int interrupt)
 {
-	atom_store_release(&clock_int, interrupt);
+	atom_store_release(&cpu->clock_int, interrupt);
 }
 
 // vim: tabstop=4 shiftwidth=4 autoindent
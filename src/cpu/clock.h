@@ -24,12 +24,14 @@
 extern "C" {
 #endif
 
+struct cpu;
+
 int clock_init(em400_cfg *cfg);
 void clock_shutdown();
-void clock_on();
-void clock_off();
-int clock_get_state();
-void clock_set_int(int interrupt);
+void clock_on(struct cpu *cpu);
+void clock_off(struct cpu *cpu);
+int clock_get_state(struct cpu *cpu);
+void clock_set_int(struct cpu *cpu, int interrupt);
 
 #ifdef __cplusplus
 }
@@ -27,7 +27,9 @@
 #include "mem/mem.h"
 #include "cpu/clock.h"
 #include "fpga/iobus.h"
+#include "ectl/shm.h"
 #include "utils/utils.h"
+#include "machine.h"
 
 #include "cfg.h"
 #include "log.h"
@@ -36,10 +38,15 @@
 
 static bool fpga;
 
+// machine and its CPU controlled by the control panel
+static struct em400_machine *cp_m;
+static struct cpu *cp_cpu;
+
 // -----------------------------------------------------------------------
 int cp_init(em400_cfg *cfg)
 {
 	fpga = cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA);
+	cp_machine_select(0);
 	return E_OK;
 }
 
@@ -49,9 +56,53 @@ void cp_shutdown()
 
 }
 
+// -----------------------------------------------------------------------
+static int cp_select(int machine, int cpu)
+{
+	if ((machine < 0) || (machine >= machine_count)) {
+		return -1;
+	}
+	if ((cpu < 0) || (cpu >= machines[machine].cpu_count)) {
+		return -1;
+	}
+
+	// breakpoints are checked only by the CPU under control
+	if (cp_cpu) atom_store_release(&cp_cpu->console, false);
+	cp_m = machines + machine;
+	cp_cpu = cp_m->cpu + cpu;
+	atom_store_release(&cp_cpu->console, true);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int cp_machine_select(int num)
+{
+	return cp_select(num, 0);
+}
+
+// -----------------------------------------------------------------------
+int cp_machine_get()
+{
+	return cp_m->num;
+}
+
+// -----------------------------------------------------------------------
+int cp_cpu_select(int num)
+{
+	return cp_select(cp_m->num, num);
+}
+
+// -----------------------------------------------------------------------
+int cp_cpu_get()
+{
+	return cp_cpu->num;
+}
+
 // -----------------------------------------------------------------------
 int cp_reg_get(unsigned id)
 {
+	struct cpu *cpu = cp_cpu;
 	int reg = -1;
 	struct iob_cp_status *stat;
 
@@ -84,32 +135,73 @@ int cp_reg_get(unsigned id)
 			case ECTL_REG_R4:
 			case ECTL_REG_R5:
 			case ECTL_REG_R6:
-			case ECTL_REG_R7: reg = r[id]; break;
-			case ECTL_REG_IC: reg = ic; break;
-			case ECTL_REG_AC: reg = ac; break;
-			case ECTL_REG_AR: reg = ar; break;
-			case ECTL_REG_IR: reg = ir; break;
+			case ECTL_REG_R7: reg = cpu->r[id]; break;
+			case ECTL_REG_IC: reg = cpu->ic; break;
+			case ECTL_REG_AC: reg = cpu->ac; break;
+			case ECTL_REG_AR: reg = cpu->ar; break;
+			case ECTL_REG_IR: reg = cpu->ir; break;
 			case ECTL_REG_SR: reg = SR_READ(); break;
-			case ECTL_REG_RZ: reg = int_get_nchan(); break;
+			case ECTL_REG_RZ: reg = int_get_nchan(cpu); break;
 			case ECTL_REG_KB:
-			case ECTL_REG_KB2: reg = kb; break;
-			case ECTL_REG_MC: reg = mc; break;
-			case ECTL_REG_ALARM: reg = rALARM; break;
-			case ECTL_REG_RM: reg = rm; break;
-			case ECTL_REG_Q: reg = q; break;
-			case ECTL_REG_BS: reg = bs; break;
-			case ECTL_REG_NB: reg = nb; break;
-			case ECTL_REG_P: reg = p; break;
-			case ECTL_REG_RZ_IO: reg = int_get_chan(); break;
+			case ECTL_REG_KB2: reg = cpu->kb; break;
+			case ECTL_REG_MC: reg = cpu->mc; break;
+			case ECTL_REG_ALARM: reg = cpu->rALARM; break;
+			case ECTL_REG_RM: reg = cpu->rm; break;
+			case ECTL_REG_Q: reg = cpu->q; break;
+			case ECTL_REG_BS: reg = cpu->bs; break;
+			case ECTL_REG_NB: reg = cpu->nb; break;
+			case ECTL_REG_P: reg = cpu->p; break;
+			case ECTL_REG_RZ_IO: reg = int_get_chan(cpu); break;
 			default: reg = -1; break;
 		}
 	}
 	return reg;
 }
 
+// -----------------------------------------------------------------------
+bool cp_regs_snapshot(uint16_t *dest)
+{
+	// Registers of a running emulated CPU are taken from the state it publishes,
+	// so readers don't race with the CPU thread. A stopped (or powered off)
+	// CPU doesn't touch the registers and they can be read (and changed) directly.
+	int state = cpu_state_get(cp_cpu);
+	if (fpga || (state == ECTL_STATE_STOP) || (state == ECTL_STATE_OFF)) {
+		return false;
+	}
+
+	struct ectl_shm_state s;
+	if (!ectl_shm_snapshot(cp_cpu, &s)) {
+		return false;
+	}
+
+	for (int i=ECTL_REG_R0 ; i<=ECTL_REG_R7 ; i++) {
+		dest[i] = s.r[i];
+	}
+	dest[ECTL_REG_IC] = s.ic;
+	dest[ECTL_REG_AC] = s.ac;
+	dest[ECTL_REG_AR] = s.ar;
+	dest[ECTL_REG_IR] = s.ir;
+	dest[ECTL_REG_SR] = s.sr;
+	dest[ECTL_REG_RZ] = ((s.rz >> 16) & 0b1111111111110000) | (s.rz & 0b1111);
+	dest[ECTL_REG_KB] = s.kb;
+	dest[ECTL_REG_KB2] = s.kb;
+	dest[ECTL_REG_MC] = s.mc;
+	dest[ECTL_REG_ALARM] = s.alarm;
+	dest[ECTL_REG_RM] = s.sr >> 6;
+	dest[ECTL_REG_Q] = (s.sr >> 5) & 1;
+	dest[ECTL_REG_BS] = (s.sr >> 4) & 1;
+	dest[ECTL_REG_NB] = s.sr & 0b1111;
+	dest[ECTL_REG_P] = s.p;
+	dest[ECTL_REG_RZ_IO] = s.rz >> 4;
+
+	return true;
+}
+
 // -----------------------------------------------------------------------
 int cp_reg_set(unsigned id, uint16_t v)
 {
+	struct cpu *cpu = cp_cpu;
+
 	if (fpga) {
 		if (id >= ECTL_REG_KB2) {
 			return -1;
@@ -126,22 +218,22 @@ int cp_reg_set(unsigned id, uint16_t v)
 			case ECTL_REG_R4:
 			case ECTL_REG_R5:
 			case ECTL_REG_R6:
-			case ECTL_REG_R7: r[id] = v; break;
-			case ECTL_REG_IC: ic = v; break;
-			case ECTL_REG_AC: ac = v; break;
-			case ECTL_REG_AR: ar = v ; break;
-			case ECTL_REG_IR: ir = v; break;
+			case ECTL_REG_R7: cpu->r[id] = v; break;
+			case ECTL_REG_IC: cpu->ic = v; break;
+			case ECTL_REG_AC: cpu->ac = v; break;
+			case ECTL_REG_AR: cpu->ar = v ; break;
+			case ECTL_REG_IR: cpu->ir = v; break;
 			case ECTL_REG_SR: SR_WRITE(v); break;
 			// n/a case ECTL_REG_RZ:
 			case ECTL_REG_KB:
-			case ECTL_REG_KB2: kb = v; break;
-			case ECTL_REG_MC: mc = v; break;
-			case ECTL_REG_ALARM: rALARM = v; break;
-			case ECTL_REG_RM: rm = v & 0b1111111111; break;
-			case ECTL_REG_Q: q = v; break;
-			case ECTL_REG_BS: bs = v; break;
-			case ECTL_REG_NB: nb = v & 0b1111; break;
-			case ECTL_REG_P: p = v; break;
+			case ECTL_REG_KB2: cpu->kb = v; break;
+			case ECTL_REG_MC: cpu->mc = v; break;
+			case ECTL_REG_ALARM: cpu->rALARM = v; break;
+			case ECTL_REG_RM: cpu->rm = v & 0b1111111111; break;
+			case ECTL_REG_Q: cpu->q = v; break;
+			case ECTL_REG_BS: cpu->bs = v; break;
+			case ECTL_REG_NB: cpu->nb = v & 0b1111; break;
+			case ECTL_REG_P: cpu->p = v; break;
 			// n/a case ECTL_REG_RZ_IO:
 			default: return -1;
 		}
@@ -187,7 +279,7 @@ bool cp_mem_read_n(unsigned nb, uint16_t addr, uint16_t *data, unsigned count)
 		// and it could happen that ui tries to read unconfigured memory as well.
 		// On the other hand, access from control panel is a regular CPU memory access,
 		// thus it should use cpu_mem_get() and fail on unconfigured memory...
-		return mem_read_n(nb, addr, data, count);
+		return mem_read_n(&cp_m->mem, nb, addr, data, count);
 	}
 }
 
@@ -223,8 +315,40 @@ bool cp_mem_write_n(unsigned nb, uint16_t addr, uint16_t *data, unsigned count)
 		}
 		return true;
 	} else {
-		return mem_write_n(nb, addr, data, count);
+		return mem_write_n(&cp_m->mem, nb, addr, data, count);
+	}
+}
+
+// -----------------------------------------------------------------------
+int cp_mem_find(int nb, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max)
+{
+	if (!fpga) {
+		return mem_find(&cp_m->mem, nb, pattern, mask, len, found, max);
+	}
+
+	if ((len < 1) || (nb >= MEM_MAX_NB)) return -1;
+
+	// no direct access to FPGA memory: fetch each block through the control panel and scan the copy
+	uint16_t *buf = malloc(MEM_MAX_AB * MEM_SEGMENT_SIZE * sizeof(uint16_t));
+	if (!buf) return -1;
+	uint16_t *segs[MEM_MAX_AB];
+	for (int ab=0 ; ab<MEM_MAX_AB ; ab++) {
+		segs[ab] = buf + ab * MEM_SEGMENT_SIZE;
 	}
+
+	int count = 0;
+	int nb_first = nb < 0 ? 0 : nb;
+	int nb_last = nb < 0 ? MEM_MAX_NB-1 : nb;
+	for (nb=nb_first ; nb<=nb_last ; nb++) {
+		for (int ab=0 ; ab<MEM_MAX_AB ; ab++) {
+			cp_mem_read_n(nb, ab * MEM_SEGMENT_SIZE, segs[ab], MEM_SEGMENT_SIZE);
+		}
+		unsigned stored = (unsigned) count < max ? (unsigned) count : max;
+		count += mem_scan(segs, (uint32_t) nb << 16, pattern, mask, len, found + stored, max - stored);
+	}
+
+	free(buf);
+	return count;
 }
 
 // -----------------------------------------------------------------------
@@ -233,7 +357,7 @@ void cp_stop()
 	if (fpga) {
 		iob_cp_set_fn(IOB_FN_START, 0);
 	} else {
-		cpu_state_change(ECTL_STATE_STOP, -1);
+		cpu_state_change(cp_cpu, ECTL_STATE_STOP, -1);
 	}
 }
 
@@ -243,7 +367,7 @@ void cp_start()
 	if (fpga) {
 		iob_cp_set_fn(IOB_FN_START, 1);
 	} else {
-		cpu_state_change(ECTL_STATE_RUN, ECTL_STATE_STOP);
+		cpu_state_change(cp_cpu, ECTL_STATE_RUN, ECTL_STATE_STOP);
 	}
 }
 
@@ -253,7 +377,7 @@ void cp_cycle()
 	if (fpga) {
 		iob_cp_set_fn(IOB_FN_CYCLE, 1);
 	} else {
-		cpu_state_change(ECTL_STATE_CYCLE, ECTL_STATE_STOP);
+		cpu_state_change(cp_cpu, ECTL_STATE_CYCLE, ECTL_STATE_STOP);
 	}
 }
 
@@ -263,7 +387,12 @@ void cp_off()
 	if (fpga) {
 		iob_quit();
 	} else {
-		cpu_state_change(ECTL_STATE_OFF, -1);
+		// emulator quits when all machines are off
+		for (int i=0 ; i<machine_count ; i++) {
+			for (int c=0 ; c<machines[i].cpu_count ; c++) {
+				cpu_state_change(machines[i].cpu + c, ECTL_STATE_OFF, -1);
+			}
+		}
 	}
 }
 
@@ -274,9 +403,9 @@ void cp_clock_set(int state)
 		iob_cp_set_fn(IOB_FN_CLOCK, state);
 	} else {
 		if (state == 0) {
-			clock_off();
+			clock_off(cp_cpu);
 		} else {
-			clock_on();
+			clock_on(cp_cpu);
 		}
 	}
 }
@@ -290,7 +419,7 @@ int cp_clock_get()
 		state = stat->leds & IOB_LED_CLOCK ? 1 : 0;
 		free(stat);
 	} else {
-		state = clock_get_state();
+		state = clock_get_state(cp_cpu);
 	}
 
 	return state;
@@ -302,7 +431,7 @@ void cp_clear()
 	if (fpga) {
 		iob_cp_set_fn(IOB_FN_CLEAR, 1);
 	} else {
-		cpu_state_change(ECTL_STATE_CLO, -1);
+		cpu_state_change(cp_cpu, ECTL_STATE_CLO, -1);
 	}
 }
 
@@ -314,7 +443,7 @@ int cp_bin()
 	if (fpga) {
 		// unsupported
 	} else {
-		res = cpu_state_change(ECTL_STATE_BIN, ECTL_STATE_STOP);
+		res = cpu_state_change(cp_cpu, ECTL_STATE_BIN, ECTL_STATE_STOP);
 	}
 
 	return res;
@@ -326,7 +455,7 @@ void cp_oprq()
 	if (fpga) {
 		iob_cp_set_fn(IOB_FN_OPRQ, 1);
 	} else {
-		int_set(INT_OPRQ);
+		int_set(cp_cpu, INT_OPRQ);
 	}
 }
 
@@ -341,7 +470,7 @@ int cp_state()
 		if (!(stat->leds & IOB_LED_RUN)) status |= ECTL_STATE_STOP;
 		free(stat);
 	} else {
-		status = cpu_state_get();
+		status = cpu_state_get(cp_cpu);
 	}
 
 	return status;
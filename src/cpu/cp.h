@@ -26,10 +26,17 @@
 int cp_init(em400_cfg *cfg);
 void cp_shutdown();
 
+int cp_machine_select(int num);
+int cp_machine_get();
+int cp_cpu_select(int num);
+int cp_cpu_get();
+
 int cp_reg_get(unsigned id);
+bool cp_regs_snapshot(uint16_t *dest);
 int cp_reg_set(unsigned id, uint16_t v);
 bool cp_mem_read_n(unsigned nb, uint16_t addr, uint16_t *data, unsigned count);
 bool cp_mem_write_n(unsigned nb, uint16_t addr, uint16_t *data, unsigned count);
+int cp_mem_find(int nb, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max);
 void cp_stop();
 void cp_start();
 void cp_cycle();
@@ -27,12 +27,14 @@
 #include <signal.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <emawp.h>
 
 #include "cpu/cpu.h"
 #include "cpu/interrupts.h"
 #include "mem/mem.h"
 #include "cpu/iset.h"
+#include "cpu/alu.h"
 #include "cpu/instructions.h"
 #include "cpu/interrupts.h"
 #include "cpu/clock.h"
@@ -41,178 +43,278 @@
 #include "io/io.h"
 
 #include "em400.h"
+#include "machine.h"
+#include "cpu/sched.h"
 #include "utils/utils.h"
 #include "log.h"
 #include "log_crk.h"
 #include "ectl/brk.h"
+#include "ectl/shm.h"
+#include "ectl/metrics.h"
 
 #include "ectl.h" // for global constants
 #include "cfg.h"
 
-static int cpu_state = ECTL_STATE_OFF;
+#define CPU_IDLE_LOOP_MAX_LEN 16	// max. backward jump distance (in words) considered a polling loop
+#define CPU_BATCH_STOPPED 128		// batch result when the CPU stops instead of halting
 
-uint16_t r[8];
-uint16_t ic, kb, ir, ac, ar;
-bool rALARM;
-int mc;
-unsigned rm, nb;
-bool p, q, bs;
-
-bool zc17;
+// -----------------------------------------------------------------------
+static void cpu_notify(struct cpu *cpu)
+{
+	// needs to be called with wake_mutex held
+	cpu->woken = true;
+	pthread_cond_broadcast(&cpu->wake_cond);
+	if (cpu->sched) sched_wake(cpu->sched, cpu);
+}
 
-bool cpu_mod_present;
-bool cpu_mod_active;
-bool cpu_user_io_illegal;
-bool awp_enabled;
-static bool nomem_stop;
+// -----------------------------------------------------------------------
+static bool cpu_do_wait(struct cpu *cpu)
+{
+	bool idle;
 
-unsigned long ips_counter;
+	pthread_mutex_lock(&cpu->wake_mutex);
+	idle = (cpu->state == ECTL_STATE_WAIT) && !(atom_load_acquire(&cpu->rp) && !cpu->p && !cpu->mc);
+	if (!idle) cpu->state &= ~ECTL_STATE_WAIT;
+	pthread_mutex_unlock(&cpu->wake_mutex);
 
-static int speed_real;
-static struct timespec cpu_timer;
-static int cpu_time_cumulative;
-static int throttle_granularity;
-static float cpu_delay_factor;
+	return idle;
+}
 
-static int sound_enabled;
+// -----------------------------------------------------------------------
+int cpu_state_change(struct cpu *cpu, int to, int from)
+{
+	int res = 1;
 
-// opcode table (instruction decoder decision table)
-struct iset_opcode *cpu_op_tab[0x10000];
+	pthread_mutex_lock(&cpu->wake_mutex);
+	if ((from == ECTL_STATE_ANY) || (cpu->state == from)) {
+		atom_store_release(&cpu->state, to);
+		cpu_notify(cpu);
+		res = 0;
+	}
+	pthread_mutex_unlock(&cpu->wake_mutex);
 
-pthread_mutex_t cpu_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cpu_wake_cond = PTHREAD_COND_INITIALIZER;
+	return res;
+}
 
 // -----------------------------------------------------------------------
-static void cpu_do_wait()
+int cpu_state_get(struct cpu *cpu)
 {
-	LOG(L_CPU, "idling in state WAIT");
+	return atom_load_acquire(&cpu->state);
+}
 
-	pthread_mutex_lock(&cpu_wake_mutex);
-	while ((cpu_state == ECTL_STATE_WAIT) && !(atom_load_acquire(&rp) && !p && !mc)) {
-			pthread_cond_wait(&cpu_wake_cond, &cpu_wake_mutex);
-	}
-	cpu_state &= ~ECTL_STATE_WAIT;
-	pthread_mutex_unlock(&cpu_wake_mutex);
+// -----------------------------------------------------------------------
+static uint64_t cpu_wall_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
 }
 
 // -----------------------------------------------------------------------
-static int cpu_do_stop()
+static uint64_t cpu_emu_idle_ns(struct cpu *cpu, uint64_t since)
 {
-	LOG(L_CPU, "idling in state STOP");
+	// time spent in WAIT or in a parked idle loop passes as it does for the guest:
+	// at wall clock pace (timer interrupts keep coming), scaled at real speed
+	uint64_t now = cpu_wall_ns();
+	if (now <= since) return 0;
+	if (cpu->speed_real) return (uint64_t) ((now - since) / cpu->delay_factor);
+	return now - since;
+}
 
-	pthread_mutex_lock(&cpu_wake_mutex);
-	while ((cpu_state & (ECTL_STATE_STOP|ECTL_STATE_OFF|ECTL_STATE_CLO|ECTL_STATE_CLM|ECTL_STATE_CYCLE|ECTL_STATE_BIN)) == ECTL_STATE_STOP) {
-		pthread_cond_wait(&cpu_wake_cond, &cpu_wake_mutex);
+// -----------------------------------------------------------------------
+static void cpu_emu_idle_start(struct cpu *cpu)
+{
+	if (!cpu->emu_idle_since_ns) {
+		atom_store_release(&cpu->emu_idle_since_ns, cpu_wall_ns());
 	}
-	int res = cpu_state;
-	pthread_mutex_unlock(&cpu_wake_mutex);
-
-	return res;
 }
 
 // -----------------------------------------------------------------------
-int cpu_state_change(int to, int from)
+static void cpu_emu_idle_end(struct cpu *cpu)
 {
-	int res = 1;
+	uint64_t since = cpu->emu_idle_since_ns;
+	if (!since) return;
 
-	pthread_mutex_lock(&cpu_wake_mutex);
-	if ((from == ECTL_STATE_ANY) || (cpu_state == from)) {
-		cpu_state = to;
-		pthread_cond_broadcast(&cpu_wake_cond);
-		res = 0;
-	}
-	pthread_mutex_unlock(&cpu_wake_mutex);
-
-	return res;
+	// readers may briefly miss the idle time, but never count it twice
+	atom_store_release(&cpu->emu_idle_since_ns, 0);
+	atom_store_release(&cpu->emu_time_ns, cpu->emu_time_ns + cpu_emu_idle_ns(cpu, since));
 }
 
 // -----------------------------------------------------------------------
-int cpu_state_get()
+uint64_t cpu_emu_time(struct cpu *cpu)
 {
-	return atom_load_acquire(&cpu_state);
+	if (cpu->emu_time_wall) {
+		return cpu_wall_ns();
+	}
+
+	// emulated time doesn't pass while the CPU is stopped
+	uint64_t t = atom_load_acquire(&cpu->emu_time_ns);
+	uint64_t idle_since = atom_load_acquire(&cpu->emu_idle_since_ns);
+	if (idle_since) t += cpu_emu_idle_ns(cpu, idle_since);
+
+	return t;
 }
 
 // -----------------------------------------------------------------------
-static void cpu_mem_fail(bool barnb)
+// kept out of line, so memory access wrappers are small enough to be inlined into the cycle
+__attribute__((noinline)) static void cpu_mem_fail(struct cpu *cpu, bool barnb)
 {
-	int_set(INT_NO_MEM);
+	int_set(cpu, INT_NO_MEM);
 	if (!barnb) {
-		rALARM = true;
-		if (nomem_stop) cpu_state_change(ECTL_STATE_STOP, ECTL_STATE_ANY);
+		cpu->rALARM = true;
+		if (cpu->nomem_stop) cpu_state_change(cpu, ECTL_STATE_STOP, ECTL_STATE_ANY);
 	}
 }
 
 // -----------------------------------------------------------------------
-bool cpu_mem_read_1(bool barnb, uint16_t addr, uint16_t *data)
+bool cpu_mem_read_1(struct cpu *cpu, bool barnb, uint16_t addr, uint16_t *data)
 {
-	if (!mem_read_1(barnb * nb, addr, data)) {
-		cpu_mem_fail(barnb);
+	if (!mem_read_1(cpu->mem, barnb * cpu->nb, addr, data)) {
+		cpu_mem_fail(cpu, barnb);
 		return false;
 	}
 	return true;
 }
 
 // -----------------------------------------------------------------------
-bool cpu_mem_write_1(bool barnb, uint16_t addr, uint16_t data)
+bool cpu_mem_read_n(struct cpu *cpu, bool barnb, uint16_t addr, uint16_t *data, int count)
 {
-	if (!mem_write_1(barnb * nb, addr, data)) {
-		cpu_mem_fail(barnb);
+	if (!mem_read_n(cpu->mem, barnb * cpu->nb, addr, data, count)) {
+		cpu_mem_fail(cpu, barnb);
 		return false;
 	}
 	return true;
 }
 
 // -----------------------------------------------------------------------
-int cpu_init(em400_cfg *cfg)
+bool cpu_mem_write_1(struct cpu *cpu, bool barnb, uint16_t addr, uint16_t data)
 {
-	int res;
+	if (!mem_write_1(cpu->mem, barnb * cpu->nb, addr, data)) {
+		cpu_mem_fail(cpu, barnb);
+		return false;
+	}
+	// the other CPU compares this counter before it parks a loop...
+	atom_store_release(&cpu->mem_writes, cpu->mem_writes + 1);
+	// ...and needs a wake-up only if it's already parked, polling memory.
+	// There is no fence between the two (it would cost every write), so a write
+	// racing with parking may leave the loop parked until its deadline.
+	if (cpu->peer && atom_load_acquire(&cpu->peer->idle_parked)) {
+		cpu_idle_wake(cpu->peer);
+	}
+	return true;
+}
 
-	awp_enabled = cfg_getbool(cfg, "cpu:awp", CFG_DEFAULT_CPU_AWP);
+// -----------------------------------------------------------------------
+int cpu_init(struct cpu *cpu, struct em400_machine *m, int num, em400_cfg *cfg)
+{
+	pthread_condattr_t attr;
+
+	cpu->m = m;
+	cpu->num = num;
+	cpu->mem = &m->mem;
+	cpu->io = &m->io;
+	cpu->primary = (m->num == 0) && (num == 0);
+	cpu->state = ECTL_STATE_OFF;
+	cpu->batch_result = CPU_BATCH_STOPPED;
+
+	pthread_mutex_init(&cpu->int_mutex, NULL);
+	pthread_mutex_init(&cpu->wake_mutex, NULL);
+	// park deadlines are CLOCK_MONOTONIC, same as the CPU timer
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cpu->wake_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	cpu->awp_enabled = cfg_getbool(cfg, "cpu:awp", CFG_DEFAULT_CPU_AWP);
+	if (cpu->awp_enabled && (awp_init(cpu, cfg) != E_OK)) {
+		return LOGERR("Failed to initialize AWP.");
+	}
 
-	kb = cfg_getint(cfg, "cpu:kb", CFG_DEFAULT_CPU_KB);
+	cpu->kb = cfg_getint(cfg, "cpu:kb", CFG_DEFAULT_CPU_KB);
 
-	cpu_mod_present = cfg_getbool(cfg, "cpu:modifications", CFG_DEFAULT_CPU_MODIFICATIONS);
-	cpu_user_io_illegal = cfg_getbool(cfg, "cpu:user_io_illegal", CFG_DEFAULT_CPU_IO_USER_ILLEGAL);
-	nomem_stop = cfg_getbool(cfg, "cpu:stop_on_nomem", CFG_DEFAULT_CPU_STOP_ON_NOMEM);
-	speed_real = cfg_getbool(cfg, "cpu:speed_real", CFG_DEFAULT_CPU_SPEED_REAL);
-	throttle_granularity = 1000 * cfg_getint(cfg, "cpu:throttle_granularity", CFG_DEFAULT_CPU_THROTTLE_GRANULARITY);
+	cpu->mod_present = cfg_getbool(cfg, "cpu:modifications", CFG_DEFAULT_CPU_MODIFICATIONS);
+	cpu->user_io_illegal = cfg_getbool(cfg, "cpu:user_io_illegal", CFG_DEFAULT_CPU_IO_USER_ILLEGAL);
+	cpu->nomem_stop = cfg_getbool(cfg, "cpu:stop_on_nomem", CFG_DEFAULT_CPU_STOP_ON_NOMEM);
+	cpu->speed_real = cfg_getbool(cfg, "cpu:speed_real", CFG_DEFAULT_CPU_SPEED_REAL);
+	cpu->emu_time_wall = cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA);
+	cpu->throttle_granularity = 1000 * cfg_getint(cfg, "cpu:throttle_granularity", CFG_DEFAULT_CPU_THROTTLE_GRANULARITY);
 	double cpu_speed_factor = cfg_getdouble(cfg, "cpu:speed_factor", CFG_DEFAULT_CPU_SPEED_FACTOR);
-	cpu_delay_factor = 1.0f/cpu_speed_factor;
+	cpu->delay_factor = 1.0f/cpu_speed_factor;
+	cpu->idle_detect = cfg_getbool(cfg, "cpu:idle_detect", CFG_DEFAULT_CPU_IDLE_DETECT);
+	cpu->idle_threshold = cfg_getint(cfg, "cpu:idle_threshold", CFG_DEFAULT_CPU_IDLE_THRESHOLD);
+	cpu->idle_park_ns = 1000L * cfg_getint(cfg, "cpu:idle_park_max", CFG_DEFAULT_CPU_IDLE_PARK_MAX);
+	if ((cpu->idle_threshold < 1) || (cpu->idle_park_ns < 1000)) {
+		return LOGERR("CPU idle loop threshold and maximum park time must be positive.");
+	}
+	cpu->batch = cfg_getbool(cfg, "batch:enabled", CFG_DEFAULT_BATCH_ENABLED);
+	// second CPU runs in batch mode only if it has somewhere to start from
+	int second_cpu_ic = cfg_getint(cfg, "batch:second_cpu_ic", CFG_DEFAULT_BATCH_SECOND_CPU_IC);
+	if (num > 0) {
+		cpu->batch = cpu->batch && (second_cpu_ic >= 0);
+	}
+	cpu->batch_halt_min = cfg_getint(cfg, "batch:halt_min", CFG_DEFAULT_BATCH_HALT_MIN);
+	if (cpu->batch_halt_min > 077) {
+		return LOGERR("Batch mode halt code (%i) out of range 0-077.", cpu->batch_halt_min);
+	}
 
-	res = iset_build(cpu_op_tab, cpu_user_io_illegal);
-	if (res != E_OK) {
+	cpu->op_tab = iset_get();
+	if (!cpu->op_tab) {
 		return LOGERR("Failed to build CPU instruction table.");
 	}
+	// IN/OU legalness in user mode is a per-CPU setting, not a property of the (shared) opcode table
+	cpu->usr_illegal_mask = OP_FL_USR_ILLEGAL | (cpu->user_io_illegal ? OP_FL_IO : 0);
 
-	int_update_mask(0);
+	int_update_mask(cpu, 0);
 
 	// this is checked only at power-on
-	if (mem_mega_boot()) {
-		ic = 0xf000;
+	if (mem_mega_boot(cpu->mem)) {
+		cpu->ic = 0xf000;
 	} else {
-		ic = 0;
+		cpu->ic = 0;
+	}
+	if (cpu->batch && (num > 0)) {
+		cpu->ic = second_cpu_ic;
 	}
 
-	cpu_mod_off();
+	cpu_mod_off(cpu);
 
-	LOG(L_CPU, "CPU initialized. AWP: %s, KB=0x%04x, modifications: %s, user I/O: %s, stop on nomem: %s",
-		awp_enabled ? "enabled" : "disabled",
-		kb,
-		cpu_mod_present ? "present" : "absent",
-		cpu_user_io_illegal ? "illegal" : "legal",
-		nomem_stop ? "true" : "false");
+	LOG(L_CPU, "CPU %i of machine %i initialized. AWP: %s, KB=0x%04x, modifications: %s, user I/O: %s, stop on nomem: %s",
+		num,
+		m->num,
+		cpu->awp_enabled ? "enabled" : "disabled",
+		cpu->kb,
+		cpu->mod_present ? "present" : "absent",
+		cpu->user_io_illegal ? "illegal" : "legal",
+		cpu->nomem_stop ? "true" : "false");
 	LOG(L_CPU, "CPU speed: %s, throttle granularity: %i, speed factor: %.2f",
-		speed_real ? "real" : "max",
-		throttle_granularity/1000,
+		cpu->speed_real ? "real" : "max",
+		cpu->throttle_granularity/1000,
 		cpu_speed_factor);
+	LOG(L_CPU, "Idle loop detection: %s, threshold: %u iterations, max park time: %li us",
+		cpu->idle_detect ? "enabled" : "disabled",
+		cpu->idle_threshold,
+		cpu->idle_park_ns / 1000);
+
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_cpu_instructions_total", "Instructions executed", &cpu->ips_counter, NULL);
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_cpu_idle_parks_total", "Guest idle loops parked", &cpu->idle_parks, NULL);
+	int_metrics_register(cpu);
+
+	cpu->publish_interval = cfg_getint(cfg, "cpu:publish_interval", CFG_DEFAULT_CPU_PUBLISH_INTERVAL);
+	if (cpu->publish_interval < 1) {
+		return LOGERR("CPU state publish interval needs to be at least 1 instruction.");
+	}
+	cpu->publish_countdown = cpu->publish_interval;
 
-	sound_enabled = cfg_getbool(cfg, "sound:enabled", CFG_DEFAULT_SOUND_ENABLED);
+	cpu->sound_enabled = cfg_getbool(cfg, "sound:enabled", CFG_DEFAULT_SOUND_ENABLED);
 
-	if (sound_enabled) {
-		if (!speed_real || (cpu_speed_factor < 0.1f) || (cpu_speed_factor > 2.0f)) {
+	if (cpu->sound_enabled) {
+		if (!cpu->primary) {
+			LOGERR("Buzzer is emulated only for the first CPU of the first machine, disabling sound for CPU %i of machine %i.", num, m->num);
+			cpu->sound_enabled = false;
+		} else if (!cpu->speed_real || (cpu_speed_factor < 0.1f) || (cpu_speed_factor > 2.0f)) {
 			LOGERR("EM400 needs to be configured with speed_real=true and 2.0 >= cpu_speed_factor >= 0.1 for the buzzer emulation to work.");
 			LOGERR("Disabling sound.");
-			sound_enabled = false;
+			cpu->sound_enabled = false;
 		} else {
 			if (buzzer_init(cfg) != E_OK) {
 				return LOGERR("Failed to initialize buzzer.");
@@ -224,126 +326,134 @@ int cpu_init(em400_cfg *cfg)
 }
 
 // -----------------------------------------------------------------------
-void cpu_shutdown()
+void cpu_shutdown(struct cpu *cpu)
 {
-	if (sound_enabled) {
+	if (cpu->sound_enabled) {
 		buzzer_shutdown();
 	}
+	pthread_cond_destroy(&cpu->wake_cond);
+	pthread_mutex_destroy(&cpu->wake_mutex);
+	pthread_mutex_destroy(&cpu->int_mutex);
 }
 
 // -----------------------------------------------------------------------
-int cpu_mod_on()
+int cpu_mod_on(struct cpu *cpu)
 {
-	cpu_mod_active = true;
-	clock_set_int(INT_EXTRA);
+	cpu->mod_active = true;
+	clock_set_int(cpu, INT_EXTRA);
 
 	return E_OK;
 }
 
 // -----------------------------------------------------------------------
-int cpu_mod_off()
+int cpu_mod_off(struct cpu *cpu)
 {
-	cpu_mod_active = false;
-	clock_set_int(INT_CLOCK);
+	cpu->mod_active = false;
+	clock_set_int(cpu, INT_CLOCK);
 
 	return E_OK;
 }
 
 // -----------------------------------------------------------------------
-static void cpu_do_clear(int scope)
+static void cpu_do_clear(struct cpu *cpu, int scope)
 {
 	// I/O reset should return when we're sure that I/O won't change CPU state (backlogged interrupts, memory writes, ...)
-	io_reset();
-	mem_reset();
-	cpu_mod_off();
+	// In a 2-CPU machine memory and I/O are shared and reset only by CPU 0,
+	// the other CPU clears just its own state.
+	if (cpu->num == 0) {
+		io_reset(cpu->io);
+		mem_reset(cpu->mem);
+	}
+	cpu_mod_off(cpu);
 
-	r[0] = 0;
+	cpu->r[0] = 0;
 	SR_WRITE(0);
 
-	int_update_mask(rm);
-	int_clear_all();
+	int_update_mask(cpu, cpu->rm);
+	int_clear_all(cpu);
 
 	if (scope == ECTL_STATE_CLO) {
-		rALARM = false;
-		mc = 0;
+		cpu->rALARM = false;
+		cpu->mc = 0;
 	}
 
-	// call even if logging is disabled - user may enable it later
-	// and we still want to know if we're running a known OS
-	log_check_os();
-	log_reset_process();
-	log_intlevel_reset();
-	log_syscall_reset();
+	// OS tracking follows the first machine only
+	if (cpu->primary) {
+		// call even if logging is disabled - user may enable it later
+		// and we still want to know if we're running a known OS
+		log_check_os();
+		log_reset_process();
+		log_intlevel_reset();
+		log_syscall_reset();
+	}
 }
 
 // -----------------------------------------------------------------------
-void cpu_ctx_switch(uint16_t arg, uint16_t new_ic, uint16_t int_mask)
+void cpu_ctx_switch(struct cpu *cpu, uint16_t arg, uint16_t new_ic, uint16_t int_mask)
 {
-	if (!cpu_mem_read_1(false, STACK_POINTER, &ar)) return;
+	if (!cpu_mem_read_1(cpu, false, STACK_POINTER, &cpu->ar)) return;
 
-	LOG(L_CPU, "Store current process ctx [IC: 0x%04x, R0: 0x%04x, SR: 0x%04x, 0x%04x] @ 0x%04x, set new IC: 0x%04x", ic, r[0], SR_READ(), arg, ar, new_ic);
+	LOG(L_CPU, "Store current process ctx [IC: 0x%04x, R0: 0x%04x, SR: 0x%04x, 0x%04x] @ 0x%04x, set new IC: 0x%04x", cpu->ic, cpu->r[0], SR_READ(), arg, cpu->ar, new_ic);
 
-	uint16_t vector[] = { ic, r[0], SR_READ(), arg };
-	for (int i=0 ; i<4 ; i++, ar++) {
-		if (!cpu_mem_write_1(false, ar, vector[i])) return;
+	uint16_t vector[] = { cpu->ic, cpu->r[0], SR_READ(), arg };
+	for (int i=0 ; i<4 ; i++, cpu->ar++) {
+		if (!cpu_mem_write_1(cpu, false, cpu->ar, vector[i])) return;
 	}
-	if (!cpu_mem_write_1(false, STACK_POINTER, ar)) return;
+	if (!cpu_mem_write_1(cpu, false, STACK_POINTER, cpu->ar)) return;
 
-	r[0] = 0;
-	ic = new_ic;
-	q = false;
-	rm &= int_mask;
-	int_update_mask(rm);
+	cpu->r[0] = 0;
+	cpu->ic = new_ic;
+	cpu->q = false;
+	cpu->rm &= int_mask;
+	int_update_mask(cpu, cpu->rm);
 }
 
 // -----------------------------------------------------------------------
-void cpu_sp_rewind()
+void cpu_sp_rewind(struct cpu *cpu)
 {
-	if (!cpu_mem_read_1(false, STACK_POINTER, &ar)) return;
-	ar -= 4;
-	if (!cpu_mem_write_1(false, STACK_POINTER, ar)) return;
+	if (!cpu_mem_read_1(cpu, false, STACK_POINTER, &cpu->ar)) return;
+	cpu->ar -= 4;
+	if (!cpu_mem_write_1(cpu, false, STACK_POINTER, cpu->ar)) return;
 }
 
 // -----------------------------------------------------------------------
-void cpu_ctx_restore(bool barnb)
+void cpu_ctx_restore(struct cpu *cpu, bool barnb)
 {
 	uint16_t sr_tmp;
-	uint16_t *vector[] = { &ic, r+0, &sr_tmp };
-	for (int i=0 ; i<3 ; i++, ar++) {
-		if (!cpu_mem_read_1(barnb, ar, vector[i])) return;
+	uint16_t *vector[] = { &cpu->ic, cpu->r+0, &sr_tmp };
+	for (int i=0 ; i<3 ; i++, cpu->ar++) {
+		if (!cpu_mem_read_1(cpu, barnb, cpu->ar, vector[i])) return;
 	}
 	SR_WRITE(sr_tmp);
-	int_update_mask(rm);
+	int_update_mask(cpu, cpu->rm);
 }
 
 // -----------------------------------------------------------------------
-static bool cpu_do_bin(bool start)
+static bool cpu_do_bin(struct cpu *cpu, bool start)
 {
-	static int words = 0;
-	static uint16_t data;
-	static uint8_t bdata[3];
-	static int cnt = 0;
+	uint16_t data;
 
 	if (start) {
-		LOG(L_CPU, "Binary load initiated @ 0x%04x", ar);
-		words = 0;
-		cnt = 0;
+		LOG(L_CPU, "Binary load initiated @ 0x%04x", cpu->ar);
+		cpu->bin_words = 0;
+		cpu->bin_cnt = 0;
 		return false;
 	}
 
-	int res = io_dispatch(IO_IN, ic, &data);
+	int res = io_dispatch(cpu->io, cpu->num, IO_IN, cpu->ic, &data);
 	if (res == IO_OK) {
-		bdata[cnt] = data & 0xff;
-		if ((cnt == 0) && bin_is_end(bdata[cnt])) {
-			LOG(L_CPU, "Binary load done, %i words loaded", words);
+		uint8_t *bdata = cpu->bin_bdata;
+		bdata[cpu->bin_cnt] = data & 0xff;
+		if ((cpu->bin_cnt == 0) && bin_is_end(bdata[cpu->bin_cnt])) {
+			LOG(L_CPU, "Binary load done, %i words loaded", cpu->bin_words);
 			return true;
-		} else if (bin_is_valid(bdata[cnt])) {
-			cnt++;
-			if (cnt >= 3) {
-				cnt = 0;
-				if (cpu_mem_write_1(q, ar, bin2word(bdata)) == 1) {
-					words++;
-					ar++;
+		} else if (bin_is_valid(bdata[cpu->bin_cnt])) {
+			cpu->bin_cnt++;
+			if (cpu->bin_cnt >= 3) {
+				cpu->bin_cnt = 0;
+				if (cpu_mem_write_1(cpu, cpu->q, cpu->ar, bin2word(bdata)) == 1) {
+					cpu->bin_words++;
+					cpu->ar++;
 				}
 			}
 		}
@@ -353,47 +463,47 @@ static bool cpu_do_bin(bool start)
 }
 
 // -----------------------------------------------------------------------
-static int cpu_do_cycle()
+static int cpu_do_cycle(struct cpu *cpu)
 {
-	struct iset_opcode *op;
+	const struct iset_opcode *op;
 	int instruction_time = 0;
 
-	if (LOG_WANTS(L_CPU)) log_store_cycle_state(SR_READ(), ic);
+	if (LOG_CYCLE_WANTED) log_store_cycle_state(SR_READ(), cpu->ic);
 
-	ips_counter++;
+	cpu->ips_counter++;
 
 	// fetch instruction
-	if (!cpu_mem_read_1(q, ic++, &ir)) {
+	if (!cpu_mem_read_1(cpu, cpu->q, cpu->ic++, &cpu->ir)) {
 		LOGCPU(L_CPU, "        no mem, instruction fetch");
 		goto ineffective_memfail;
 	}
 
-	op = cpu_op_tab[ir];
+	op = cpu->op_tab[cpu->ir];
 	unsigned flags = op->flags;
 
 	// check instruction effectiveness
-	if (p || ((r[0] & op->jmp_nef_mask) != op->jmp_nef_result)) {
-		LOGDASM(0, 0, "skip: ");
+	if (cpu->p || ((cpu->r[0] & op->jmp_nef_mask) != op->jmp_nef_result)) {
+		LOGDASM(cpu->mem, 0, 0, "skip: ");
 		// if the instruction is ineffective, argument for 2-word instructions is skipped
-		if ((flags & OP_FL_ARG_NORM) && !IR_C) ic++;
+		if ((flags & OP_FL_ARG_NORM) && !IR_C) cpu->ic++;
 		goto ineffective;
 	}
 
 	// check instruction legalness
 	// NOTE: for illegal and user-illegal 2-word instructions argument is _not_ skipped
 	if (flags & OP_FL_ILLEGAL) {
-		LOGCPU(L_CPU, "    illegal: 0x%04x", ir);
-		int_set(INT_ILLEGAL_INSTRUCTION);
+		LOGCPU(L_CPU, "    illegal: 0x%04x", cpu->ir);
+		int_set(cpu, INT_ILLEGAL_INSTRUCTION);
 		goto ineffective;
 	}
-	if (q && (flags & OP_FL_USR_ILLEGAL)) {
-		LOGDASM(0, 0, "user illegal: ");
-		int_set(INT_ILLEGAL_INSTRUCTION);
+	if (cpu->q && (flags & cpu->usr_illegal_mask)) {
+		LOGDASM(cpu->mem, 0, 0, "user illegal: ");
+		int_set(cpu, INT_ILLEGAL_INSTRUCTION);
 		goto ineffective;
 	}
-	if ((op->fun == op_77_md) && (mc == 3)) {
-		LOGDASM(0, 0, "illegal (4th md): ");
-		int_set(INT_ILLEGAL_INSTRUCTION);
+	if ((op->fun == op_77_md) && (cpu->mc == 3)) {
+		LOGDASM(cpu->mem, 0, 0, "illegal (4th md): ");
+		int_set(cpu, INT_ILLEGAL_INSTRUCTION);
 		goto ineffective;
 	}
 
@@ -403,56 +513,56 @@ static int cpu_do_cycle()
 	// get the argument
 	if (flags & OP_FL_ARG_NORM) {
 		if (IR_C) {
-			ac = r[IR_C];
+			cpu->ac = cpu->r[IR_C];
 		} else {
-			if (!cpu_mem_read_1(q, ic, &ac)) {
-				LOGCPU(L_CPU, "    no mem, long arg fetch @ %i:0x%04x", q*nb, ic);
+			if (!cpu_mem_read_1(cpu, cpu->q, cpu->ic, &cpu->ac)) {
+				LOGCPU(L_CPU, "    no mem, long arg fetch @ %i:0x%04x", cpu->q*cpu->nb, cpu->ic);
 				goto ineffective_memfail;
 			}
-			ic++;
+			cpu->ic++;
 			instruction_time += TIME_MEM_ARG;
 		}
 	} else if (flags & OP_FL_ARG_SHORT) {
-		ac = IR_T;
+		cpu->ac = IR_T;
 	} else if (flags & OP_FL_ARG_BYTE) {
-		ac = IR_b;
+		cpu->ac = IR_b;
 	}
 
 	// pre-mod
-	if (mc) {
-		zc17 = (ac + ar) > 0xffff;
-		ac += ar;
+	if (cpu->mc) {
+		cpu->zc17 = (cpu->ac + cpu->ar) > 0xffff;
+		cpu->ac += cpu->ar;
 		instruction_time += TIME_PREMOD;
 	} else {
-		zc17 = false;
+		cpu->zc17 = false;
 	}
 
 	// B-mod
 	if ((flags & OP_FL_ARG_NORM) && IR_B) {
-		zc17 = (ac + r[IR_B]) > 0xffff;
-		ac += r[IR_B];
+		cpu->zc17 = (cpu->ac + cpu->r[IR_B]) > 0xffff;
+		cpu->ac += cpu->r[IR_B];
 		instruction_time += TIME_BMOD;
 	}
 
-	ar = ac;
+	cpu->ar = cpu->ac;
 
 	// D-mod
 	if ((flags & OP_FL_ARG_NORM) && IR_D) {
-		if (!cpu_mem_read_1(q, ac, &ac)) {
-			LOGCPU(L_CPU, "    no mem, indirect arg fetch @ %i:0x%04x", q*nb, ar);
+		if (!cpu_mem_read_1(cpu, cpu->q, cpu->ac, &cpu->ac)) {
+			LOGCPU(L_CPU, "    no mem, indirect arg fetch @ %i:0x%04x", cpu->q*cpu->nb, cpu->ar);
 			goto ineffective_memfail;
 		}
-		ar = ac;
+		cpu->ar = cpu->ac;
 		instruction_time += TIME_DMOD;
 	}
 
 	// execute instruction
-	LOGDASM((op->flags & (OP_FL_ARG_NORM | OP_FL_ARG_SHORT)), ac, "");
-	op->fun();
+	LOGDASM(cpu->mem, (op->flags & (OP_FL_ARG_NORM | OP_FL_ARG_SHORT)), cpu->ac, "");
+	op->fun(cpu);
 	instruction_time += op->time;
 
 	// clear modification counter if instruction was not MD
-	if (op->fun != op_77_md) mc = 0;
+	if (op->fun != op_77_md) cpu->mc = 0;
 
 	if (op->fun == op_72_shc) {
 		instruction_time += IR_t * TIME_SHIFT;
@@ -463,6 +573,7 @@ static int cpu_do_cycle()
 		// Without it, it may happen that interrupt HLT was supposed to wait for
 		// is served just after OU, causing HLT to sleep indefinitely.
 		instruction_time *= -1;
+		cpu->io_outs++;
 	}
 
 	return instruction_time;
@@ -471,13 +582,13 @@ ineffective_memfail:
 	instruction_time += TIME_NOANS_IF;
 ineffective:
 	instruction_time += TIME_P;
-	p = false;
-	mc = 0;
+	cpu->p = false;
+	cpu->mc = 0;
 	return instruction_time;
 }
 
 // -----------------------------------------------------------------------
-static void cpu_timekeeping(int cpu_time)
+static bool cpu_timekeeping(struct cpu *cpu, int cpu_time)
 {
 	bool skip_sleep = false;
 
@@ -486,87 +597,334 @@ static void cpu_timekeeping(int cpu_time)
 		skip_sleep = true;
 	}
 
-	cpu_time *= cpu_delay_factor;
-	cpu_time_cumulative += cpu_time;
+	cpu_time *= cpu->delay_factor;
+	cpu->time_cumulative += cpu_time;
 
-	if (sound_enabled) {
-		buzzer_update(ir, cpu_time);
+	if (cpu->sound_enabled) {
+		buzzer_update(cpu->ir, cpu_time);
 	}
 
-	if (!skip_sleep && (cpu_time_cumulative >= throttle_granularity)) {
-		cpu_timer.tv_nsec += cpu_time_cumulative;
-		while (cpu_timer.tv_nsec >= 1000000000) {
-			cpu_timer.tv_nsec -= 1000000000;
-			cpu_timer.tv_sec++;
+	if (!skip_sleep && (cpu->time_cumulative >= cpu->throttle_granularity)) {
+		if (cpu->sound_enabled) {
+			buzzer_sync();
 		}
-		cpu_time_cumulative = 0;
-		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &cpu_timer, NULL) == EINTR);
+		cpu->timer.tv_nsec += cpu->time_cumulative;
+		while (cpu->timer.tv_nsec >= 1000000000) {
+			cpu->timer.tv_nsec -= 1000000000;
+			cpu->timer.tv_sec++;
+		}
+		cpu->time_cumulative = 0;
+		// CPU is ahead of real time, sleep until cpu->timer
+		return true;
 	}
+
+	return false;
 }
 
 // -----------------------------------------------------------------------
-void cpu_loop()
+void cpu_idle_wake(struct cpu *cpu)
 {
-	cpu_state_change(ECTL_STATE_STOP, ECTL_STATE_ANY);
-	clock_gettime(CLOCK_MONOTONIC, &cpu_timer);
+	// called by anything that may end a guest polling loop (interrupts, I/O memory writes)
+	atom_add_release(&cpu->idle_events, 1);
+	atom_full_fence();
+	if (atom_load_acquire(&cpu->idle_parked)) {
+		pthread_mutex_lock(&cpu->wake_mutex);
+		cpu_notify(cpu);
+		pthread_mutex_unlock(&cpu->wake_mutex);
+	}
+}
 
-	while (1) {
+// -----------------------------------------------------------------------
+static unsigned long cpu_idle_peer_writes(struct cpu *cpu)
+{
+	return cpu->peer ? atom_load_acquire(&cpu->peer->mem_writes) : 0;
+}
+
+// -----------------------------------------------------------------------
+static bool cpu_idle_park(struct cpu *cpu)
+{
+	bool parked = false;
+
+	LOG(L_CPU, "Parking idle loop @ 0x%04x", cpu->idle_head);
+	cpu->idle_parks++;
+
+	// loop has to prove to be idle again before next park
+	cpu->idle_count = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &cpu->idle_park_start);
+	cpu->wake_deadline = cpu->idle_park_start;
+	cpu->wake_deadline.tv_nsec += cpu->idle_park_ns;
+	while (cpu->wake_deadline.tv_nsec >= 1000000000) {
+		cpu->wake_deadline.tv_nsec -= 1000000000;
+		cpu->wake_deadline.tv_sec++;
+	}
+
+	pthread_mutex_lock(&cpu->wake_mutex);
+	atom_store_release(&cpu->idle_parked, true);
+	atom_full_fence();
+	// events and writes by the other CPU that happened since the loop was last checked wake the CPU right away
+	if ((atom_load_acquire(&cpu->idle_events) == cpu->idle_sig.events) && (cpu_idle_peer_writes(cpu) == cpu->idle_sig.peer_writes) && (cpu->state == ECTL_STATE_RUN)) {
+		// anything that happens from now on sets 'woken' again
+		cpu->woken = false;
+		cpu->wake_deadline_set = true;
+		parked = true;
+		cpu_emu_idle_start(cpu);
+	} else {
+		atom_store_release(&cpu->idle_parked, false);
+	}
+	pthread_mutex_unlock(&cpu->wake_mutex);
+
+	return parked;
+}
+
+// -----------------------------------------------------------------------
+static void cpu_idle_unpark(struct cpu *cpu)
+{
+	atom_store_release(&cpu->idle_parked, false);
+	cpu->wake_deadline_set = false;
+
+	// time spent parked has been counted as emulated time spent in the loop
+	if (cpu->speed_real) {
+		clock_gettime(CLOCK_MONOTONIC, &cpu->timer);
+		cpu->time_cumulative = 0;
+	}
+}
+
+// -----------------------------------------------------------------------
+static bool cpu_idle_check(struct cpu *cpu, uint16_t prev_ic)
+{
+	// only short backward jumps may close a polling loop
+	if ((cpu->ic >= prev_ic) || (prev_ic - cpu->ic > CPU_IDLE_LOOP_MAX_LEN) || cpu->mc || cpu->p) {
+		return false;
+	}
+
+	// loop is idle if it comes back to the same state: same registers, no memory writes
+	// (by either CPU), no I/O output and no external events
+	struct cpu_idle_sig sig;
+	memset(&sig, 0, sizeof(sig)); // padding is compared too
+	memcpy(sig.r, cpu->r, sizeof(sig.r));
+	sig.sr = SR_READ();
+	sig.mem_writes = cpu->mem_writes;
+	sig.peer_writes = cpu_idle_peer_writes(cpu);
+	sig.io_outs = cpu->io_outs;
+	sig.events = atom_load_acquire(&cpu->idle_events);
+
+	if ((cpu->ic == cpu->idle_head) && !memcmp(&sig, &cpu->idle_sig, sizeof(sig))) {
+		return ++cpu->idle_count >= cpu->idle_threshold;
+	}
+
+	cpu->idle_head = cpu->ic;
+	cpu->idle_sig = sig;
+	cpu->idle_count = 0;
+	return false;
+}
+
+// -----------------------------------------------------------------------
+static void cpu_batch_finish(struct cpu *cpu, int result)
+{
+	LOG(L_CPU, "Batch run finished with result %i", result);
+	cpu->batch_result = result;
+	cpu_state_change(cpu, ECTL_STATE_OFF, ECTL_STATE_ANY);
+	// batch run ends with the first CPU, the other one goes off too
+	if ((cpu->num == 0) && cpu->peer) {
+		cpu_state_change(cpu->peer, ECTL_STATE_OFF, ECTL_STATE_ANY);
+	}
+}
+
+// -----------------------------------------------------------------------
+int cpu_batch_result(struct cpu *cpu)
+{
+	return cpu->batch_result;
+}
+
+// -----------------------------------------------------------------------
+void cpu_power_on(struct cpu *cpu)
+{
+	// in batch mode there is nobody to start the CPU
+	cpu_state_change(cpu, cpu->batch ? ECTL_STATE_RUN : ECTL_STATE_STOP, ECTL_STATE_ANY);
+	clock_gettime(CLOCK_MONOTONIC, &cpu->timer);
+}
+
+// -----------------------------------------------------------------------
+static void cpu_resume(struct cpu *cpu)
+{
+	cpu_emu_idle_end(cpu);
+
+	if (cpu->idle_parked) {
+		cpu_idle_unpark(cpu);
+	}
+
+	if (cpu->stopped) {
+		int state = atom_load_acquire(&cpu->state);
+		if (state == ECTL_STATE_STOP) return;
+		cpu->stopped = false;
+		if (cpu->speed_real && (state == ECTL_STATE_RUN)) {
+			if (cpu->sound_enabled) buzzer_start();
+			clock_gettime(CLOCK_MONOTONIC, &cpu->timer);
+			cpu->time_cumulative = 0;
+		} else if (state == ECTL_STATE_BIN) {
+			cpu_do_bin(cpu, true); // initiate binary load
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+static bool cpu_cycle_checks(struct cpu *cpu)
+{
+	// breakpoints are checked only on the CPU controlled through the control panel
+	return cpu->idle_detect || (atom_load_acquire(&cpu->console) && ectl_brk_any());
+}
+
+// -----------------------------------------------------------------------
+// Both cpu_loop() and the scheduler call cpu_run(). Keeping a single out-of-line
+// copy of it lets the compiler inline the whole instruction cycle into the loop.
+__attribute__((noinline, noclone)) int cpu_run(struct cpu *cpu, unsigned quantum)
+{
+	int res = CPU_RUN_YIELD;
+
+	cpu_resume(cpu);
+
+	// Emulated time and publish countdown are kept local. Emulated time is published
+	// together with the CPU state every publish_interval instructions and when
+	// cpu_run() returns, which is also when the need for per-cycle checks is reevaluated.
+	uint64_t emu_time = cpu->emu_time_ns;
+	unsigned publish_countdown = cpu->publish_countdown;
+	bool cycle_checks = cpu_cycle_checks(cpu);
+
+	while (quantum--) {
 		int cpu_time = 0;
-		int state = atom_load_acquire(&cpu_state);
+		bool parked = false;
+		int state = atom_load_acquire(&cpu->state);
 
 		switch (state) {
 			case ECTL_STATE_CYCLE:
-				cpu_state_change(ECTL_STATE_STOP, ECTL_STATE_CYCLE);
+				cpu_state_change(cpu, ECTL_STATE_STOP, ECTL_STATE_CYCLE);
 			case ECTL_STATE_RUN:
-				if (atom_load_acquire(&rp) && !p && (mc == 0)) {
-					int_serve();
+				if (atom_load_acquire(&cpu->rp) && !cpu->p && (cpu->mc == 0)) {
+					int_serve(cpu);
 					cpu_time = TIME_INT_SERVE;
 				} else {
-					cpu_time = cpu_do_cycle();
-					if (ectl_brk_check()) {
-						cpu_state_change(ECTL_STATE_STOP, ECTL_STATE_RUN);
+					if (cycle_checks) cpu->idle_prev_ic = cpu->ic;
+					cpu_time = cpu_do_cycle(cpu);
+					if (cycle_checks) {
+						if (atom_load_acquire(&cpu->console) && ectl_brk_check()) {
+							cpu_state_change(cpu, ECTL_STATE_STOP, ECTL_STATE_RUN);
+						} else if (cpu->idle_detect && (state == ECTL_STATE_RUN) && cpu_idle_check(cpu, cpu->idle_prev_ic)) {
+							parked = cpu_idle_park(cpu);
+						}
 					}
 				}
 				break;
 			case ECTL_STATE_OFF:
-				if (sound_enabled) buzzer_stop();
-				return;
+				if (cpu->sound_enabled) buzzer_stop();
+				res = CPU_RUN_OFF;
+				goto done;
 			case ECTL_STATE_CLM:
-				cpu_do_clear(ECTL_STATE_CLM);
-				cpu_state_change(ECTL_STATE_RUN, ECTL_STATE_CLM);
+				cpu_do_clear(cpu, ECTL_STATE_CLM);
+				cpu_state_change(cpu, ECTL_STATE_RUN, ECTL_STATE_CLM);
 				break;
 			case ECTL_STATE_CLO:
-				if (sound_enabled) buzzer_stop();
-				cpu_do_clear(ECTL_STATE_CLO);
-				cpu_state_change(ECTL_STATE_STOP, ECTL_STATE_CLO);
+				if (cpu->sound_enabled) buzzer_stop();
+				cpu_do_clear(cpu, ECTL_STATE_CLO);
+				cpu_state_change(cpu, ECTL_STATE_STOP, ECTL_STATE_CLO);
 				break;
 			case ECTL_STATE_BIN:
-				if (cpu_do_bin(false)) cpu_state_change(ECTL_STATE_STOP, ECTL_STATE_BIN);
+				if (cpu_do_bin(cpu, false)) cpu_state_change(cpu, ECTL_STATE_STOP, ECTL_STATE_BIN);
 				break;
 			case ECTL_STATE_STOP:
-				if (sound_enabled) buzzer_stop();
-				int res = cpu_do_stop();
-				if (speed_real && (res == ECTL_STATE_RUN)) {
-					if (sound_enabled) buzzer_start();
-					clock_gettime(CLOCK_MONOTONIC, &cpu_timer);
-					cpu_time_cumulative = 0;
-				} else if (res == ECTL_STATE_BIN) {
-					cpu_do_bin(true); // initiate binary load
+				if (cpu->batch) {
+					cpu_batch_finish(cpu, CPU_BATCH_STOPPED);
+					break;
 				}
-				break;
+				if (!cpu->stopped) {
+					LOG(L_CPU, "idling in state STOP");
+					if (cpu->sound_enabled) buzzer_stop();
+					ectl_shm_publish(cpu, state);
+					cpu->stopped = true;
+				}
+				res = CPU_RUN_BLOCK;
+				goto done;
 			case ECTL_STATE_WAIT:
-				if (speed_real) {
-					if (atom_load_acquire(&rp) && !p && !mc) {
-						cpu_state_change(ECTL_STATE_RUN, ECTL_STATE_WAIT);
+				// HLT with a high enough code ends the batch run
+				if (cpu->batch && (IR_OP == 073) && (IR_A == 0) && ((cpu->ir & 077) >= cpu->batch_halt_min)) {
+					cpu_batch_finish(cpu, cpu->ir & 077);
+					break;
+				}
+				if (cpu->speed_real) {
+					if (atom_load_acquire(&cpu->rp) && !cpu->p && !cpu->mc) {
+						cpu_state_change(cpu, ECTL_STATE_RUN, ECTL_STATE_WAIT);
 					} else {
-						cpu_time = throttle_granularity;
+						cpu_time = cpu->throttle_granularity;
+					}
+				} else {
+					ectl_shm_publish(cpu, state);
+					if (cpu_do_wait(cpu)) {
+						LOG(L_CPU, "idling in state WAIT");
+						cpu_emu_idle_start(cpu);
+						res = CPU_RUN_BLOCK;
+						goto done;
 					}
 				}
-				else cpu_do_wait();
 				break;
 		}
 
-		if (speed_real) cpu_timekeeping(cpu_time);
+		emu_time += abs(cpu_time);
+
+		if (--publish_countdown == 0) {
+			atom_store_release(&cpu->emu_time_ns, emu_time);
+			ectl_shm_publish(cpu, state);
+			publish_countdown = cpu->publish_interval;
+			cycle_checks = cpu_cycle_checks(cpu);
+		}
+
+		if (parked) {
+			res = CPU_RUN_BLOCK;
+			break;
+		}
+		if (cpu->speed_real && cpu_timekeeping(cpu, cpu_time)) {
+			res = CPU_RUN_SLEEP;
+			break;
+		}
+	}
+
+done:
+	cpu->publish_countdown = publish_countdown;
+	atom_store_release(&cpu->emu_time_ns, emu_time);
+	return res;
+}
+
+// -----------------------------------------------------------------------
+static void cpu_block(struct cpu *cpu)
+{
+	pthread_mutex_lock(&cpu->wake_mutex);
+	while (!cpu->woken) {
+		if (!cpu->wake_deadline_set) {
+			pthread_cond_wait(&cpu->wake_cond, &cpu->wake_mutex);
+		} else if (pthread_cond_timedwait(&cpu->wake_cond, &cpu->wake_mutex, &cpu->wake_deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	cpu->woken = false;
+	pthread_mutex_unlock(&cpu->wake_mutex);
+}
+
+// -----------------------------------------------------------------------
+void cpu_loop(struct cpu *cpu)
+{
+	cpu_power_on(cpu);
+
+	// CPU running on its own thread: give up the thread only to sleep or block
+	while (1) {
+		switch (cpu_run(cpu, UINT_MAX)) {
+			case CPU_RUN_OFF:
+				return;
+			case CPU_RUN_SLEEP:
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &cpu->timer, NULL) == EINTR);
+				break;
+			case CPU_RUN_BLOCK:
+				cpu_block(cpu);
+				break;
+		}
 	}
 }
 
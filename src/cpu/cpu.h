@@ -20,9 +20,20 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 
+#include "ectl/shm.h"
 #include "cfg.h"
 
+#include "ectl.h" // for global constants
+
+struct em400_machine;
+struct mem;
+struct io;
+struct iset_opcode;
+struct sched;
+
 // -----------------------------------------------------------------------
 // Flags in R0
 // -----------------------------------------------------------------------
@@ -37,15 +48,18 @@
 #define FL_Y    0b0000000100000000
 #define FL_X    0b0000000010000000
 
+// Register access macros below work on the CPU pointed to
+// by 'cpu' in the current scope
+
 // -----------------------------------------------------------------------
 // SR access macros
 // -----------------------------------------------------------------------
-#define SR_READ() (rm << 6 | q << 5 | bs << 4 | nb)
-#define SR_WRITE(sr)				\
-	rm = (sr >> 6) & 0b1111111111;	\
-	q =  sr & 0b100000;				\
-	bs = sr & 0b010000;				\
-	nb = sr & 0b001111
+#define SR_READ() (cpu->rm << 6 | cpu->q << 5 | cpu->bs << 4 | cpu->nb)
+#define SR_WRITE(sr)					\
+	cpu->rm = (sr >> 6) & 0b1111111111;	\
+	cpu->q =  sr & 0b100000;			\
+	cpu->bs = sr & 0b010000;			\
+	cpu->nb = sr & 0b001111
 
 // -----------------------------------------------------------------------
 // IR access macros
@@ -58,48 +72,165 @@
 #define _T(x)	(int8_t) (((x) & 0b0000000000111111) * (((x) & 0b0000001000000000) ? -1 : 1))
 #define _t(x)	(uint8_t) (((x) & 0b0000000000000111) | (((x) & 0b0000001000000000) >> 6)) // only SHC uses it
 #define _b(x)	((x) & 0x00ff)
-#define IR_OP	_OP(ir)
-#define IR_D	_D(ir)
-#define IR_A	_A(ir)
-#define IR_B	_B(ir)
-#define IR_C	_C(ir)
-#define IR_T	_T(ir)
-#define IR_t	_t(ir)
-#define IR_b	_b(ir)
-
-#define REG_RESTRICT_WRITE(i, v) r[i] = ((i)|!q) ? (v) : (r[i] & 0xff00) | ((v) & 0x00ff)
-
-extern uint16_t r[8];
-extern uint16_t ic, kb, ir, ac, ar;
-extern bool rALARM;
-extern int mc;
-extern unsigned rm, nb;
-extern bool p, q, bs;
-
-extern bool zc17;
-
-extern bool cpu_mod_present;
-extern bool cpu_mod_active;
-extern bool cpu_user_io_illegal;
-extern bool awp_enabled;
-
-bool cpu_mem_read_1(bool barnb, uint16_t addr, uint16_t *data);
-bool cpu_mem_write_1(bool barnb, uint16_t addr, uint16_t data);
-
-int cpu_init(em400_cfg *cfg);
-void cpu_shutdown();
-
-int cpu_mod_on();
-int cpu_mod_off();
-
-void cpu_ctx_switch(uint16_t arg, uint16_t new_ic, uint16_t int_mask);
-void cpu_sp_rewind();
-void cpu_ctx_restore(bool barnb);
-
-void cpu_loop();
-
-int cpu_state_change(int to, int from);
-int cpu_state_get();
+#define IR_OP	_OP(cpu->ir)
+#define IR_D	_D(cpu->ir)
+#define IR_A	_A(cpu->ir)
+#define IR_B	_B(cpu->ir)
+#define IR_C	_C(cpu->ir)
+#define IR_T	_T(cpu->ir)
+#define IR_t	_t(cpu->ir)
+#define IR_b	_b(cpu->ir)
+
+#define REG_RESTRICT_WRITE(i, v) cpu->r[i] = ((i)|!cpu->q) ? (v) : (cpu->r[i] & 0xff00) | ((v) & 0x00ff)
+
+// idle (polling) loop signature
+struct cpu_idle_sig {
+	uint16_t r[8];
+	uint16_t sr;
+	unsigned long mem_writes;
+	unsigned long peer_writes;
+	unsigned long io_outs;
+	unsigned long events;
+};
+
+// results of cpu_run()
+enum cpu_run_results {
+	CPU_RUN_YIELD,	// quantum used up, CPU wants to run again
+	CPU_RUN_SLEEP,	// CPU is ahead of real time, sleep until cpu->timer
+	CPU_RUN_BLOCK,	// CPU waits for a wake-up (and until cpu->wake_deadline, if set)
+	CPU_RUN_OFF,	// CPU is off
+};
+
+struct cpu {
+	// registers (used by every instruction, keep them first)
+	uint16_t r[8];
+	uint16_t ic, kb, ir, ac, ar;
+	bool rALARM;
+	int mc;
+	unsigned rm, nb;
+	bool p, q, bs;
+	bool zc17;
+
+	// interrupts: rz, rp and int_mask are guarded by int_mutex (rp is also read without it)
+	uint32_t rz;
+	uint32_t rp;
+	uint32_t int_mask;
+	pthread_mutex_t int_mutex;
+
+	struct mem *mem;			// machine memory
+	struct io *io;				// machine I/O
+	const struct iset_opcode * const *op_tab;	// opcode table (instruction decoder decision table), shared and read-only
+	unsigned usr_illegal_mask;	// opcode flags of instructions illegal in user mode
+	unsigned long ips_counter;	// instructions executed
+
+	int state;
+	bool console;				// CPU is controlled through the control panel (breakpoints are checked)
+	bool primary;				// first CPU of the first machine (sound, OS tracking in logs)
+	int num;					// CPU number within the machine (PN)
+	struct cpu *peer;			// the other CPU in a 2-CPU machine
+
+	bool mod_present;
+	bool mod_active;
+	bool user_io_illegal;
+	bool awp_enabled;
+	bool awp_native;			// emawp is used only where native AWP operation can't handle the case
+	bool nomem_stop;
+
+	// clock interrupt
+	int clock_enabled;
+	int clock_int;
+
+	// timekeeping
+	int speed_real;
+	struct timespec timer;
+	int time_cumulative;
+	int throttle_granularity;
+	float delay_factor;
+	uint64_t emu_time_ns;		// emulated time (ns of CPU time), advanced only by the CPU thread, published with CPU state
+	uint64_t emu_idle_since_ns;	// wall clock time the CPU started to wait or got parked at (0 if it didn't)
+	bool emu_time_wall;			// CPU is not emulated (FPGA), emulated time is the wall clock
+	int sound_enabled;
+
+	// published CPU state (for UIs and shared memory export)
+	unsigned publish_interval;
+	unsigned publish_countdown;
+	struct ectl_shm_state *pub;
+	struct ectl_shm_state pub_local;
+
+	// idle (polling) loop detection
+	bool idle_detect;
+	unsigned idle_threshold;
+	long idle_park_ns;
+	uint16_t idle_head;
+	uint16_t idle_prev_ic;		// IC before the last cycle (kept only while per-cycle checks are on)
+	unsigned idle_count;
+	struct cpu_idle_sig idle_sig;
+	unsigned long mem_writes;
+	unsigned long io_outs;
+	unsigned long idle_events;
+	bool idle_parked;
+	struct timespec idle_park_start;
+	unsigned long idle_parks;
+
+	// batch mode
+	bool batch;
+	unsigned batch_halt_min;
+	int batch_result;
+
+	// binary load
+	int bin_words;
+	uint8_t bin_bdata[3];
+	int bin_cnt;
+
+	// wake-ups: state changes, interrupts and external events that may end WAIT, STOP or a parked loop
+	pthread_mutex_t wake_mutex;
+	pthread_cond_t wake_cond;
+	bool woken;
+	bool stopped;				// CPU thread noticed it's stopped
+	bool wake_deadline_set;
+	struct timespec wake_deadline;	// CLOCK_MONOTONIC
+
+	// scheduler bookkeeping (guarded by the scheduler)
+	struct sched *sched;
+	struct cpu *sched_next;
+	int sched_state;
+	bool sched_wakeup;
+
+	// interrupt statistics: time and instruction count at which each pending
+	// interrupt has been raised (guarded by int_mutex)...
+	uint64_t int_raised_ns[32];
+	unsigned long int_raised_ins[32];
+	// ...served interrupts and log2 histograms of raise-to-serve latency (updated by the CPU thread only)
+	unsigned long int_served[32];
+	unsigned long int_lat_hist[ECTL_INT_LAT_UNITS][32][ECTL_INT_LAT_BUCKETS];
+	unsigned long int_lat_sum[ECTL_INT_LAT_UNITS][32];
+
+	struct em400_machine *m;	// machine the CPU belongs to
+};
+
+bool cpu_mem_read_1(struct cpu *cpu, bool barnb, uint16_t addr, uint16_t *data);
+bool cpu_mem_read_n(struct cpu *cpu, bool barnb, uint16_t addr, uint16_t *data, int count);
+bool cpu_mem_write_1(struct cpu *cpu, bool barnb, uint16_t addr, uint16_t data);
+
+int cpu_init(struct cpu *cpu, struct em400_machine *m, int num, em400_cfg *cfg);
+void cpu_shutdown(struct cpu *cpu);
+
+int cpu_mod_on(struct cpu *cpu);
+int cpu_mod_off(struct cpu *cpu);
+
+void cpu_ctx_switch(struct cpu *cpu, uint16_t arg, uint16_t new_ic, uint16_t int_mask);
+void cpu_sp_rewind(struct cpu *cpu);
+void cpu_ctx_restore(struct cpu *cpu, bool barnb);
+
+void cpu_power_on(struct cpu *cpu);
+int cpu_run(struct cpu *cpu, unsigned quantum);
+void cpu_loop(struct cpu *cpu);
+int cpu_batch_result(struct cpu *cpu);
+void cpu_idle_wake(struct cpu *cpu);
+
+int cpu_state_change(struct cpu *cpu, int to, int from);
+int cpu_state_get(struct cpu *cpu);
+uint64_t cpu_emu_time(struct cpu *cpu);
 
 #endif
 
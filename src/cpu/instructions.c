@@ -31,113 +31,113 @@
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_lw()
+void op_lw(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, ac);
+	REG_RESTRICT_WRITE(IR_A, cpu->ac);
 }
 
 // -----------------------------------------------------------------------
-void op_tw()
+void op_tw(struct cpu *cpu)
 {
 	uint16_t data;
-	if (cpu_mem_read_1(true, ar, &data)) {
+	if (cpu_mem_read_1(cpu, true, cpu->ar, &data)) {
 		REG_RESTRICT_WRITE(IR_A, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_ls()
+void op_ls(struct cpu *cpu)
 {
-	ar = ac & r[7];
-	ac = r[IR_A] & ~r[7];
-	REG_RESTRICT_WRITE(IR_A, ac | ar);
+	cpu->ar = cpu->ac & cpu->r[7];
+	cpu->ac = cpu->r[IR_A] & ~cpu->r[7];
+	REG_RESTRICT_WRITE(IR_A, cpu->ac | cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_ri()
+void op_ri(struct cpu *cpu)
 {
-	ar = r[IR_A];
-	if (cpu_mem_write_1(q, ar, ac)) {
-		REG_RESTRICT_WRITE(IR_A, r[IR_A] + 1);
+	cpu->ar = cpu->r[IR_A];
+	if (cpu_mem_write_1(cpu, cpu->q, cpu->ar, cpu->ac)) {
+		REG_RESTRICT_WRITE(IR_A, cpu->r[IR_A] + 1);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_rw()
+void op_rw(struct cpu *cpu)
 {
-	cpu_mem_write_1(q, ar, r[IR_A]);
+	cpu_mem_write_1(cpu, cpu->q, cpu->ar, cpu->r[IR_A]);
 }
 
 // -----------------------------------------------------------------------
-void op_pw()
+void op_pw(struct cpu *cpu)
 {
-	cpu_mem_write_1(true, ar, r[IR_A]);
+	cpu_mem_write_1(cpu, true, cpu->ar, cpu->r[IR_A]);
 }
 
 // -----------------------------------------------------------------------
-void op_rj()
+void op_rj(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, ic);
-	ic = ac;
+	REG_RESTRICT_WRITE(IR_A, cpu->ic);
+	cpu->ic = cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_is()
+void op_is(struct cpu *cpu)
 {
-	if (!cpu_mem_read_1(true, ar, &ac)) return;
+	if (!cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) return;
 
-	if ((ac & r[IR_A]) == r[IR_A]) {
-		p = true;
+	if ((cpu->ac & cpu->r[IR_A]) == cpu->r[IR_A]) {
+		cpu->p = true;
 	} else {
-		cpu_mem_write_1(true, ar, ac | r[IR_A]);
+		cpu_mem_write_1(cpu, true, cpu->ar, cpu->ac | cpu->r[IR_A]);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_bb()
+void op_bb(struct cpu *cpu)
 {
-	p = (r[IR_A] & ac) == ac;
+	cpu->p = (cpu->r[IR_A] & cpu->ac) == cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_bm()
+void op_bm(struct cpu *cpu)
 {
-	if (cpu_mem_read_1(true, ar, &ac)) {
-		p = (ac & r[IR_A]) == r[IR_A];
+	if (cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) {
+		cpu->p = (cpu->ac & cpu->r[IR_A]) == cpu->r[IR_A];
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_bs()
+void op_bs(struct cpu *cpu)
 {
-	ac ^= r[IR_A];
-	p = !(ac & r[7]);
+	cpu->ac ^= cpu->r[IR_A];
+	cpu->p = !(cpu->ac & cpu->r[7]);
 }
 
 // -----------------------------------------------------------------------
-void op_bc()
+void op_bc(struct cpu *cpu)
 {
-	p = (r[IR_A] & ac) != ac;
+	cpu->p = (cpu->r[IR_A] & cpu->ac) != cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_bn()
+void op_bn(struct cpu *cpu)
 {
-	p = (r[IR_A] & ac) == 0;
+	cpu->p = (cpu->r[IR_A] & cpu->ac) == 0;
 }
 
 // -----------------------------------------------------------------------
-void op_ou()
+void op_ou(struct cpu *cpu)
 {
-	ic += io_dispatch(IO_OU, ar, r+IR_A);
-	cpu_mem_read_1(q, ic, &ic);
+	cpu->ic += io_dispatch(cpu->io, cpu->num, IO_OU, cpu->ar, cpu->r+IR_A);
+	cpu_mem_read_1(cpu, cpu->q, cpu->ic, &cpu->ic);
 }
 
 // -----------------------------------------------------------------------
-void op_in()
+void op_in(struct cpu *cpu)
 {
-	ic += io_dispatch(IO_IN, ar, r+IR_A);
-	cpu_mem_read_1(q, ic, &ic);
+	cpu->ic += io_dispatch(cpu->io, cpu->num, IO_IN, cpu->ar, cpu->r+IR_A);
+	cpu_mem_read_1(cpu, cpu->q, cpu->ic, &cpu->ic);
 }
 
 // -----------------------------------------------------------------------
@@ -145,51 +145,51 @@ void op_in()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_37_ad()
+void op_37_ad(struct cpu *cpu)
 {
-	awp_dispatch(AWP_AD, ar);
+	awp_dispatch(cpu, AWP_AD, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_sd()
+void op_37_sd(struct cpu *cpu)
 {
-	awp_dispatch(AWP_SD, ar);
+	awp_dispatch(cpu, AWP_SD, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_mw()
+void op_37_mw(struct cpu *cpu)
 {
-	awp_dispatch(AWP_MW, ar);
+	awp_dispatch(cpu, AWP_MW, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_dw()
+void op_37_dw(struct cpu *cpu)
 {
-	awp_dispatch(AWP_DW, ar);
+	awp_dispatch(cpu, AWP_DW, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_af()
+void op_37_af(struct cpu *cpu)
 {
-	awp_dispatch(AWP_AF, ar);
+	awp_dispatch(cpu, AWP_AF, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_sf()
+void op_37_sf(struct cpu *cpu)
 {
-	awp_dispatch(AWP_SF, ar);
+	awp_dispatch(cpu, AWP_SF, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_mf()
+void op_37_mf(struct cpu *cpu)
 {
-	awp_dispatch(AWP_MF, ar);
+	awp_dispatch(cpu, AWP_MF, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
-void op_37_df()
+void op_37_df(struct cpu *cpu)
 {
-	awp_dispatch(AWP_DF, ar);
+	awp_dispatch(cpu, AWP_DF, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
@@ -197,151 +197,151 @@ void op_37_df()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_aw()
+void op_aw(struct cpu *cpu)
 {
-	alu_16_add(r[IR_A], ac, 0);
+	alu_16_add(cpu, cpu->r[IR_A], cpu->ac, 0);
 }
 
 // -----------------------------------------------------------------------
-void op_ac()
+void op_ac(struct cpu *cpu)
 {
-	alu_16_add(r[IR_A], ac, FGET(FL_C));
+	alu_16_add(cpu, cpu->r[IR_A], cpu->ac, FGET(FL_C));
 }
 
 // -----------------------------------------------------------------------
-void op_sw()
+void op_sw(struct cpu *cpu)
 {
-	alu_16_sub(r[IR_A], ac);
+	alu_16_sub(cpu, cpu->r[IR_A], cpu->ac);
 }
 
 // -----------------------------------------------------------------------
-void op_cw()
+void op_cw(struct cpu *cpu)
 {
-	alu_16_set_LEG((int16_t) r[IR_A], (int16_t) ac);
+	alu_16_set_LEG(cpu, (int16_t) cpu->r[IR_A], (int16_t) cpu->ac);
 }
 
 // -----------------------------------------------------------------------
-void op_or()
+void op_or(struct cpu *cpu)
 {
-	uint16_t data = r[IR_A] | ac;
-	alu_16_set_Z_bool(data);
+	uint16_t data = cpu->r[IR_A] | cpu->ac;
+	alu_16_set_Z_bool(cpu, data);
 	// reg writes needs to go after flag setting to cover corner cases
 	// where logical operations are performed on r0
 	REG_RESTRICT_WRITE(IR_A, data);
 }
 
 // -----------------------------------------------------------------------
-void op_om()
+void op_om(struct cpu *cpu)
 {
-	if (cpu_mem_read_1(true, ar, &ac)) {
-		uint16_t data = ac | r[IR_A];
-		alu_16_set_Z_bool(data);
-		cpu_mem_write_1(true, ar, data);
+	if (cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) {
+		uint16_t data = cpu->ac | cpu->r[IR_A];
+		alu_16_set_Z_bool(cpu, data);
+		cpu_mem_write_1(cpu, true, cpu->ar, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_nr()
+void op_nr(struct cpu *cpu)
 {
-	uint16_t data = r[IR_A] & ac;
-	alu_16_set_Z_bool(data);
+	uint16_t data = cpu->r[IR_A] & cpu->ac;
+	alu_16_set_Z_bool(cpu, data);
 	REG_RESTRICT_WRITE(IR_A, data);
 }
 
 // -----------------------------------------------------------------------
-void op_nm()
+void op_nm(struct cpu *cpu)
 {
-	if (cpu_mem_read_1(true, ar, &ac)) {
-		uint16_t data = ac & r[IR_A];
-		alu_16_set_Z_bool(data);
-		cpu_mem_write_1(true, ar, data);
+	if (cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) {
+		uint16_t data = cpu->ac & cpu->r[IR_A];
+		alu_16_set_Z_bool(cpu, data);
+		cpu_mem_write_1(cpu, true, cpu->ar, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_er()
+void op_er(struct cpu *cpu)
 {
-	uint16_t data = r[IR_A] & ~ac;
-	alu_16_set_Z_bool(data);
+	uint16_t data = cpu->r[IR_A] & ~cpu->ac;
+	alu_16_set_Z_bool(cpu, data);
 	REG_RESTRICT_WRITE(IR_A, data);
 }
 
 // -----------------------------------------------------------------------
-void op_em()
+void op_em(struct cpu *cpu)
 {
-	if (cpu_mem_read_1(true, ar, &ac)) {
-		uint16_t data = ac & ~r[IR_A];
-		alu_16_set_Z_bool(data);
-		cpu_mem_write_1(true, ar, data);
+	if (cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) {
+		uint16_t data = cpu->ac & ~cpu->r[IR_A];
+		alu_16_set_Z_bool(cpu, data);
+		cpu_mem_write_1(cpu, true, cpu->ar, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_xr()
+void op_xr(struct cpu *cpu)
 {
-	uint16_t data = r[IR_A] ^ ac;
-	alu_16_set_Z_bool(data);
+	uint16_t data = cpu->r[IR_A] ^ cpu->ac;
+	alu_16_set_Z_bool(cpu, data);
 	REG_RESTRICT_WRITE(IR_A, data);
 }
 
 // -----------------------------------------------------------------------
-void op_xm()
+void op_xm(struct cpu *cpu)
 {
-	if (cpu_mem_read_1(true, ar, &ac)) {
-		uint16_t data = ac ^ r[IR_A];
-		alu_16_set_Z_bool(data);
-		cpu_mem_write_1(true, ar, data);
+	if (cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) {
+		uint16_t data = cpu->ac ^ cpu->r[IR_A];
+		alu_16_set_Z_bool(cpu, data);
+		cpu_mem_write_1(cpu, true, cpu->ar, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_cl()
+void op_cl(struct cpu *cpu)
 {
-	alu_16_set_LEG(r[IR_A], ac);
+	alu_16_set_LEG(cpu, cpu->r[IR_A], cpu->ac);
 }
 
 // -----------------------------------------------------------------------
-static inline int cpu_byte_addr_fixup()
+static inline int cpu_byte_addr_fixup(struct cpu *cpu)
 {
-	int shift = 8 * (~ar & 1);
-	ar >>= 1;
+	int shift = 8 * (~cpu->ar & 1);
+	cpu->ar >>= 1;
 
 	// fixup address if 17-bit byte addressing is active
-	if (cpu_mod_active && !(q & bs)) {
-		ar |= zc17 << 15;
+	if (cpu->mod_active && !(cpu->q & cpu->bs)) {
+		cpu->ar |= cpu->zc17 << 15;
 	}
 
 	return shift;
 }
 
 // -----------------------------------------------------------------------
-void op_lb()
+void op_lb(struct cpu *cpu)
 {
-	int shift = cpu_byte_addr_fixup();
+	int shift = cpu_byte_addr_fixup(cpu);
 
-	if (!cpu_mem_read_1(true, ar, &ac)) return;
-	ac >>= shift;
+	if (!cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) return;
+	cpu->ac >>= shift;
 
-	REG_RESTRICT_WRITE(IR_A, (r[IR_A] & 0xff00) | (ac & 0xff));
+	REG_RESTRICT_WRITE(IR_A, (cpu->r[IR_A] & 0xff00) | (cpu->ac & 0xff));
 }
 
 // -----------------------------------------------------------------------
-void op_rb()
+void op_rb(struct cpu *cpu)
 {
-	int shift = cpu_byte_addr_fixup();
+	int shift = cpu_byte_addr_fixup(cpu);
 
-	if (!cpu_mem_read_1(true, ar, &ac)) return;
-	cpu_mem_write_1(true, ar, (ac & (0xff00 >> shift)) | ((r[IR_A] & 0xff) << shift));
+	if (!cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) return;
+	cpu_mem_write_1(cpu, true, cpu->ar, (cpu->ac & (0xff00 >> shift)) | ((cpu->r[IR_A] & 0xff) << shift));
 }
 
 // -----------------------------------------------------------------------
-void op_cb()
+void op_cb(struct cpu *cpu)
 {
-	int shift = cpu_byte_addr_fixup();
+	int shift = cpu_byte_addr_fixup(cpu);
 
-	if (!cpu_mem_read_1(true, ar, &ac)) return;
-	ac >>= shift;
-	alu_16_set_LEG((uint8_t) r[IR_A], ac & 0xff);
+	if (!cpu_mem_read_1(cpu, true, cpu->ar, &cpu->ac)) return;
+	cpu->ac >>= shift;
+	alu_16_set_LEG(cpu, (uint8_t) cpu->r[IR_A], cpu->ac & 0xff);
 }
 
 // -----------------------------------------------------------------------
@@ -349,59 +349,59 @@ void op_cb()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_awt()
+void op_awt(struct cpu *cpu)
 {
-	alu_16_add(r[IR_A], ac, 0);
+	alu_16_add(cpu, cpu->r[IR_A], cpu->ac, 0);
 }
 
 // -----------------------------------------------------------------------
-void op_trb()
+void op_trb(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, r[IR_A] + ac);
-	p = r[IR_A] == 0;
+	REG_RESTRICT_WRITE(IR_A, cpu->r[IR_A] + cpu->ac);
+	cpu->p = cpu->r[IR_A] == 0;
 }
 
 // -----------------------------------------------------------------------
-void op_irb()
+void op_irb(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, r[IR_A] + 1);
-	if (r[IR_A]) ic += ac;
+	REG_RESTRICT_WRITE(IR_A, cpu->r[IR_A] + 1);
+	if (cpu->r[IR_A]) cpu->ic += cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_drb()
+void op_drb(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, r[IR_A] - 1);
-	if (r[IR_A] != 0) ic += ac;
+	REG_RESTRICT_WRITE(IR_A, cpu->r[IR_A] - 1);
+	if (cpu->r[IR_A] != 0) cpu->ic += cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_cwt()
+void op_cwt(struct cpu *cpu)
 {
-	alu_16_set_LEG((int16_t) r[IR_A], (int16_t) ac);
+	alu_16_set_LEG(cpu, (int16_t) cpu->r[IR_A], (int16_t) cpu->ac);
 }
 
 // -----------------------------------------------------------------------
-void op_lwt()
+void op_lwt(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, ac);
+	REG_RESTRICT_WRITE(IR_A, cpu->ac);
 }
 
 // -----------------------------------------------------------------------
-void op_lws()
+void op_lws(struct cpu *cpu)
 {
 	uint16_t data;
-	ar = ic + ac;
-	if (cpu_mem_read_1(q, ar, &data)) {
+	cpu->ar = cpu->ic + cpu->ac;
+	if (cpu_mem_read_1(cpu, cpu->q, cpu->ar, &data)) {
 		REG_RESTRICT_WRITE(IR_A, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_rws()
+void op_rws(struct cpu *cpu)
 {
-	ar = ic + ac;
-	cpu_mem_write_1(q, ar, r[IR_A]);
+	cpu->ar = cpu->ic + cpu->ac;
+	cpu_mem_write_1(cpu, cpu->q, cpu->ar, cpu->r[IR_A]);
 }
 
 // -----------------------------------------------------------------------
@@ -409,15 +409,15 @@ void op_rws()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_70_jump()
+void op_70_jump(struct cpu *cpu)
 {
-	ic += ac;
+	cpu->ic += cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_70_jvs()
+void op_70_jvs(struct cpu *cpu)
 {
-	ic += ac;
+	cpu->ic += cpu->ac;
 	FCLR(FL_V);
 }
 
@@ -426,41 +426,41 @@ void op_70_jvs()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_71_blc()
+void op_71_blc(struct cpu *cpu)
 {
-	p = ((r[0] >> 8) & ac) != ac;
+	cpu->p = ((cpu->r[0] >> 8) & cpu->ac) != cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_71_exl()
+void op_71_exl(struct cpu *cpu)
 {
 	uint16_t data;
 
 	if (LOG_ENABLED) {
 		if (LOG_WANTS(L_OP)) {
-			log_log_cpu(L_OP, "EXL: %i (r4: 0x%04x)", ac, r[4]);
+			log_log_cpu(L_OP, "EXL: %i (r4: 0x%04x)", cpu->ac, cpu->r[4]);
 		}
-		if (LOG_WANTS(L_CRK5)) {
-			log_handle_syscall(L_CRK5, ac, nb, ic, r[4]);
+		if (LOG_WANTS(L_CRK5) && cpu->primary) {
+			log_handle_syscall(L_CRK5, cpu->ac, cpu->nb, cpu->ic, cpu->r[4]);
 		}
 	}
 
-	if (cpu_mem_read_1(false, EXL_VECTOR, &data)) {
-		cpu_ctx_switch(ac, data, MASK_9);
+	if (cpu_mem_read_1(cpu, false, EXL_VECTOR, &data)) {
+		cpu_ctx_switch(cpu, cpu->ac, data, MASK_9);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_71_brc()
+void op_71_brc(struct cpu *cpu)
 {
-	p = (r[0] & ac) != ac;
+	cpu->p = (cpu->r[0] & cpu->ac) != cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_71_nrf()
+void op_71_nrf(struct cpu *cpu)
 {
 	int nrf_op = IR_A & 0b011; // used by soft-awp, apparently (TODO: check in h/w)
-	awp_dispatch(nrf_op, ar);
+	awp_dispatch(cpu, nrf_op, cpu->ar);
 }
 
 // -----------------------------------------------------------------------
@@ -468,166 +468,154 @@ void op_71_nrf()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_72_ric()
+void op_72_ric(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, ic);
+	REG_RESTRICT_WRITE(IR_A, cpu->ic);
 }
 
 // -----------------------------------------------------------------------
-void op_72_zlb()
+void op_72_zlb(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, r[IR_A] & 0xff);
+	REG_RESTRICT_WRITE(IR_A, cpu->r[IR_A] & 0xff);
 }
 
 // -----------------------------------------------------------------------
-void op_72_sxu()
+void op_72_sxu(struct cpu *cpu)
 {
-	if (r[IR_A] & 0x8000) {
-		FSET(FL_X);
-	} else {
-		FCLR(FL_X);
-	}
+	FPUT(FL_X, (cpu->r[IR_A] & 0x8000) ? FL_X : 0);
 }
 
 // -----------------------------------------------------------------------
-void op_72_nga()
+void op_72_nga(struct cpu *cpu)
 {
-	ac = r[IR_A];
-	alu_16_add(~ac, 0, 1);
+	cpu->ac = cpu->r[IR_A];
+	alu_16_add(cpu, ~cpu->ac, 0, 1);
 }
 
 // -----------------------------------------------------------------------
-void shift_left(uint16_t shift_in, int check_v)
+void shift_left(struct cpu *cpu, uint16_t shift_in, int check_v)
 {
-	uint16_t data = (r[IR_A] << 1) | shift_in;
-	if (check_v && ((r[IR_A] ^ data) & 0x8000)) {
-		FSET(FL_V);
-	}
-	if (r[IR_A] & 0x8000) FSET(FL_Y);
-	else FCLR(FL_Y);
+	uint16_t data = (cpu->r[IR_A] << 1) | shift_in;
+	// V is only ever set here
+	FPUT(FL_Y, ((cpu->r[IR_A] & 0x8000) ? FL_Y : 0) | ((check_v && ((cpu->r[IR_A] ^ data) & 0x8000)) ? FL_V : 0));
 	REG_RESTRICT_WRITE(IR_A, data);
 }
 
 // -----------------------------------------------------------------------
-void op_72_slz()
+void op_72_slz(struct cpu *cpu)
 {
-	shift_left(0, 0);
+	shift_left(cpu, 0, 0);
 }
 
 // -----------------------------------------------------------------------
-void op_72_sly()
+void op_72_sly(struct cpu *cpu)
 {
-	shift_left(FGET(FL_Y), 0);
+	shift_left(cpu, FGET(FL_Y), 0);
 }
 
 // -----------------------------------------------------------------------
-void op_72_slx()
+void op_72_slx(struct cpu *cpu)
 {
-	shift_left(FGET(FL_X), 0);
+	shift_left(cpu, FGET(FL_X), 0);
 }
 
 // -----------------------------------------------------------------------
-void op_72_svz()
+void op_72_svz(struct cpu *cpu)
 {
-	shift_left(0, 1);
+	shift_left(cpu, 0, 1);
 }
 
 // -----------------------------------------------------------------------
-void op_72_svy()
+void op_72_svy(struct cpu *cpu)
 {
-	shift_left(FGET(FL_Y), 1);
+	shift_left(cpu, FGET(FL_Y), 1);
 }
 
 // -----------------------------------------------------------------------
-void op_72_svx()
+void op_72_svx(struct cpu *cpu)
 {
-	shift_left(FGET(FL_X), 1);
+	shift_left(cpu, FGET(FL_X), 1);
 }
 
 // -----------------------------------------------------------------------
-static inline void shift_right(uint16_t shift_in)
+static inline void shift_right(struct cpu *cpu, uint16_t shift_in)
 {
-	uint16_t data = (r[IR_A] >> 1) | shift_in;
-	if (r[IR_A] & 1) FSET(FL_Y);
-	else FCLR(FL_Y);
+	uint16_t data = (cpu->r[IR_A] >> 1) | shift_in;
+	FPUT(FL_Y, (cpu->r[IR_A] & 1) ? FL_Y : 0);
 	REG_RESTRICT_WRITE(IR_A, data);
 }
 
 // -----------------------------------------------------------------------
-void op_72_sry()
+void op_72_sry(struct cpu *cpu)
 {
-	shift_right(FGET(FL_Y) << 15);
+	shift_right(cpu, FGET(FL_Y) << 15);
 }
 
 // -----------------------------------------------------------------------
-void op_72_srx()
+void op_72_srx(struct cpu *cpu)
 {
-	shift_right(FGET(FL_X) << 15);
+	shift_right(cpu, FGET(FL_X) << 15);
 }
 
 // -----------------------------------------------------------------------
-void op_72_srz()
+void op_72_srz(struct cpu *cpu)
 {
-	shift_right(0);
+	shift_right(cpu, 0);
 }
 
 // -----------------------------------------------------------------------
-void op_72_ngl()
+void op_72_ngl(struct cpu *cpu)
 {
-	uint16_t data = ~r[IR_A];
-	alu_16_set_Z_bool(data);
-	r[IR_A] = data;
+	uint16_t data = ~cpu->r[IR_A];
+	alu_16_set_Z_bool(cpu, data);
+	cpu->r[IR_A] = data;
 }
 
 // -----------------------------------------------------------------------
-void op_72_rpc()
+void op_72_rpc(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, r[0]);
+	REG_RESTRICT_WRITE(IR_A, cpu->r[0]);
 }
 
 // -----------------------------------------------------------------------
-void op_72_shc()
+void op_72_shc(struct cpu *cpu)
 {
 	if (!IR_t) return;
 
-	uint16_t data = (r[IR_A] & ((1 << IR_t) - 1)) << (16 - IR_t);
+	uint16_t data = (cpu->r[IR_A] & ((1 << IR_t) - 1)) << (16 - IR_t);
 
-	REG_RESTRICT_WRITE(IR_A, (r[IR_A] >> IR_t) | data);
+	REG_RESTRICT_WRITE(IR_A, (cpu->r[IR_A] >> IR_t) | data);
 }
 
 // -----------------------------------------------------------------------
-void op_72_rky()
+void op_72_rky(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, kb);
+	REG_RESTRICT_WRITE(IR_A, cpu->kb);
 }
 
 // -----------------------------------------------------------------------
-void op_72_zrb()
+void op_72_zrb(struct cpu *cpu)
 {
-	REG_RESTRICT_WRITE(IR_A, r[IR_A] & 0xff00);
+	REG_RESTRICT_WRITE(IR_A, cpu->r[IR_A] & 0xff00);
 }
 
 // -----------------------------------------------------------------------
-void op_72_sxl()
+void op_72_sxl(struct cpu *cpu)
 {
-	if (r[IR_A] & 1) {
-		FSET(FL_X);
-	} else {
-		FCLR(FL_X);
-	}
+	FPUT(FL_X, (cpu->r[IR_A] & 1) ? FL_X : 0);
 }
 
 // -----------------------------------------------------------------------
-void op_72_ngc()
+void op_72_ngc(struct cpu *cpu)
 {
-	ac = r[IR_A];
-	alu_16_add(~ac, 0, FGET(FL_C));
+	cpu->ac = cpu->r[IR_A];
+	alu_16_add(cpu, ~cpu->ac, 0, FGET(FL_C));
 }
 
 // -----------------------------------------------------------------------
-void op_72_lpc()
+void op_72_lpc(struct cpu *cpu)
 {
-	r[0] = r[IR_A];
+	cpu->r[0] = cpu->r[IR_A];
 }
 
 // -----------------------------------------------------------------------
@@ -635,58 +623,67 @@ void op_72_lpc()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_73_hlt()
+void op_73_hlt(struct cpu *cpu)
 {
-	LOGCPU(L_OP, "HALT 0%02o (alarm: %i)", ac, r[6] & 0xff);
-	cpu_state_change(ECTL_STATE_WAIT, ECTL_STATE_RUN);
+	LOGCPU(L_OP, "HALT 0%02o (alarm: %i)", cpu->ac, cpu->r[6] & 0xff);
+	cpu_state_change(cpu, ECTL_STATE_WAIT, ECTL_STATE_RUN);
 }
 
 // -----------------------------------------------------------------------
-void op_73_mcl()
+void op_73_mcl(struct cpu *cpu)
 {
-	cpu_state_change(ECTL_STATE_CLM, ECTL_STATE_RUN);
+	cpu_state_change(cpu, ECTL_STATE_CLM, ECTL_STATE_RUN);
 }
 
 // -----------------------------------------------------------------------
-void op_73_softint()
+void op_73_softint(struct cpu *cpu)
 {
 	// SIT, SIL, SIU, CIT
 	if ((IR_C & 3) == 0) {
-		int_clear(INT_SOFT_U);
-		int_clear(INT_SOFT_L);
+		int_clear(cpu, INT_SOFT_U);
+		int_clear(cpu, INT_SOFT_L);
 	} else {
-		if ((IR_C & 1)) int_set(INT_SOFT_L);
-		if ((IR_C & 2)) int_set(INT_SOFT_U);
+		if ((IR_C & 1)) int_set(cpu, INT_SOFT_L);
+		if ((IR_C & 2)) int_set(cpu, INT_SOFT_U);
 	}
 
 	// SINT, SIND
-	if (cpu_mod_present && (IR_C & 4)) int_set(INT_CLOCK);
+	if (cpu->mod_present && (IR_C & 4)) int_set(cpu, INT_CLOCK);
 }
 
 // -----------------------------------------------------------------------
-void op_73_giu()
+void op_73_giu(struct cpu *cpu)
 {
-	// TODO: 2-cpu configuration
+	// int_set() locks the other CPU's interrupt mutex and wakes it up if it waits
+	if (cpu->peer) {
+		int_set(cpu->peer, INT_2CPU_HIGH);
+	} else {
+		LOGCPU(L_OP, "GIU ignored: no second CPU present");
+	}
 }
 
 // -----------------------------------------------------------------------
-void op_73_gil()
+void op_73_gil(struct cpu *cpu)
 {
-	// TODO: 2-cpu configuration
+	if (cpu->peer) {
+		int_set(cpu->peer, INT_2CPU_LOW);
+	} else {
+		LOGCPU(L_OP, "GIL ignored: no second CPU present");
+	}
 }
 
 // -----------------------------------------------------------------------
-void op_73_lip()
+void op_73_lip(struct cpu *cpu)
 {
-	cpu_sp_rewind();
-	cpu_ctx_restore(false);
+	cpu_sp_rewind(cpu);
+	cpu_ctx_restore(cpu, false);
 
-	LOG(L_CPU, "Loaded process ctx @ 0x%04x: [IC: 0x%04x, R0: 0x%04x, SR: 0x%04x]", ar-2, ic, r[0], SR_READ());
+	LOG(L_CPU, "Loaded process ctx @ 0x%04x: [IC: 0x%04x, R0: 0x%04x, SR: 0x%04x]", cpu->ar-2, cpu->ic, cpu->r[0], SR_READ());
 
-	if (LOG_ENABLED) {
+	if (LOG_ENABLED && cpu->primary) {
 		log_update_process();
 		if (LOG_WANTS(L_CRK5)) {
-			log_handle_syscall_ret(L_CRK5, ic, SR_READ(), r[4]);
+			log_handle_syscall_ret(L_CRK5, cpu->ic, SR_READ(), cpu->r[4]);
 		}
 		if (LOG_WANTS(L_CRK5)) {
 			log_log_process(L_CRK5);
@@ -696,13 +693,13 @@ void op_73_lip()
 }
 
 // -----------------------------------------------------------------------
-void op_73_cron()
+void op_73_cron(struct cpu *cpu)
 {
-	if (cpu_mod_present) {
-		cpu_mod_on();
+	if (cpu->mod_present) {
+		cpu_mod_on(cpu);
 	}
 	// CRON is an illegal instruction anyway
-	int_set(INT_ILLEGAL_INSTRUCTION);
+	int_set(cpu, INT_ILLEGAL_INSTRUCTION);
 }
 
 // -----------------------------------------------------------------------
@@ -710,16 +707,16 @@ void op_73_cron()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_74_jump()
+void op_74_jump(struct cpu *cpu)
 {
-	ic = ac;
+	cpu->ic = cpu->ac;
 }
 
 // -----------------------------------------------------------------------
-void op_74_lj()
+void op_74_lj(struct cpu *cpu)
 {
-	if (cpu_mem_write_1(q, ar, ic)) {
-		ic = ac+1;
+	if (cpu_mem_write_1(cpu, cpu->q, cpu->ar, cpu->ic)) {
+		cpu->ic = cpu->ac+1;
 	}
 }
 
@@ -728,60 +725,60 @@ void op_74_lj()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-static inline void load_multiword(bool barnb, int start, int end)
+static inline void load_multiword(struct cpu *cpu, bool barnb, int start, int end)
 {
 	for (int i=start ; i<=end ; i++) {
-		if (!cpu_mem_read_1(barnb, ar, r+i)) return;
-		ar++;
+		if (!cpu_mem_read_1(cpu, barnb, cpu->ar, cpu->r+i)) return;
+		cpu->ar++;
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_75_ld()
+void op_75_ld(struct cpu *cpu)
 {
-	load_multiword(q, 1, 2);
+	load_multiword(cpu, cpu->q, 1, 2);
 }
 
 // -----------------------------------------------------------------------
-void op_75_lf()
+void op_75_lf(struct cpu *cpu)
 {
-	load_multiword(q, 1, 3);
+	load_multiword(cpu, cpu->q, 1, 3);
 }
 
 // -----------------------------------------------------------------------
-void op_75_la()
+void op_75_la(struct cpu *cpu)
 {
-	load_multiword(q, 1, 7);
+	load_multiword(cpu, cpu->q, 1, 7);
 }
 
 // -----------------------------------------------------------------------
-void op_75_ll()
+void op_75_ll(struct cpu *cpu)
 {
-	load_multiword(q, 5, 7);
+	load_multiword(cpu, cpu->q, 5, 7);
 }
 
 // -----------------------------------------------------------------------
-void op_75_td()
+void op_75_td(struct cpu *cpu)
 {
-	load_multiword(true, 1, 2);
+	load_multiword(cpu, true, 1, 2);
 }
 
 // -----------------------------------------------------------------------
-void op_75_tf()
+void op_75_tf(struct cpu *cpu)
 {
-	load_multiword(true, 1, 3);
+	load_multiword(cpu, true, 1, 3);
 }
 
 // -----------------------------------------------------------------------
-void op_75_ta()
+void op_75_ta(struct cpu *cpu)
 {
-	load_multiword(true, 1, 7);
+	load_multiword(cpu, true, 1, 7);
 }
 
 // -----------------------------------------------------------------------
-void op_75_tl()
+void op_75_tl(struct cpu *cpu)
 {
-	load_multiword(true, 5, 7);
+	load_multiword(cpu, true, 5, 7);
 }
 
 // -----------------------------------------------------------------------
@@ -789,60 +786,60 @@ void op_75_tl()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-static inline void store_multiword(bool barnb, int start, int end)
+static inline void store_multiword(struct cpu *cpu, bool barnb, int start, int end)
 {
 	for (int i=start ; i<=end ; i++) {
-		if (!cpu_mem_write_1(barnb, ar, r[i])) return;
-		ar++;
+		if (!cpu_mem_write_1(cpu, barnb, cpu->ar, cpu->r[i])) return;
+		cpu->ar++;
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_76_rd()
+void op_76_rd(struct cpu *cpu)
 {
-	store_multiword(q, 1, 2);
+	store_multiword(cpu, cpu->q, 1, 2);
 }
 
 // -----------------------------------------------------------------------
-void op_76_rf()
+void op_76_rf(struct cpu *cpu)
 {
-	store_multiword(q, 1, 3);
+	store_multiword(cpu, cpu->q, 1, 3);
 }
 
 // -----------------------------------------------------------------------
-void op_76_ra()
+void op_76_ra(struct cpu *cpu)
 {
-	store_multiword(q, 1, 7);
+	store_multiword(cpu, cpu->q, 1, 7);
 }
 
 // -----------------------------------------------------------------------
-void op_76_rl()
+void op_76_rl(struct cpu *cpu)
 {
-	store_multiword(q, 5, 7);
+	store_multiword(cpu, cpu->q, 5, 7);
 }
 
 // -----------------------------------------------------------------------
-void op_76_pd()
+void op_76_pd(struct cpu *cpu)
 {
-	store_multiword(true, 1, 2);
+	store_multiword(cpu, true, 1, 2);
 }
 
 // -----------------------------------------------------------------------
-void op_76_pf()
+void op_76_pf(struct cpu *cpu)
 {
-	store_multiword(true, 1, 3);
+	store_multiword(cpu, true, 1, 3);
 }
 
 // -----------------------------------------------------------------------
-void op_76_pa()
+void op_76_pa(struct cpu *cpu)
 {
-	store_multiword(true, 1, 7);
+	store_multiword(cpu, true, 1, 7);
 }
 
 // -----------------------------------------------------------------------
-void op_76_pl()
+void op_76_pl(struct cpu *cpu)
 {
-	store_multiword(true, 5, 7);
+	store_multiword(cpu, true, 5, 7);
 }
 
 // -----------------------------------------------------------------------
@@ -850,80 +847,80 @@ void op_76_pl()
 // -----------------------------------------------------------------------
 
 // -----------------------------------------------------------------------
-void op_77_mb()
+void op_77_mb(struct cpu *cpu)
 {
 	uint16_t data;
-	if (cpu_mem_read_1(q, ar, &data)) {
-		q =  data & 0b100000;
-		bs = data & 0b010000;
-		nb = data & 0b001111;
+	if (cpu_mem_read_1(cpu, cpu->q, cpu->ar, &data)) {
+		cpu->q =  data & 0b100000;
+		cpu->bs = data & 0b010000;
+		cpu->nb = data & 0b001111;
 
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_77_im()
+void op_77_im(struct cpu *cpu)
 {
 	uint16_t data;
-	if (cpu_mem_read_1(q, ar, &data)) {
-		rm = (data >> 6) & 0b1111111111;
-		int_update_mask(rm);
+	if (cpu_mem_read_1(cpu, cpu->q, cpu->ar, &data)) {
+		cpu->rm = (data >> 6) & 0b1111111111;
+		int_update_mask(cpu, cpu->rm);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_77_ki()
+void op_77_ki(struct cpu *cpu)
 {
-	uint16_t data = int_get_nchan();
-	cpu_mem_write_1(q, ar, data);
+	uint16_t data = int_get_nchan(cpu);
+	cpu_mem_write_1(cpu, cpu->q, cpu->ar, data);
 }
 
 // -----------------------------------------------------------------------
-void op_77_fi()
+void op_77_fi(struct cpu *cpu)
 {
 	uint16_t data;
-	if (cpu_mem_read_1(q, ar, &data)) {
-		int_put_nchan(data);
+	if (cpu_mem_read_1(cpu, cpu->q, cpu->ar, &data)) {
+		int_put_nchan(cpu, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_77_sp()
+void op_77_sp(struct cpu *cpu)
 {
-	cpu_ctx_restore(true);
+	cpu_ctx_restore(cpu, true);
 
-	if (LOG_ENABLED) {
+	if (LOG_ENABLED && cpu->primary) {
 		log_update_process();
 		log_intlevel_reset();
 		if (LOG_WANTS(L_OP)) {
-			log_log_cpu(L_OP, "SP: context @ 0x%04x", ac);
+			log_log_cpu(L_OP, "SP: context @ 0x%04x", cpu->ac);
 		}
 		if (LOG_WANTS(L_CRK5)) {
-			log_handle_syscall_ret(L_CRK5, ic, SR_READ(), r[4]);
+			log_handle_syscall_ret(L_CRK5, cpu->ic, SR_READ(), cpu->r[4]);
 			log_log_process(L_CRK5);
 		}
 	}
 }
 
 // -----------------------------------------------------------------------
-void op_77_md()
+void op_77_md(struct cpu *cpu)
 {
-	mc++;
+	cpu->mc++;
 }
 
 // -----------------------------------------------------------------------
-void op_77_rz()
+void op_77_rz(struct cpu *cpu)
 {
-	cpu_mem_write_1(q, ar, 0);
+	cpu_mem_write_1(cpu, cpu->q, cpu->ar, 0);
 }
 
 // -----------------------------------------------------------------------
-void op_77_ib()
+void op_77_ib(struct cpu *cpu)
 {
-	if (cpu_mem_read_1(q, ar, &ac)) {
-		ac++;
-		p = (ac == 0);
-		cpu_mem_write_1(q, ar, ac);
+	if (cpu_mem_read_1(cpu, cpu->q, cpu->ar, &cpu->ac)) {
+		cpu->ac++;
+		cpu->p = (cpu->ac == 0);
+		cpu_mem_write_1(cpu, cpu->q, cpu->ar, cpu->ac);
 	}
 }
 
@@ -18,124 +18,126 @@
 #ifndef INSTRUCTIONS_H
 #define INSTRUCTIONS_H
 
-void op_lw();
-void op_tw();
-void op_ls();
-void op_ri();
-void op_rw();
-void op_pw();
-void op_rj();
-void op_is();
-void op_bb();
-void op_bm();
-void op_bs();
-void op_bc();
-void op_bn();
-void op_ou();
-void op_in();
-
-void op_aw();
-void op_ac();
-void op_sw();
-void op_cw();
-void op_or();
-void op_om();
-void op_nr();
-void op_nm();
-void op_er();
-void op_em();
-void op_xr();
-void op_xm();
-void op_cl();
-void op_lb();
-void op_rb();
-void op_cb();
-
-void op_awt();
-void op_trb();
-void op_irb();
-void op_drb();
-void op_cwt();
-void op_lwt();
-void op_lws();
-void op_rws();
-
-void op_37_ad();
-void op_37_sd();
-void op_37_mw();
-void op_37_dw();
-void op_37_af();
-void op_37_sf();
-void op_37_mf();
-void op_37_df();
-
-void op_70_jump();
-void op_70_jvs();
-
-void op_71_blc();
-void op_71_exl();
-void op_71_brc();
-void op_71_nrf();
-
-void op_72_ric();
-void op_72_zlb();
-void op_72_sxu();
-void op_72_nga();
-void op_72_slz();
-void op_72_sly();
-void op_72_slx();
-void op_72_sry();
-void op_72_ngl();
-void op_72_rpc();
-void op_72_shc();
-void op_72_rky();
-void op_72_zrb();
-void op_72_sxl();
-void op_72_ngc();
-void op_72_svz();
-void op_72_svy();
-void op_72_svx();
-void op_72_srx();
-void op_72_srz();
-void op_72_lpc();
-
-void op_73_hlt();
-void op_73_mcl();
-void op_73_softint();
-void op_73_giu();
-void op_73_gil();
-void op_73_lip();
-void op_73_cron();
-
-void op_74_jump();
-void op_74_lj();
-
-void op_75_ld();
-void op_75_lf();
-void op_75_la();
-void op_75_ll();
-void op_75_td();
-void op_75_tf();
-void op_75_ta();
-void op_75_tl();
-
-void op_76_rd();
-void op_76_rf();
-void op_76_ra();
-void op_76_rl();
-void op_76_pd();
-void op_76_pf();
-void op_76_pa();
-void op_76_pl();
-
-void op_77_mb();
-void op_77_im();
-void op_77_ki();
-void op_77_fi();
-void op_77_sp();
-void op_77_md();
-void op_77_rz();
-void op_77_ib();
+struct cpu;
+
+void op_lw(struct cpu *cpu);
+void op_tw(struct cpu *cpu);
+void op_ls(struct cpu *cpu);
+void op_ri(struct cpu *cpu);
+void op_rw(struct cpu *cpu);
+void op_pw(struct cpu *cpu);
+void op_rj(struct cpu *cpu);
+void op_is(struct cpu *cpu);
+void op_bb(struct cpu *cpu);
+void op_bm(struct cpu *cpu);
+void op_bs(struct cpu *cpu);
+void op_bc(struct cpu *cpu);
+void op_bn(struct cpu *cpu);
+void op_ou(struct cpu *cpu);
+void op_in(struct cpu *cpu);
+
+void op_aw(struct cpu *cpu);
+void op_ac(struct cpu *cpu);
+void op_sw(struct cpu *cpu);
+void op_cw(struct cpu *cpu);
+void op_or(struct cpu *cpu);
+void op_om(struct cpu *cpu);
+void op_nr(struct cpu *cpu);
+void op_nm(struct cpu *cpu);
+void op_er(struct cpu *cpu);
+void op_em(struct cpu *cpu);
+void op_xr(struct cpu *cpu);
+void op_xm(struct cpu *cpu);
+void op_cl(struct cpu *cpu);
+void op_lb(struct cpu *cpu);
+void op_rb(struct cpu *cpu);
+void op_cb(struct cpu *cpu);
+
+void op_awt(struct cpu *cpu);
+void op_trb(struct cpu *cpu);
+void op_irb(struct cpu *cpu);
+void op_drb(struct cpu *cpu);
+void op_cwt(struct cpu *cpu);
+void op_lwt(struct cpu *cpu);
+void op_lws(struct cpu *cpu);
+void op_rws(struct cpu *cpu);
+
+void op_37_ad(struct cpu *cpu);
+void op_37_sd(struct cpu *cpu);
+void op_37_mw(struct cpu *cpu);
+void op_37_dw(struct cpu *cpu);
+void op_37_af(struct cpu *cpu);
+void op_37_sf(struct cpu *cpu);
+void op_37_mf(struct cpu *cpu);
+void op_37_df(struct cpu *cpu);
+
+void op_70_jump(struct cpu *cpu);
+void op_70_jvs(struct cpu *cpu);
+
+void op_71_blc(struct cpu *cpu);
+void op_71_exl(struct cpu *cpu);
+void op_71_brc(struct cpu *cpu);
+void op_71_nrf(struct cpu *cpu);
+
+void op_72_ric(struct cpu *cpu);
+void op_72_zlb(struct cpu *cpu);
+void op_72_sxu(struct cpu *cpu);
+void op_72_nga(struct cpu *cpu);
+void op_72_slz(struct cpu *cpu);
+void op_72_sly(struct cpu *cpu);
+void op_72_slx(struct cpu *cpu);
+void op_72_sry(struct cpu *cpu);
+void op_72_ngl(struct cpu *cpu);
+void op_72_rpc(struct cpu *cpu);
+void op_72_shc(struct cpu *cpu);
+void op_72_rky(struct cpu *cpu);
+void op_72_zrb(struct cpu *cpu);
+void op_72_sxl(struct cpu *cpu);
+void op_72_ngc(struct cpu *cpu);
+void op_72_svz(struct cpu *cpu);
+void op_72_svy(struct cpu *cpu);
+void op_72_svx(struct cpu *cpu);
+void op_72_srx(struct cpu *cpu);
+void op_72_srz(struct cpu *cpu);
+void op_72_lpc(struct cpu *cpu);
+
+void op_73_hlt(struct cpu *cpu);
+void op_73_mcl(struct cpu *cpu);
+void op_73_softint(struct cpu *cpu);
+void op_73_giu(struct cpu *cpu);
+void op_73_gil(struct cpu *cpu);
+void op_73_lip(struct cpu *cpu);
+void op_73_cron(struct cpu *cpu);
+
+void op_74_jump(struct cpu *cpu);
+void op_74_lj(struct cpu *cpu);
+
+void op_75_ld(struct cpu *cpu);
+void op_75_lf(struct cpu *cpu);
+void op_75_la(struct cpu *cpu);
+void op_75_ll(struct cpu *cpu);
+void op_75_td(struct cpu *cpu);
+void op_75_tf(struct cpu *cpu);
+void op_75_ta(struct cpu *cpu);
+void op_75_tl(struct cpu *cpu);
+
+void op_76_rd(struct cpu *cpu);
+void op_76_rf(struct cpu *cpu);
+void op_76_ra(struct cpu *cpu);
+void op_76_rl(struct cpu *cpu);
+void op_76_pd(struct cpu *cpu);
+void op_76_pf(struct cpu *cpu);
+void op_76_pa(struct cpu *cpu);
+void op_76_pl(struct cpu *cpu);
+
+void op_77_mb(struct cpu *cpu);
+void op_77_im(struct cpu *cpu);
+void op_77_ki(struct cpu *cpu);
+void op_77_fi(struct cpu *cpu);
+void op_77_sp(struct cpu *cpu);
+void op_77_md(struct cpu *cpu);
+void op_77_rz(struct cpu *cpu);
+void op_77_ib(struct cpu *cpu);
 
 #endif
 
@@ -17,6 +17,7 @@
 
 #include <inttypes.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "cpu/cpu.h"
 #include "mem/mem.h"
@@ -25,15 +26,10 @@
 
 #include "log.h"
 #include "atomic.h"
+#include "ectl/metrics.h"
 
 #include "ectl.h" // for global constants
 
-uint32_t rz;
-uint32_t rp;
-uint32_t int_mask;
-
-pthread_mutex_t int_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 #define INT_BIT(x) (1UL << (31 - x))
 
 #define RZ_CHAN_BITMASK			0b00000000000011111111111111110000
@@ -108,17 +104,100 @@ static const char *int_names[] = {
 };
 
 // -----------------------------------------------------------------------
-static void int_update_rp()
+static uint64_t int_now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// -----------------------------------------------------------------------
+static void int_stamp(struct cpu *cpu, uint32_t raised)
+{
+	// function called under mutex, for interrupts that just became pending
+	if (!raised) return;
+
+	uint64_t now = int_now_ns();
+	unsigned long ins = atom_load_acquire(&cpu->ips_counter);
+	for (int i=0 ; i<32 ; i++) {
+		if (raised & INT_BIT(i)) {
+			cpu->int_raised_ns[i] = now;
+			cpu->int_raised_ins[i] = ins;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+static unsigned int_lat_bucket(uint64_t v)
+{
+	// bucket 0: 0, bucket n: [2^(n-1), 2^n), last bucket is open-ended
+	unsigned b = 0;
+	while (v && (b < ECTL_INT_LAT_BUCKETS-1)) {
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+// -----------------------------------------------------------------------
+static void int_lat_record(struct cpu *cpu, unsigned interrupt, uint64_t raised_ns, unsigned long raised_ins)
+{
+	uint64_t lat[ECTL_INT_LAT_UNITS] = {
+		[ECTL_INT_LAT_NS] = int_now_ns() - raised_ns,
+		[ECTL_INT_LAT_INSTRUCTIONS] = cpu->ips_counter - raised_ins,
+	};
+
+	for (int u=0 ; u<ECTL_INT_LAT_UNITS ; u++) {
+		unsigned long *h = cpu->int_lat_hist[u][interrupt] + int_lat_bucket(lat[u]);
+		atom_store_release(h, *h + 1);
+		atom_store_release(cpu->int_lat_sum[u] + interrupt, cpu->int_lat_sum[u][interrupt] + lat[u]);
+	}
+}
+
+// -----------------------------------------------------------------------
+int int_latency_get(struct cpu *cpu, unsigned interrupt, unsigned unit, unsigned long *hist, unsigned long *sum)
+{
+	if ((interrupt >= 32) || (unit >= ECTL_INT_LAT_UNITS)) {
+		return E_ERR;
+	}
+
+	for (int i=0 ; i<ECTL_INT_LAT_BUCKETS ; i++) {
+		hist[i] = atom_load_acquire(cpu->int_lat_hist[unit][interrupt] + i);
+	}
+	if (sum) {
+		*sum = atom_load_acquire(cpu->int_lat_sum[unit] + interrupt);
+	}
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void int_latency_reset(struct cpu *cpu)
+{
+	// may race with the CPU thread, losing a sample or two is fine here
+	for (int u=0 ; u<ECTL_INT_LAT_UNITS ; u++) {
+		for (int i=0 ; i<32 ; i++) {
+			for (int b=0 ; b<ECTL_INT_LAT_BUCKETS ; b++) {
+				atom_store_release(cpu->int_lat_hist[u][i] + b, 0);
+			}
+			atom_store_release(cpu->int_lat_sum[u] + i, 0);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+static void int_update_rp(struct cpu *cpu)
 {
 	// function called under mutex
-	rp = rz & int_mask;
-	if (rp && !p && !mc) {
-		cpu_state_change(ECTL_STATE_RUN, ECTL_STATE_WAIT);
+	// rp and rz are read without locking by the CPU thread
+	atom_store_release(&cpu->rp, cpu->rz & cpu->int_mask);
+	if (cpu->rp && !cpu->p && !cpu->mc) {
+		cpu_state_change(cpu, ECTL_STATE_RUN, ECTL_STATE_WAIT);
 	}
 }
 
 // -----------------------------------------------------------------------
-void int_update_mask(uint16_t mask)
+void int_update_mask(struct cpu *cpu, uint16_t mask)
 {
 	int i;
 	uint32_t xmask = 1 << 31;
@@ -129,92 +208,115 @@ void int_update_mask(uint16_t mask)
 		}
 	}
 
-	pthread_mutex_lock(&int_mutex);
-	int_mask = xmask;
-	int_update_rp();
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	cpu->int_mask = xmask;
+	int_update_rp(cpu);
+	pthread_mutex_unlock(&cpu->int_mutex);
 }
 
 // -----------------------------------------------------------------------
-void int_set(int x)
+void int_set(struct cpu *cpu, int x)
 {
 	LOG(L_INT, "Set interrupt: %i (%s)", x, int_names[x]);
 
-	pthread_mutex_lock(&int_mutex);
-	rz |= INT_BIT(x);
-	int_update_rp();
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	int_stamp(cpu, ~cpu->rz & INT_BIT(x));
+	atom_or_release(&cpu->rz, INT_BIT(x));
+	int_update_rp(cpu);
+	pthread_mutex_unlock(&cpu->int_mutex);
+
+	cpu_idle_wake(cpu);
 }
 
 // -----------------------------------------------------------------------
-void int_clear_all()
+void int_clear_all(struct cpu *cpu)
 {
-	pthread_mutex_lock(&int_mutex);
-	rz = 0;
-	int_update_rp();
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	atom_store_release(&cpu->rz, 0);
+	int_update_rp(cpu);
+	pthread_mutex_unlock(&cpu->int_mutex);
 }
 
 // -----------------------------------------------------------------------
-void int_clear(int x)
+void int_clear(struct cpu *cpu, int x)
 {
 	LOG(L_INT, "Clear interrupt: %i (%s)", x, int_names[x]);
 
-	pthread_mutex_lock(&int_mutex);
-	rz &= ~INT_BIT(x);
-	int_update_rp();
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	atom_and_release(&cpu->rz, ~INT_BIT(x));
+	int_update_rp(cpu);
+	pthread_mutex_unlock(&cpu->int_mutex);
 }
 
 // -----------------------------------------------------------------------
-void int_put_nchan(uint16_t r)
+void int_put_nchan(struct cpu *cpu, uint16_t r)
 {
 	LOG(L_INT, "Set non-channel interrupts to: %d", r);
 
-	pthread_mutex_lock(&int_mutex);
-	rz = (rz & RZ_CHAN_BITMASK) | ((r & R_NCHAN_HIGH_BITMASK) << 16) | (r & R_NCHAN_LOW_BITMASK);
-	int_update_rp();
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	uint32_t rz_old = cpu->rz;
+	atom_store_release(&cpu->rz, (cpu->rz & RZ_CHAN_BITMASK) | ((r & R_NCHAN_HIGH_BITMASK) << 16) | (r & R_NCHAN_LOW_BITMASK));
+	int_stamp(cpu, cpu->rz & ~rz_old);
+	int_update_rp(cpu);
+	pthread_mutex_unlock(&cpu->int_mutex);
 }
 
 // -----------------------------------------------------------------------
-uint16_t int_get_nchan()
+uint16_t int_get_nchan(struct cpu *cpu)
 {
 	uint32_t rz_tmp;
-	pthread_mutex_lock(&int_mutex);
-	rz_tmp = rz;
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	rz_tmp = cpu->rz;
+	pthread_mutex_unlock(&cpu->int_mutex);
 	return ((rz_tmp & RZ_NCHAN_HIGH_BITMASK) >> 16) | (rz_tmp & RZ_NCHAN_LOW_BITMASK);
 }
 
 // -----------------------------------------------------------------------
-uint16_t int_get_chan()
+uint16_t int_get_chan(struct cpu *cpu)
 {
 	uint32_t rz_tmp;
-	pthread_mutex_lock(&int_mutex);
-	rz_tmp = rz;
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	rz_tmp = cpu->rz;
+	pthread_mutex_unlock(&cpu->int_mutex);
 	return rz_tmp >> 4;
 }
 
 // -----------------------------------------------------------------------
-void int_serve()
+void int_metrics_register(struct cpu *cpu)
+{
+	for (int i=0 ; i<32 ; i++) {
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_int_served_total", "Interrupts served", cpu->int_served + i,
+			"level=\"%i\",name=\"%s\"", i, int_names[i]);
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_int_latency_ns_total", "Total time between raising and serving interrupts", cpu->int_lat_sum[ECTL_INT_LAT_NS] + i,
+			"level=\"%i\",name=\"%s\"", i, int_names[i]);
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_int_latency_instructions_total", "Total instructions executed between raising and serving interrupts", cpu->int_lat_sum[ECTL_INT_LAT_INSTRUCTIONS] + i,
+			"level=\"%i\",name=\"%s\"", i, int_names[i]);
+	}
+}
+
+// -----------------------------------------------------------------------
+void int_serve(struct cpu *cpu)
 {
 	// find highest interrupt to serve
 	unsigned interrupt = 31;
-	unsigned i = rp;
+	unsigned i = atom_load_acquire(&cpu->rp);
 	while (i >>= 1) interrupt--;
 
 	// clear interrupt; rp gets updated int context switch, together with interrupt mask
-	pthread_mutex_lock(&int_mutex);
-	rz &= ~INT_BIT(interrupt);
-	pthread_mutex_unlock(&int_mutex);
+	pthread_mutex_lock(&cpu->int_mutex);
+	atom_and_release(&cpu->rz, ~INT_BIT(interrupt));
+	uint64_t raised_ns = cpu->int_raised_ns[interrupt];
+	unsigned long raised_ins = cpu->int_raised_ins[interrupt];
+	pthread_mutex_unlock(&cpu->int_mutex);
+
+	int_lat_record(cpu, interrupt, raised_ns, raised_ins);
 
 	// get interrupt vector
 	uint16_t int_vec;
-	if (!cpu_mem_read_1(false, INT_VECTORS + interrupt, &int_vec)) return;
+	if (!cpu_mem_read_1(cpu, false, INT_VECTORS + interrupt, &int_vec)) return;
 
 	LOG(L_INT, "Serve interrupt: %i (%s) -> 0x%04x", interrupt, int_names[interrupt], int_vec);
+	cpu->int_served[interrupt]++;
 
 	// get new interrupt mask for the given interrupt
 	uint16_t int_mask = int_int2mask[interrupt];
@@ -222,16 +324,16 @@ void int_serve()
 	// get interrupt specification for channel interrupts
 	uint16_t int_spec = 0;
 	if ((interrupt >= 12) && (interrupt < 12 + 16)) {
-		io_get_intspec(interrupt - 12, &ac);
-		int_spec = ac;
+		io_get_intspec(cpu->io, cpu->num, interrupt - 12, &cpu->ac);
+		int_spec = cpu->ac;
 		// extend interrupt mask if cpu_mod is enabled
-		if (cpu_mod_active) int_mask &= MASK_EX;
+		if (cpu->mod_active) int_mask &= MASK_EX;
 	}
 
 	// switch context
-	cpu_ctx_switch(int_spec, int_vec, int_mask);
+	cpu_ctx_switch(cpu, int_spec, int_vec, int_mask);
 
-	if (LOG_ENABLED) log_intlevel_inc();
+	if (LOG_ENABLED && cpu->primary) log_intlevel_inc();
 }
 
 // vim: tabstop=4 shiftwidth=4 autoindent
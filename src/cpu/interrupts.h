@@ -25,8 +25,7 @@
 #define EXL_VECTOR 0x60
 #define STACK_POINTER 0x61
 
-extern uint32_t rz;
-extern uint32_t rp;
+struct cpu;
 
 enum named_interrupts {
 	INT_2CPU_POWER		= 0,
@@ -77,14 +76,17 @@ enum int_masks {
 	MASK_EX = MASK_4,
 };
 
-void int_update_mask(uint16_t mask);
-void int_set(int x);
-void int_clear(int x);
-void int_clear_all();
-void int_put_nchan(uint16_t r);
-uint16_t int_get_nchan();
-uint16_t int_get_chan();
-void int_serve();
+void int_update_mask(struct cpu *cpu, uint16_t mask);
+void int_set(struct cpu *cpu, int x);
+void int_clear(struct cpu *cpu, int x);
+void int_clear_all(struct cpu *cpu);
+void int_put_nchan(struct cpu *cpu, uint16_t r);
+uint16_t int_get_nchan(struct cpu *cpu);
+uint16_t int_get_chan(struct cpu *cpu);
+void int_serve(struct cpu *cpu);
+void int_metrics_register(struct cpu *cpu);
+int int_latency_get(struct cpu *cpu, unsigned interrupt, unsigned unit, unsigned long *hist, unsigned long *sum);
+void int_latency_reset(struct cpu *cpu);
 
 #endif
 
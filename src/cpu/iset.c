@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "log.h"
 
@@ -40,7 +41,7 @@ enum em400_var_masks {
 #define O(x) ((x) << 10)
 
 // MERA-400 instruction list
-struct iset_instruction em400_ilist[] = {
+static const struct iset_instruction em400_ilist[] = {
 	{ 0, VARMASK_ALL, { OP_FL_ILLEGAL, NULL, 0, 0, TIME_P } },// // illegal instructions
 
 	{ O(020), VARMASK_DABC, { OP_FL_ARG_NORM, op_lw, 0, 0, 1650 } },
@@ -178,7 +179,7 @@ struct iset_instruction em400_ilist[] = {
 };
 
 // -----------------------------------------------------------------------
-static int iset_register_op(struct iset_opcode **op_tab, struct iset_instruction *instr)
+static int iset_register_op(const struct iset_opcode **op_tab, const struct iset_instruction *instr)
 {
 	int offsets[16];
 
@@ -201,7 +202,7 @@ static int iset_register_op(struct iset_opcode **op_tab, struct iset_instruction
 			result |= ((i >> pos) & 1) << offsets[pos];
 		}
 
-		struct iset_opcode *op = op_tab[instr->opcode | result];
+		const struct iset_opcode *op = op_tab[instr->opcode | result];
 
 		// sanity check: we don't want to overwrite non-illegal registered ops
 		if ((op) && (op->fun != NULL)) {
@@ -213,25 +214,35 @@ static int iset_register_op(struct iset_opcode **op_tab, struct iset_instruction
 	return E_OK;
 }
 
+// Opcode table (instruction decoder decision table).
+// Built once and never modified afterwards, so it may be shared
+// by any number of CPUs.
+static const struct iset_opcode *iset_op_tab[0x10000];
+static pthread_once_t iset_once = PTHREAD_ONCE_INIT;
+static int iset_res;
+
 // -----------------------------------------------------------------------
-int iset_build(struct iset_opcode **op_tab, int cpu_user_io_illegal)
+static void iset_build()
 {
-	struct iset_instruction *instr = em400_ilist;
+	const struct iset_instruction *instr = em400_ilist;
 	while (instr->var_mask) {
-		// set IN/OU legalness in user mode
-		if ((instr->op.flags & OP_FL_IO)) {
-			if (cpu_user_io_illegal) {
-				instr->op.flags |= OP_FL_USR_ILLEGAL;
-			} else {
-				instr->op.flags &= ~OP_FL_USR_ILLEGAL;
-			}
-		}
-		if (iset_register_op(op_tab, instr) != E_OK) {
-			return LOGERR("Failed to register op 0x%04x.", instr->opcode);
+		if (iset_register_op(iset_op_tab, instr) != E_OK) {
+			iset_res = LOGERR("Failed to register op 0x%04x.", instr->opcode);
+			return;
 		}
 		instr++;
 	}
-	return E_OK;
+	iset_res = E_OK;
+}
+
+// -----------------------------------------------------------------------
+const struct iset_opcode * const * iset_get()
+{
+	pthread_once(&iset_once, iset_build);
+	if (iset_res != E_OK) {
+		return NULL;
+	}
+	return iset_op_tab;
 }
 
 // vim: tabstop=4 shiftwidth=4 autoindent
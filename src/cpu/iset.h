@@ -38,10 +38,12 @@ enum opcode_flags {
 	OP_FL_ARG_BYTE		= 0x4, // byte argument
 	OP_FL_ILLEGAL		= 0x8,	// illegal instruction
 	OP_FL_USR_ILLEGAL	= 0x10,	// instruction illegal in user mode
-	OP_FL_IO			= 0x20,	// I/O instruction
+	OP_FL_IO			= 0x20,	// I/O instruction (illegal in user mode if configured so)
 };
 
-typedef void (*opfun)();
+struct cpu;
+
+typedef void (*opfun)(struct cpu *cpu);
 
 struct iset_opcode {
 	unsigned flags;			// opcode flags
@@ -57,7 +59,7 @@ struct iset_instruction {
 	struct iset_opcode op;	// opcode definition
 };
 
-int iset_build(struct iset_opcode **op_tab, int cpu_user_io_illegal);
+const struct iset_opcode * const * iset_get();
 
 #endif
 
@@ -0,0 +1,250 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "cpu/cpu.h"
+#include "cpu/sched.h"
+
+#include "log.h"
+
+// Scheduler runs CPUs of all emulated machines on a fixed pool of worker threads.
+// Each worker picks a CPU from the run queue and runs it for one quantum.
+// CPUs that sleep (are ahead of real time) or block (STOP, WAIT, parked idle loop)
+// leave the queue until their deadline passes or until they're woken up.
+
+enum sched_states {
+	SCHED_QUEUED,
+	SCHED_RUNNING,
+	SCHED_SLEEPING,	// until cpu->timer
+	SCHED_BLOCKED,	// until woken up (or until cpu->wake_deadline, if set)
+	SCHED_OFF,
+};
+
+struct sched {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct cpu *head, *tail;
+	struct cpu **cpus;
+	int count;
+	int active;
+	unsigned quantum;
+};
+
+// -----------------------------------------------------------------------
+static void sched_enqueue(struct sched *s, struct cpu *cpu)
+{
+	cpu->sched_state = SCHED_QUEUED;
+	cpu->sched_next = NULL;
+	if (s->tail) {
+		s->tail->sched_next = cpu;
+	} else {
+		s->head = cpu;
+	}
+	s->tail = cpu;
+}
+
+// -----------------------------------------------------------------------
+static struct cpu * sched_dequeue(struct sched *s)
+{
+	struct cpu *cpu = s->head;
+	if (cpu) {
+		s->head = cpu->sched_next;
+		if (!s->head) s->tail = NULL;
+		cpu->sched_next = NULL;
+	}
+	return cpu;
+}
+
+// -----------------------------------------------------------------------
+static inline bool sched_ts_before(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec < b->tv_sec) || ((a->tv_sec == b->tv_sec) && (a->tv_nsec < b->tv_nsec));
+}
+
+// -----------------------------------------------------------------------
+static const struct timespec * sched_expire(struct sched *s)
+{
+	// queue CPUs whose deadlines have passed, return the earliest deadline still ahead
+	const struct timespec *next = NULL;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (int i=0 ; i<s->count ; i++) {
+		struct cpu *cpu = s->cpus[i];
+		const struct timespec *deadline;
+		if (cpu->sched_state == SCHED_SLEEPING) {
+			deadline = &cpu->timer;
+		} else if ((cpu->sched_state == SCHED_BLOCKED) && cpu->wake_deadline_set) {
+			deadline = &cpu->wake_deadline;
+		} else {
+			continue;
+		}
+		if (!sched_ts_before(&now, deadline)) {
+			sched_enqueue(s, cpu);
+		} else if (!next || sched_ts_before(deadline, next)) {
+			next = deadline;
+		}
+	}
+
+	return next;
+}
+
+// -----------------------------------------------------------------------
+void sched_wake(struct sched *s, struct cpu *cpu)
+{
+	// called with cpu->wake_mutex held
+	pthread_mutex_lock(&s->mutex);
+	if (cpu->sched_state == SCHED_BLOCKED) {
+		sched_enqueue(s, cpu);
+		pthread_cond_signal(&s->cond);
+	} else if (cpu->sched_state == SCHED_RUNNING) {
+		// CPU may be just about to block, make it run again
+		cpu->sched_wakeup = true;
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+// -----------------------------------------------------------------------
+static void * sched_worker(void *ptr)
+{
+	struct sched *s = ptr;
+
+	pthread_mutex_lock(&s->mutex);
+
+	while (s->active > 0) {
+		struct cpu *cpu = sched_dequeue(s);
+
+		if (!cpu) {
+			const struct timespec *deadline = sched_expire(s);
+			if (s->head) continue;
+			if (deadline) {
+				struct timespec until = *deadline;
+				pthread_cond_timedwait(&s->cond, &s->mutex, &until);
+			} else {
+				pthread_cond_wait(&s->cond, &s->mutex);
+			}
+			continue;
+		}
+
+		cpu->sched_state = SCHED_RUNNING;
+		cpu->sched_wakeup = false;
+		pthread_mutex_unlock(&s->mutex);
+		int res = cpu_run(cpu, s->quantum);
+		pthread_mutex_lock(&s->mutex);
+
+		switch (res) {
+			case CPU_RUN_YIELD:
+				sched_enqueue(s, cpu);
+				break;
+			case CPU_RUN_SLEEP:
+				cpu->sched_state = SCHED_SLEEPING;
+				// idle workers need to learn about the new deadline
+				pthread_cond_broadcast(&s->cond);
+				break;
+			case CPU_RUN_BLOCK:
+				if (cpu->sched_wakeup) {
+					sched_enqueue(s, cpu);
+				} else {
+					cpu->sched_state = SCHED_BLOCKED;
+					if (cpu->wake_deadline_set) pthread_cond_broadcast(&s->cond);
+				}
+				break;
+			case CPU_RUN_OFF:
+				cpu->sched_state = SCHED_OFF;
+				if (--s->active == 0) pthread_cond_broadcast(&s->cond);
+				break;
+		}
+	}
+
+	pthread_mutex_unlock(&s->mutex);
+
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+int sched_run(struct cpu **cpus, int count, int workers, unsigned quantum)
+{
+	struct sched s = {
+		.cpus = cpus,
+		.count = count,
+		.active = count,
+		.quantum = quantum,
+	};
+	pthread_t *threads = calloc(workers, sizeof(pthread_t));
+	if (!threads) {
+		return LOGERR("Failed to allocate memory for scheduler worker threads.");
+	}
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&s.mutex, NULL);
+
+	for (int i=0 ; i<count ; i++) {
+		struct cpu *cpu = cpus[i];
+		pthread_mutex_lock(&cpu->wake_mutex);
+		pthread_mutex_lock(&s.mutex);
+		cpu->sched = &s;
+		sched_enqueue(&s, cpu);
+		pthread_mutex_unlock(&s.mutex);
+		pthread_mutex_unlock(&cpu->wake_mutex);
+		cpu_power_on(cpu);
+	}
+
+	// calling thread is one of the workers
+	int started = 0;
+	for (int i=1 ; i<workers ; i++) {
+		if (pthread_create(threads + i, NULL, sched_worker, &s)) {
+			LOGERR("Failed to start scheduler worker thread %i, continuing with %i.", i, i);
+			break;
+		}
+		pthread_setname_np(threads[i], "sched");
+		started++;
+	}
+
+	LOG(L_EM4H, "Scheduler running %i CPU(s) on %i worker thread(s)", count, started+1);
+	sched_worker(&s);
+
+	for (int i=1 ; i<=started ; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	for (int i=0 ; i<count ; i++) {
+		struct cpu *cpu = cpus[i];
+		pthread_mutex_lock(&cpu->wake_mutex);
+		cpu->sched = NULL;
+		pthread_mutex_unlock(&cpu->wake_mutex);
+	}
+
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.mutex);
+
+	return E_OK;
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
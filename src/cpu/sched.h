@@ -0,0 +1,37 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cpu;
+struct sched;
+
+void sched_wake(struct sched *s, struct cpu *cpu);
+int sched_run(struct cpu **cpus, int count, int workers, unsigned quantum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
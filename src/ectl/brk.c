@@ -130,6 +130,12 @@ int ectl_brk_delete(unsigned id)
 }
 
 
+// -----------------------------------------------------------------------
+int ectl_brk_any()
+{
+	return atom_load_acquire(&ectl_brk_list) != NULL;
+}
+
 // -----------------------------------------------------------------------
 int ectl_brk_check()
 {
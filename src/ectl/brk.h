@@ -23,6 +23,7 @@
 int ectl_brk_insert(struct ectl_est *tree, char *expr);
 void ectl_brk_del_all();
 int ectl_brk_delete(unsigned id);
+int ectl_brk_any();
 int ectl_brk_check();
 
 #endif
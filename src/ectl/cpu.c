@@ -21,6 +21,8 @@
 #include <inttypes.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "log.h"
 #include "utils/utils.h"
@@ -30,6 +32,7 @@
 #include "cpu/interrupts.h"
 #include "mem/mem.h"
 #include "io/defs.h"
+#include "machine.h"
 
 #include "ectl.h"
 #include "ectl/est.h"
@@ -65,6 +68,20 @@ int ectl_yyparse();
 YY_BUFFER_STATE ectl_yy_scan_string(char *input);
 void ectl_yy_delete_buffer(YY_BUFFER_STATE b);
 
+// -----------------------------------------------------------------------
+static struct em400_machine * ectl_machine()
+{
+	// ECTL works on the machine selected on the control panel
+	return machines + cp_machine_get();
+}
+
+// -----------------------------------------------------------------------
+static struct cpu * ectl_cpu()
+{
+	// ...and on its CPU selected on the control panel
+	return ectl_machine()->cpu + cp_cpu_get();
+}
+
 // -----------------------------------------------------------------------
 int ectl_init()
 {
@@ -83,6 +100,9 @@ void ectl_shutdown()
 void ectl_regs_get(uint16_t *dest)
 {
 	LOG(L_ECTL, "ECTL regs get");
+	if (cp_regs_snapshot(dest)) {
+		return;
+	}
 	for (int i=0 ; i<ECTL_REG_COUNT ; i++) {
 		dest[i] = cp_reg_get(i);
 	}
@@ -92,7 +112,13 @@ void ectl_regs_get(uint16_t *dest)
 int ectl_reg_get(unsigned id)
 {
 	LOG(L_ECTL, "ECTL reg get");
-	int reg = cp_reg_get(id);
+	uint16_t regs[ECTL_REG_COUNT];
+	int reg;
+	if ((id < ECTL_REG_COUNT) && cp_regs_snapshot(regs)) {
+		reg = regs[id];
+	} else {
+		reg = cp_reg_get(id);
+	}
 	LOG(L_ECTL, "ECTL reg get: %s = 0x%04x", ectl_reg_name(id), reg);
 	return reg;
 }
@@ -144,11 +170,20 @@ bool ectl_mem_write_n(int seg, uint16_t addr, uint16_t *src, unsigned count)
 	return cp_mem_write_n(seg, addr, src, count);
 }
 
+// -----------------------------------------------------------------------
+int ectl_mem_find(int seg, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max)
+{
+	LOG(L_ECTL, "ECTL mem find: %i words in segment %i", len, seg);
+	int count = cp_mem_find(seg, pattern, mask, len, found, max);
+	LOG(L_ECTL, "ECTL mem find: %i matches", count);
+	return count;
+}
+
 // -----------------------------------------------------------------------
 int ectl_mem_map(int seg)
 {
 	LOG(L_ECTL, "ECTL mem map");
-	int map = mem_get_map(seg);
+	int map = mem_get_map(&ectl_machine()->mem, seg);
 	LOG(L_ECTL, "ECTL mem map: %i = 0x%04x", seg, map);
 	return map;
 }
@@ -158,7 +193,7 @@ int ectl_mem_cfg(int nb, int ab, int mp, int seg)
 {
 	uint16_t r = (nb & 0b1111) | (ab << 12);
 	uint16_t n = ((mp & 0b1111) << 1) | ((seg & 0b1111) << 5);
-	int res = mem_cmd(n, r);
+	int res = mem_cmd(&ectl_machine()->mem, n, r);
 	if (res == IO_OK) {
 		return 0;
 	} else {
@@ -257,7 +292,7 @@ int ectl_int_set(unsigned interrupt)
 	if (interrupt >= 32) {
 		return -1;
 	}
-	int_set(interrupt);
+	int_set(ectl_cpu(), interrupt);
 	LOG(L_ECTL, "ECTL int set %i", interrupt);
 	return 0;
 }
@@ -268,7 +303,7 @@ int ectl_int_clear(unsigned interrupt)
 	if (interrupt >= 32) {
 		return -1;
 	}
-	int_clear(interrupt);
+	int_clear(ectl_cpu(), interrupt);
 	LOG(L_ECTL, "ECTL int clear %i", interrupt);
 	return 0;
 }
@@ -277,14 +312,33 @@ int ectl_int_clear(unsigned interrupt)
 uint32_t ectl_int_get32()
 {
 	LOG(L_ECTL, "ECTL interrupts get");
-	uint16_t rz = ectl_reg_get(ECTL_REG_RZ);
-	uint16_t rz_io = ectl_reg_get(ECTL_REG_RZ_IO);
+	uint16_t regs[ECTL_REG_COUNT];
+	ectl_regs_get(regs);
+	uint16_t rz = regs[ECTL_REG_RZ];
+	uint16_t rz_io = regs[ECTL_REG_RZ_IO];
 	uint32_t rz32 = ((rz & 0b1111111111110000) << 16) | (rz_io << 4) | (rz & 0b1111);
 	LOG(L_ECTL, "ECTL interrupts get: 0x%08x", rz32);
 
 	return rz32;
 }
 
+// -----------------------------------------------------------------------
+int ectl_int_latency_get(unsigned interrupt, unsigned unit, unsigned long *hist, unsigned long *sum)
+{
+	LOG(L_ECTL, "ECTL interrupt %i latency get", interrupt);
+	if (int_latency_get(ectl_cpu(), interrupt, unit, hist, sum) != E_OK) {
+		return -1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+void ectl_int_latency_reset()
+{
+	LOG(L_ECTL, "ECTL interrupt latency reset");
+	int_latency_reset(ectl_cpu());
+}
+
 // -----------------------------------------------------------------------
 const char * ectl_version()
 {
@@ -309,12 +363,14 @@ const char * ectl_capa_bit_name(unsigned bitpos)
 int ectl_capa()
 {
 	int capa = 0;
-
-	if (cpu_mod_present) capa |= 1 << ECTL_CAPA_MX16;
-	if (cpu_mod_active) capa |= 1 << ECTL_CAPA_CRON;
-	if (awp_enabled) capa |= 1 << ECTL_CAPA_AWP;
-	if (!cpu_user_io_illegal) capa |= 1 << ECTL_CAPA_UIO;
-	if (mem_mega_boot()) capa |= 1 << ECTL_CAPA_MEGABOOT;
+	struct em400_machine *m = ectl_machine();
+	struct cpu *cpu = ectl_cpu();
+
+	if (cpu->mod_present) capa |= 1 << ECTL_CAPA_MX16;
+	if (cpu->mod_active) capa |= 1 << ECTL_CAPA_CRON;
+	if (cpu->awp_enabled) capa |= 1 << ECTL_CAPA_AWP;
+	if (!cpu->user_io_illegal) capa |= 1 << ECTL_CAPA_UIO;
+	if (mem_mega_boot(&m->mem)) capa |= 1 << ECTL_CAPA_MEGABOOT;
 	//TODO: if (nomem_stop) capa |= 1 << ECTL_CAPA_NOMEMSTOP;
 
 	LOG(L_ECTL, "ECTL capabilities: 0x%04x", capa);
@@ -417,22 +473,43 @@ int ectl_log_component_id(char *name)
 }
 
 // -----------------------------------------------------------------------
-extern unsigned long ips_counter;
+// IPS is measured over windows at least ECTL_IPS_WINDOW_NS long, shared by
+// all callers. Clients polling at different rates get the value from the last
+// complete window instead of resetting each other's baseline.
+// Switching machines or CPUs starts a new window.
+#define ECTL_IPS_WINDOW_NS 500000000.0
 unsigned long ectl_ips_get()
 {
-	double ips;
-	static unsigned long oips;
-
-	double elapsed_ns = stopwatch_ns();
-	if (elapsed_ns > 0) {
-		ips = (1000000000.0 * (ips_counter - oips)) / elapsed_ns;
-	} else {
+	static pthread_mutex_t ips_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static struct timespec window_start;
+	static unsigned long window_count;
+	static unsigned long ips;
+	static struct cpu *window_cpu;
+
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	struct cpu *cpu = ectl_cpu();
+	unsigned long count = atom_load_acquire(&cpu->ips_counter);
+
+	pthread_mutex_lock(&ips_mutex);
+	if (cpu != window_cpu) {
+		window_cpu = cpu;
+		window_start.tv_sec = window_start.tv_nsec = 0;
 		ips = 0;
 	}
-	oips = ips_counter;
+	double elapsed_ns = 1000000000.0 * (t.tv_sec - window_start.tv_sec) + (t.tv_nsec - window_start.tv_nsec);
+	if (elapsed_ns >= ECTL_IPS_WINDOW_NS) {
+		if (window_start.tv_sec || window_start.tv_nsec) {
+			ips = (1000000000.0 * (count - window_count)) / elapsed_ns;
+		}
+		window_start = t;
+		window_count = count;
+	}
+	unsigned long res = ips;
+	pthread_mutex_unlock(&ips_mutex);
 
-	LOG(L_ECTL, "ECTL ips: %li", ips);
-	return ips;
+	LOG(L_ECTL, "ECTL ips: %lu", res);
+	return res;
 }
 
 // -----------------------------------------------------------------------
@@ -515,6 +592,51 @@ int ectl_brk_del(unsigned id)
 	return ectl_brk_delete(id);
 }
 
+// -----------------------------------------------------------------------
+int ectl_machine_count()
+{
+	LOG(L_ECTL, "ECTL machine count: %i", machine_count);
+	return machine_count;
+}
+
+// -----------------------------------------------------------------------
+int ectl_machine_get()
+{
+	int num = cp_machine_get();
+	LOG(L_ECTL, "ECTL machine get: %i", num);
+	return num;
+}
+
+// -----------------------------------------------------------------------
+int ectl_machine_select(int num)
+{
+	LOG(L_ECTL, "ECTL machine select: %i", num);
+	return cp_machine_select(num);
+}
+
+// -----------------------------------------------------------------------
+int ectl_cpu_count()
+{
+	int count = ectl_machine()->cpu_count;
+	LOG(L_ECTL, "ECTL CPU count: %i", count);
+	return count;
+}
+
+// -----------------------------------------------------------------------
+int ectl_cpu_get()
+{
+	int num = cp_cpu_get();
+	LOG(L_ECTL, "ECTL CPU get: %i", num);
+	return num;
+}
+
+// -----------------------------------------------------------------------
+int ectl_cpu_select(int num)
+{
+	LOG(L_ECTL, "ECTL CPU select: %i", num);
+	return cp_cpu_select(num);
+}
+
 // -----------------------------------------------------------------------
 int ectl_stopn(uint16_t addr)
 {
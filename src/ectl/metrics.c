@@ -0,0 +1,355 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "atomic.h"
+#include "ectl/metrics.h"
+
+#include "log.h"
+#include "cfg.h"
+
+#define METRICS_LABELS_MAX 128
+#define METRICS_REQUEST_MAX 4096
+
+struct ectl_metric {
+	int type;
+	const char *name;
+	const char *help;
+	char labels[METRICS_LABELS_MAX];
+	const unsigned long *value;
+	ectl_metric_fn fn;
+	void *arg;
+};
+
+static const char *metric_type_names[] = { "counter", "gauge" };
+
+static struct ectl_metric *metrics;
+static int metrics_count;
+static int metrics_capacity;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char metrics_scope[METRICS_LABELS_MAX]; // labels prepended to newly registered metrics
+
+static int metrics_listenfd = -1;
+static int metrics_quit_pipe[2] = { -1, -1 };
+static pthread_t metrics_th;
+static bool metrics_running;
+
+// -----------------------------------------------------------------------
+static int ectl_metric_register(int type, const char *name, const char *help, const unsigned long *value, ectl_metric_fn fn, void *arg, const char *labels_fmt, va_list vl)
+{
+	pthread_mutex_lock(&metrics_mutex);
+
+	if (metrics_count >= metrics_capacity) {
+		int capacity = metrics_capacity ? 2 * metrics_capacity : 64;
+		struct ectl_metric *m = (struct ectl_metric *) realloc(metrics, capacity * sizeof(struct ectl_metric));
+		if (!m) {
+			pthread_mutex_unlock(&metrics_mutex);
+			return LOGERR("Memory allocation error while registering metric: %s.", name);
+		}
+		metrics = m;
+		metrics_capacity = capacity;
+	}
+
+	struct ectl_metric *m = metrics + metrics_count;
+	m->type = type;
+	m->name = name;
+	m->help = help;
+	m->value = value;
+	m->fn = fn;
+	m->arg = arg;
+	int len = snprintf(m->labels, METRICS_LABELS_MAX, "%s%s", metrics_scope, (*metrics_scope && labels_fmt) ? "," : "");
+	if (labels_fmt && (len < METRICS_LABELS_MAX)) {
+		vsnprintf(m->labels + len, METRICS_LABELS_MAX - len, labels_fmt, vl);
+	}
+	metrics_count++;
+
+	pthread_mutex_unlock(&metrics_mutex);
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void ectl_metrics_scope(const char *labels_fmt, ...)
+{
+	pthread_mutex_lock(&metrics_mutex);
+	metrics_scope[0] = '\0';
+	if (labels_fmt) {
+		va_list vl;
+		va_start(vl, labels_fmt);
+		vsnprintf(metrics_scope, METRICS_LABELS_MAX, labels_fmt, vl);
+		va_end(vl);
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+// -----------------------------------------------------------------------
+int ectl_metric_add(int type, const char *name, const char *help, const unsigned long *value, const char *labels_fmt, ...)
+{
+	va_list vl;
+	va_start(vl, labels_fmt);
+	int res = ectl_metric_register(type, name, help, value, NULL, NULL, labels_fmt, vl);
+	va_end(vl);
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int ectl_metric_add_fn(int type, const char *name, const char *help, ectl_metric_fn fn, void *arg, const char *labels_fmt, ...)
+{
+	va_list vl;
+	va_start(vl, labels_fmt);
+	int res = ectl_metric_register(type, name, help, NULL, fn, arg, labels_fmt, vl);
+	va_end(vl);
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+static void ectl_metrics_render(FILE *f)
+{
+	pthread_mutex_lock(&metrics_mutex);
+
+	// samples of one metric family need to be grouped together,
+	// but modules register them in any order
+	for (int i=0 ; i<metrics_count ; i++) {
+		struct ectl_metric *m = metrics + i;
+		bool seen = false;
+		for (int j=0 ; j<i ; j++) {
+			if (!strcmp(metrics[j].name, m->name)) {
+				seen = true;
+				break;
+			}
+		}
+		if (seen) continue;
+
+		fprintf(f, "# HELP %s %s\n", m->name, m->help);
+		fprintf(f, "# TYPE %s %s\n", m->name, metric_type_names[m->type]);
+		for (int j=i ; j<metrics_count ; j++) {
+			struct ectl_metric *s = metrics + j;
+			if (strcmp(s->name, m->name)) continue;
+			unsigned long v = s->fn ? s->fn(s->arg) : atom_load_acquire(s->value);
+			if (*s->labels) {
+				fprintf(f, "%s{%s} %lu\n", s->name, s->labels, v);
+			} else {
+				fprintf(f, "%s %lu\n", s->name, v);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+// -----------------------------------------------------------------------
+static int ectl_metrics_write(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		// scraper may hang up any time, that must not kill the emulator with SIGPIPE
+		ssize_t res = send(fd, buf, len, MSG_NOSIGNAL);
+		if (res < 0) {
+			if (errno == EINTR) continue;
+			return E_ERR;
+		}
+		buf += res;
+		len -= res;
+	}
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+static void ectl_metrics_serve(int fd)
+{
+	char req[METRICS_REQUEST_MAX];
+	int len = 0;
+
+	// don't let a stalled client block the exporter
+	struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	// read the request headers, the request body (if any) is ignored
+	while (len < METRICS_REQUEST_MAX-1) {
+		ssize_t res = read(fd, req+len, METRICS_REQUEST_MAX-1-len);
+		if (res <= 0) break;
+		len += res;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+	}
+	req[len] = '\0';
+
+	if (strncmp(req, "GET ", 4)) {
+		const char *resp = "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n";
+		ectl_metrics_write(fd, resp, strlen(resp));
+		return;
+	}
+
+	char *body = NULL;
+	size_t body_len = 0;
+	FILE *f = open_memstream(&body, &body_len);
+	if (!f) {
+		LOG(L_ECTL, "Metrics: failed to allocate response buffer");
+		return;
+	}
+	ectl_metrics_render(f);
+	fclose(f);
+
+	char hdr[128];
+	int hdr_len = snprintf(hdr, sizeof(hdr),
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n\r\n",
+		body_len
+	);
+
+	if (ectl_metrics_write(fd, hdr, hdr_len) == E_OK) {
+		ectl_metrics_write(fd, body, body_len);
+	}
+
+	free(body);
+}
+
+// -----------------------------------------------------------------------
+static void * ectl_metrics_server(void *ptr)
+{
+	struct pollfd fds[2] = {
+		{ .fd = metrics_listenfd, .events = POLLIN },
+		{ .fd = metrics_quit_pipe[0], .events = POLLIN },
+	};
+
+	while (true) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			LOG(L_ECTL, "Metrics: poll() failed, exiting");
+			break;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(metrics_listenfd, NULL, NULL);
+			if (fd >= 0) {
+				ectl_metrics_serve(fd);
+				close(fd);
+			}
+		}
+	}
+
+	pthread_exit(NULL);
+}
+
+// -----------------------------------------------------------------------
+int ectl_metrics_init(em400_cfg *cfg)
+{
+	const int port = cfg_getint(cfg, "metrics:port", CFG_DEFAULT_METRICS_PORT);
+	if (port <= 0) {
+		return E_OK;
+	}
+
+	metrics_listenfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (metrics_listenfd < 0) {
+		return LOGERR("Failed to create metrics socket.");
+	}
+
+	int on = 1;
+	if (setsockopt(metrics_listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+		LOGERR("Failed to set metrics socket options.");
+		goto cleanup;
+	}
+
+	struct sockaddr_in servaddr;
+	memset(&servaddr, 0, sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	servaddr.sin_port = htons(port);
+
+	if (bind(metrics_listenfd, (struct sockaddr*) &servaddr, sizeof(servaddr)) < 0) {
+		LOGERR("Failed to bind metrics socket to port %i.", port);
+		goto cleanup;
+	}
+	if (listen(metrics_listenfd, 4) < 0) {
+		LOGERR("Failed to listen on metrics socket.");
+		goto cleanup;
+	}
+	if (pipe(metrics_quit_pipe)) {
+		LOGERR("Failed to create metrics exporter pipe.");
+		goto cleanup;
+	}
+	if (pthread_create(&metrics_th, NULL, ectl_metrics_server, NULL)) {
+		LOGERR("Failed to spawn metrics exporter thread.");
+		goto cleanup;
+	}
+	pthread_setname_np(metrics_th, "metrics");
+	metrics_running = true;
+
+	LOG(L_ECTL, "Exporting %i metrics on 127.0.0.1:%i", metrics_count, port);
+
+	return E_OK;
+
+cleanup:
+	ectl_metrics_shutdown();
+	return E_ERR;
+}
+
+// -----------------------------------------------------------------------
+void ectl_metrics_shutdown()
+{
+	if (metrics_running) {
+		if (write(metrics_quit_pipe[1], "q", 1) != 1) {
+			LOGERR("Failed to stop metrics exporter thread.");
+		}
+		pthread_join(metrics_th, NULL);
+		metrics_running = false;
+	}
+
+	for (int i=0 ; i<2 ; i++) {
+		if (metrics_quit_pipe[i] >= 0) {
+			close(metrics_quit_pipe[i]);
+			metrics_quit_pipe[i] = -1;
+		}
+	}
+	if (metrics_listenfd >= 0) {
+		close(metrics_listenfd);
+		metrics_listenfd = -1;
+	}
+
+	pthread_mutex_lock(&metrics_mutex);
+	free(metrics);
+	metrics = NULL;
+	metrics_count = metrics_capacity = 0;
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
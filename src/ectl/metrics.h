@@ -0,0 +1,53 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef ECTL_METRICS_H
+#define ECTL_METRICS_H
+
+#include "cfg.h"
+
+// Performance counters registry.
+//
+// Modules register counters they own and update themselves. A counter that is
+// updated by a single thread is a plain increment, counters shared by many
+// threads need atom_add_release(). Gauges that need computing (queue depths)
+// are registered as callbacks instead.
+//
+// The exporter reads all values with atomic loads and serves them in the
+// Prometheus text format over HTTP on the loopback interface (metrics:port).
+// Registered values must stay valid until ectl_metrics_shutdown().
+// Labels set with ectl_metrics_scope() are added to all metrics registered
+// afterwards (used to tell apart metrics of different machines).
+
+enum ectl_metric_types {
+	ECTL_METRIC_COUNTER,
+	ECTL_METRIC_GAUGE,
+};
+
+typedef unsigned long (*ectl_metric_fn)(void *arg);
+
+int ectl_metric_add(int type, const char *name, const char *help, const unsigned long *value, const char *labels_fmt, ...);
+int ectl_metric_add_fn(int type, const char *name, const char *help, ectl_metric_fn fn, void *arg, const char *labels_fmt, ...);
+void ectl_metrics_scope(const char *labels_fmt, ...);
+
+int ectl_metrics_init(em400_cfg *cfg);
+void ectl_metrics_shutdown();
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -0,0 +1,148 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "atomic.h"
+#include "cpu/cpu.h"
+#include "cpu/interrupts.h"
+#include "mem/mem.h"
+#include "mem/arena.h"
+#include "ectl/shm.h"
+
+#include "log.h"
+#include "cfg.h"
+
+static char shm_state_name[256];
+
+// -----------------------------------------------------------------------
+static void ectl_shm_state_setup(struct cpu *cpu, struct ectl_shm_state *s)
+{
+	s->magic = ECTL_SHM_MAGIC;
+	s->version = ECTL_SHM_VERSION;
+	s->segments = cpu->mem->arena.size / (MEM_SEGMENT_SIZE * sizeof(uint16_t));
+	cpu->pub = s;
+}
+
+// -----------------------------------------------------------------------
+int ectl_shm_init(struct cpu *cpu, em400_cfg *cfg, bool export)
+{
+	// only one machine may export its state, others would use the same name
+	const char *name = export ? cfg_getstr(cfg, "memory:shm_name", CFG_DEFAULT_MEMORY_SHM_NAME) : NULL;
+	if (!name) {
+		ectl_shm_state_setup(cpu, &cpu->pub_local);
+		return E_OK;
+	}
+
+	snprintf(shm_state_name, sizeof(shm_state_name), "/%s.state", name);
+
+	int fd = shm_open(shm_state_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		return LOGERR("Failed to create shared memory object: %s.", shm_state_name);
+	}
+	if (ftruncate(fd, sizeof(struct ectl_shm_state))) {
+		close(fd);
+		shm_unlink(shm_state_name);
+		return LOGERR("Failed to set size of shared memory object: %s.", shm_state_name);
+	}
+	void *ptr = mmap(NULL, sizeof(struct ectl_shm_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		shm_unlink(shm_state_name);
+		return LOGERR("Failed to map shared memory object: %s.", shm_state_name);
+	}
+
+	ectl_shm_state_setup(cpu, (struct ectl_shm_state *) ptr);
+
+	LOG(L_ECTL, "Exporting CPU state as shared memory: %s", shm_state_name);
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void ectl_shm_shutdown(struct cpu *cpu)
+{
+	if (!cpu->pub) return;
+
+	if (cpu->pub != &cpu->pub_local) {
+		munmap(cpu->pub, sizeof(struct ectl_shm_state));
+		shm_unlink(shm_state_name);
+	}
+	cpu->pub = NULL;
+}
+
+// -----------------------------------------------------------------------
+void ectl_shm_publish(struct cpu *cpu, int state)
+{
+	struct ectl_shm_state *s = cpu->pub;
+	if (!s) return;
+
+	const uint32_t seq = s->seq;
+
+	atom_store_release(&s->seq, seq + 1);
+	atom_full_fence();
+
+	s->state = state;
+	s->instructions = cpu->ips_counter;
+	s->rz = atom_load_acquire(&cpu->rz);
+	memcpy(s->r, cpu->r, sizeof(s->r));
+	s->ic = cpu->ic;
+	s->ir = cpu->ir;
+	s->ac = cpu->ac;
+	s->ar = cpu->ar;
+	s->kb = cpu->kb;
+	s->sr = SR_READ();
+	s->mc = cpu->mc;
+	s->alarm = cpu->rALARM;
+	s->p = cpu->p;
+
+	const struct mem *mem = cpu->mem;
+	for (int nb=0 ; nb<MEM_MAX_NB ; nb++) {
+		for (int ab=0 ; ab<MEM_MAX_AB ; ab++) {
+			const uint16_t *seg = atom_load_acquire(&mem->map[nb][ab]);
+			s->mem_map[nb][ab] = seg ? (seg - mem->arena.base) / MEM_SEGMENT_SIZE : ECTL_SHM_UNMAPPED;
+		}
+	}
+
+	atom_store_release(&s->seq, seq + 2);
+}
+
+// -----------------------------------------------------------------------
+bool ectl_shm_snapshot(struct cpu *cpu, struct ectl_shm_state *dst)
+{
+	const struct ectl_shm_state *s = cpu->pub;
+	if (!s) return false;
+
+	uint32_t seq;
+	do {
+		while ((seq = atom_load_acquire(&s->seq)) & 1) {
+			sched_yield();
+		}
+		memcpy(dst, s, sizeof(struct ectl_shm_state));
+		atom_full_fence();
+	} while (atom_load_acquire(&s->seq) != seq);
+
+	return true;
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -0,0 +1,68 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef ECTL_SHM_H
+#define ECTL_SHM_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "cfg.h"
+
+// Machine state published by the CPU thread (struct ectl_shm_state below)
+// every cpu:publish_interval instructions and whenever it stops or waits.
+// UIs read registers from it while the CPU is running, instead of touching
+// live CPU state.
+//
+// With memory:shm_name = <name> state of the first machine is also exported
+// via POSIX shared memory:
+//
+//  * /<name>.mem   - physical memory arena: all memory segments,
+//                    MEM_SEGMENT_SIZE host-endian words each
+//  * /<name>.state - struct ectl_shm_state below
+//
+// State is published under a seqlock. Readers retry until they see
+// the same, even seq value before and after reading the block.
+
+#define ECTL_SHM_MAGIC 0x45343030 // "E400"
+#define ECTL_SHM_VERSION 2
+#define ECTL_SHM_UNMAPPED -1 // mem_map entry for an unmapped logical segment
+
+struct ectl_shm_state {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;				// seqlock sequence, odd while an update is in progress
+	uint32_t state;				// CPU state (ECTL_STATE_*)
+	uint64_t instructions;		// instructions executed so far
+	uint32_t rz;				// interrupt request register
+	uint32_t segments;			// segments in the memory arena
+	uint16_t r[8];
+	uint16_t ic, ir, ac, ar, kb, sr;
+	uint16_t mc, alarm, p, reserved;
+	int32_t mem_map[16][16];	// [nb][ab] -> arena segment index
+};
+
+struct cpu;
+
+int ectl_shm_init(struct cpu *cpu, em400_cfg *cfg, bool export);
+void ectl_shm_shutdown(struct cpu *cpu);
+void ectl_shm_publish(struct cpu *cpu, int state);
+bool ectl_shm_snapshot(struct cpu *cpu, struct ectl_shm_state *dst);
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
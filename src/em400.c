@@ -25,13 +25,14 @@
 #include <sys/types.h>
 
 #include "ui/ui.h"
+#include "machine.h"
 #include "cpu/cp.h"
-#include "cpu/cpu.h"
-#include "mem/mem.h"
-#include "cpu/interrupts.h"
 #include "cpu/clock.h"
-#include "io/io.h"
 #include "fpga/iobus.h"
+#include "ectl/shm.h"
+#include "ectl/metrics.h"
+#include "utils/utils.h"
+#include "ectl.h"
 
 #include "em400.h"
 #include "cfg.h"
@@ -47,13 +48,16 @@ int em400_init(em400_cfg *cfg)
 {
 	if (log_init(cfg) != E_OK) return LOGERR("Failed to initialize logging.");
 	if (iob_init(cfg) != E_OK) return LOGERR("Failed to set up FPGA I/O bus.");
-	if (mem_init(cfg) != E_OK) return LOGERR("Failed to initialize memory.");
-	if (cpu_init(cfg) != E_OK) return LOGERR("Failed to initialize CPU.");
+	if (machines_init(cfg) != E_OK) return LOGERR("Failed to initialize machines.");
 	if (cp_init(cfg) != E_OK) return LOGERR("Failed to initialize control panel.");
 	if (clock_init(cfg) != E_OK) return LOGERR("Failed to initialize clock.");
-	if (io_init(cfg) != E_OK) return LOGERR("Failed to initialize I/O.");
 	if (ectl_init() != E_OK) return LOGERR("Failed to initialize ECTL interface.");
-	if (!(ui = ui_create(cfg))) return LOGERR("Failed to initialize UI.");
+	if (ectl_metrics_init(cfg) != E_OK) return LOGERR("Failed to set up metrics exporter.");
+	if (cfg_getbool(cfg, "batch:enabled", CFG_DEFAULT_BATCH_ENABLED)) {
+		LOG(L_EM4H, "Batch mode, UI disabled");
+	} else if (!(ui = ui_create(cfg))) {
+		return LOGERR("Failed to initialize UI.");
+	}
 
 	return E_OK;
 }
@@ -62,12 +66,12 @@ int em400_init(em400_cfg *cfg)
 void em400_shutdown()
 {
 	ui_shutdown(ui);
+	ectl_metrics_shutdown();
 	ectl_shutdown();
-	io_shutdown();
 	clock_shutdown();
 	cp_shutdown();
-	cpu_shutdown();
-	mem_shutdown();
+	iob_close(); // bus simulator serves memory, needs to go first
+	machines_shutdown();
 	log_shutdown();
 }
 
@@ -94,6 +98,116 @@ int em400_preload_program(const char *program_name)
 	return E_OK;
 }
 
+// -----------------------------------------------------------------------
+static int em400_preload_programs()
+{
+	int res = E_OK;
+
+	// each machine gets the program from its own configuration
+	for (int i=0 ; i<machine_count ; i++) {
+		cp_machine_select(i);
+		if (em400_preload_program(cfg_getstr(machines[i].cfg, "memory:preload", CFG_DEFAULT_MEMORY_PRELOAD)) != E_OK) {
+			res = E_ERR;
+			break;
+		}
+	}
+	cp_machine_select(0);
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+static int em400_dump_words(FILE *f, uint16_t *buf, int count)
+{
+	endianswap(buf, count);
+	if (fwrite(buf, sizeof(uint16_t), count, f) != (size_t) count) {
+		return E_ERR;
+	}
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int em400_batch_dump_regs(const char *filename)
+{
+	uint16_t regs[ECTL_REG_COUNT];
+
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		return LOGERR("Failed to open register dump file: \"%s\".", filename);
+	}
+
+	ectl_regs_get(regs);
+	int res = em400_dump_words(f, regs, ECTL_REG_COUNT);
+	fclose(f);
+	if (res != E_OK) {
+		return LOGERR("Failed to write register dump file: \"%s\".", filename);
+	}
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int em400_batch_dump_mem(const char *filename, const char *ranges)
+{
+	uint16_t buf[0x10000];
+	int res = E_ERR;
+
+	char *r = strdup(ranges);
+	FILE *f = fopen(filename, "wb");
+	if (!r || !f) {
+		LOGERR("Failed to open memory dump file: \"%s\".", filename);
+		goto cleanup;
+	}
+
+	// <segment>:<address>:<words>,...
+	char *saveptr;
+	char *range = strtok_r(r, ",", &saveptr);
+	while (range) {
+		char *end;
+		long seg = strtol(range, &end, 0);
+		long addr = (*end == ':') ? strtol(end+1, &end, 0) : -1;
+		long count = (*end == ':') ? strtol(end+1, &end, 0) : -1;
+		if ((*end != '\0') || (seg < 0) || (seg > 15) || (addr < 0) || (addr > 0xffff) || (count < 1) || (addr + count > 0x10000)) {
+			LOGERR("Malformed memory dump range: \"%s\".", range);
+			goto cleanup;
+		}
+		if (!ectl_mem_read_n(seg, addr, buf, count)) {
+			LOGERR("Failed to read memory range for dump: %li:0x%04lx, %li words.", seg, addr, count);
+			goto cleanup;
+		}
+		if (em400_dump_words(f, buf, count) != E_OK) {
+			LOGERR("Failed to write memory dump file: \"%s\".", filename);
+			goto cleanup;
+		}
+		range = strtok_r(NULL, ",", &saveptr);
+	}
+	res = E_OK;
+
+cleanup:
+	if (f) fclose(f);
+	free(r);
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int em400_batch_dump(em400_cfg *cfg)
+{
+	int res = E_OK;
+
+	const char *regs_dump = cfg_getstr(cfg, "batch:regs_dump", CFG_DEFAULT_BATCH_REGS_DUMP);
+	if (regs_dump && (em400_batch_dump_regs(regs_dump) != E_OK)) {
+		res = E_ERR;
+	}
+
+	const char *mem_dump = cfg_getstr(cfg, "batch:mem_dump", CFG_DEFAULT_BATCH_MEM_DUMP);
+	const char *mem_ranges = cfg_getstr(cfg, "batch:mem_ranges", CFG_DEFAULT_BATCH_MEM_RANGES);
+	if (mem_dump && mem_ranges && (em400_batch_dump_mem(mem_dump, mem_ranges) != E_OK)) {
+		res = E_ERR;
+	}
+
+	return res;
+}
+
 // -----------------------------------------------------------------------
 void em400_usage()
 {
@@ -117,6 +231,8 @@ void em400_usage()
 	fprintf(stdout,
 		"   -F               : Use FPGA implementation of the CPU and external memory (experimental)\n"
 		"   -O sec:key=value : Override configuration entry \"key\" in section [sec] with a specific value\n"
+		"   -b               : Batch mode: no UI, run preloaded program at full speed until it halts\n"
+		"                      with HLT code >= batch:halt_min, exit with the HLT code\n"
 	);
 }
 
@@ -133,7 +249,7 @@ void em400_mkconfdir()
 	}
 }
 
-const char em400_cmdline_opts[] = "hc:p:k:l:Lu:FO:";
+const char em400_cmdline_opts[] = "hc:p:k:l:Lu:FO:b";
 
 // -----------------------------------------------------------------------
 int em400_cmdline_1(int argc, char **argv, int *print_help, char **config)
@@ -155,6 +271,7 @@ int em400_cmdline_1(int argc, char **argv, int *print_help, char **config)
             case 'u':
             case 'F':
 			case 'O':
+			case 'b':
 				break;
             default:
                 return E_ERR;
@@ -170,6 +287,8 @@ int em400_cmdline_2(em400_cfg *cfg, int argc, char **argv)
     int option;
     optind = 1; // reset to 1 so consecutive calls work
 	char *key, *val, *colon;
+	bool batch = false;
+	bool log_wanted = false;
 
     while ((option = getopt(argc, argv, em400_cmdline_opts)) != -1) {
         switch (option) {
@@ -188,6 +307,7 @@ int em400_cmdline_2(em400_cfg *cfg, int argc, char **argv)
             case 'l':
 				cfg_set(cfg, "log:enabled", "true");
 				cfg_set(cfg, "log:components", optarg);
+				log_wanted = true;
                 break;
             case 'u':
                 cfg_set(cfg, "ui:interface", optarg);
@@ -204,11 +324,21 @@ int em400_cmdline_2(em400_cfg *cfg, int argc, char **argv)
 				}
 				cfg_set(cfg, key, val);
 				break;
+			case 'b':
+				batch = true;
+				break;
             default:
                 return E_ERR;
         }
     }
 
+	// batch runs go at full speed and don't log unless asked to with -l
+	if (batch) {
+		cfg_set(cfg, "batch:enabled", "true");
+		cfg_set(cfg, "cpu:speed_real", "false");
+		if (!log_wanted) cfg_set(cfg, "log:enabled", "false");
+	}
+
     return E_OK;
 }
 
@@ -264,17 +394,37 @@ int main(int argc, char** argv)
 		goto done;
 	}
 
-	em400_preload_program(cfg_getstr(cfg, "memory:preload", CFG_DEFAULT_MEMORY_PRELOAD));
+	bool batch = cfg_getbool(cfg, "batch:enabled", CFG_DEFAULT_BATCH_ENABLED);
+	bool fpga = cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA);
+
+	if (batch) {
+		if (fpga) {
+			LOGERR("Batch mode is not available for the FPGA CPU.");
+			goto done;
+		}
+		if (em400_preload_programs() != E_OK) {
+			goto done;
+		}
+		machines_run();
+		// results come from the first machine
+		if (em400_batch_dump(cfg) != E_OK) {
+			goto done;
+		}
+		return_code = cpu_batch_result(machines[0].cpu);
+		goto done;
+	}
+
+	em400_preload_programs();
 
 	if (ui_run(ui) != E_OK) {
 		LOGERR("Failed to start the UI: %s.", ui->drv->name);
 		goto done;
 	}
 
-	if (cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA)) {
+	if (fpga) {
 		iob_loop();
 	} else {
-		cpu_loop();
+		machines_run();
 	}
 
 	return_code = 0;
@@ -22,6 +22,8 @@
 #include <strings.h>
 #include <getopt.h>
 #include <stdarg.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "io/dev/e4image.h"
 
@@ -29,6 +31,11 @@ enum actions_e{
 	A_UNKNOWN = -1,
 	A_FLAGS = 1,
 	A_GET,
+	A_OVERLAY,
+	A_MERGE,
+	A_DISCARD,
+	A_COMPRESS,
+	A_DECOMPRESS,
 	A_CREATE_CHS = 100,
 	A_CREATE_LBA,
 	A_CREATE_SEQ,
@@ -90,8 +97,8 @@ struct kv_t known_types[] = {
 	{ NULL, 0 }
 };
 
-char *image, *preset, *src;
-int get, append, blocks, cyls, heads, spt, sector, id, flags_set, flags_clear, got_flags, type, utype;
+char *image, *preset, *src, *base, *compress, *decompress;
+int get, merge, discard, append, blocks, cyls, heads, spt, sector, id, flags_set, flags_clear, got_flags, type, utype;
 e4i_id_gen_f *genf = NULL;
 
 // -----------------------------------------------------------------------
@@ -100,12 +107,12 @@ int m9425_idgenf(struct e4i_t *e, uint8_t *buf, int id_len, uint32_t block)
 	const uint16_t cylinder = block / (e->heads * e->spt);
 	const int rem = block % (e->heads * e->spt);
 	const uint8_t head = rem / e->spt;
-	const uint8_t sector = rem / e->spt;
+	const uint8_t sector = rem % e->spt;
 
 	*(buf+0) = (cylinder>>8) & 1;
 	*(buf+1) = cylinder & 255;
 
-	*(buf+2) = head | (e->flags & E4I_F_REMOVABLE) ? 0b100 : 0;
+	*(buf+2) = head | ((e->flags & E4I_F_REMOVABLE) ? 0b100 : 0);
 	*(buf+3) = sector;
 
 	*(buf+4) = 0; // key
@@ -118,6 +125,24 @@ int m9425_idgenf(struct e4i_t *e, uint8_t *buf, int id_len, uint32_t block)
 	return 10;
 }
 
+// -----------------------------------------------------------------------
+double elapsed_s(struct timespec *start)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - start->tv_sec) + (t.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+// -----------------------------------------------------------------------
+double file_mb(const char *name)
+{
+	struct stat st;
+	if (stat(name, &st)) {
+		return 0;
+	}
+	return (double) st.st_size / (1024 * 1024);
+}
+
 // -----------------------------------------------------------------------
 void error(const char *format, ...)
 {
@@ -150,6 +175,11 @@ void print_help()
 		"  --append, -a              : appendable media\n"
 		"  --type, -t <type>         : image type\n"
 		"  --utype, -u <type>        : user image type\n"
+		"  --overlay, -o <filename>  : create copy-on-write overlay over base image <filename>\n"
+		"  --merge                   : write overlay contents back to its base image, empty the overlay\n"
+		"  --discard                 : drop all changes stored in the overlay\n"
+		"  --compress <filename>     : write block-compressed (read-only) copy of the image to <filename>\n"
+		"  --decompress <filename>   : write uncompressed copy of the image to <filename>\n"
 		"\n"
 		"Usage scenarios:\n"
 		"  * Show media header:\n"
@@ -163,6 +193,14 @@ void print_help()
 		"  * Create media from raw data:\n"
 		"      e4itool --image <filename> --src <source> --sector <bytes> --id <bytes>\n"
 		"      e4itool --image <filename> --src <source> --cyls <c> --heads <h> --spt <sectors> --sector <bytes> --id <bytes>\n"
+		"  * Create copy-on-write overlay for a (possibly shared, master copy) base image:\n"
+		"      e4itool --image <filename> --overlay <base>\n"
+		"  * Merge or discard changes stored in an overlay:\n"
+		"      e4itool --image <filename> --merge\n"
+		"      e4itool --image <filename> --discard\n"
+		"  * Archive media in a compressed image, or unpack it (overlays are flattened):\n"
+		"      e4itool --image <filename> --compress <destination>\n"
+		"      e4itool --image <filename> --decompress <destination>\n"
 		"  * Change flags:\n"
 		"      e4itool --image <filename> --flag <name>|<^name> --flag <name>|<^name> ...\n"
 		"\n"
@@ -234,12 +272,17 @@ void parse_opts(int argc, char **argv)
 		{ "append",		no_argument,		0, 'a' },
 		{ "type",		required_argument,	0, 't' },
 		{ "utype",		required_argument,	0, 'u' },
+		{ "overlay",	required_argument,	0, 'o' },
+		{ "merge",		no_argument,		0, 0 },
+		{ "discard",	no_argument,		0, 0 },
+		{ "compress",	required_argument,	0, 0 },
+		{ "decompress",	required_argument,	0, 0 },
 		{ "help",		no_argument,		0, 0 },
 		{ 0,			0,					0, 0 }
 	};
 
 	while (1) {
-		opt = getopt_long(argc, argv,"i:gp:r:b:c:h:s:l:x:f:at:u:", opts, &idx);
+		opt = getopt_long(argc, argv,"i:gp:r:b:c:h:s:l:x:f:at:u:o:", opts, &idx);
 		if (opt == -1) {
 			break;
 		}
@@ -247,6 +290,14 @@ void parse_opts(int argc, char **argv)
 			case 0:
 				if (!strcmp(opts[idx].name, "help")) {
 					print_help();
+				} else if (!strcmp(opts[idx].name, "merge")) {
+					merge = 1;
+				} else if (!strcmp(opts[idx].name, "discard")) {
+					discard = 1;
+				} else if (!strcmp(opts[idx].name, "compress")) {
+					compress = optarg;
+				} else if (!strcmp(opts[idx].name, "decompress")) {
+					decompress = optarg;
 				}
 				break;
 			case 'i':
@@ -321,6 +372,9 @@ void parse_opts(int argc, char **argv)
 			case 'u':
 				utype = atoi(optarg);
 				break;
+			case 'o':
+				base = optarg;
+				break;
 			default:
 				error("Unknown option");
 				break;
@@ -348,6 +402,30 @@ int get_action()
 		return A_GET;
 	}
 
+	// overlay operations
+	if (base || merge || discard) {
+		if (blocks || cyls || heads || spt || sector || append || src) {
+			error("--overlay/--merge/--discard can't be used when creating new media");
+		}
+		if ((base && merge) || (base && discard) || (merge && discard)) {
+			error("Only one of --overlay, --merge and --discard can be used at a time");
+		}
+		if (base) return A_OVERLAY;
+		if (merge) return A_MERGE;
+		return A_DISCARD;
+	}
+
+	// compressed copies
+	if (compress || decompress) {
+		if (blocks || cyls || heads || spt || sector || append || src) {
+			error("--compress/--decompress can't be used when creating new media");
+		}
+		if (compress && decompress) {
+			error("Only one of --compress and --decompress can be used at a time");
+		}
+		return compress ? A_COMPRESS : A_DECOMPRESS;
+	}
+
 	// create LBA media
 	if (blocks && sector) {
 		if (cyls || heads || spt) {
@@ -392,6 +470,8 @@ int main(int argc, char **argv)
 
 	// create
 	if (action >= A_CREATE_CHS) {
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
 
 		// create as requested
 		if (action == A_CREATE_LBA) {
@@ -425,6 +505,89 @@ int main(int argc, char **argv)
 			}
 		}
 
+		double t = elapsed_s(&start);
+		double mb = (double) e->blocks * (e->id_size + e->block_size) / (1024 * 1024);
+		printf("%.1f MB in %.3f s (%.1f MB/s)\n", mb, t, t > 0 ? mb / t : 0);
+
+	// create overlay
+	} else if (action == A_OVERLAY) {
+		e = e4i_create_overlay(image, base);
+		if (!e) {
+			error("Could not create overlay: %s", e4i_get_err(e4i_err));
+		}
+		printf("Overlay created:\n");
+
+	// merge or discard overlay contents
+	} else if ((action == A_MERGE) || (action == A_DISCARD)) {
+		e = e4i_open(image);
+		if (!e) {
+			error("Could not open imege: %s", e4i_get_err(e4i_err));
+		}
+		uint32_t count = e4i_overlay_blocks(e);
+		if (action == A_MERGE) {
+			res = e4i_overlay_merge(e);
+		} else {
+			res = e4i_overlay_discard(e);
+		}
+		if (res != E4I_E_OK) {
+			error("Could not %s overlay: %s", action == A_MERGE ? "merge" : "discard", e4i_get_err(res));
+		}
+		printf("%i blocks %s\n", count, action == A_MERGE ? "merged into the base image" : "discarded");
+
+	// write compressed or uncompressed copy
+	} else if ((action == A_COMPRESS) || (action == A_DECOMPRESS)) {
+		char *dst = (action == A_COMPRESS) ? compress : decompress;
+		struct e4i_t *s = e4i_open(image);
+		if (!s) {
+			error("Could not open imege: %s", e4i_get_err(e4i_err));
+		}
+		double mb = (double) s->blocks * (s->id_size + s->block_size) / (1024 * 1024);
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (action == A_COMPRESS) {
+			res = e4i_compress(s, dst);
+		} else {
+			res = e4i_decompress(s, dst);
+		}
+		if (res != E4I_E_OK) {
+			error("Could not %s image: %s", action == A_COMPRESS ? "compress" : "decompress", e4i_get_err(res));
+		}
+		double t = elapsed_s(&start);
+		double in_mb = file_mb(image);
+		double out_mb = file_mb(dst);
+		printf("%.1f MB -> %.1f MB (ratio %.2f), %.1f MB of media in %.3f s (%.1f MB/s)\n",
+			in_mb, out_mb, out_mb > 0 ? in_mb / out_mb : 0, mb, t, t > 0 ? mb / t : 0);
+
+		// read everything back and compare with the source
+		e = e4i_open(dst);
+		if (!e) {
+			error("Could not open imege: %s", e4i_get_err(e4i_err));
+		}
+		uint8_t *buf_s = (uint8_t *) malloc(s->id_size + s->block_size);
+		uint8_t *buf_d = (uint8_t *) malloc(s->id_size + s->block_size);
+		if (!buf_s || !buf_d) {
+			error("Could not allocate memory");
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (uint32_t b=0 ; b<e->blocks ; b++) {
+			if ((e4i_bread_id(e, buf_d, b) != E4I_E_OK) || (e4i_bread(e, buf_d + e->id_size, b) != E4I_E_OK)) {
+				error("Could not read back block %i", b);
+			}
+			if ((e4i_bread_id(s, buf_s, b) != E4I_E_OK) || (e4i_bread(s, buf_s + s->id_size, b) != E4I_E_OK)) {
+				error("Could not read source block %i", b);
+			}
+			if (memcmp(buf_s, buf_d, s->id_size + s->block_size)) {
+				error("Block %i differs after %s", b, action == A_COMPRESS ? "compression" : "decompression");
+			}
+		}
+		t = elapsed_s(&start);
+		printf("Verified against the source in %.3f s (%.1f MB/s)\n", t, t > 0 ? mb / t : 0);
+		free(buf_s);
+		free(buf_d);
+		e4i_close(s);
+		printf("Image written:\n");
+
 	// show image header
 	} else if (action == A_GET) {
 		e = e4i_open(image);
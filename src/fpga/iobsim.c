@@ -0,0 +1,220 @@
+//  Copyright (c) 2017 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+// FPGA I/O bus simulator: answers IOB_CMD_* requests coming over a pty
+// using EM400's own memory, so the FPGA bus can be exercised without hardware.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "log.h"
+#include "ectl.h"
+#include "mem/mem.h"
+#include "machine.h"
+#include "fpga/iobus.h"
+#include "fpga/iobsim.h"
+
+static int master = -1;
+static int quit;
+static pthread_t sim_th;
+static int sim_running;
+
+static uint16_t keys;
+static int rotary;
+static uint16_t regs[16];
+
+// -----------------------------------------------------------------------
+static int iobsim_nb()
+{
+	// Q set in SR selects the NB block, as for the CPU
+	return (regs[ECTL_REG_SR] & 0b0000000000100000) ? regs[ECTL_REG_SR] & 0b1111 : 0;
+}
+
+// -----------------------------------------------------------------------
+static void iobsim_cp_fn(int fn, int v)
+{
+	if (!v) return;
+
+	switch (fn) {
+		case IOB_FN_LOAD:
+			regs[rotary] = keys;
+			break;
+		case IOB_FN_FETCH:
+			if (!mem_read_1(&machines[0].mem, iobsim_nb(), regs[ECTL_REG_AR], &regs[ECTL_REG_AC])) {
+				regs[ECTL_REG_AC] = 0;
+			}
+			regs[ECTL_REG_AR]++;
+			break;
+		case IOB_FN_STORE:
+			mem_write_1(&machines[0].mem, iobsim_nb(), regs[ECTL_REG_AR], keys);
+			regs[ECTL_REG_AR]++;
+			break;
+		case IOB_FN_CLEAR:
+			memset(regs, 0, sizeof(regs));
+			break;
+		default:
+			LOG(L_FPGA, "SIM: function key %i ignored", fn);
+			break;
+	}
+}
+
+// -----------------------------------------------------------------------
+static void iobsim_serve(struct iob_msg *mi)
+{
+	struct iob_msg mo = { .cmd = IOB_CMD_OK };
+
+	switch (mi->cmd) {
+		case IOB_CMD_R:
+			if (mem_read_1(&machines[0].mem, mi->nb, mi->ad, &mo.dt)) {
+				mo.has_a3 = 1;
+			} else {
+				mo.cmd = IOB_CMD_NO;
+			}
+			break;
+		case IOB_CMD_W:
+			if (!mem_write_1(&machines[0].mem, mi->nb, mi->ad, mi->dt)) {
+				mo.cmd = IOB_CMD_NO;
+			}
+			break;
+		case IOB_CMD_IN:
+			LOG(L_FPGA, "SIM: interrupt from channel %i", mi->dt >> 1);
+			break;
+		case IOB_CMD_CPS:
+			mo.has_a2 = 1;
+			mo.has_a3 = 1;
+			mo.ad = (rotary == ECTL_REG_KB) ? keys : regs[rotary];
+			mo.dt = rotary;
+			break;
+		// no reply for these
+		case IOB_CMD_PA:
+			LOG(L_FPGA, "SIM: power alarm");
+			return;
+		case IOB_CMD_CPD:
+			keys = mi->dt;
+			return;
+		case IOB_CMD_CPR:
+			rotary = mi->nb & 0b1111;
+			if (rotary == ECTL_REG_KB2) rotary = ECTL_REG_KB;
+			return;
+		case IOB_CMD_CPF:
+			iobsim_cp_fn(mi->nb, mi->pn);
+			return;
+		default:
+			LOG(L_FPGA, "SIM: unexpected request %i, ignored", mi->cmd);
+			return;
+	}
+
+	iob_msg_send(master, &mo);
+}
+
+// -----------------------------------------------------------------------
+static void * iobsim_thread(void *ptr)
+{
+	struct iob_msg mi;
+	fd_set fds;
+	struct timeval timeout;
+
+	while (!atom_load_acquire(&quit)) {
+		FD_ZERO(&fds);
+		FD_SET(master, &fds);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100 * 1000;
+
+		if (select(master+1, &fds, NULL, NULL, &timeout) <= 0) {
+			continue;
+		}
+
+		if (!iob_msg_recv(master, &mi)) {
+			LOG(L_FPGA, "SIM: invalid message: %s", mi.invalid_reason);
+			continue;
+		}
+
+		if (!mi.is_req) {
+			// replies to S/F requests, which the simulator never sends
+			continue;
+		}
+
+		iobsim_serve(&mi);
+	}
+
+	pthread_exit(NULL);
+}
+
+// -----------------------------------------------------------------------
+const char * iobsim_init()
+{
+	struct termios tty;
+	const char *name;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0) {
+		LOGERR("SIM: failed to open pty master");
+		return NULL;
+	}
+
+	if (grantpt(master) || unlockpt(master) || !(name = ptsname(master))) {
+		LOGERR("SIM: failed to set up pty slave");
+		goto fail;
+	}
+
+	// raw mode on our side too, bus traffic is binary
+	if (tcgetattr(master, &tty) == 0) {
+		cfmakeraw(&tty);
+		tcsetattr(master, TCSANOW, &tty);
+	}
+
+	if (pthread_create(&sim_th, NULL, iobsim_thread, NULL)) {
+		LOGERR("SIM: failed to start simulator thread");
+		goto fail;
+	}
+	pthread_setname_np(sim_th, "iobsim");
+	sim_running = 1;
+
+	LOG(L_FPGA, "SIM: FPGA bus simulator listening on %s", name);
+
+	return name;
+
+fail:
+	close(master);
+	master = -1;
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+void iobsim_shutdown()
+{
+	if (sim_running) {
+		atom_store_release(&quit, 1);
+		pthread_join(sim_th, NULL);
+		sim_running = 0;
+	}
+	if (master >= 0) {
+		close(master);
+		master = -1;
+	}
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -18,6 +18,8 @@
 #define _XOPEN_SOURCE 500
 
 #include <pthread.h>
+#include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -32,18 +34,27 @@
 
 #include "utils/serial.h"
 #include "fpga/iobus.h"
+#include "fpga/iobsim.h"
 #include "io/io.h"
+#include "machine.h"
 #include "io/defs.h"
 #include "cfg.h"
 
 #define BR 0
 #define BW 1
 
-static int xbus;
-static int ibus[2];
-static int ibusi[2];
+static int xbus = -1;
+static int ibus[2] = { -1, -1 };
+static int ibusi[2] = { -1, -1 };
 static int quit;
 
+// requests sent to the FPGA and still waiting for a reply, oldest first
+static int window;
+static uint8_t pending[IOB_WINDOW_MAX];
+static int pend_head;
+static int pend_count;
+static struct timeval pend_time;
+
 pthread_mutex_t bus_mutex;
 
 const char *iob_req_names[] = {
@@ -79,12 +90,24 @@ int iob_init(em400_cfg *cfg)
 
 	const char *bus_dev = cfg_getstr(cfg, "fpga:device", CFG_DEFAULT_FPGA_DEVICE);
 	int speed = cfg_getint(cfg, "fpga:speed", CFG_DEFAULT_FPGA_SPEED);
+	window = cfg_getint(cfg, "fpga:window", CFG_DEFAULT_FPGA_WINDOW);
 
 	speed_t setspeed = serial_int2speed(speed);
 	if (setspeed == 0) {
 		return LOGERR("Wrong FPGA bus speed: %i", speed);
 	}
 
+	if ((window < 1) || (window > IOB_WINDOW_MAX)) {
+		return LOGERR("Wrong FPGA bus request window: %i (must be 1-%i)", window, IOB_WINDOW_MAX);
+	}
+
+	if (!strcmp(bus_dev, "sim")) {
+		bus_dev = iobsim_init();
+		if (!bus_dev) {
+			return LOGERR("Failed to start FPGA bus simulator");
+		}
+	}
+
 	xbus = serial_open(bus_dev, setspeed);
 
 	if (xbus < 0) {
@@ -106,7 +129,7 @@ int iob_init(em400_cfg *cfg)
 		return LOGERR("Failed to initialize internal FPGA bus pipe");
 	}
 
-	LOG(L_FPGA, "FPGA IO bus initialized. Device: %s, speed: %i", bus_dev, speed);
+	LOG(L_FPGA, "FPGA IO bus initialized. Device: %s, speed: %i, request window: %i", bus_dev, speed, window);
 
 	return E_OK;
 }
@@ -114,7 +137,16 @@ int iob_init(em400_cfg *cfg)
 // -----------------------------------------------------------------------
 void iob_close()
 {
-	close(xbus);
+	int *fds[] = { &xbus, ibus, ibus+1, ibusi, ibusi+1 };
+
+	// may be called when the bus is disabled or only partially initialized
+	for (int i=0 ; i<5 ; i++) {
+		if (*fds[i] >= 0) {
+			close(*fds[i]);
+			*fds[i] = -1;
+		}
+	}
+	iobsim_shutdown();
 }
 
 // -----------------------------------------------------------------------
@@ -218,13 +250,13 @@ void iob_msg_log(struct iob_msg *m, char *buf)
 static int iob_check_msg(struct iob_msg *m)
 {
 	if ((m->is_req) && ((m->cmd > 11) || (m->cmd == 7))) {
-		m->invalid_reason = strdup("unknown request");
+		m->invalid_reason = "unknown request";
 		m->is_valid = 0;
 	} else if ((!m->is_req) && ((m->cmd < 1) || (m->cmd > 4))) {
-		m->invalid_reason = strdup("unknown response");
+		m->invalid_reason = "unknown response";
 		m->is_valid = 0;
 	} else if (m->b_argc > 5) {
-		m->invalid_reason = strdup("too many argument bytes (>5)");
+		m->invalid_reason = "too many argument bytes (>5)";
 		m->is_valid = 0;
 	} else {
 		m->is_valid = 1;
@@ -243,7 +275,22 @@ static void iob_update_argc(struct iob_msg *m)
 }
 
 // -----------------------------------------------------------------------
-static struct iob_msg * iob_msg_read(int bus)
+static void iob_msg_log_raw(struct iob_msg *m, uint8_t *buf, int len)
+{
+	char lbuf1[1024];
+	char lbuf2[64];
+	iob_msg_log(m, lbuf1);
+	for (int i=0 ; i<len ; i++) {
+		sprintf(lbuf2+3*i, " %02x", buf[i]);
+	}
+	LOG(L_FPGA, "%s%s ::%s", m->is_valid ? "" : "ERROR ", lbuf1, lbuf2);
+	if (!m->is_valid) {
+		LOG(L_FPGA, "Message invalid: %s", m->invalid_reason);
+	}
+}
+
+// -----------------------------------------------------------------------
+int iob_msg_recv(int bus, struct iob_msg *m)
 {
 	uint8_t buf[6];
 	int bpos = 0;
@@ -251,17 +298,14 @@ static struct iob_msg * iob_msg_read(int bus)
 	int total_recvd = 0;
 	int need;
 
-	struct iob_msg *m = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-	if (!m) {
-		goto done;
-	}
+	memset(m, 0, sizeof(struct iob_msg));
 
 	// read command
 	res = read(bus, buf, 1);
 	if (res != 1) {
 		LOG(L_FPGA, "ERROR: command read returned: %i", res);
 		m->is_valid = 0;
-		m->invalid_reason = strdup("failed to read command byte");
+		m->invalid_reason = "failed to read command byte";
 		goto done;
 	}
 	total_recvd += res;
@@ -296,10 +340,15 @@ static struct iob_msg * iob_msg_read(int bus)
 		res = read(bus, buf+bpos+m->b_argc-need, need);
 		if (res <= 0) {
 			LOG(L_FPGA, "ERROR: argument read returned: %i, need to read %i more bytes", res, need);
+			if (res == 0) {
+				m->is_valid = 0;
+				m->invalid_reason = "bus closed";
+				goto done;
+			}
 		} else {
 			need -= res;
+			total_recvd += res;
 		}
-		total_recvd += res;
 	}
 
 	if (m->has_a1) {
@@ -319,25 +368,14 @@ static struct iob_msg * iob_msg_read(int bus)
 
 done:
 	if (bus == xbus) {
-		char lbuf1[1024];
-		char lbuf2[64];
-		iob_msg_log(m, lbuf1);
-		for (int i=0 ; i<total_recvd ; i++) {
-			sprintf(lbuf2+3*i, " %02x", buf[i]);
-		}
-		LOG(L_FPGA, "%s%s ::%s", m->is_valid ? "" : "ERROR ", lbuf1, lbuf2);
-		if (!m->is_valid) {
-			LOG(L_FPGA, "Message invalid: %s", m->invalid_reason);
-		}
+		iob_msg_log_raw(m, buf, total_recvd);
 	}
-	return m;
+	return m->is_valid;
 }
 
 // -----------------------------------------------------------------------
-int iob_msg_send(int bus, struct iob_msg *m)
+static int iob_msg_encode(struct iob_msg *m, uint8_t *buf)
 {
-	uint8_t buf[6];
-	int res = 0;
 	int bpos = 0;
 
 	buf[bpos] = (m->is_req << 7) | (m->cmd << 3) | (m->has_a1 << 2) | (m->has_a2 << 1) | (m->has_a3 << 0);
@@ -355,34 +393,48 @@ int iob_msg_send(int bus, struct iob_msg *m)
 	if (m->has_a3) {
 		buf[bpos] = m->dt >> 8;
 		buf[bpos+1] = m->dt & 0xff;
+		bpos += 2;
 	}
 
 	iob_update_argc(m);
 	iob_check_msg(m);
 
-	if (bus == xbus) {
-		char lbuf1[1024];
-		char lbuf2[64];
-		iob_msg_log(m, lbuf1);
-		for (int i=0 ; i<1+m->b_argc ; i++) {
-			sprintf(lbuf2+3*i, " %02x", buf[i]);
+	return bpos;
+}
+
+// -----------------------------------------------------------------------
+int iob_msg_send_n(int bus, struct iob_msg *m, int count)
+{
+	uint8_t buf[6 * IOB_BURST_MAX];
+	int res = 0;
+	int len = 0;
+
+	assert(count <= IOB_BURST_MAX);
+
+	// all messages go out in a single write, so the other end
+	// (and the internal pipe) sees them back-to-back
+	for (int i=0 ; i<count ; i++) {
+		int mlen = iob_msg_encode(m+i, buf+len);
+		if (bus == xbus) {
+			iob_msg_log_raw(m+i, buf+len, mlen);
 		}
-		LOG(L_FPGA, "%s%s ::%s", m->is_valid ? "" : "ERROR ", lbuf1, lbuf2);
-		if (!m->is_valid) {
-			LOG(L_FPGA, "Message invalid: %s", m->invalid_reason);
+		if (m[i].is_valid) {
+			len += mlen;
 		}
 	}
 
-	if (m->is_valid) {
-		int need = 1+m->b_argc;
-		while (need > 0) {
-			res = write(bus, buf, need);
-			if (res <= 0) {
-				LOG(L_FPGA, "ERROR: write returned: %i, need to write %i more bytes", res, need);
-			} else {
-				need -= res;
-			}
+	int sent = 0;
+	while (sent < len) {
+		res = write(bus, buf+sent, len-sent);
+		if (res <= 0) {
+			LOG(L_FPGA, "ERROR: write returned: %i, need to write %i more bytes", res, len-sent);
+			if ((res < 0) && (errno != EINTR) && (errno != EAGAIN)) break;
+		} else {
+			sent += res;
 		}
+	}
+
+	if ((bus == xbus) && (len > 0)) {
 		tcdrain(bus);
 	}
 
@@ -390,153 +442,210 @@ int iob_msg_send(int bus, struct iob_msg *m)
 }
 
 // -----------------------------------------------------------------------
-void iob_msg_free(struct iob_msg *msg)
+int iob_msg_send(int bus, struct iob_msg *m)
 {
-	free(msg);
+	return iob_msg_send_n(bus, m, 1);
 }
 
 // -----------------------------------------------------------------------
-static struct iob_msg * iob_dialog(struct iob_msg* mo)
+static void iob_dialog_n(struct iob_msg *mo, struct iob_msg *mi, int count)
 {
-	struct iob_msg *mi = NULL;
 	fd_set fds;
 	struct timeval timeout;
+	int i;
 
 	pthread_mutex_lock(&bus_mutex);
 
-	iob_msg_send(ibus[BW], mo);
-	//LOG(L_FPGA, "Client is waiting for reply");
+	iob_msg_send_n(ibus[BW], mo, count);
 
-	FD_ZERO(&fds);
-	FD_SET(ibusi[BR], &fds);
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 1000 * 1000;
+	for (i=0 ; i<count ; i++) {
+		FD_ZERO(&fds);
+		FD_SET(ibusi[BR], &fds);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 1000 * 1000;
 
-	int select_res = select(ibusi[BR]+1, &fds, NULL, NULL, &timeout);
-	if (select_res > 0) {
-		mi = iob_msg_read(ibusi[BR]);
-	} else {
-		LOG(L_FPGA, "select() returned %i", select_res);
-		// fake reply so main MX loop does not stuck waiting for reset to end
-		mi = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-		mi->cmd = IOB_CMD_OK;
+		int select_res = select(ibusi[BR]+1, &fds, NULL, NULL, &timeout);
+		if (select_res <= 0) {
+			LOG(L_FPGA, "select() returned %i", select_res);
+			break;
+		}
+		iob_msg_recv(ibusi[BR], mi+i);
+	}
+
+	// fake replies so main MX loop does not stuck waiting for reset to end
+	for ( ; i<count ; i++) {
+		memset(mi+i, 0, sizeof(struct iob_msg));
+		mi[i].cmd = IOB_CMD_OK;
 	}
 
 	pthread_mutex_unlock(&bus_mutex);
+}
 
-	return mi;
+// -----------------------------------------------------------------------
+static void iob_dialog(struct iob_msg *mo, struct iob_msg *mi)
+{
+	iob_dialog_n(mo, mi, 1);
 }
 
 // -----------------------------------------------------------------------
-void iob_loop()
+static int iob_cmd_has_reply(int cmd)
+{
+	switch (cmd) {
+		case IOB_CMD_R:
+		case IOB_CMD_W:
+		case IOB_CMD_IN:
+		case IOB_CMD_CPS:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// -----------------------------------------------------------------------
+static void iob_pending_push(uint8_t cmd)
+{
+	pending[(pend_head + pend_count) % IOB_WINDOW_MAX] = cmd;
+	pend_count++;
+}
+
+// -----------------------------------------------------------------------
+static void iob_pending_pop()
+{
+	pend_head = (pend_head + 1) % IOB_WINDOW_MAX;
+	pend_count--;
+}
+
+// -----------------------------------------------------------------------
+static void iob_pending_flush()
+{
+	struct iob_msg mo = { .cmd = IOB_CMD_OK };
+
+	// requests without a reply get a fake one once they reach the queue head,
+	// so clients always receive replies in the order they sent requests
+	while ((pend_count > 0) && !iob_cmd_has_reply(pending[pend_head])) {
+		iob_msg_send(ibusi[BW], &mo);
+		iob_pending_pop();
+	}
+}
+
+// -----------------------------------------------------------------------
+static void iob_xbus_handle()
 {
 	int io_res;
-	struct iob_msg *mi;
-	struct iob_msg *mo;
-	struct iob_msg *intreq = NULL;
+	struct iob_msg mi;
+	static struct timeval xt1, xt2;
+
+	if (!iob_msg_recv(xbus, &mi)) {
+		LOG(L_FPGA, "ERROR: Message invalid, ignoring: %s", mi.invalid_reason);
+		return;
+	}
+
+	if (mi.is_req) {
+		switch (mi.cmd) {
+			case IOB_CMD_CL:
+				io_reset(&machines[0].io);
+				break;
+			case IOB_CMD_S:
+			case IOB_CMD_F:
+				io_res = io_dispatch(&machines[0].io, mi.pn, mi.io_dir, mi.ad, &mi.dt);
+				if (io_res != IO_NO) {
+					gettimeofday(&xt1, NULL);
+					iob_reply_send(xbus, &mi, io_res);
+					gettimeofday(&xt2, NULL);
+					double elapsed_us = 1000000.0 * (xt2.tv_sec - xt1.tv_sec) + (xt2.tv_usec - xt1.tv_usec);
+					LOG(L_FPGA, "External request service time: %.0f us", elapsed_us);
+				}
+				break;
+			default:
+				LOG(L_FPGA, "ERROR: Not an I/O request, ignored");
+				break;
+		}
+	} else {
+		switch (mi.cmd) {
+			case IOB_CMD_NO:
+			case IOB_CMD_OK:
+			case IOB_CMD_PE:
+				if (pend_count > 0) {
+					iob_msg_send(ibusi[BW], &mi);
+					iob_pending_pop();
+					iob_pending_flush();
+					gettimeofday(&pend_time, NULL);
+				} else {
+					LOG(L_FPGA, "ERROR: Noone waiting for the reply, ignored");
+				}
+				break;
+			default:
+				LOG(L_FPGA, "ERROR: Not an I/O reply, ignored");
+				break;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+static void iob_ibus_handle()
+{
+	struct iob_msg mo[IOB_WINDOW_MAX];
+	int count = 0;
+	int avail;
+
+	// collect as many queued client requests as the window allows
+	// and push them to the FPGA in one go
+	do {
+		if (!iob_msg_recv(ibus[BR], mo+count)) {
+			LOG(L_FPGA, "ERROR: Message invalid, ignoring: %s", mo[count].invalid_reason);
+		} else if (!mo[count].is_req || (mo[count].cmd == IOB_CMD_CL) || (mo[count].io_dir != -1)) {
+			LOG(L_FPGA, "ERROR: Not an I/O request nor reply, ignored");
+		} else {
+			iob_pending_push(mo[count].cmd);
+			count++;
+		}
+		if (ioctl(ibus[BR], FIONREAD, &avail) < 0) {
+			avail = 0;
+		}
+	} while ((avail > 0) && (pend_count < window));
+
+	if (count > 0) {
+		iob_msg_send_n(xbus, mo, count);
+		gettimeofday(&pend_time, NULL);
+	}
+	iob_pending_flush();
+}
+
+// -----------------------------------------------------------------------
+void iob_loop()
+{
 	fd_set fds;
 	struct timeval timeout;
-	static struct timeval xt1, xt2;
+	struct timeval now;
 
 	while (!atom_load_acquire(&quit)) {
 		FD_ZERO(&fds);
 		FD_SET(xbus, &fds);
-		FD_SET(ibus[BR], &fds);
+		if (pend_count < window) {
+			FD_SET(ibus[BR], &fds);
+		}
 		timeout.tv_sec = 0;
 		timeout.tv_usec = 100 * 1000;
 
 		int select_res = select(ibus[BR]+1, &fds, NULL, NULL, &timeout);
 		if (select_res > 0) {
-
 			// message on the external bus
 			if (FD_ISSET(xbus, &fds)) {
-				mi = iob_msg_read(xbus);
-				if (!mi->is_valid) {
-					LOG(L_FPGA, "ERROR: Message invalid, ignoring: ", mi->invalid_reason);
-					iob_msg_free(mi);
-					continue;
-				}
-				if (mi->is_req) {
-					switch (mi->cmd) {
-						case IOB_CMD_CL:
-							io_reset();
-							break;
-						case IOB_CMD_S:
-						case IOB_CMD_F:
-							io_res = io_dispatch(mi->io_dir, mi->ad, &mi->dt);
-							if (io_res != IO_NO) {
-								gettimeofday(&xt1, NULL);
-								iob_reply_send(xbus, mi, io_res);
-								gettimeofday(&xt2, NULL);
-								double elapsed_us = 1000000.0 * (xt2.tv_sec - xt1.tv_sec) + (xt2.tv_usec - xt1.tv_usec);
-								LOG(L_FPGA, "External request service time: %.0f us", elapsed_us);
-							}
-							break;
-						default:
-							LOG(L_FPGA, "ERROR: Not an I/O request, ignored");
-							break;
-					}
-				} else {
-					switch (mi->cmd) {
-						case IOB_CMD_NO:
-						case IOB_CMD_OK:
-						case IOB_CMD_PE:
-							if (intreq) {
-								iob_msg_send(ibusi[BW], mi);
-								free(intreq);
-								intreq = NULL;
-							} else {
-								LOG(L_FPGA, "ERROR: Noone waiting for the reply, ignored");
-							}
-							break;
-						default:
-							LOG(L_FPGA, "ERROR: Not an I/O reply, ignored");
-							break;
-					}
-
-				}
-
-				iob_msg_free(mi);
-
+				iob_xbus_handle();
 			// message on the internal bus
 			} else if (FD_ISSET(ibus[BR], &fds)) {
-				intreq = iob_msg_read(ibus[BR]);
-				if (!intreq->is_valid) {
-					LOG(L_FPGA, "ERROR: Message invalid, ignoring: %s", intreq->invalid_reason);
-					iob_msg_free(intreq);
-					intreq = NULL;
-					continue;
-				}
-
-				switch (intreq->cmd) {
-					case IOB_CMD_R:
-					case IOB_CMD_W:
-					case IOB_CMD_IN:
-					case IOB_CMD_CPS:
-						iob_msg_send(xbus, intreq);
-						break;
-					case IOB_CMD_CPD:
-					case IOB_CMD_CPR:
-					case IOB_CMD_CPF:
-					case IOB_CMD_PA:
-						iob_msg_send(xbus, intreq);
-						free(intreq);
-						intreq = NULL;
-						// fake reply
-						mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-						mo->cmd = IOB_CMD_OK;
-						iob_msg_send(ibusi[BW], mo);
-						free(mo);
-						break;
-					default:
-						LOG(L_FPGA, "ERROR: Not an I/O request nor reply, ignored");
-						free(intreq);
-						intreq = NULL;
-						break;
-				}
+				iob_ibus_handle();
 			} else {
 				LOG(L_FPGA, "ERROR: No know fd");
 			}
+		} else if (pend_count > 0) {
+			// clients give up after 1s, so should we
+			gettimeofday(&now, NULL);
+			double elapsed_ms = 1000.0 * (now.tv_sec - pend_time.tv_sec) + (now.tv_usec - pend_time.tv_usec) / 1000.0;
+			if (elapsed_ms > 1000) {
+				LOG(L_FPGA, "ERROR: No reply for %i pending request(s), dropping", pend_count);
+				pend_count = 0;
+			}
 		}
 	}
 }
@@ -549,82 +658,73 @@ void iob_reply_send(int bus, struct iob_msg *mi, int io_res)
 		return;
 	}
 
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = io_res;
+	struct iob_msg mo = { .cmd = io_res };
 
 	if ((mi->cmd == IOB_CMD_F) && (io_res == IO_OK)) {
-		mo->has_a3 = 1;
-		mo->dt = mi->dt;
+		mo.has_a3 = 1;
+		mo.dt = mi->dt;
 	}
-	iob_msg_send(bus, mo);
-
-	iob_msg_free(mo);
+	iob_msg_send(bus, &mo);
 }
 
 // -----------------------------------------------------------------------
 void iob_cp_set_keys(uint16_t k)
 {
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = IOB_CMD_CPD;
-	mo->is_req = 1;
-	mo->has_a3 = 1;
-	mo->dt = k;
-
-	iob_dialog(mo);
-
-	iob_msg_free(mo);
+	struct iob_msg mi;
+	struct iob_msg mo = {
+		.cmd = IOB_CMD_CPD,
+		.is_req = 1,
+		.has_a3 = 1,
+		.dt = k,
+	};
+
+	iob_dialog(&mo, &mi);
 }
 
 // -----------------------------------------------------------------------
 void iob_cp_set_rotary(int r)
 {
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = IOB_CMD_CPR;
-	mo->is_req = 1;
-	mo->has_a1 = 1;
-	mo->nb = r;
-
-	iob_dialog(mo);
-
-	iob_msg_free(mo);
+	struct iob_msg mi;
+	struct iob_msg mo = {
+		.cmd = IOB_CMD_CPR,
+		.is_req = 1,
+		.has_a1 = 1,
+		.nb = r,
+	};
+
+	iob_dialog(&mo, &mi);
 }
 
 // -----------------------------------------------------------------------
 void iob_cp_set_fn(int fn, int v)
 {
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = IOB_CMD_CPF;
-	mo->is_req = 1;
-	mo->has_a1 = 1;
-	mo->nb = fn;
-	mo->pn = v;
-
-	iob_dialog(mo);
-
-	iob_msg_free(mo);
+	struct iob_msg mi;
+	struct iob_msg mo = {
+		.cmd = IOB_CMD_CPF,
+		.is_req = 1,
+		.has_a1 = 1,
+		.nb = fn,
+		.pn = v,
+	};
+
+	iob_dialog(&mo, &mi);
 }
 
 // -----------------------------------------------------------------------
 struct iob_cp_status * iob_cp_get_status()
 {
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = IOB_CMD_CPS;
-	mo->is_req = 1;
+	struct iob_msg mi;
+	struct iob_msg mo = {
+		.cmd = IOB_CMD_CPS,
+		.is_req = 1,
+	};
 
-	struct iob_msg *mi = iob_dialog(mo);
+	iob_dialog(&mo, &mi);
 
 	struct iob_cp_status *stat = (struct iob_cp_status *) malloc(sizeof(struct iob_cp_status));
-	stat->data = mi->ad;
-	stat->rot = mi->dt & 0b1111;
-	stat->leds = mi->dt >> 6;
-
-	iob_msg_free(mi);
-	iob_msg_free(mo);
+	stat->data = mi.ad;
+	stat->rot = mi.dt & 0b1111;
+	stat->leds = mi.dt >> 6;
 
 	return stat;
 }
@@ -632,41 +732,35 @@ struct iob_cp_status * iob_cp_get_status()
 // -----------------------------------------------------------------------
 void iob_int_send(int x)
 {
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = IOB_CMD_IN;
-	mo->is_req = 1;
-	mo->has_a1 = 1;
-	mo->has_a3 = 1;
-	mo->pn = 0; // TODO: 2cpu support
-	mo->dt = (x & 0b1111) << 1;
-
-	struct iob_msg *mi = iob_dialog(mo);
-
-	iob_msg_free(mi);
-	iob_msg_free(mo);
+	struct iob_msg mi;
+	struct iob_msg mo = {
+		.cmd = IOB_CMD_IN,
+		.is_req = 1,
+		.has_a1 = 1,
+		.has_a3 = 1,
+		.pn = 0, // TODO: 2cpu support
+		.dt = (x & 0b1111) << 1,
+	};
+
+	iob_dialog(&mo, &mi);
 }
 
 // -----------------------------------------------------------------------
 void iob_pa_send()
 {
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
-	mo->cmd = IOB_CMD_PA;
-	mo->is_req = 1;
-
-	iob_dialog(mo);
-
-	iob_msg_free(mo);
+	struct iob_msg mi;
+	struct iob_msg mo = {
+		.cmd = IOB_CMD_PA,
+		.is_req = 1,
+	};
 
+	iob_dialog(&mo, &mi);
 }
 
 // -----------------------------------------------------------------------
-bool iob_mem_read_1(int nb, uint16_t addr, uint16_t *data)
+static void iob_mem_msg_read(struct iob_msg *mo, int nb, uint16_t addr)
 {
-	int ret;
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
+	memset(mo, 0, sizeof(struct iob_msg));
 	mo->cmd = IOB_CMD_R;
 	mo->is_req = 1;
 	mo->has_a1 = 1;
@@ -674,28 +768,12 @@ bool iob_mem_read_1(int nb, uint16_t addr, uint16_t *data)
 	mo->pn = 0; // TODO: 2cpu support
 	mo->nb = nb;
 	mo->ad = addr;
-
-	struct iob_msg *mi = iob_dialog(mo);
-
-	if (mi->cmd == IOB_CMD_OK) {
-		*data = mi->dt;
-		ret = true;
-	} else {
-		ret = false;
-	}
-
-	iob_msg_free(mi);
-	iob_msg_free(mo);
-
-	return ret;
 }
 
 // -----------------------------------------------------------------------
-bool iob_mem_write_1(int nb, uint16_t addr, uint16_t data)
+static void iob_mem_msg_write(struct iob_msg *mo, int nb, uint16_t addr, uint16_t data)
 {
-	int ret;
-	struct iob_msg *mo = (struct iob_msg *) calloc(1, sizeof(struct iob_msg));
-
+	memset(mo, 0, sizeof(struct iob_msg));
 	mo->cmd = IOB_CMD_W;
 	mo->is_req = 1;
 	mo->has_a1 = 1;
@@ -705,33 +783,55 @@ bool iob_mem_write_1(int nb, uint16_t addr, uint16_t data)
 	mo->nb = nb;
 	mo->ad = addr;
 	mo->dt = data;
+}
 
-	struct iob_msg *mi = iob_dialog(mo);
+// -----------------------------------------------------------------------
+bool iob_mem_read_1(int nb, uint16_t addr, uint16_t *data)
+{
+	struct iob_msg mo, mi;
 
-	if (mi->cmd == IOB_CMD_OK) {
-		ret = true;
+	iob_mem_msg_read(&mo, nb, addr);
+	iob_dialog(&mo, &mi);
+
+	if (mi.cmd == IOB_CMD_OK) {
+		*data = mi.dt;
+		return true;
 	} else {
-		ret = false;
+		return false;
 	}
+}
 
-	iob_msg_free(mi);
-	iob_msg_free(mo);
+// -----------------------------------------------------------------------
+bool iob_mem_write_1(int nb, uint16_t addr, uint16_t data)
+{
+	struct iob_msg mo, mi;
 
-	return ret;
+	iob_mem_msg_write(&mo, nb, addr, data);
+	iob_dialog(&mo, &mi);
+
+	return (mi.cmd == IOB_CMD_OK);
 }
 
 // -----------------------------------------------------------------------
 bool iob_mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count)
 {
-	int ret;
+	struct iob_msg mo[IOB_BURST_MAX];
+	struct iob_msg mi[IOB_BURST_MAX];
 	int cnt = 0;
-	uint16_t d;
 
 	while (cnt < count) {
-		ret = iob_mem_read_1(nb, saddr+cnt, &d);
-		if (!ret) return false;
-		*(dest+cnt) = d;
-		cnt++;
+		int burst = count - cnt;
+		if (burst > IOB_BURST_MAX) burst = IOB_BURST_MAX;
+
+		for (int i=0 ; i<burst ; i++) {
+			iob_mem_msg_read(mo+i, nb, saddr+cnt+i);
+		}
+		iob_dialog_n(mo, mi, burst);
+		for (int i=0 ; i<burst ; i++) {
+			if (mi[i].cmd != IOB_CMD_OK) return false;
+			*(dest+cnt+i) = mi[i].dt;
+		}
+		cnt += burst;
 	}
 
 	return true;
@@ -740,13 +840,24 @@ bool iob_mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count)
 // -----------------------------------------------------------------------
 bool iob_mem_write_n(int nb, uint16_t saddr, uint16_t *src, int count)
 {
-	int ret;
+	struct iob_msg mo[IOB_BURST_MAX];
+	struct iob_msg mi[IOB_BURST_MAX];
 	int cnt = 0;
 
+	// NOTE: writes following a failed one within the same burst
+	// are already on their way and will be carried out
 	while (cnt < count) {
-		ret = iob_mem_write_1(nb, saddr+cnt, *(src+cnt));
-		if (!ret) return false;
-		cnt++;
+		int burst = count - cnt;
+		if (burst > IOB_BURST_MAX) burst = IOB_BURST_MAX;
+
+		for (int i=0 ; i<burst ; i++) {
+			iob_mem_msg_write(mo+i, nb, saddr+cnt+i, *(src+cnt+i));
+		}
+		iob_dialog_n(mo, mi, burst);
+		for (int i=0 ; i<burst ; i++) {
+			if (mi[i].cmd != IOB_CMD_OK) return false;
+		}
+		cnt += burst;
 	}
 
 	return true;
@@ -22,9 +22,12 @@
 #include <stdbool.h>
 #include "cfg.h"
 
+#define IOB_WINDOW_MAX 64	// max. requests in flight on the external bus
+#define IOB_BURST_MAX 64	// max. requests in a single client dialog
+
 struct iob_msg {
 	int is_valid;
-	char *invalid_reason;
+	const char *invalid_reason;
 	uint8_t cmd;
 	int is_req;
 	int b_argc;
@@ -99,6 +102,10 @@ void iob_close();
 void iob_quit();
 void iob_loop();
 
+int iob_msg_recv(int bus, struct iob_msg *m);
+int iob_msg_send(int bus, struct iob_msg *m);
+int iob_msg_send_n(int bus, struct iob_msg *m, int count);
+
 void iob_reply_send(int bus, struct iob_msg *mi, int io_res);
 void iob_int_send(int x);
 void iob_pa_send();
@@ -68,10 +68,11 @@ static struct cchar_unit_proto_t * cchar_unit_proto_get(struct cchar_unit_proto_
 }
 
 // -----------------------------------------------------------------------
-void * cchar_create(int ch_num, em400_cfg *cfg)
+void * cchar_create(struct io *io, int ch_num, em400_cfg *cfg)
 {
 	struct cchar_chan_t *chan = (struct cchar_chan_t *) calloc(1, sizeof(struct cchar_chan_t));
 
+	chan->io = io;
 	chan->num = ch_num;
 	for (int dev_num=0 ; dev_num<CCHAR_MAX_DEVICES ; dev_num++) {
 		// find unit prototype
@@ -150,6 +151,10 @@ void cchar_reset(void *chan)
 
 	pthread_mutex_lock(&ch->int_mutex);
 	ch->interrupting_device = NO_INTERRUPT_REPORTED;
+	ch->int_mask = 0;
+	for (int i=0 ; i<CCHAR_MAX_DEVICES ; i++) {
+		ch->unit_cpu[i] = 0;
+	}
 	pthread_mutex_unlock(&ch->int_mutex);
 }
 
@@ -161,13 +166,16 @@ void cchar_int_trigger(struct cchar_chan_t *chan)
 		// interrupt reported to the CPU but not yet served, nothing more to do
 		LOG(L_CCHR, "CCHAR (ch:%i) not reporting interrupt. Reported by unit: %i has yet to be served", chan->num, chan->interrupting_device);
 	} else {
-		// check if any unit reported interrupt
+		// check if any unit reported interrupt (and report it to the CPU
+		// the unit is allocated to, unless it's masked for that CPU)
 		for (int unit_n=0 ; unit_n<CCHAR_MAX_DEVICES ; unit_n++) {
 			struct cchar_unit_proto_t *unit = chan->unit[unit_n];
-			if (unit && unit->has_interrupt(unit)) {
-				LOG(L_CCHR, "CCHAR (ch:%i) reporting interrupt from unit %i", chan->num, unit_n);
+			int cpu = chan->unit_cpu[unit_n];
+			if (unit && !(chan->int_mask & (1 << cpu)) && unit->has_interrupt(unit)) {
+				LOG(L_CCHR, "CCHAR (ch:%i) reporting interrupt from unit %i to CPU %i", chan->num, unit_n, cpu);
 				chan->interrupting_device = unit_n;
-				io_int_set(chan->num);
+				chan->int_cpu = cpu;
+				io_int_set_pn(chan->io, chan->num, cpu);
 				break;
 			}
 		}
@@ -191,10 +199,11 @@ void cchar_int_cancel(struct cchar_chan_t *chan, int unit_n)
 }
 
 // -----------------------------------------------------------------------
-static int cchar_cmd_intspec(struct cchar_chan_t *chan, uint16_t *r_arg)
+static int cchar_cmd_intspec(struct cchar_chan_t *chan, int pn, uint16_t *r_arg)
 {
 	pthread_mutex_lock(&chan->int_mutex);
-	if (chan->interrupting_device != NO_INTERRUPT_REPORTED) {
+	// interrupt is specified only to the CPU it has been reported to
+	if ((chan->interrupting_device != NO_INTERRUPT_REPORTED) && (chan->int_cpu == pn)) {
 		struct cchar_unit_proto_t *unit = chan->unit[chan->interrupting_device];
 		int intspec = unit->intspec(unit);
 		LOG(L_CCHR, "CCHAR (ch:%i) device %i interrupt specification: %i", chan->num, chan->interrupting_device, intspec);
@@ -213,22 +222,33 @@ static int cchar_cmd_intspec(struct cchar_chan_t *chan, uint16_t *r_arg)
 
 
 // -----------------------------------------------------------------------
-static int cchar_chan_cmd(struct cchar_chan_t *chan, int dir, int cmd, int u_num, uint16_t *r_arg)
+static int cchar_chan_cmd(struct cchar_chan_t *chan, int pn, int dir, int cmd, int u_num, uint16_t *r_arg)
 {
+	// all CPUs except the one issuing the command
+	const int npn_mask = ((1 << io_cpu_count(chan->io)) - 1) & ~(1 << pn);
+
 	if (dir == IO_OU) {
 		switch (cmd) {
 		case CHAN_CMD_EXISTS:
 			LOG(L_CCHR, "CCHAR %i: command: check chan exists", chan->num);
 			break;
 		case CHAN_CMD_MASK_PN:
-			LOG(L_CCHR, "CCHAR %i: command: mask CPU", chan->num);
+			LOG(L_CCHR, "CCHAR %i: command: mask CPU %i", chan->num, pn);
+			pthread_mutex_lock(&chan->int_mutex);
+			chan->int_mask |= 1 << pn;
+			pthread_mutex_unlock(&chan->int_mutex);
 			break;
 		case CHAN_CMD_MASK_NPN:
-			LOG(L_CCHR, "CCHAR %i: command: mask ~CPU (ignored)", chan->num);
+			LOG(L_CCHR, "CCHAR %i: command: mask ~CPU %i%s", chan->num, pn, npn_mask ? "" : " (ignored, no other CPU)");
+			pthread_mutex_lock(&chan->int_mutex);
+			chan->int_mask |= npn_mask;
+			pthread_mutex_unlock(&chan->int_mutex);
 			break;
 		case CHAN_CMD_ASSIGN:
-			// nothing to assign, always assigned to CPU 0
-			LOG(L_CCHR, "CCHAR %i:%i: command: assign CPU (ignored)", chan->num, u_num);
+			LOG(L_CCHR, "CCHAR %i:%i: command: assign CPU %i", chan->num, u_num, pn);
+			pthread_mutex_lock(&chan->int_mutex);
+			chan->unit_cpu[u_num] = pn;
+			pthread_mutex_unlock(&chan->int_mutex);
 			break;
 		default:
 			LOG(L_CCHR, "CCHAR %i:%i: unknow command", chan->num, u_num);
@@ -242,10 +262,11 @@ static int cchar_chan_cmd(struct cchar_chan_t *chan, int dir, int cmd, int u_num
 			LOG(L_CCHR, "CCHAR %i: command: check chan exists", chan->num);
 			break;
 		case CHAN_CMD_INTSPEC:
-			return cchar_cmd_intspec(chan, r_arg);
+			return cchar_cmd_intspec(chan, pn, r_arg);
 		case CHAN_CMD_ALLOC:
-			// all units always working with CPU 0
-			*r_arg = 0;
+			pthread_mutex_lock(&chan->int_mutex);
+			*r_arg = chan->unit_cpu[u_num];
+			pthread_mutex_unlock(&chan->int_mutex);
 			LOG(L_CCHR, "CCHAR %i:%i: command: get allocation -> %i", chan->num, u_num, *r_arg);
 			break;
 		default:
@@ -259,24 +280,38 @@ static int cchar_chan_cmd(struct cchar_chan_t *chan, int dir, int cmd, int u_num
 }
 
 // -----------------------------------------------------------------------
-int cchar_cmd(void *ch, int dir, uint16_t n_arg, uint16_t *r_arg)
+int cchar_cmd(void *ch, int pn, int dir, uint16_t n_arg, uint16_t *r_arg)
 {
 	const unsigned cmd = (n_arg & 0b1111110000000000) >> 10;
 	const unsigned u_num = (n_arg & 0b0000000011100000) >> 5;
 	const unsigned is_chan_cmd = (cmd & 0b111000) == 0;
 
 	struct cchar_chan_t *chan = (struct cchar_chan_t *) ch;
+	int res;
+
+	// any command other than mask takes the interrupt mask off (for the issuing CPU)
+	pthread_mutex_lock(&chan->int_mutex);
+	int was_masked = chan->int_mask & (1 << pn);
+	chan->int_mask &= ~(1 << pn);
+	pthread_mutex_unlock(&chan->int_mutex);
 
 	if (is_chan_cmd) {
-		return cchar_chan_cmd(chan, dir, cmd, u_num, r_arg);
+		res = cchar_chan_cmd(chan, pn, dir, cmd, u_num, r_arg);
 	} else {
 		struct cchar_unit_proto_t *u = (struct cchar_unit_proto_t *) chan->unit[u_num];
 		if (u) {
-			return u->cmd(u, dir, cmd, r_arg);
+			res = u->cmd(u, dir, cmd, r_arg);
 		} else {
-			return IO_NO;
+			res = IO_NO;
 		}
 	}
+
+	// report interrupts held back by the mask
+	if (was_masked) {
+		cchar_int_trigger(chan);
+	}
+
+	return res;
 }
 
 // -----------------------------------------------------------------------
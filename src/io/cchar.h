@@ -27,6 +27,7 @@
 #define CCHAR_MAX_DEVICES 8
 #define CCHAR_INT_NONE 9999 // no interrupt (em400 marker)
 
+struct io;
 struct cchar_unit_proto_t;
 
 typedef struct cchar_unit_proto_t * (*cchar_unit_f_create)(em400_cfg *cfg, int ch_num, int dev_num);
@@ -53,23 +54,26 @@ struct cchar_unit_proto_t {
 };
 
 struct cchar_chan_t {
+	struct io *io;
 	int num;
 
 	pthread_mutex_t int_mutex;
-	int int_mask;
+	int int_mask; // bit set for each CPU the channel interrupts are masked for
 	int interrupting_device;
+	int int_cpu; // CPU the reported interrupt has been sent to
+	int unit_cpu[CCHAR_MAX_DEVICES]; // CPU each unit is allocated to
 	int was_en;
 	int untransmitted;
 
 	struct cchar_unit_proto_t *unit[CCHAR_MAX_DEVICES];
 };
 
-void *cchar_create(int num, em400_cfg *cfg);
+void *cchar_create(struct io *io, int num, em400_cfg *cfg);
 void cchar_shutdown(void *chan);
 void cchar_reset(void *chan);
 void cchar_int_trigger(struct cchar_chan_t *chan);
 void cchar_int_cancel(struct cchar_chan_t *chan, int unit_n);
-int cchar_cmd(void *chan, int dir, uint16_t n_arg, uint16_t *r_arg);
+int cchar_cmd(void *chan, int pn, int dir, uint16_t n_arg, uint16_t *r_arg);
 
 extern struct chan_drv cchar_chan_driver;
 
@@ -31,6 +31,7 @@
 #include "io/defs.h"
 #include "io/cchar_term.h"
 #include "io/dev/fdbridge.h"
+#include "ectl/metrics.h"
 
 #include "log.h"
 #include "cfg.h"
@@ -59,9 +60,6 @@ struct cchar_unit_proto_t * cchar_term_create(em400_cfg *cfg, int ch_num, int de
 			goto fail;
 		}
 		unit->term = fdb_open_tcp(port);
-		if (speed > 0) {
-			fdb_set_speed(unit->term, speed);
-		}
 	} else if (!strcasecmp(transport, "serial")) {
 		if (!device || (speed < 0)) {
 			LOGERR("Serial terminal needs both 'device' and 'speed' configuration.");
@@ -90,6 +88,16 @@ struct cchar_unit_proto_t * cchar_term_create(em400_cfg *cfg, int ch_num, int de
 
 	fdb_set_callback(unit->term, fdb_callback, unit);
 
+	// serial port is paced by the hardware, other transports are paced by the bridge
+	// at the configured line speed (no speed or 0 means unthrottled)
+	if (strcasecmp(transport, "serial") && (speed > 0)) {
+		fdb_set_speed(unit->term, speed);
+	}
+
+	const char *labels = "chan=\"%i\",unit=\"%i\",transport=\"%s\"";
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_term_received_bytes_total", "Bytes received from the terminal", &unit->bytes_in, labels, ch_num, dev_num, transport);
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_term_sent_bytes_total", "Bytes sent to the terminal", &unit->bytes_out, labels, ch_num, dev_num, transport);
+
 	return (struct cchar_unit_proto_t *) unit;
 
 fail:
@@ -170,6 +178,7 @@ int cchar_term_read(struct cchar_unit_term_t *unit, uint16_t *r_arg)
 		LOG(L_TERM, "Receive from terminal: %i (#%02x)", data, data);
 	}
 
+	unit->bytes_in++;
 	*r_arg = data;
 	return IO_OK;
 }
@@ -182,6 +191,8 @@ int cchar_term_write(struct cchar_unit_term_t *unit, uint16_t *r_arg)
 
 	if (fdb_write(unit->term, data) < 0) {
 		res = IO_EN;
+	} else {
+		unit->bytes_out++;
 	}
 
 	if ((data >= 32) && (data < 127)) {
@@ -30,6 +30,8 @@ struct cchar_unit_term_t {
 	struct cchar_unit_proto_t proto;
 	struct fdb *term;
 	int spec;
+	unsigned long bytes_in;		// updated by the CPU thread only
+	unsigned long bytes_out;	// updated by the CPU thread only
 };
 
 // commands
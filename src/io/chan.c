@@ -23,18 +23,20 @@
 #include "cfg.h"
 
 extern struct chan_drv cchar_chan_driver;
+extern struct chan_drv cmem_chan_driver;
 extern struct chan_drv mx_chan_driver;
 extern struct chan_drv it_chan_driver;
 
 const struct chan_drv *chan_drivers[] = {
 	&cchar_chan_driver,
+	&cmem_chan_driver,
 	&mx_chan_driver,
 	&it_chan_driver,
 	NULL
 };
 
 // -----------------------------------------------------------------------
-struct chan * chan_make(int num, const char *name, em400_cfg *cfg)
+struct chan * chan_make(struct io *io, int num, const char *name, em400_cfg *cfg)
 {
 	const struct chan_drv **cdriver = chan_drivers;
 
@@ -45,7 +47,7 @@ struct chan * chan_make(int num, const char *name, em400_cfg *cfg)
 				return NULL;
 			}
 			chan->drv = *cdriver;
-			chan->obj = chan->drv->create(num, cfg);
+			chan->obj = chan->drv->create(io, num, cfg);
 			if (!chan->obj) {
 				free(chan);
 				return NULL;
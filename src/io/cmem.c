@@ -22,12 +22,15 @@
 #include <strings.h>
 
 #include "io/io.h"
+#include "io/chan.h"
 #include "io/cmem.h"
 #include "io/cmem_m9425.h"
 
 #include "log.h"
+#include "cfg.h"
 
-#define CHAN ((struct cmem_chan_t *)(chan))
+#define NO_INTERRUPT_REPORTED -1
+#define NO_TRANSMISSION -1
 
 // unit prototypes
 struct cmem_unit_proto_t cmem_unit_proto[] = {
@@ -42,7 +45,7 @@ struct cmem_unit_proto_t cmem_unit_proto[] = {
 };
 
 // -----------------------------------------------------------------------
-struct cmem_unit_proto_t * cmem_unit_proto_get(struct cmem_unit_proto_t *proto, char *name)
+static struct cmem_unit_proto_t * cmem_unit_proto_get(struct cmem_unit_proto_t *proto, const char *name)
 {
 	while (proto && proto->name) {
 		if (strcasecmp(name, proto->name) == 0) {
@@ -54,33 +57,47 @@ struct cmem_unit_proto_t * cmem_unit_proto_get(struct cmem_unit_proto_t *proto,
 }
 
 // -----------------------------------------------------------------------
-struct chan * cmem_create(struct cfg_unit *units)
+void * cmem_create(struct io *io, int ch_num, em400_cfg *cfg)
 {
-	struct cmem_chan_t *chan = calloc(1, sizeof(struct cmem_chan_t));
+	struct cmem_chan_t *chan = (struct cmem_chan_t *) calloc(1, sizeof(struct cmem_chan_t));
+	if (!chan) {
+		LOGERR("Failed to allocate memory for memory channel %i.", ch_num);
+		return NULL;
+	}
+
+	chan->io = io;
+	chan->num = ch_num;
+	chan->int_reported = NO_INTERRUPT_REPORTED;
+	chan->transmitting = NO_TRANSMISSION;
+	for (int unit_n=0 ; unit_n<CMEM_MAX_DEVICES ; unit_n++) {
+		chan->int_unit[unit_n] = CMEM_INT_NONE;
+	}
 
-	pthread_mutexattr_t attr;
-	pthread_mutexattr_init(&attr);
-	pthread_mutex_init(&chan->transmit_mutex, &attr);
-	pthread_mutex_init(&chan->int_mutex, &attr);
+	if (pthread_mutex_init(&chan->int_mutex, NULL)) {
+		LOGERR("Failed to initialize memory channel interrupt mutex.");
+		free(chan);
+		return NULL;
+	}
 
-	// initialize units
-	struct cfg_unit *cunit = units;
-	while (cunit) {
+	for (int dev_num=0 ; dev_num<CMEM_MAX_DEVICES ; dev_num++) {
 		// find unit prototype
-		struct cmem_unit_proto_t *proto = cmem_unit_proto_get(cmem_unit_proto, cunit->name);
+		const char *unit_name = cfg_fgetstr(cfg, "dev%i.%i:type", ch_num, dev_num);
+		if (!unit_name) continue;
+		struct cmem_unit_proto_t *proto = cmem_unit_proto_get(cmem_unit_proto, unit_name);
 		if (!proto) {
-			LOGERR("Unknown device type or device incompatibile with channel: %s.", cunit->name);
-			free(chan);
+			LOGERR("Unknown device type or device incompatibile with channel: %s.", unit_name);
+			cmem_shutdown(chan);
 			return NULL;
 		}
 
-		LOG(L_CMEM, "Adding unit %i: %s", cunit->num, proto->name);
-
 		// create unit based on prototype
-		struct cmem_unit_proto_t *unit = proto->create(cunit->args);
+		struct cmem_unit_proto_t *unit = proto->create(cfg, ch_num, dev_num);
 		if (!unit) {
-			free(chan);
+			LOGERR("Failed to create unit: %s.", unit_name);
+			cmem_shutdown(chan);
 			return NULL;
+		} else {
+			LOG(L_CMEM, "Connected device %i: %s", dev_num, proto->name);
 		}
 
 		// fill in functions
@@ -92,139 +109,166 @@ struct chan * cmem_create(struct cfg_unit *units)
 
 		// remember the channel unit is connected to
 		unit->chan = chan;
-		unit->num = cunit->num;
-
-		CHAN->unit[unit->num] = unit;
-		cunit = cunit->next;
-	}
+		unit->num = dev_num;
 
-	// clear unit interrupts
-	pthread_mutex_lock(&chan->int_mutex);
-	for (int unit_n=0 ; unit_n<CMEM_MAX_DEVICES ; unit_n++) {
-		CHAN->int_unit[unit_n] = CMEM_INT_NONE;
+		chan->unit[dev_num] = unit;
 	}
-	pthread_mutex_unlock(&chan->int_mutex);
 
-
-	return (struct chan *) chan;
+	return (void *) chan;
 }
 
 // -----------------------------------------------------------------------
-void cmem_shutdown(struct chan *chan)
+void cmem_shutdown(void *chan)
 {
+	if (!chan) return;
+
+	struct cmem_chan_t *ch = (struct cmem_chan_t *) chan;
+
 	for (int i=0 ; i<CMEM_MAX_DEVICES ; i++) {
-		struct cmem_unit_proto_t *unit = CHAN->unit[i];
-		if (unit) {
-			unit->shutdown(unit);
-			CHAN->unit[i] = NULL;
+		struct cmem_unit_proto_t *u = ch->unit[i];
+		if (u) {
+			u->shutdown(u);
+			ch->unit[i] = NULL;
 		}
 	}
-	pthread_mutex_destroy(&CHAN->int_mutex);
-	pthread_mutex_destroy(&CHAN->transmit_mutex);
+	pthread_mutex_destroy(&ch->int_mutex);
 	free(chan);
 }
 
 // -----------------------------------------------------------------------
-void cmem_reset(struct cmem_chan_t *chan)
+void cmem_reset(void *chan)
 {
-	LOG(L_CMEM, "CMEM (ch:%i) reset", chan->num);
+	if (!chan) return;
+
+	struct cmem_chan_t *ch = (struct cmem_chan_t *) chan;
+
+	LOG(L_CMEM, "CMEM (ch:%i) reset", ch->num);
+
 	for (int i=0 ; i<CMEM_MAX_DEVICES ; i++) {
-		struct cmem_unit_proto_t *unit = CHAN->unit[i];
-		if (unit) {
-			unit->reset(unit);
+		struct cmem_unit_proto_t *u = ch->unit[i];
+		if (u) {
+			u->reset(u);
 		}
 	}
+
+	pthread_mutex_lock(&ch->int_mutex);
+	for (int unit_n=0 ; unit_n<CMEM_MAX_DEVICES ; unit_n++) {
+		ch->int_unit[unit_n] = CMEM_INT_NONE;
+	}
+	ch->int_reported = NO_INTERRUPT_REPORTED;
+	ch->int_mask = 0;
+	for (int unit_n=0 ; unit_n<CMEM_MAX_DEVICES ; unit_n++) {
+		ch->unit_cpu[unit_n] = 0;
+	}
+	ch->was_en = 0;
+	ch->untransmitted = 0;
+	ch->transmitting = NO_TRANSMISSION;
+	pthread_mutex_unlock(&ch->int_mutex);
 }
 
 // -----------------------------------------------------------------------
-void cmem_int_report(struct cmem_chan_t *chan)
+static void cmem_int_report(struct cmem_chan_t *chan)
 {
-	// if interrupt is reported and not yet served, there's nothing to do, for now
-	pthread_mutex_lock(&CHAN->int_mutex);
-	if (CHAN->int_reported) {
-		pthread_mutex_unlock(&CHAN->int_mutex);
-		return;
-	}
-	pthread_mutex_unlock(&CHAN->int_mutex);
-
-	// check if any unit reported interrupt
-	for (int unit_n=0 ; unit_n<CMEM_MAX_DEVICES ; unit_n++) {
-		pthread_mutex_lock(&CHAN->int_mutex);
-		if ((CHAN->int_unit[unit_n] != CMEM_INT_NONE) && !CHAN->int_mask) {
-			chan->int_reported = unit_n;
-			pthread_mutex_unlock(&CHAN->int_mutex);
-			LOG(L_CMEM, "CMEM (ch:%i) reporting interrupt %i", chan->num, chan->num + 12);
-			io_int_set(chan->num);
-			break;
-		} else {
-			pthread_mutex_unlock(&CHAN->int_mutex);
+	pthread_mutex_lock(&chan->int_mutex);
+	if (chan->int_reported != NO_INTERRUPT_REPORTED) {
+		// interrupt reported to the CPU but not yet served, nothing more to do
+		LOG(L_CMEM, "CMEM (ch:%i) not reporting interrupt. Reported by unit: %i has yet to be served", chan->num, chan->int_reported);
+	} else {
+		// report the interrupt of the first unit that has one,
+		// to the CPU the unit is allocated to, unless it's masked for that CPU
+		for (int unit_n=0 ; unit_n<CMEM_MAX_DEVICES ; unit_n++) {
+			int cpu = chan->unit_cpu[unit_n];
+			if ((chan->int_unit[unit_n] != CMEM_INT_NONE) && !(chan->int_mask & (1 << cpu))) {
+				LOG(L_CMEM, "CMEM (ch:%i) reporting interrupt from unit %i to CPU %i", chan->num, unit_n, cpu);
+				chan->int_reported = unit_n;
+				chan->int_cpu = cpu;
+				io_int_set_pn(chan->io, chan->num, cpu);
+				break;
+			}
 		}
 	}
+	pthread_mutex_unlock(&chan->int_mutex);
 }
 
 // -----------------------------------------------------------------------
 void cmem_int(struct cmem_chan_t *chan, int unit_n, int interrupt)
 {
 	LOG(L_CMEM, "CMEM (ch:%i) interrupt %i, unit: %i", chan->num, interrupt, unit_n);
-	pthread_mutex_lock(&CHAN->int_mutex);
-	if (interrupt < CHAN->int_unit[unit_n]) {
-		CHAN->int_unit[unit_n] = interrupt;
+
+	pthread_mutex_lock(&chan->int_mutex);
+	// lower number = higher priority
+	if (interrupt < chan->int_unit[unit_n]) {
+		chan->int_unit[unit_n] = interrupt;
 	}
-	pthread_mutex_unlock(&CHAN->int_mutex);
+	// every transmission ends with exactly one interrupt, channel is free again
+	if (chan->transmitting == unit_n) {
+		chan->transmitting = NO_TRANSMISSION;
+	}
+	pthread_mutex_unlock(&chan->int_mutex);
 
-	cmem_int_report(CHAN);
+	cmem_int_report(chan);
 }
 
 // -----------------------------------------------------------------------
-int cmem_cmd_intspec(struct chan *chan, uint16_t *r_arg)
+void cmem_untransmitted_set(struct cmem_chan_t *chan, int words)
 {
-	LOG(L_CMEM, "CMEM (ch:%i) command: intspec", chan->num);
+	pthread_mutex_lock(&chan->int_mutex);
+	chan->untransmitted = words;
+	pthread_mutex_unlock(&chan->int_mutex);
+}
 
-	pthread_mutex_lock(&CHAN->int_mutex);
-	if (CHAN->int_reported != -1) {
-		*r_arg = (CHAN->was_en << 15) | (CHAN->int_unit[CHAN->int_reported] << 8) | (CHAN->int_reported << 5);
+// -----------------------------------------------------------------------
+static int cmem_cmd_intspec(struct cmem_chan_t *chan, int pn, uint16_t *r_arg)
+{
+	pthread_mutex_lock(&chan->int_mutex);
+	// interrupt is specified only to the CPU it has been reported to
+	if ((chan->int_reported != NO_INTERRUPT_REPORTED) && (chan->int_cpu == pn)) {
+		int unit_n = chan->int_reported;
+		LOG(L_CMEM, "CMEM (ch:%i) device %i interrupt specification: %i", chan->num, unit_n, chan->int_unit[unit_n]);
+		*r_arg = (chan->was_en << 15) | (chan->int_unit[unit_n] << 8) | (unit_n << 5);
 		// mark interrupt as served
-		CHAN->int_unit[CHAN->int_reported] = CMEM_INT_NONE;
-		// nothing new reported
-		CHAN->int_reported = -1;
+		chan->int_unit[unit_n] = CMEM_INT_NONE;
+		chan->int_reported = NO_INTERRUPT_REPORTED;
+		chan->was_en = 0;
 	} else {
 		*r_arg = 0;
 	}
-	pthread_mutex_unlock(&CHAN->int_mutex);
-
-	// this is where we always unlock after transmission command
-	// (TODO: but may it be unlocked earlier by the unit?)
-	pthread_mutex_unlock(&CHAN->transmit_mutex);
+	pthread_mutex_unlock(&chan->int_mutex);
 
-	// report another interrupt if it's there
-	cmem_int_report(CHAN);
+	// try reporting another interrupt
+	cmem_int_report(chan);
 
 	return IO_OK;
 }
 
 // -----------------------------------------------------------------------
-int cmem_chan_cmd(struct chan *chan, int dir, int cmd, int u_num, uint16_t *r_arg)
+static int cmem_chan_cmd(struct cmem_chan_t *chan, int pn, int dir, int cmd, int u_num, uint16_t *r_arg)
 {
-	// any command makes channel take of the interrupt mask
-	pthread_mutex_lock(&CHAN->int_mutex);
-	CHAN->int_mask = 0;
-	pthread_mutex_unlock(&CHAN->int_mutex);
+	// all CPUs except the one issuing the command
+	const int npn_mask = ((1 << io_cpu_count(chan->io)) - 1) & ~(1 << pn);
 
 	if (dir == IO_OU) {
 		switch (cmd) {
 		case CHAN_CMD_EXISTS:
 			LOG(L_CMEM, "CMEM %i: command: check chan exists", chan->num);
 			break;
-		case CHAN_CMD_INTSPEC:
-			return cmem_cmd_intspec(chan, r_arg);
-		case CHAN_CMD_STATUS:
-			*r_arg = CHAN->untransmitted;
-			LOG(L_CMEM, "CMEM %i command: get status", chan->num);
+		case CHAN_CMD_MASK_PN:
+			LOG(L_CMEM, "CMEM %i: command: mask CPU %i", chan->num, pn);
+			pthread_mutex_lock(&chan->int_mutex);
+			chan->int_mask |= 1 << pn;
+			pthread_mutex_unlock(&chan->int_mutex);
 			break;
-		case CHAN_CMD_ALLOC:
-			// all units always working with CPU 0
-			*r_arg = 0;
-			LOG(L_CMEM, "CMEM %i:%i: command: get allocation -> %i", chan->num, u_num, *r_arg);
+		case CHAN_CMD_MASK_NPN:
+			LOG(L_CMEM, "CMEM %i: command: mask ~CPU %i%s", chan->num, pn, npn_mask ? "" : " (ignored, no other CPU)");
+			pthread_mutex_lock(&chan->int_mutex);
+			chan->int_mask |= npn_mask;
+			pthread_mutex_unlock(&chan->int_mutex);
+			break;
+		case CHAN_CMD_ASSIGN:
+			LOG(L_CMEM, "CMEM %i:%i: command: assign CPU %i", chan->num, u_num, pn);
+			pthread_mutex_lock(&chan->int_mutex);
+			chan->unit_cpu[u_num] = pn;
+			pthread_mutex_unlock(&chan->int_mutex);
 			break;
 		default:
 			LOG(L_CMEM, "CMEM %i:%i: unknow command", chan->num, u_num);
@@ -236,50 +280,106 @@ int cmem_chan_cmd(struct chan *chan, int dir, int cmd, int u_num, uint16_t *r_ar
 		case CHAN_CMD_EXISTS:
 			LOG(L_CMEM, "CMEM %i: command: check chan exists", chan->num);
 			break;
-		case CHAN_CMD_MASK_PN:
-			CHAN->int_mask = 1;
-			LOG(L_CMEM, "CMEM %i: command: mask CPU", chan->num);
-			break;
-		case CHAN_CMD_MASK_NPN:
-			LOG(L_CMEM, "CMEM %i: command: mask ~CPU -> ignored", chan->num);
-			// ignore 2nd CPU
+		case CHAN_CMD_STATUS:
+			pthread_mutex_lock(&chan->int_mutex);
+			*r_arg = chan->untransmitted;
+			pthread_mutex_unlock(&chan->int_mutex);
+			LOG(L_CMEM, "CMEM %i: command: get status -> %i", chan->num, *r_arg);
 			break;
-		case CHAN_CMD_ASSIGN:
-			LOG(L_CMEM, "CMEM %i: command: assign CPU -> ignored", chan->num);
-			// always for CPU 0
+		case CHAN_CMD_INTSPEC:
+			return cmem_cmd_intspec(chan, pn, r_arg);
+		case CHAN_CMD_ALLOC:
+			pthread_mutex_lock(&chan->int_mutex);
+			*r_arg = chan->unit_cpu[u_num];
+			pthread_mutex_unlock(&chan->int_mutex);
+			LOG(L_CMEM, "CMEM %i:%i: command: get allocation -> %i", chan->num, u_num, *r_arg);
 			break;
 		default:
-			LOG(L_CMEM, "CMEM %i:%i: unknow command", chan->num, u_num);
+			LOG(L_CMEM, "CMEM %i:%i: unknown command", chan->num, u_num);
 			// shouldn't happen, but as channel always reports OK...
 			break;
 		}
 	}
+
 	return IO_OK;
 }
 
 // -----------------------------------------------------------------------
-int cmem_cmd(struct chan *chan, int dir, uint16_t n_arg, uint16_t *r_arg)
+static int cmem_unit_cmd(struct cmem_chan_t *chan, struct cmem_unit_proto_t *u, int dir, int cmd, uint16_t *r_arg)
 {
-	int cmd		= (n_arg & 0b1111110000000000) >> 10;
-	int u_num	= (n_arg & 0b0000000011100000) >> 5;
-
-	if ((cmd & 0b111000) == 0) { // command for channel
-		return cmem_chan_cmd(chan, dir, cmd, u_num, r_arg);
-	} else { // command for unit
-	 	// transmission command
-	 	if ((cmd & 0b11100) == 0b11000) {
-			// only one transmission command at a time
-			int res = pthread_mutex_trylock(&CHAN->transmit_mutex);
-			if (res) {
-				return IO_EN;
-			}
+	const unsigned is_transmission = (dir == IO_OU) && ((cmd & 0b111000) == 0b110000);
+
+	if (!is_transmission) {
+		return u->cmd(u, dir, cmd, r_arg);
+	}
+
+	// only one transmission at a time
+	pthread_mutex_lock(&chan->int_mutex);
+	if (chan->transmitting != NO_TRANSMISSION) {
+		LOG(L_CMEM, "CMEM %i:%i: transmission rejected, unit %i is transmitting", chan->num, u->num, chan->transmitting);
+		chan->was_en = 1;
+		pthread_mutex_unlock(&chan->int_mutex);
+		return IO_EN;
+	}
+	chan->transmitting = u->num;
+	chan->untransmitted = 0;
+	pthread_mutex_unlock(&chan->int_mutex);
+
+	int res = u->cmd(u, dir, cmd, r_arg);
+
+	if (res != IO_OK) {
+		pthread_mutex_lock(&chan->int_mutex);
+		if (chan->transmitting == u->num) {
+			chan->transmitting = NO_TRANSMISSION;
 		}
-		if (CHAN->unit[u_num]) {
-			return CHAN->unit[u_num]->cmd(CHAN->unit[u_num], dir, cmd, r_arg);
+		pthread_mutex_unlock(&chan->int_mutex);
+	}
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int cmem_cmd(void *ch, int pn, int dir, uint16_t n_arg, uint16_t *r_arg)
+{
+	const unsigned cmd = (n_arg & 0b1111110000000000) >> 10;
+	const unsigned u_num = (n_arg & 0b0000000011100000) >> 5;
+	const unsigned is_chan_cmd = (cmd & 0b111000) == 0;
+
+	struct cmem_chan_t *chan = (struct cmem_chan_t *) ch;
+	int res;
+
+	// any command other than mask takes the interrupt mask off (for the issuing CPU)
+	pthread_mutex_lock(&chan->int_mutex);
+	int was_masked = chan->int_mask & (1 << pn);
+	chan->int_mask &= ~(1 << pn);
+	pthread_mutex_unlock(&chan->int_mutex);
+
+	if (is_chan_cmd) {
+		res = cmem_chan_cmd(chan, pn, dir, cmd, u_num, r_arg);
+	} else {
+		struct cmem_unit_proto_t *u = chan->unit[u_num];
+		if (u) {
+			res = cmem_unit_cmd(chan, u, dir, cmd, r_arg);
 		} else {
-			return IO_NO;
+			res = IO_NO;
 		}
 	}
+
+	// report interrupts held back by the mask
+	if (was_masked) {
+		cmem_int_report(chan);
+	}
+
+	return res;
 }
 
+// -----------------------------------------------------------------------
+struct chan_drv cmem_chan_driver = {
+	.name = "mem",
+	.create = cmem_create,
+	.shutdown = cmem_shutdown,
+	.reset = cmem_reset,
+	.cmd = cmem_cmd
+};
+
 // vim: tabstop=4 shiftwidth=4 autoindent
@@ -21,13 +21,14 @@
 #include <inttypes.h>
 #include <pthread.h>
 
-#include "io/chan.h"
+#include "cfg.h"
 
 #define CMEM_MAX_DEVICES 8
 
+struct io;
 struct cmem_unit_proto_t;
 
-typedef struct cmem_unit_proto_t * (*cmem_unit_f_create)(struct cfg_arg *args);
+typedef struct cmem_unit_proto_t * (*cmem_unit_f_create)(em400_cfg *cfg, int ch_num, int dev_num);
 typedef void (*cmem_unit_f_shutdown)(struct cmem_unit_proto_t *unit);
 typedef void (*cmem_unit_f_reset)(struct cmem_unit_proto_t *unit);
 typedef int (*cmem_unit_f_cmd)(struct cmem_unit_proto_t *unit, int dir, int cmd, uint16_t *r_arg);
@@ -47,16 +48,19 @@ struct cmem_unit_proto_t {
 };
 
 struct cmem_chan_t {
+	struct io *io;
 	int num;
 
 	pthread_mutex_t int_mutex;
-	int int_mask;
+	int int_mask; // bit set for each CPU the channel interrupts are masked for
 	int int_unit[CMEM_MAX_DEVICES];
 	int int_reported;
+	int int_cpu; // CPU the reported interrupt has been sent to
+	int unit_cpu[CMEM_MAX_DEVICES]; // CPU each unit is allocated to
 	int was_en;
 	int untransmitted;
+	int transmitting; // unit doing the transmission, -1 if channel is free
 
-	pthread_mutex_t transmit_mutex;
 	struct cmem_unit_proto_t *unit[CMEM_MAX_DEVICES];
 };
 
@@ -69,11 +73,14 @@ enum cmem_int_e {
 	CMEM_INT_NONE		= 9999,// no interrupt (em400 marker)
 };
 
-struct chan * cmem_create(struct cfg_unit *units);
-void cmem_shutdown(struct chan *chan);
-void cmem_reset(struct chan *chan);
+void * cmem_create(struct io *io, int ch_num, em400_cfg *cfg);
+void cmem_shutdown(void *chan);
+void cmem_reset(void *chan);
 void cmem_int(struct cmem_chan_t *chan, int unit_n, int interrupt);
-int cmem_cmd(struct chan *chan, int dir, uint16_t n_arg, uint16_t *r_arg);
+void cmem_untransmitted_set(struct cmem_chan_t *chan, int words);
+int cmem_cmd(void *chan, int pn, int dir, uint16_t n_arg, uint16_t *r_arg);
+
+extern struct chan_drv cmem_chan_driver;
 
 #endif
 
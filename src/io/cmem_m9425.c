@@ -15,182 +15,189 @@
 //  Foundation, Inc.,
 //  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <pthread.h>
 
+#include "atomic.h"
+#include "io/defs.h"
+#include "io/io.h"
+#include "io/cmem.h"
 #include "io/cmem_m9425.h"
+#include "utils/utils.h"
+#include "ectl/metrics.h"
+#include "cfg.h"
 
 #include "log.h"
 
 #define UNIT ((struct cmem_unit_m9425_t *)(unit))
 
+#define M9425_INT_NONE 0
+
+enum m9425_states {
+	M9425ST_IDLE,		// waiting for a command
+	M9425ST_NTR,		// transmission with a new control field requested
+	M9425ST_OTR,		// transmission with the old control field requested
+	M9425ST_TRANSMIT,	// transmission in progress
+	M9425ST_QUIT,
+};
+
+enum m9425_platters {
+	M9425_FIXED		= 0,
+	M9425_REMOVABLE	= 1,
+};
+
+static const char *m9425_platter_name[] = { "fixed", "removable" };
+static const int m9425_platter_type[] = { E4I_T_HDD, E4I_T_HDC };
+
+static void * cmem_m9425_worker(void *ptr);
+
 // -----------------------------------------------------------------------
-struct cmem_unit_proto_t * cmem_m9425_create(struct cfg_arg *args)
+static struct e4i_t * m9425_disk_open(const char *image, int platter)
 {
-	char *image_name[2] = { NULL, NULL };
-	struct cmem_unit_m9425_t *unit = calloc(1, sizeof(struct cmem_unit_m9425_t));
-	int res;
+	struct e4i_t *disk = e4i_open(image);
 
-	if (!unit) {
-		LOGERR("Failed to allocate memory for unit: %s.", args->text);
-		goto fail;
+	if (!disk) {
+		LOGERR("Error opening MERA 9425 %s disk image \"%s\": %s.", m9425_platter_name[platter], image, e4i_get_err(e4i_err));
+		return NULL;
 	}
 
-	if ((image_name[0] || image_name[1]) && !strcmp(image_name[0], image_name[1])) {
-		LOGERR("Error opening image: \"%s\". Trying to use the same image for fixed and removable disk.", image_name[0]);
+	if (disk->img_type != m9425_platter_type[platter]) {
+		LOGERR("Error opening MERA 9425 %s disk image \"%s\": wrong image type.", m9425_platter_name[platter], image);
 		goto fail;
 	}
 
-	res = cfg_args_decode(args, "ss", &image_name[0], &image_name[1]);
-	if (res != E_OK) {
-		LOGERR("Failed to parse MERA 9425 image names from string: \"%s\".", args->text);
+	if ((disk->cylinders != CMEM_M9425_CYLINDERS)
+		|| (disk->heads != CMEM_M9425_HEADS)
+		|| (disk->spt != CMEM_M9425_SPT)
+		|| (disk->block_size != CMEM_M9425_SECTOR_SIZE)
+		|| (disk->id_size != CMEM_M9425_ID_SIZE)) {
+		LOGERR("Error opening MERA 9425 %s disk image \"%s\": wrong geometry.", m9425_platter_name[platter], image);
 		goto fail;
 	}
 
-	for (int i=0 ; i<=1 ; i++) {
-		UNIT->disk[i] = e4i_open(image_name[i]);
+	LOG(L_9425, "MERA 9425 %s disk: cyl=%i, head=%i, spt=%i, sector=%i, image=%s",
+		m9425_platter_name[platter], disk->cylinders, disk->heads, disk->spt, disk->block_size, image);
 
-		if (!UNIT->disk[i]) {
-			LOGERR("Error opening image \"%s\": %s.", image_name[i], e4i_get_err(e4i_err));
-			goto fail;
-		}
+	return disk;
 
-		if (UNIT->disk[i]->img_type != E4I_T_HDD) {
-			LOGERR("Error opening image \"%s\": wrong image type, expecting hdd.", image_name[i]);
-			goto fail;
-		}
+fail:
+	e4i_close(disk);
+	return NULL;
+}
 
-		if ((UNIT->disk[i]->cylinders != 203) || (UNIT->disk[i]->heads != 2) || (UNIT->disk[i]->spt != 12) || (UNIT->disk[i]->block_size != 512)) {
-			LOGERR("Error opening image \"%s\": wrong geometry.", image_name[i]);
+// -----------------------------------------------------------------------
+struct cmem_unit_proto_t * cmem_m9425_create(em400_cfg *cfg, int ch_num, int dev_num)
+{
+	struct cmem_unit_m9425_t *unit = (struct cmem_unit_m9425_t *) calloc(1, sizeof(struct cmem_unit_m9425_t));
+	if (!unit) {
+		LOGERR("Failed to allocate memory for MERA 9425: %i.%i", ch_num, dev_num);
+		return NULL;
+	}
+
+	// cmem_m9425_shutdown() cleans up after any failure below, it needs both initialized
+	if (pthread_mutex_init(&unit->state_mutex, NULL)) {
+		LOGERR("Failed to initialize MERA 9425 state mutex.");
+		free(unit);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&unit->state_cond, NULL)) {
+		LOGERR("Failed to initialize MERA 9425 state cond.");
+		pthread_mutex_destroy(&unit->state_mutex);
+		free(unit);
+		return NULL;
+	}
+
+	const char *image[2];
+	image[M9425_FIXED] = cfg_fgetstr(cfg, "dev%i.%i:image_fixed", ch_num, dev_num);
+	image[M9425_REMOVABLE] = cfg_fgetstr(cfg, "dev%i.%i:image_removable", ch_num, dev_num);
+
+	if (image[M9425_FIXED] && image[M9425_REMOVABLE] && !strcmp(image[M9425_FIXED], image[M9425_REMOVABLE])) {
+		LOGERR("Error opening image: \"%s\". Trying to use the same image for fixed and removable disk.", image[M9425_FIXED]);
+		goto fail;
+	}
+
+	for (int i=M9425_FIXED ; i<=M9425_REMOVABLE ; i++) {
+		if (!image[i]) continue;
+		unit->disk[i] = m9425_disk_open(image[i], i);
+		if (!unit->disk[i]) {
 			goto fail;
 		}
-		LOG(L_9425, "MERA 9425 (plate %i): cyl=%i, head=%i, sectors=%i, spt=%i, image=%s", i, UNIT->disk[i]->cylinders, UNIT->disk[i]->heads, UNIT->disk[i]->spt, UNIT->disk[i]->block_size, image_name[i]);
-		free(image_name[i]);
-		image_name[i] = NULL;
 	}
 
-	res = pthread_create(&unit->worker, NULL, cmem_m9425_worker, (void*) unit);
-	if (res != 0) {
-		LOGERR("Failed to spawn 9425 worker thread.");
+	unit->state = M9425ST_IDLE;
+
+	if (pthread_create(&unit->worker, NULL, cmem_m9425_worker, unit)) {
+		LOGERR("Failed to spawn MERA 9425 worker thread.");
 		goto fail;
 	}
 
 	pthread_setname_np(unit->worker, "m9425");
 
+	for (int dir=IO_OU ; dir<=IO_IN ; dir++) {
+		const char *labels = "chan=\"%i\",unit=\"%i\",drive=\"mera9425\",dir=\"%s\"";
+		const char *dir_name = dir == IO_IN ? "read" : "write";
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_disk_sectors_total", "Disk sectors transferred", unit->sectors + dir, labels, ch_num, dev_num, dir_name);
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_disk_bytes_total", "Disk bytes transferred", unit->bytes + dir, labels, ch_num, dev_num, dir_name);
+	}
+
 	return (struct cmem_unit_proto_t *) unit;
 
 fail:
-	for (int i=0 ; i<=1 ; i++) {
-		free(image_name[i]);
-	}
-	cmem_m9425_shutdown((struct cmem_unit_proto_t*) unit);
+	cmem_m9425_shutdown((struct cmem_unit_proto_t *) unit);
 	return NULL;
 }
 
 // -----------------------------------------------------------------------
 void cmem_m9425_shutdown(struct cmem_unit_proto_t *unit)
 {
-	if (unit) {
-		for (int i=0 ; i<=1 ; i++) {
-			e4i_close(UNIT->disk[i]);
-			UNIT->disk[i] = NULL;
-		}
-		free(UNIT);
+	if (!unit) return;
+
+	if (UNIT->worker) {
+		pthread_mutex_lock(&UNIT->state_mutex);
+		UNIT->state = M9425ST_QUIT;
+		atom_add_release(&UNIT->gen, 1);
+		pthread_cond_signal(&UNIT->state_cond);
+		pthread_mutex_unlock(&UNIT->state_mutex);
+		pthread_join(UNIT->worker, NULL);
 	}
-}
 
-// -----------------------------------------------------------------------
-void cmem_m9425_reset(struct cmem_unit_proto_t *unit)
-{
-	// TODO: przerwij transmisję
-}
+	pthread_mutex_destroy(&UNIT->state_mutex);
+	pthread_cond_destroy(&UNIT->state_cond);
 
-// -----------------------------------------------------------------------
-void * cmem_m9425_worker(void *th_id)
-{
-	struct cmem_unit_proto_t *unit = th_id;
-	while (1) {
-		switch (UNIT->worker_trans_type) {
-			case CMEM_M9425_RD:
-				break;
-			case CMEM_M9425_RA:
-				break;
-			case CMEM_M9425_WD:
-				break;
-			case CMEM_M9425_WA:
-				break;
-			default:
-				break;
-		}
+	for (int i=M9425_FIXED ; i<=M9425_REMOVABLE ; i++) {
+		e4i_close(UNIT->disk[i]);
 	}
-
-	pthread_exit(NULL);
+	free(UNIT);
 }
 
 // -----------------------------------------------------------------------
-int cmem_m9425_cmd(struct cmem_unit_proto_t *unit, int dir, int cmd, uint16_t *r_arg)
+void cmem_m9425_reset(struct cmem_unit_proto_t *unit)
 {
-	if (dir == IO_IN) {
-		switch (cmd) {
-			case CMEM_M9425_CMD_TEST:
-				if (pthread_mutex_trylock(&unit->chan->transmit_mutex) == 0) {
-					pthread_mutex_unlock(&unit->chan->transmit_mutex);
-					return IO_OK;
-				} else {
-					return IO_EN;
-				}
-				break;
-			case CMEM_M9425_CMD_TSR:
-				// TODO: zwróć status sektora z ostatio czytanego pola adresowego
-				*r_arg = 0;
-				break;
-			case CMEM_M9425_CMD_TCH:
-				break;
-			default:
-				break;
-		}
-	} else {
-		switch (cmd) {
-			case CMEM_M9425_CMD_ZER:
-				cmem_m9425_reset(unit);
-				cmem_int(unit->chan, unit->num, CMEM_M9425_INT_ZER);
-				break;
-			case CMEM_M9425_CMD_OTR:
-				break;
-			case CMEM_M9425_CMD_NTR:
-				break;
-			case CMEM_M9425_CMD_SEEK:
-				// trrrr.. done.
-				cmem_int(unit->chan, unit->num, CMEM_M9425_INT_SEEK);
-				break;
-			case CMEM_M9425_CMD_RTZ:
-				// trrrr.. also done.
-				cmem_int(unit->chan, unit->num, CMEM_M9425_INT_RTZ);
-				break;
-			case CMEM_M9425_CMD_SELOFF:
-				if (pthread_mutex_trylock(&unit->chan->transmit_mutex) == 0) {
-					pthread_mutex_unlock(&unit->chan->transmit_mutex);
-					return IO_OK;
-				} else {
-					return IO_EN;
-				}
-			case CMEM_M9425_CMD_RES:
-				cmem_int(unit->chan, unit->num, CMEM_M9425_INT_RES);
-				break;
-			default:
-				break;
-		}
+	LOG(L_9425, "reset");
+
+	pthread_mutex_lock(&UNIT->state_mutex);
+	if (UNIT->state != M9425ST_QUIT) {
+		UNIT->state = M9425ST_IDLE;
 	}
-	return IO_OK;
+	// abandon any ongoing transmission
+	atom_add_release(&UNIT->gen, 1);
+	UNIT->cf_valid = 0;
+	UNIT->cyl = 0;
+	UNIT->sector_status = 0;
+	pthread_mutex_unlock(&UNIT->state_mutex);
 }
 
 // -----------------------------------------------------------------------
-int cmem_m9425_decode_cf_t(int addr, struct cmem_m9425_cf_t *cf)
+static void m9425_cf_decode(uint16_t *data, struct cmem_m9425_cf_t *cf)
 {
-	uint16_t data[7];
-	mem_read(0, addr, data, 7);
-
 	cf->cf_len			= (data[0] & 0b0000111100000000) >> 8;
 	cf->cpu				= (data[0] & 0b0000000000010000) >> 4;
 	cf->nb				= (data[0] & 0b0000000000001111);
@@ -206,9 +213,354 @@ int cmem_m9425_decode_cf_t(int addr, struct cmem_m9425_cf_t *cf)
 	cf->sector			= (data[4] & 0b0000000000001111);
 	cf->key				= data[5];
 	cf->addr			= data[6];
+}
+
+// -----------------------------------------------------------------------
+static int m9425_cf_check(struct cmem_m9425_cf_t *cf)
+{
+	if ((cf->cf_len != 7) || (cf->len == 0) || (cf->cyl >= CMEM_M9425_CYLINDERS) || (cf->sector >= CMEM_M9425_SPT)) {
+		return CMEM_M9425_INT_CF;
+	}
+	return M9425_INT_NONE;
+}
+
+// -----------------------------------------------------------------------
+static int m9425_id_check(struct cmem_unit_m9425_t *unit, struct cmem_m9425_cf_t *cf, uint8_t *id)
+{
+	const int id_cyl = ((id[0] & 1) << 8) | id[1];
+	const int id_head = id[2] & 1;
+	const int id_sector = id[3];
+	const int id_key = (id[4] << 8) | id[5];
+	const uint16_t id_status = (id[6] << 8) | id[7];
+
+	unit->sector_status = id_status;
+
+	if (id_cyl != cf->cyl) return CMEM_M9425_INT_CYL;
+	if (id_head != cf->head) return CMEM_M9425_INT_HEAD;
+	if (id_sector != cf->sector) return CMEM_M9425_INT_SECTOR;
+	if (!cf->ign_key && (id_key != cf->key)) return CMEM_M9425_INT_KEY;
+	if (!cf->ign_defects && (id_status & CMEM_M9425_SST_DEFECT)) return CMEM_M9425_INT_SECT_PROTECT;
+	if (!cf->ign_wrprotect && (cf->oper == CMEM_M9425_WD) && (id_status & CMEM_M9425_SST_WRPROTECT)) return CMEM_M9425_INT_WRPROTECT;
+
+	return M9425_INT_NONE;
+}
+
+// -----------------------------------------------------------------------
+static int m9425_sector_transmit(struct cmem_unit_m9425_t *unit, struct e4i_t *disk, struct cmem_m9425_cf_t *cf, int words)
+{
+	uint8_t id[CMEM_M9425_ID_SIZE];
+	uint8_t *buf = (uint8_t *) unit->buf;
+	int res;
+
+	// all operations but formatting need the sector address field to match
+	if (cf->oper != CMEM_M9425_WA) {
+		res = e4i_sread_id(disk, id, unit->cyl, cf->head, cf->sector);
+		if (res != E4I_E_OK) {
+			LOG(L_9425, "Address field read error: %s", e4i_get_err(res));
+			return CMEM_M9425_INT_CRC_ADR;
+		}
+		res = m9425_id_check(unit, cf, id);
+		if (res != M9425_INT_NONE) {
+			LOG(L_9425, "Address field check failed: cyl=%i, head=%i, sector=%i, interrupt %i", unit->cyl, cf->head, cf->sector, res);
+			return res;
+		}
+	}
+
+	switch (cf->oper) {
+	case CMEM_M9425_RD:
+		res = e4i_sread(disk, buf, unit->cyl, cf->head, cf->sector);
+		if (res != E4I_E_OK) {
+			LOG(L_9425, "Sector read error: %s", e4i_get_err(res));
+			return CMEM_M9425_INT_CRC_DATA;
+		}
+		endianswap(unit->buf, words);
+		if (!io_mem_write_n(unit->proto.chan->io, cf->nb, cf->addr, unit->buf, words)) {
+			return CMEM_INT_NOMEM;
+		}
+		unit->sectors[IO_IN]++;
+		unit->bytes[IO_IN] += 2 * words;
+		break;
+	case CMEM_M9425_WD:
+		if (!io_mem_read_n(unit->proto.chan->io, cf->nb, cf->addr, unit->buf, words)) {
+			return CMEM_INT_NOMEM;
+		}
+		// partial sector is padded with zeros
+		memset(unit->buf + words, 0, CMEM_M9425_SECTOR_SIZE - 2*words);
+		endianswap(unit->buf, words);
+		res = e4i_swrite(disk, buf, unit->cyl, cf->head, cf->sector, CMEM_M9425_SECTOR_SIZE);
+		if (res != E4I_E_OK) {
+			LOG(L_9425, "Sector write error: %s", e4i_get_err(res));
+			return (res == E4I_E_WRPROTECT) ? CMEM_M9425_INT_WRPROTECT : CMEM_M9425_INT_ALARM;
+		}
+		unit->sectors[IO_OU]++;
+		unit->bytes[IO_OU] += 2 * words;
+		break;
+	case CMEM_M9425_RA:
+		memcpy(buf, id, CMEM_M9425_ID_SIZE);
+		endianswap(unit->buf, words);
+		if (!io_mem_write_n(unit->proto.chan->io, cf->nb, cf->addr, unit->buf, words)) {
+			return CMEM_INT_NOMEM;
+		}
+		break;
+	case CMEM_M9425_WA:
+		memset(buf, 0, CMEM_M9425_ID_SIZE);
+		if (!io_mem_read_n(unit->proto.chan->io, cf->nb, cf->addr, unit->buf, words)) {
+			return CMEM_INT_NOMEM;
+		}
+		endianswap(unit->buf, words);
+		res = e4i_swrite_id(disk, buf, unit->cyl, cf->head, cf->sector);
+		if (res != E4I_E_OK) {
+			LOG(L_9425, "Address field write error: %s", e4i_get_err(res));
+			return (res == E4I_E_WRPROTECT) ? CMEM_M9425_INT_WRPROTECT : CMEM_M9425_INT_ALARM;
+		}
+		unit->sector_status = (buf[6] << 8) | buf[7];
+		break;
+	}
 
-	return E_OK;
+	return M9425_INT_NONE;
 }
 
+// -----------------------------------------------------------------------
+static int m9425_transmit(struct cmem_unit_m9425_t *unit, unsigned gen)
+{
+	struct cmem_m9425_cf_t *cf = &unit->cf;
+	struct e4i_t *disk = unit->disk[cf->platter];
+	const int sector_words = (cf->oper & 1) ? CMEM_M9425_ID_SIZE/2 : CMEM_M9425_SECTOR_SIZE/2;
+	int interrupt = M9425_INT_NONE;
+
+	LOG(L_9425, "Transmission: oper=%i, %s disk, cyl=%i, head=%i, sector=%i, len=%i, memory %i:0x%04x",
+		cf->oper, m9425_platter_name[cf->platter], cf->cyl, cf->head, cf->sector, cf->len, cf->nb, cf->addr);
+
+	if (!disk) {
+		return CMEM_M9425_INT_NODEV;
+	}
+
+	int left = cf->len;
+	while (left > 0) {
+		// reset abandons the transmission
+		if (atom_load_acquire(&unit->gen) != gen) {
+			return M9425_INT_NONE;
+		}
+
+		const int words = (left < sector_words) ? left : sector_words;
+		interrupt = m9425_sector_transmit(unit, disk, cf, words);
+		if (interrupt != M9425_INT_NONE) {
+			break;
+		}
+
+		cf->addr += words;
+		left -= words;
+
+		// next sector, then next head, there is no implied seek to the next cylinder
+		if (++cf->sector >= CMEM_M9425_SPT) {
+			cf->sector = 0;
+			if (++cf->head >= CMEM_M9425_HEADS) {
+				cf->head = 0;
+				cf->cyl++;
+				if (left > 0) {
+					interrupt = CMEM_M9425_INT_CYL_END;
+					break;
+				}
+			}
+		}
+	}
+
+	cmem_untransmitted_set(unit->proto.chan, left);
+
+	// OTR continues where this transmission ended
+	if (left > 0) {
+		cf->len = left;
+	}
+
+	return (interrupt == M9425_INT_NONE) ? CMEM_M9425_INT_DONE : interrupt;
+}
+
+// -----------------------------------------------------------------------
+static int m9425_cf_load(struct cmem_unit_m9425_t *unit, uint16_t cf_addr)
+{
+	uint16_t data[7];
+
+	if (!io_mem_read_n(unit->proto.chan->io, 0, cf_addr, data, 7)) {
+		return CMEM_INT_NOMEM;
+	}
+
+	m9425_cf_decode(data, &unit->cf);
+
+	return m9425_cf_check(&unit->cf);
+}
+
+// -----------------------------------------------------------------------
+static void * cmem_m9425_worker(void *ptr)
+{
+	struct cmem_unit_m9425_t *unit = (struct cmem_unit_m9425_t *) ptr;
+	int interrupt;
+	int state;
+	unsigned gen;
+	uint16_t cf_addr;
+	int cf_valid;
+	bool quit = false;
+
+	while (!quit) {
+		pthread_mutex_lock(&unit->state_mutex);
+		while ((unit->state == M9425ST_IDLE) || (unit->state == M9425ST_TRANSMIT)) {
+			pthread_cond_wait(&unit->state_cond, &unit->state_mutex);
+		}
+		state = unit->state;
+		gen = atom_load_acquire(&unit->gen);
+		cf_addr = unit->cf_addr;
+		if (state != M9425ST_QUIT) {
+			unit->state = M9425ST_TRANSMIT;
+		}
+		pthread_mutex_unlock(&unit->state_mutex);
+
+		interrupt = M9425_INT_NONE;
+
+		switch (state) {
+		case M9425ST_QUIT:
+			quit = true;
+			break;
+		case M9425ST_NTR:
+			interrupt = m9425_cf_load(unit, cf_addr);
+			pthread_mutex_lock(&unit->state_mutex);
+			unit->cf_valid = (interrupt == M9425_INT_NONE) && (atom_load_acquire(&unit->gen) == gen);
+			pthread_mutex_unlock(&unit->state_mutex);
+			if (interrupt == M9425_INT_NONE) {
+				interrupt = m9425_transmit(unit, gen);
+			}
+			break;
+		case M9425ST_OTR:
+			pthread_mutex_lock(&unit->state_mutex);
+			cf_valid = unit->cf_valid;
+			pthread_mutex_unlock(&unit->state_mutex);
+			if (cf_valid) {
+				interrupt = m9425_transmit(unit, gen);
+			} else {
+				interrupt = CMEM_M9425_INT_CF;
+			}
+			break;
+		}
+
+		if (quit) break;
+
+		// report only if the transmission hasn't been abandoned meanwhile
+		pthread_mutex_lock(&unit->state_mutex);
+		const bool current = (atom_load_acquire(&unit->gen) == gen);
+		if (current) {
+			unit->state = M9425ST_IDLE;
+		}
+		pthread_mutex_unlock(&unit->state_mutex);
+
+		if (current && (interrupt != M9425_INT_NONE)) {
+			cmem_int(unit->proto.chan, unit->proto.num, interrupt);
+		}
+	}
+
+	LOG(L_9425, "Leaving MERA 9425 worker loop");
+	pthread_exit(NULL);
+}
+
+// -----------------------------------------------------------------------
+static bool m9425_busy(struct cmem_unit_m9425_t *unit)
+{
+	pthread_mutex_lock(&unit->state_mutex);
+	const bool busy = (unit->state != M9425ST_IDLE);
+	pthread_mutex_unlock(&unit->state_mutex);
+	return busy;
+}
+
+// -----------------------------------------------------------------------
+static int m9425_cmd_transmit(struct cmem_unit_m9425_t *unit, int state, uint16_t cf_addr)
+{
+	int io_ret;
+
+	pthread_mutex_lock(&unit->state_mutex);
+	if (unit->state == M9425ST_IDLE) {
+		unit->state = state;
+		unit->cf_addr = cf_addr;
+		pthread_cond_signal(&unit->state_cond);
+		io_ret = IO_OK;
+	} else {
+		io_ret = IO_EN;
+	}
+	pthread_mutex_unlock(&unit->state_mutex);
+
+	return io_ret;
+}
+
+// -----------------------------------------------------------------------
+static int m9425_cmd_seek(struct cmem_unit_m9425_t *unit, int cyl, int interrupt)
+{
+	pthread_mutex_lock(&unit->state_mutex);
+	if (unit->state != M9425ST_IDLE) {
+		pthread_mutex_unlock(&unit->state_mutex);
+		return IO_EN;
+	}
+	if (cyl < CMEM_M9425_CYLINDERS) {
+		unit->cyl = cyl;
+	} else {
+		interrupt = CMEM_M9425_INT_NOSEEK;
+	}
+	pthread_mutex_unlock(&unit->state_mutex);
+
+	// trrrr.. done.
+	cmem_int(unit->proto.chan, unit->proto.num, interrupt);
+
+	return IO_OK;
+}
+
+// -----------------------------------------------------------------------
+int cmem_m9425_cmd(struct cmem_unit_proto_t *unit, int dir, int cmd, uint16_t *r_arg)
+{
+	if (dir == IO_IN) {
+		switch (cmd) {
+		case CMEM_M9425_CMD_TEST:
+			LOG(L_9425, "command: test");
+			return m9425_busy(UNIT) ? IO_EN : IO_OK;
+		case CMEM_M9425_CMD_TSR:
+			pthread_mutex_lock(&UNIT->state_mutex);
+			*r_arg = UNIT->sector_status;
+			pthread_mutex_unlock(&UNIT->state_mutex);
+			LOG(L_9425, "command: get sector status -> 0x%04x", *r_arg);
+			break;
+		case CMEM_M9425_CMD_TCH:
+			LOG(L_9425, "command: device test");
+			break;
+		default:
+			LOG(L_9425, "unknown IN command: %i", cmd);
+			break;
+		}
+	} else {
+		switch (cmd) {
+		case CMEM_M9425_CMD_ZER:
+			LOG(L_9425, "command: reset");
+			cmem_m9425_reset(unit);
+			cmem_int(unit->chan, unit->num, CMEM_M9425_INT_ZER);
+			break;
+		case CMEM_M9425_CMD_OTR:
+			LOG(L_9425, "command: transmit with old addresses");
+			return m9425_cmd_transmit(UNIT, M9425ST_OTR, 0);
+		case CMEM_M9425_CMD_NTR:
+			LOG(L_9425, "command: transmit with new addresses, control field at 0x%04x", *r_arg);
+			return m9425_cmd_transmit(UNIT, M9425ST_NTR, *r_arg);
+		case CMEM_M9425_CMD_SEEK:
+			LOG(L_9425, "command: seek to cylinder %i", *r_arg & 0b111111111);
+			return m9425_cmd_seek(UNIT, *r_arg & 0b111111111, CMEM_M9425_INT_SEEK);
+		case CMEM_M9425_CMD_RTZ:
+			LOG(L_9425, "command: return to cylinder 0");
+			return m9425_cmd_seek(UNIT, 0, CMEM_M9425_INT_RTZ);
+		case CMEM_M9425_CMD_SELOFF:
+			LOG(L_9425, "command: disconnect");
+			return m9425_busy(UNIT) ? IO_EN : IO_OK;
+		case CMEM_M9425_CMD_RES:
+			LOG(L_9425, "command: device test");
+			cmem_int(unit->chan, unit->num, CMEM_M9425_INT_RES);
+			break;
+		default:
+			LOG(L_9425, "unknown OU command: %i", cmd);
+			break;
+		}
+	}
+	return IO_OK;
+}
 
 // vim: tabstop=4 shiftwidth=4 autoindent
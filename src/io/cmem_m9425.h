@@ -22,6 +22,7 @@
 
 #include "io/dev/e4image.h"
 #include "io/cmem.h"
+#include "cfg.h"
 
 // cmem control field - modes of operation
 enum cmem_m9425_transmission_type_e {
@@ -74,14 +75,15 @@ enum cmem_m9425_int_e {
 	CMEM_M9425_INT_DONE			= 035, // transmission finished OK
 };
 
-struct cmem_unit_m9425_t {
-	struct cmem_unit_proto_t proto;
-	struct e4i_t *disk[2];
+#define CMEM_M9425_CYLINDERS	203
+#define CMEM_M9425_HEADS		2
+#define CMEM_M9425_SPT			12
+#define CMEM_M9425_SECTOR_SIZE	512
+#define CMEM_M9425_ID_SIZE		10
 
-	pthread_t worker;
-	int worker_trans_type;
-	int worker_addr;
-};
+// sector status field bits (address field bytes 6-7)
+#define CMEM_M9425_SST_WRPROTECT	0b1000000000000000 // sector is write protected
+#define CMEM_M9425_SST_DEFECT		0b0100000000000000 // sector is marked as defective
 
 // --- transmit ----------------------------------------------------------
 struct cmem_m9425_cf_t {
@@ -102,14 +104,34 @@ struct cmem_m9425_cf_t {
 	uint16_t addr;
 };
 
-struct cmem_unit_proto_t * cmem_m9425_create(struct cfg_arg *args);
+struct cmem_unit_m9425_t {
+	struct cmem_unit_proto_t proto;
+	struct e4i_t *disk[2];
+
+	pthread_t worker;
+	pthread_mutex_t state_mutex;
+	pthread_cond_t state_cond;
+	int state;
+	unsigned gen;
+
+	uint16_t cf_addr;
+	struct cmem_m9425_cf_t cf;
+	int cf_valid;
+	int cyl;
+	uint16_t sector_status;
+
+	uint16_t buf[CMEM_M9425_SECTOR_SIZE/2];
+
+	// traffic counters [IO_OU/IO_IN], updated by the worker thread only
+	unsigned long sectors[2];
+	unsigned long bytes[2];
+};
+
+struct cmem_unit_proto_t * cmem_m9425_create(em400_cfg *cfg, int ch_num, int dev_num);
 void cmem_m9425_shutdown(struct cmem_unit_proto_t *unit);
 void cmem_m9425_reset(struct cmem_unit_proto_t *unit);
-void * cmem_m9425_worker(void *th_id);
 int cmem_m9425_cmd(struct cmem_unit_proto_t *unit, int dir, int cmd, uint16_t *r_arg);
 
-int cmem_m9425_decode_cf_t(int addr, struct cmem_m9425_cf_t *cf);
-
 #endif
 
 // vim: tabstop=4 shiftwidth=4 autoindent
@@ -28,6 +28,7 @@ extern struct dev_drv dev_punchrd;
 extern struct dev_drv dev_puncher;
 extern struct dev_drv dev_terminal;
 extern struct dev_drv dev_printer;
+extern struct dev_drv dev_tape;
 
 const struct dev_drv *dev_drivers[] = {
 	&dev_winch,
@@ -36,6 +37,7 @@ const struct dev_drv *dev_drivers[] = {
 	&dev_puncher,
 	&dev_terminal,
 	&dev_printer,
+	&dev_tape,
 	NULL
 };
 
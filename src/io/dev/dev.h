@@ -32,6 +32,10 @@ enum dev_cmd_status {
 	DEV_CMD_WRERR,
 	DEV_CMD_RDERR,
 	DEV_CMD_ERR,
+	DEV_CMD_TAPEMARK,
+	DEV_CMD_BOT,
+	DEV_CMD_EOT,
+	DEV_CMD_TOOLONG,
 };
 
 struct dev_chs {
@@ -48,6 +52,11 @@ typedef int (*dev_sector_rd_f)(void *dev, uint8_t *buf, struct dev_chs *chs);
 typedef int (*dev_sector_wr_f)(void *dev, uint8_t *buf, struct dev_chs *chs);
 typedef int (*dev_char_rd_f)(void *dev, uint8_t *c);
 typedef int (*dev_char_wr_f)(void *dev, uint8_t *c);
+typedef int (*dev_rec_rd_f)(void *dev, uint8_t *buf, unsigned max_len, unsigned *len);
+typedef int (*dev_rec_wr_f)(void *dev, uint8_t *buf, unsigned len);
+typedef int (*dev_mark_wr_f)(void *dev);
+typedef int (*dev_rec_skip_f)(void *dev, int count, int marks, unsigned *skipped);
+typedef int (*dev_rewind_f)(void *dev);
 
 struct dev_drv {
 	const char *name;
@@ -58,6 +67,11 @@ struct dev_drv {
 	dev_sector_wr_f sector_wr;
 	dev_char_rd_f char_rd;
 	dev_char_wr_f char_wr;
+	dev_rec_rd_f rec_rd;
+	dev_rec_wr_f rec_wr;
+	dev_mark_wr_f mark_wr;
+	dev_rec_skip_f rec_skip;
+	dev_rewind_f rewind;
 };
 
 int dev_make(em400_cfg *cfg, int ch_num, int dev_num, const struct dev_drv **dev_drv, void **dev_obj);
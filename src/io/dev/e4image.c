@@ -16,6 +16,7 @@
 //  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #define _XOPEN_SOURCE 500
+#define _FILE_OFFSET_BITS 64
 
 #include <inttypes.h>
 #include <stdlib.h>
@@ -23,6 +24,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -33,6 +35,14 @@
 
 int e4i_err;
 
+// images are filled and imported in batches of this many bytes
+#define E4I_BATCH_BYTES (1024 * 1024)
+
+// compressed images are split into groups of about this many bytes
+#define E4I_GROUP_BYTES (64 * 1024)
+// sanity limit for groups in images being opened
+#define E4I_GROUP_MAX_BYTES (16 * 1024 * 1024)
+
 struct e4i_errdesc_t errdesc[] = {
 	{ E4I_E_OK, "OK" },
 	{ E4I_E_EXISTS, "image already exists" },
@@ -60,6 +70,13 @@ struct e4i_errdesc_t errdesc[] = {
 	{ E4I_E_GENF_MISSING, "missing ID field generatr function" },
 	{ E4I_E_GENF_UNNEEDED, "ID field generatr function specified, but ID size is 0" },
 	{ E4I_E_IDGEN, "could not generate ID filed for sector" },
+	{ E4I_E_BASE_OPEN, "cannot open overlay base image" },
+	{ E4I_E_BASE_MISMATCH, "overlay base image geometry mismatch" },
+	{ E4I_E_NOT_OVERLAY, "not an overlay image" },
+	{ E4I_E_OVERLAY_ACCESS, "overlays are supported only for CHS/LBA media" },
+	{ E4I_E_COMPRESSED, "operation not supported for compressed images" },
+	{ E4I_E_COMPRESSED_ACCESS, "compression is supported only for CHS/LBA media" },
+	{ E4I_E_DECOMPRESS, "compressed block group is damaged" },
 
 	{ E4I_E_UNKNOWN, "unknown error" }
 };
@@ -70,6 +87,16 @@ void e4i_close(struct e4i_t *e)
 	if (e) {
 		if (e->image) fclose(e->image);
 		if (e->img_name) free(e->img_name);
+		e4i_close(e->base);
+		free(e->bitmap);
+		free(e->group_pos);
+		if (e->cache) {
+			for (int i=0 ; i<E4I_GROUP_CACHE ; i++) {
+				free(e->cache[i].data);
+			}
+			free(e->cache);
+		}
+		free(e->zbuf);
 		free(e);
 	}
 }
@@ -96,18 +123,30 @@ void e4i_header_print(struct e4i_t *e)
 	printf(" Magic        : %c%c%c%c\n", e->magic[0], e->magic[1], e->magic[2], e->magic[3]);
 	printf(" Version      : %i.%i\n", e->v_major, e->v_minor);
 	printf(" Image type   : %i (user type: %i)\n", e->img_type, e->img_utype);
-	printf(" Flags        : %s%s%s%s%s%s%s\n",
+	printf(" Flags        : %s%s%s%s%s%s%s%s%s\n",
 		e->flags&E4I_F_FORMATTED ? "formatted " : "unformatted ",
 		e->flags&E4I_F_WRPROTECT ? "wrprotect " : "",
 		e->flags&E4I_F_REMOVABLE ? "removable " : "",
 		e->flags&E4I_F_MASTERCOPY ? "master " : "",
 		e->flags&E4I_F_CHS ? "chs " : "",
 		e->flags&E4I_F_LBA ? "lba " : "",
-		e->flags&E4I_F_APPEND ? "append " : "");
+		e->flags&E4I_F_APPEND ? "append " : "",
+		e->flags&E4I_F_OVERLAY ? "overlay " : "",
+		e->flags&E4I_F_COMPRESSED ? "compressed " : "");
 	printf(" Total blocks : %i\n", e->blocks);
 	printf(" CHS geometry : %i / %i / %i\n", e->cylinders, e->heads, e->spt);
 	printf(" ID size      : %i\n", e->id_size);
 	printf(" Block size   : %i\n", e->block_size);
+	if (e->base) {
+		printf(" Base image   : %s\n", e->base->img_name);
+		printf(" Overlay      : %i blocks\n", e4i_overlay_blocks(e));
+	}
+	if (e->group_pos) {
+		uint64_t raw = (uint64_t) e->blocks * (e->id_size + e->block_size);
+		uint64_t packed = e->group_pos[e->groups] - e->group_pos[0];
+		printf(" Groups       : %i x %i blocks\n", e->groups, e->group_blocks);
+		printf(" Compressed   : %"PRIu64" bytes (%.1f%% of %"PRIu64")\n", packed, raw ? 100.0 * packed / raw : 0, raw);
+	}
 	printf("--------------------------------------\n");
 }
 
@@ -227,7 +266,420 @@ static int __e4i_header_check(struct e4i_t *e)
 }
 
 // -----------------------------------------------------------------------
-struct e4i_t * e4i_open(const char *img_name)
+static uint32_t __e4i_bitmap_size(struct e4i_t *e)
+{
+	return (e->blocks + 7) / 8;
+}
+
+// -----------------------------------------------------------------------
+static uint64_t __e4i_overlay_data_offset(struct e4i_t *e)
+{
+	// start blocks at a page boundary, so the image file stays nicely sparse
+	return E4I_OVERLAY_BITMAP_POS + ((__e4i_bitmap_size(e) + 4095) & ~4095);
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_overlay_check_base(struct e4i_t *e, struct e4i_t *base)
+{
+	if ((base->flags & E4I_F_APPEND) || !(base->flags & (E4I_F_CHS | E4I_F_LBA))) {
+		return E4I_E_OVERLAY_ACCESS;
+	}
+	if (!(base->flags & E4I_F_FORMATTED)) {
+		return E4I_E_UNFORMATTED;
+	}
+	if ((base->blocks != e->blocks)
+	|| (base->cylinders != e->cylinders) || (base->heads != e->heads) || (base->spt != e->spt)
+	|| (base->id_size != e->id_size) || (base->block_size != e->block_size)) {
+		return E4I_E_BASE_MISMATCH;
+	}
+	return E4I_E_OK;
+}
+
+static struct e4i_t * __e4i_open(const char *img_name, const char *mode);
+
+// -----------------------------------------------------------------------
+static int __e4i_overlay_load(struct e4i_t *e)
+{
+	uint8_t len_buf[2];
+	char base_name[E4I_OVERLAY_NAME_MAX+1];
+
+	if (fseeko(e->image, E4I_HEADER_SIZE, SEEK_SET)) {
+		return E4I_E_HEADER_READ;
+	}
+	if (fread(len_buf, 1, 2, e->image) != 2) {
+		return E4I_E_HEADER_READ;
+	}
+	unsigned len = (len_buf[0] << 8) | len_buf[1];
+	if ((len == 0) || (len > E4I_OVERLAY_NAME_MAX)) {
+		return E4I_E_HEADER_READ;
+	}
+	if (fread(base_name, 1, len, e->image) != len) {
+		return E4I_E_HEADER_READ;
+	}
+	base_name[len] = '\0';
+
+	// base image is never written through an overlay (only when merging)
+	e->base = __e4i_open(base_name, "rb");
+	if (!e->base) {
+		return E4I_E_BASE_OPEN;
+	}
+	int res = __e4i_overlay_check_base(e, e->base);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	e->bitmap = (uint8_t *) calloc(1, __e4i_bitmap_size(e));
+	if (!e->bitmap) {
+		return E4I_E_ALLOC;
+	}
+	if (fseeko(e->image, E4I_OVERLAY_BITMAP_POS, SEEK_SET)) {
+		return E4I_E_HEADER_READ;
+	}
+	if (fread(e->bitmap, 1, __e4i_bitmap_size(e), e->image) != __e4i_bitmap_size(e)) {
+		return E4I_E_HEADER_READ;
+	}
+
+	e->data_offset = __e4i_overlay_data_offset(e);
+
+	return E4I_E_OK;
+}
+
+// block compression
+//
+// Groups are compressed with a small LZ4 block format codec: a sequence of
+// token (literals count : match length), literals, 16-bit little-endian
+// match offset. Last bytes of a group are always literals.
+
+#define E4I_LZ_MINMATCH 4
+#define E4I_LZ_LAST_LITERALS 5
+#define E4I_LZ_MFLIMIT 12
+#define E4I_LZ_MAX_OFFSET 65535
+#define E4I_LZ_HASH_BITS 12
+
+// -----------------------------------------------------------------------
+static unsigned __e4i_lz_hash(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761U) >> (32 - E4I_LZ_HASH_BITS);
+}
+
+// -----------------------------------------------------------------------
+static uint8_t * __e4i_lz_put_len(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+// -----------------------------------------------------------------------
+static uint8_t * __e4i_lz_put_seq(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len)
+{
+	// worst case length of the sequence
+	if ((size_t) (oend - op) < 1 + lit_len/255 + 1 + lit_len + 2 + match_len/255 + 1) {
+		return NULL;
+	}
+
+	uint8_t *token = op++;
+	*token = (lit_len >= 15 ? 15 : lit_len) << 4;
+	if (lit_len >= 15) {
+		op = __e4i_lz_put_len(op, lit_len - 15);
+	}
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	// last sequence has literals only
+	if (offset) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		match_len -= E4I_LZ_MINMATCH;
+		*token |= match_len >= 15 ? 15 : match_len;
+		if (match_len >= 15) {
+			op = __e4i_lz_put_len(op, match_len - 15);
+		}
+	}
+
+	return op;
+}
+
+// -----------------------------------------------------------------------
+static size_t __e4i_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+	uint32_t htab[1 << E4I_LZ_HASH_BITS] = { 0 };
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *iend = src + len;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + cap;
+
+	if (len > E4I_LZ_MFLIMIT) {
+		const uint8_t *mflimit = iend - E4I_LZ_MFLIMIT;
+		const uint8_t *matchlimit = iend - E4I_LZ_LAST_LITERALS;
+		ip++;
+		while (ip < mflimit) {
+			unsigned h = __e4i_lz_hash(ip);
+			const uint8_t *ref = src + htab[h];
+			htab[h] = ip - src;
+			if ((ip - ref > E4I_LZ_MAX_OFFSET) || memcmp(ref, ip, E4I_LZ_MINMATCH)) {
+				ip++;
+				continue;
+			}
+			// match found, extend it both ways
+			while ((ip > anchor) && (ref > src) && (ip[-1] == ref[-1])) {
+				ip--;
+				ref--;
+			}
+			const uint8_t *mp = ip + E4I_LZ_MINMATCH;
+			const uint8_t *rp = ref + E4I_LZ_MINMATCH;
+			while ((mp < matchlimit) && (*mp == *rp)) {
+				mp++;
+				rp++;
+			}
+			op = __e4i_lz_put_seq(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+			if (!op) {
+				return 0;
+			}
+			ip = anchor = mp;
+			if (ip < mflimit) {
+				htab[__e4i_lz_hash(ip - 2)] = ip - 2 - src;
+			}
+		}
+	}
+
+	op = __e4i_lz_put_seq(op, oend, anchor, iend - anchor, 0, 0);
+	if (!op) {
+		return 0;
+	}
+
+	return op - dst;
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_lz_get_len(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+	do {
+		if (*ip >= iend) {
+			return -1;
+		}
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+static long __e4i_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = src + len;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + cap;
+
+	// image contents may be damaged, check everything
+	while (ip < iend) {
+		unsigned token = *ip++;
+		size_t lit_len = token >> 4;
+		if ((lit_len == 15) && __e4i_lz_get_len(&ip, iend, &lit_len)) {
+			return -1;
+		}
+		if ((lit_len > (size_t) (iend - ip)) || (lit_len > (size_t) (oend - op))) {
+			return -1;
+		}
+		memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		if (ip == iend) {
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return -1;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (size_t) (op - dst))) {
+			return -1;
+		}
+		size_t match_len = token & 15;
+		if ((match_len == 15) && __e4i_lz_get_len(&ip, iend, &match_len)) {
+			return -1;
+		}
+		match_len += E4I_LZ_MINMATCH;
+		if (match_len > (size_t) (oend - op)) {
+			return -1;
+		}
+		const uint8_t *match = op - offset;
+		if (offset >= match_len) {
+			memcpy(op, match, match_len);
+		} else if (offset == 1) {
+			memset(op, *match, match_len);
+		} else {
+			// overlapping copy repeats the pattern
+			for (size_t i=0 ; i<match_len ; i++) {
+				op[i] = match[i];
+			}
+		}
+		op += match_len;
+	}
+
+	return op - dst;
+}
+
+// -----------------------------------------------------------------------
+static uint64_t __e4i_get64(const uint8_t *p)
+{
+	uint64_t v = 0;
+	for (int i=0 ; i<8 ; i++) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+// -----------------------------------------------------------------------
+static void __e4i_put64(uint8_t *p, uint64_t v)
+{
+	for (int i=7 ; i>=0 ; i--) {
+		p[i] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+// -----------------------------------------------------------------------
+static unsigned __e4i_group_len(struct e4i_t *e, uint32_t group)
+{
+	uint32_t first = group * e->group_blocks;
+	uint32_t count = (e->blocks - first < e->group_blocks) ? e->blocks - first : e->group_blocks;
+	return count * (e->id_size + e->block_size);
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_compressed_load(struct e4i_t *e)
+{
+	uint8_t buf[8];
+	unsigned csize = e->id_size + e->block_size;
+
+	if (fseeko(e->image, E4I_HEADER_SIZE, SEEK_SET)) {
+		return E4I_E_HEADER_READ;
+	}
+	if (fread(buf, 1, 8, e->image) != 8) {
+		return E4I_E_HEADER_READ;
+	}
+	e->group_blocks = ntohl(*(uint32_t*)buf);
+	e->groups = ntohl(*(uint32_t*)(buf+4));
+	if ((e->group_blocks == 0) || ((uint64_t) e->group_blocks * csize > E4I_GROUP_MAX_BYTES)) {
+		return E4I_E_HEADER_READ;
+	}
+	if (e->groups != (e->blocks + (uint64_t) e->group_blocks - 1) / e->group_blocks) {
+		return E4I_E_HEADER_READ;
+	}
+
+	e->group_pos = (uint64_t *) calloc(e->groups + 1, sizeof(uint64_t));
+	e->cache = (struct e4i_group_cache *) calloc(E4I_GROUP_CACHE, sizeof(struct e4i_group_cache));
+	e->zbuf = (uint8_t *) malloc(e->group_blocks * csize);
+	if (!e->group_pos || !e->cache || !e->zbuf) {
+		return E4I_E_ALLOC;
+	}
+
+	uint64_t data_start = E4I_COMPRESSED_INDEX_POS + (uint64_t) (e->groups + 1) * 8;
+	for (uint32_t g=0 ; g<=e->groups ; g++) {
+		if (fread(buf, 1, 8, e->image) != 8) {
+			return E4I_E_HEADER_READ;
+		}
+		e->group_pos[g] = __e4i_get64(buf);
+		if ((g == 0) && (e->group_pos[g] != data_start)) {
+			return E4I_E_HEADER_READ;
+		}
+		// group is never stored larger than uncompressed
+		if ((g > 0) && ((e->group_pos[g] < e->group_pos[g-1]) || (e->group_pos[g] - e->group_pos[g-1] > __e4i_group_len(e, g-1)))) {
+			return E4I_E_HEADER_READ;
+		}
+	}
+
+	// last group ends where the file ends, truncated images are rejected right away
+	if (fseeko(e->image, 0, SEEK_END) || (ftello(e->image) != (off_t) e->group_pos[e->groups])) {
+		return E4I_E_HEADER_READ;
+	}
+
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_group_get(struct e4i_t *e, uint32_t group, uint8_t **data)
+{
+	struct e4i_group_cache *slot = e->cache;
+
+	for (int i=0 ; i<E4I_GROUP_CACHE ; i++) {
+		struct e4i_group_cache *c = e->cache + i;
+		if (c->used && (c->group == group)) {
+			c->used = ++e->cache_tick;
+			*data = c->data;
+			return E4I_E_OK;
+		}
+		if (c->used < slot->used) {
+			slot = c;
+		}
+	}
+
+	// not cached, reuse the least recently used slot
+	unsigned len = __e4i_group_len(e, group);
+	unsigned zlen = e->group_pos[group+1] - e->group_pos[group];
+	slot->used = 0;
+	if (!slot->data) {
+		slot->data = (uint8_t *) malloc(e->group_blocks * (e->id_size + e->block_size));
+		if (!slot->data) {
+			return E4I_E_ALLOC;
+		}
+	}
+
+	if (fseeko(e->image, e->group_pos[group], SEEK_SET)) {
+		return E4I_E_NO_SECTOR;
+	}
+	if (zlen == len) {
+		if (fread(slot->data, 1, len, e->image) != len) {
+			return E4I_E_READ;
+		}
+	} else {
+		if (fread(e->zbuf, 1, zlen, e->image) != zlen) {
+			return E4I_E_READ;
+		}
+		if (__e4i_lz_decompress(e->zbuf, zlen, slot->data, len) != len) {
+			return E4I_E_DECOMPRESS;
+		}
+	}
+
+	slot->group = group;
+	slot->used = ++e->cache_tick;
+	*data = slot->data;
+
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_compressed_read(struct e4i_t *e, uint8_t *buf, int block, int boffset, int struct_size)
+{
+	uint8_t *data;
+
+	if ((block < 0) || (block >= e->blocks)) {
+		return E4I_E_NO_SECTOR;
+	}
+
+	int res = __e4i_group_get(e, block / e->group_blocks, &data);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	unsigned csize = e->id_size + e->block_size;
+	memcpy(buf, data + (block % e->group_blocks) * csize + boffset, struct_size);
+
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static struct e4i_t * __e4i_open(const char *img_name, const char *mode)
 {
 	int res;
 	e4i_err = E4I_E_OK;
@@ -239,7 +691,7 @@ struct e4i_t * e4i_open(const char *img_name)
 	}
 
 	// open image
-	e->image = fopen(img_name, "rb+");
+	e->image = fopen(img_name, mode);
 	if (!e->image) {
 		e4i_err = E4I_E_OPEN;
 		e4i_close(e);
@@ -263,10 +715,34 @@ struct e4i_t * e4i_open(const char *img_name)
 	}
 
 	e->cur_pos = 0;
+	e->data_offset = E4I_HEADER_SIZE;
 	e->img_name = strdup(img_name);
+
+	if (e->flags & E4I_F_OVERLAY) {
+		res = __e4i_overlay_load(e);
+		if (res != E4I_E_OK) {
+			e4i_err = res;
+			e4i_close(e);
+			return NULL;
+		}
+	} else if (e->flags & E4I_F_COMPRESSED) {
+		res = __e4i_compressed_load(e);
+		if (res != E4I_E_OK) {
+			e4i_err = res;
+			e4i_close(e);
+			return NULL;
+		}
+	}
+
 	return e;
 }
 
+// -----------------------------------------------------------------------
+struct e4i_t * e4i_open(const char *img_name)
+{
+	return __e4i_open(img_name, "rb+");
+}
+
 // -----------------------------------------------------------------------
 static struct e4i_t * __e4i_create(char *img_name, uint16_t id_size, uint16_t block_size, uint16_t cylinders, uint8_t heads, uint8_t spt, uint32_t blocks, uint32_t flags)
 {
@@ -296,7 +772,7 @@ static struct e4i_t * __e4i_create(char *img_name, uint16_t id_size, uint16_t bl
 	// fill header data
 	memcpy(e->magic, E4I_MAGIC, 4);
 	e->v_major = E4I_IMAGE_V_MAJOR;
-	e->v_minor = E4I_IMAGE_V_MINOR;
+	e->v_minor = (flags & E4I_F_COMPRESSED) ? 2 : (flags & E4I_F_OVERLAY) ? 1 : 0;
 	e->flags = flags;
 	e->cylinders = cylinders;
 	e->heads = heads;
@@ -305,6 +781,7 @@ static struct e4i_t * __e4i_create(char *img_name, uint16_t id_size, uint16_t bl
 	e->id_size = id_size;
 	e->block_size = block_size;
 	e->cur_pos = 0;
+	e->data_offset = E4I_HEADER_SIZE;
 	e->img_name = strdup(img_name);
 
 	int res;
@@ -342,13 +819,13 @@ struct e4i_t * e4i_create_seq(char *img_name, uint16_t id_size, uint16_t block_s
 static int __e4i_write_ignore_flags(struct e4i_t *e, uint8_t *buf, int block, int bytes, int boffset, int max_bytes)
 {
 	int res;
-	int csize = e->id_size + e->block_size;
+	off_t csize = e->id_size + e->block_size;
 
 	if (bytes > max_bytes) {
 		return E4I_E_WRITE;
 	}
 
-	res = fseek(e->image, E4I_HEADER_SIZE + block*csize + boffset, SEEK_SET);
+	res = fseeko(e->image, e->data_offset + block*csize + boffset, SEEK_SET);
 	if (res < 0) {
 		return E4I_E_NO_SECTOR;
 	}
@@ -362,6 +839,28 @@ static int __e4i_write_ignore_flags(struct e4i_t *e, uint8_t *buf, int block, in
 
 }
 
+// -----------------------------------------------------------------------
+static unsigned __e4i_batch_blocks(struct e4i_t *e)
+{
+	unsigned batch = E4I_BATCH_BYTES / (e->id_size + e->block_size);
+	return batch ? batch : 1;
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_write_blocks(struct e4i_t *e, uint8_t *buf, uint32_t block, int count)
+{
+	off_t csize = e->id_size + e->block_size;
+
+	if (fseeko(e->image, e->data_offset + block*csize, SEEK_SET)) {
+		return E4I_E_NO_SECTOR;
+	}
+	if (fwrite(buf, csize, count, e->image) != count) {
+		return E4I_E_WRITE;
+	}
+
+	return E4I_E_OK;
+}
+
 // -----------------------------------------------------------------------
 int e4i_import(struct e4i_t *e, char *src_name, uint16_t img_type, uint16_t img_utype)
 {
@@ -395,16 +894,22 @@ int e4i_import(struct e4i_t *e, char *src_name, uint16_t img_type, uint16_t img_
 	}
 
 	int ret = E4I_E_OK;
-	unsigned bufsize = e->id_size + e->block_size;
-	uint8_t *buf = (uint8_t *) calloc(bufsize, 1);
+	unsigned csize = e->id_size + e->block_size;
+	unsigned batch = __e4i_batch_blocks(e);
+	uint8_t *buf = (uint8_t *) malloc(batch * csize);
+	if (!buf) {
+		fclose(source);
+		return E4I_E_ALLOC;
+	}
 
-	for (long s=0 ; s < source_len/bufsize ; s++) {
-		if (fread(buf, 1, bufsize, source) != bufsize) {
+	const long blocks = source_len / csize;
+	for (long s=0 ; s<blocks ; s+=batch) {
+		int count = (blocks-s < batch) ? blocks-s : batch;
+		if (fread(buf, csize, count, source) != count) {
 			ret = E4I_E_SOURCE_READ;
 			break;
 		}
-		// write block
-		ret = __e4i_write_ignore_flags(e, buf, s, bufsize, 0, bufsize);
+		ret = __e4i_write_blocks(e, buf, s, count);
 		if (ret != E4I_E_OK) {
 			break;
 		}
@@ -436,23 +941,38 @@ static int __e4i_init_disk(struct e4i_t *e, e4i_id_gen_f *genf, uint16_t img_typ
 	}
 
 	int ret = E4I_E_OK;
-	int bufsize = e->id_size + e->block_size;
-	uint8_t *buf = (uint8_t *) calloc(bufsize, 1);
-	uint8_t *id_buf = (uint8_t *) calloc(e->id_size, 1);
-
-	for (long s=0 ; s<e->blocks ; s++) {
-		if (genf) {
-			if (genf(e, id_buf, e->id_size, s) != e->id_size) {
-				ret = E4I_E_IDGEN;
+	off_t csize = e->id_size + e->block_size;
+
+	if (!genf) {
+		// media is filled with zeros only, just set the file size
+		// and let the filesystem create a sparse file
+		if (fflush(e->image) || ftruncate(fileno(e->image), e->data_offset + e->blocks * csize)) {
+			return E4I_E_FILL;
+		}
+	} else {
+		// data area is all zeros, only ID fields are generated
+		unsigned batch = __e4i_batch_blocks(e);
+		uint8_t *buf = (uint8_t *) calloc(batch, csize);
+		if (!buf) {
+			return E4I_E_ALLOC;
+		}
+		for (long s=0 ; s<e->blocks ; s+=batch) {
+			int count = (e->blocks-s < batch) ? e->blocks-s : batch;
+			for (int i=0 ; i<count ; i++) {
+				if (genf(e, buf + i*csize, e->id_size, s+i) != e->id_size) {
+					ret = E4I_E_IDGEN;
+					break;
+				}
+			}
+			if (ret != E4I_E_OK) {
+				break;
+			}
+			ret = __e4i_write_blocks(e, buf, s, count);
+			if (ret != E4I_E_OK) {
 				break;
 			}
-			memcpy(buf, id_buf, e->id_size);
-		}
-		// write block
-		ret = __e4i_write_ignore_flags(e, buf, s, bufsize, 0, bufsize);
-		if (ret != E4I_E_OK) {
-			break;
 		}
+		free(buf);
 	}
 
 	if (ret == E4I_E_OK) {
@@ -462,8 +982,6 @@ static int __e4i_init_disk(struct e4i_t *e, e4i_id_gen_f *genf, uint16_t img_typ
 		ret = __e4i_header_write(e);
 	}
 
-	free(buf);
-	free(id_buf);
 	return ret;
 }
 
@@ -499,10 +1017,22 @@ static int __e4i_read(struct e4i_t *e, uint8_t *buf, int block, int boffset, int
 		return E4I_E_UNFORMATTED;
 	}
 
+	// blocks not (yet) in the overlay are read from the base image
+	if (e->base) {
+		if ((block < 0) || (block >= e->blocks)) {
+			return E4I_E_NO_SECTOR;
+		}
+		if (!(e->bitmap[block >> 3] & (1 << (block & 7)))) {
+			return __e4i_read(e->base, buf, block, boffset, struct_size);
+		}
+	} else if (e->flags & E4I_F_COMPRESSED) {
+		return __e4i_compressed_read(e, buf, block, boffset, struct_size);
+	}
+
 	int res;
-	int csize = e->id_size + e->block_size;
+	off_t csize = e->id_size + e->block_size;
 
-	res = fseek(e->image, E4I_HEADER_SIZE + block*csize + boffset, SEEK_SET);
+	res = fseeko(e->image, e->data_offset + block*csize + boffset, SEEK_SET);
 	if (res < 0) {
 		return E4I_E_NO_SECTOR;
 	}
@@ -515,10 +1045,53 @@ static int __e4i_read(struct e4i_t *e, uint8_t *buf, int block, int boffset, int
 	return E4I_E_OK;
 }
 
+// -----------------------------------------------------------------------
+static int __e4i_bitmap_write(struct e4i_t *e, uint32_t pos, uint32_t len)
+{
+	if (fseeko(e->image, E4I_OVERLAY_BITMAP_POS + pos, SEEK_SET)) {
+		return E4I_E_HEADER_WRITE;
+	}
+	if (fwrite(e->bitmap + pos, 1, len, e->image) != len) {
+		return E4I_E_HEADER_WRITE;
+	}
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_overlay_copy_up(struct e4i_t *e, int block)
+{
+	if ((block < 0) || (block >= e->blocks)) {
+		return E4I_E_NO_SECTOR;
+	}
+	if (e->bitmap[block >> 3] & (1 << (block & 7))) {
+		return E4I_E_OK;
+	}
+
+	// partial writes need the rest of the block (and its ID) from the base image
+	int csize = e->id_size + e->block_size;
+	uint8_t *buf = (uint8_t *) malloc(csize);
+	if (!buf) {
+		return E4I_E_ALLOC;
+	}
+	int res = __e4i_read(e->base, buf, block, 0, csize);
+	if (res == E4I_E_OK) {
+		res = __e4i_write_ignore_flags(e, buf, block, csize, 0, csize);
+	}
+	free(buf);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	// block data goes first, so the bitmap never points to a missing block
+	e->bitmap[block >> 3] |= 1 << (block & 7);
+	return __e4i_bitmap_write(e, block >> 3, 1);
+}
+
 // -----------------------------------------------------------------------
 static int __e4i_write(struct e4i_t *e, uint8_t *buf, int block, int bytes, int boffset, int max_bytes)
 {
-	if (e->flags & (E4I_F_WRPROTECT | E4I_F_MASTERCOPY)) {
+	// compressed images are read-only, same as write-protected media
+	if (e->flags & (E4I_F_WRPROTECT | E4I_F_MASTERCOPY | E4I_F_COMPRESSED)) {
 		return E4I_E_WRPROTECT;
 	}
 
@@ -526,9 +1099,343 @@ static int __e4i_write(struct e4i_t *e, uint8_t *buf, int block, int bytes, int
 		return E4I_E_UNFORMATTED;
 	}
 
+	if (e->base) {
+		int res = __e4i_overlay_copy_up(e, block);
+		if (res != E4I_E_OK) {
+			return res;
+		}
+	}
+
 	return __e4i_write_ignore_flags(e, buf, block, bytes, boffset, max_bytes);
 }
 
+// copy-on-write overlays
+
+// -----------------------------------------------------------------------
+struct e4i_t * e4i_create_overlay(char *img_name, char *base_name)
+{
+	char *abs_name = NULL;
+	struct e4i_t *e = NULL;
+
+	e4i_err = E4I_E_OK;
+
+	// overlay may be opened from any directory, so store an absolute base image path
+#ifdef _WIN32
+	abs_name = strdup(base_name);
+#else
+	abs_name = realpath(base_name, NULL);
+#endif
+	if (!abs_name) {
+		e4i_err = E4I_E_BASE_OPEN;
+		return NULL;
+	}
+	size_t len = strlen(abs_name);
+	if (len > E4I_OVERLAY_NAME_MAX) {
+		e4i_err = E4I_E_BASE_OPEN;
+		goto cleanup;
+	}
+
+	struct e4i_t *base = __e4i_open(abs_name, "rb");
+	if (!base) {
+		e4i_err = E4I_E_BASE_OPEN;
+		goto cleanup;
+	}
+	int res = __e4i_overlay_check_base(base, base);
+	if (res != E4I_E_OK) {
+		e4i_close(base);
+		e4i_err = res;
+		goto cleanup;
+	}
+
+	// overlay is an uncompressed working copy of the base, even if the base is a master copy
+	uint32_t flags = (base->flags & ~(E4I_F_MASTERCOPY | E4I_F_COMPRESSED)) | E4I_F_OVERLAY;
+	e = __e4i_create(img_name, base->id_size, base->block_size, base->cylinders, base->heads, base->spt, base->blocks, flags);
+	if (!e) {
+		e4i_close(base);
+		goto cleanup;
+	}
+	e->img_type = base->img_type;
+	e->img_utype = base->img_utype;
+	e->base = base;
+
+	res = __e4i_header_write(e);
+	if (res != E4I_E_OK) {
+		goto fail;
+	}
+
+	uint8_t len_buf[2] = { (len >> 8) & 0xff, len & 0xff };
+	if ((fwrite(len_buf, 1, 2, e->image) != 2) || (fwrite(abs_name, 1, len, e->image) != len)) {
+		res = E4I_E_HEADER_WRITE;
+		goto fail;
+	}
+
+	e->bitmap = (uint8_t *) calloc(1, __e4i_bitmap_size(e));
+	if (!e->bitmap) {
+		res = E4I_E_ALLOC;
+		goto fail;
+	}
+	res = __e4i_bitmap_write(e, 0, __e4i_bitmap_size(e));
+	if (res != E4I_E_OK) {
+		goto fail;
+	}
+	e->data_offset = __e4i_overlay_data_offset(e);
+
+	free(abs_name);
+	return e;
+
+fail:
+	remove(img_name);
+	e4i_close(e);
+	e = NULL;
+	e4i_err = res;
+cleanup:
+	free(abs_name);
+	return e;
+}
+
+// -----------------------------------------------------------------------
+uint32_t e4i_overlay_blocks(struct e4i_t *e)
+{
+	uint32_t count = 0;
+
+	if (!e->base) return 0;
+
+	for (uint32_t i=0 ; i<__e4i_bitmap_size(e) ; i++) {
+		count += __builtin_popcount(e->bitmap[i]);
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+int e4i_overlay_discard(struct e4i_t *e)
+{
+	if (!e->base) {
+		return E4I_E_NOT_OVERLAY;
+	}
+
+	// clear the bitmap first, then release space taken by blocks
+	memset(e->bitmap, 0, __e4i_bitmap_size(e));
+	int res = __e4i_bitmap_write(e, 0, __e4i_bitmap_size(e));
+	if (res != E4I_E_OK) {
+		return res;
+	}
+	if (fflush(e->image) || ftruncate(fileno(e->image), e->data_offset)) {
+		return E4I_E_WRITE;
+	}
+
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int e4i_overlay_merge(struct e4i_t *e)
+{
+	if (!e->base) {
+		return E4I_E_NOT_OVERLAY;
+	}
+	if (e->base->flags & E4I_F_WRPROTECT) {
+		return E4I_E_WRPROTECT;
+	}
+	if (e->base->flags & E4I_F_COMPRESSED) {
+		return E4I_E_COMPRESSED;
+	}
+
+	// base is opened read-only for the overlay, open it again for writing
+	struct e4i_t *base = __e4i_open(e->base->img_name, "rb+");
+	if (!base) {
+		return E4I_E_BASE_OPEN;
+	}
+
+	int res = E4I_E_OK;
+	int csize = e->id_size + e->block_size;
+	uint8_t *buf = (uint8_t *) malloc(csize);
+	if (!buf) {
+		res = E4I_E_ALLOC;
+		goto cleanup;
+	}
+
+	for (uint32_t block=0 ; block<e->blocks ; block++) {
+		if (!(e->bitmap[block >> 3] & (1 << (block & 7)))) continue;
+		res = __e4i_read(e, buf, block, 0, csize);
+		if (res != E4I_E_OK) break;
+		res = __e4i_write_ignore_flags(base, buf, block, csize, 0, csize);
+		if (res != E4I_E_OK) break;
+	}
+	if ((res == E4I_E_OK) && fflush(base->image)) {
+		res = E4I_E_WRITE;
+	}
+
+	// reopen the read-only base, so no stale data is left in its buffers
+	if (res == E4I_E_OK) {
+		struct e4i_t *rbase = __e4i_open(e->base->img_name, "rb");
+		if (!rbase) {
+			res = E4I_E_BASE_OPEN;
+			goto cleanup;
+		}
+		e4i_close(e->base);
+		e->base = rbase;
+		res = e4i_overlay_discard(e);
+	}
+
+cleanup:
+	free(buf);
+	e4i_close(base);
+	return res;
+}
+
+// block-compressed images
+
+// -----------------------------------------------------------------------
+static int __e4i_copy_check(struct e4i_t *e)
+{
+	if (!(e->flags & E4I_F_FORMATTED)) {
+		return E4I_E_UNFORMATTED;
+	}
+	if ((e->flags & E4I_F_APPEND) || !(e->flags & (E4I_F_CHS | E4I_F_LBA))) {
+		return E4I_E_COMPRESSED_ACCESS;
+	}
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int e4i_compress(struct e4i_t *e, char *img_name)
+{
+	int res = __e4i_copy_check(e);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	// overlays are flattened, compressed images may be compressed again
+	uint32_t flags = (e->flags & ~E4I_F_OVERLAY) | E4I_F_COMPRESSED;
+	struct e4i_t *c = __e4i_create(img_name, e->id_size, e->block_size, e->cylinders, e->heads, e->spt, e->blocks, flags);
+	if (!c) {
+		return e4i_err;
+	}
+	c->img_type = e->img_type;
+	c->img_utype = e->img_utype;
+
+	unsigned csize = e->id_size + e->block_size;
+	c->group_blocks = E4I_GROUP_BYTES / csize ? E4I_GROUP_BYTES / csize : 1;
+	c->groups = (e->blocks + (uint64_t) c->group_blocks - 1) / c->group_blocks;
+
+	uint8_t *raw = (uint8_t *) malloc(c->group_blocks * csize);
+	uint8_t *zbuf = (uint8_t *) malloc(c->group_blocks * csize);
+	uint8_t *index = (uint8_t *) calloc(c->groups + 1, 8);
+	if (!raw || !zbuf || !index) {
+		res = E4I_E_ALLOC;
+		goto cleanup;
+	}
+
+	res = __e4i_header_write(c);
+	if (res != E4I_E_OK) {
+		goto cleanup;
+	}
+	uint8_t buf[8];
+	*(uint32_t*)buf = htonl(c->group_blocks);
+	*(uint32_t*)(buf+4) = htonl(c->groups);
+	if (fwrite(buf, 1, 8, c->image) != 8) {
+		res = E4I_E_HEADER_WRITE;
+		goto cleanup;
+	}
+
+	// groups are written first, index goes in once all positions are known
+	uint64_t pos = E4I_COMPRESSED_INDEX_POS + (uint64_t) (c->groups + 1) * 8;
+	if (fseeko(c->image, pos, SEEK_SET)) {
+		res = E4I_E_WRITE;
+		goto cleanup;
+	}
+	for (uint32_t g=0 ; g<c->groups ; g++) {
+		uint32_t first = g * c->group_blocks;
+		unsigned len = __e4i_group_len(c, g);
+		for (uint32_t i=0 ; i<len/csize ; i++) {
+			res = __e4i_read(e, raw + i*csize, first + i, 0, csize);
+			if (res != E4I_E_OK) {
+				goto cleanup;
+			}
+		}
+		size_t zlen = __e4i_lz_compress(raw, len, zbuf, len - 1);
+		uint8_t *out = zlen ? zbuf : raw;
+		if (!zlen) {
+			zlen = len;
+		}
+		if (fwrite(out, 1, zlen, c->image) != zlen) {
+			res = E4I_E_WRITE;
+			goto cleanup;
+		}
+		__e4i_put64(index + g*8, pos);
+		pos += zlen;
+	}
+	__e4i_put64(index + c->groups*8, pos);
+
+	if (fseeko(c->image, E4I_COMPRESSED_INDEX_POS, SEEK_SET)
+	|| (fwrite(index, 8, c->groups + 1, c->image) != c->groups + 1)
+	|| fflush(c->image)) {
+		res = E4I_E_HEADER_WRITE;
+	}
+
+cleanup:
+	free(raw);
+	free(zbuf);
+	free(index);
+	e4i_close(c);
+	if (res != E4I_E_OK) {
+		remove(img_name);
+	}
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int e4i_decompress(struct e4i_t *e, char *img_name)
+{
+	int res = __e4i_copy_check(e);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	uint32_t flags = e->flags & ~(E4I_F_OVERLAY | E4I_F_COMPRESSED);
+	struct e4i_t *d = __e4i_create(img_name, e->id_size, e->block_size, e->cylinders, e->heads, e->spt, e->blocks, flags);
+	if (!d) {
+		return e4i_err;
+	}
+	d->img_type = e->img_type;
+	d->img_utype = e->img_utype;
+
+	unsigned csize = e->id_size + e->block_size;
+	unsigned batch = __e4i_batch_blocks(e);
+	uint8_t *buf = (uint8_t *) malloc(batch * csize);
+	if (!buf) {
+		res = E4I_E_ALLOC;
+		goto cleanup;
+	}
+
+	for (uint32_t s=0 ; s<e->blocks ; s+=batch) {
+		int count = (e->blocks-s < batch) ? e->blocks-s : batch;
+		for (int i=0 ; i<count ; i++) {
+			res = __e4i_read(e, buf + i*csize, s+i, 0, csize);
+			if (res != E4I_E_OK) {
+				goto cleanup;
+			}
+		}
+		res = __e4i_write_blocks(d, buf, s, count);
+		if (res != E4I_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	res = __e4i_header_write(d);
+	if ((res == E4I_E_OK) && fflush(d->image)) {
+		res = E4I_E_WRITE;
+	}
+
+cleanup:
+	free(buf);
+	e4i_close(d);
+	if (res != E4I_E_OK) {
+		remove(img_name);
+	}
+	return res;
+}
+
 // CHS access
 
 // -----------------------------------------------------------------------
@@ -606,28 +1513,146 @@ int e4i_bwrite_id(struct e4i_t *e, uint8_t *buf, int block)
 }
 
 // sequential access
+//
+// Sequential access always works on whole blocks (ID field followed by data)
+// starting at the current position. Appending truncates everything past
+// the write position, just like writing to a tape does.
+
+// -----------------------------------------------------------------------
+static int __e4i_seq_check(struct e4i_t *e)
+{
+	if (!(e->flags & E4I_F_APPEND)) {
+		return E4I_E_ACCESS;
+	}
+	if (!(e->flags & E4I_F_FORMATTED)) {
+		return E4I_E_UNFORMATTED;
+	}
+	return E4I_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int __e4i_seq_seek(struct e4i_t *e, int boffset)
+{
+	off_t csize = e->id_size + e->block_size;
+
+	if (fseeko(e->image, E4I_HEADER_SIZE + e->cur_pos*csize + boffset, SEEK_SET)) {
+		return E4I_E_NO_SECTOR;
+	}
+
+	return E4I_E_OK;
+}
 
 // -----------------------------------------------------------------------
 int e4i_bget(struct e4i_t *e, uint8_t *buf, int count)
 {
+	int res = __e4i_seq_check(e);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	if (e->cur_pos + count > e->blocks) {
+		return E4I_E_NO_SECTOR;
+	}
+
+	res = __e4i_seq_seek(e, 0);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	if (fread(buf, e->id_size + e->block_size, count, e->image) != count) {
+		return E4I_E_READ;
+	}
+
+	e->cur_pos += count;
+
 	return E4I_E_OK;
 }
 
 // -----------------------------------------------------------------------
-int e4i_bappend(struct e4i_t *e, uint8_t *buf, int count)
+int e4i_bget_id(struct e4i_t *e, uint8_t *buf, int count)
 {
-	if (!(e->flags & E4I_F_APPEND)) {
-		return E4I_E_ACCESS;
+	int res = __e4i_seq_check(e);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	if (e->cur_pos + count > e->blocks) {
+		return E4I_E_NO_SECTOR;
+	}
+
+	// seeks stay within stdio buffer most of the time, so this is
+	// a plain sequential read of the image
+	for (int i=0 ; i<count ; i++) {
+		res = __e4i_seq_seek(e, 0);
+		if (res != E4I_E_OK) {
+			return res;
+		}
+		if (fread(buf + i*e->id_size, 1, e->id_size, e->image) != e->id_size) {
+			return E4I_E_READ;
+		}
+		e->cur_pos++;
 	}
 
 	return E4I_E_OK;
 }
 
 // -----------------------------------------------------------------------
-int e4i_rewind(struct e4i_t *e)
+int e4i_bappend(struct e4i_t *e, uint8_t *buf, int count)
 {
+	int res = __e4i_seq_check(e);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	if (e->flags & (E4I_F_WRPROTECT | E4I_F_MASTERCOPY)) {
+		return E4I_E_WRPROTECT;
+	}
+
+	res = __e4i_seq_seek(e, 0);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	if (fwrite(buf, e->id_size + e->block_size, count, e->image) != count) {
+		return E4I_E_WRITE;
+	}
+
+	e->cur_pos += count;
+
+	// drop whatever was recorded after the new data
+	if (e->cur_pos < e->blocks) {
+		off_t csize = e->id_size + e->block_size;
+		if (fflush(e->image) || ftruncate(fileno(e->image), E4I_HEADER_SIZE + e->cur_pos*csize)) {
+			return E4I_E_WRITE;
+		}
+	}
+
+	e->blocks = e->cur_pos;
+
+	return __e4i_header_write(e);
+}
+
+// -----------------------------------------------------------------------
+int e4i_bseek(struct e4i_t *e, uint32_t block)
+{
+	int res = __e4i_seq_check(e);
+	if (res != E4I_E_OK) {
+		return res;
+	}
+
+	if (block > e->blocks) {
+		return E4I_E_NO_SECTOR;
+	}
+
+	e->cur_pos = block;
 
 	return E4I_E_OK;
 }
 
+// -----------------------------------------------------------------------
+int e4i_rewind(struct e4i_t *e)
+{
+	return e4i_bseek(e, 0);
+}
+
 // vim: tabstop=4 shiftwidth=4 autoindent
@@ -23,7 +23,7 @@
 
 #define E4I_MAGIC "E4IM"
 #define E4I_IMAGE_V_MAJOR 1
-#define E4I_IMAGE_V_MINOR 0
+#define E4I_IMAGE_V_MINOR 2 // 1.1 adds copy-on-write overlays, 1.2 block-compressed images, plain images are still written as 1.0
 
 #ifdef __cplusplus
 extern "C" {
@@ -59,6 +59,13 @@ enum e4i_errors_e {
 	E4I_E_GENF_MISSING,
 	E4I_E_GENF_UNNEEDED,
 	E4I_E_IDGEN,
+	E4I_E_BASE_OPEN,
+	E4I_E_BASE_MISMATCH,
+	E4I_E_NOT_OVERLAY,
+	E4I_E_OVERLAY_ACCESS,
+	E4I_E_COMPRESSED,
+	E4I_E_COMPRESSED_ACCESS,
+	E4I_E_DECOMPRESS,
 };
 
 struct e4i_errdesc_t {
@@ -74,6 +81,8 @@ enum e4i_media_flags_e {
 	E4I_F_CHS			= 1 << 4,	// access by C/H/S / no access by C/H/S
 	E4I_F_LBA			= 1 << 5,	// access by LBA / no access by LBA
 	E4I_F_APPEND		= 1 << 6,	// appendable / not appendable
+	E4I_F_OVERLAY		= 1 << 7,	// copy-on-write overlay over a base image / standalone image
+	E4I_F_COMPRESSED	= 1 << 8,	// block-compressed (read-only) / uncompressed
 };
 
 #define e4i_flags_resetable (E4I_F_WRPROTECT | E4I_F_MASTERCOPY | E4I_F_REMOVABLE)
@@ -92,6 +101,37 @@ enum e4i_img_type_e {
 };
 
 #define E4I_HEADER_SIZE 26
+
+// Copy-on-write overlay layout (E4I_F_OVERLAY):
+//  * header (E4I_HEADER_SIZE bytes), geometry copied from the base image
+//  * base image name length (16-bit) followed by the name
+//  * block allocation bitmap at E4I_OVERLAY_BITMAP_POS, one bit per block
+//  * blocks, at the same positions as in the base image, but starting at
+//    the first page boundary after the bitmap. The file is sparse:
+//    only blocks written since the overlay was created take space.
+// Reads of blocks not in the overlay fall through to the (read-only) base image.
+#define E4I_OVERLAY_BITMAP_POS 4096
+#define E4I_OVERLAY_NAME_MAX (E4I_OVERLAY_BITMAP_POS - E4I_HEADER_SIZE - 2)
+
+// Block-compressed image layout (E4I_F_COMPRESSED):
+//  * header (E4I_HEADER_SIZE bytes)
+//  * blocks per group (32-bit), number of groups (32-bit)
+//  * group index at E4I_COMPRESSED_INDEX_POS: file position of each group
+//    (64-bit), plus one extra entry marking the end of the last group
+//  * groups of consecutive blocks (ID fields included), each compressed
+//    on its own (LZ4 block format), so any block can be read without
+//    touching other groups. A group that doesn't compress is stored as-is
+//    (its length in the image equals its uncompressed length).
+// Compressed images are read-only. Use an overlay to write to one.
+#define E4I_COMPRESSED_INDEX_POS (E4I_HEADER_SIZE + 8)
+#define E4I_GROUP_CACHE 8 // decompressed groups kept in memory
+
+struct e4i_group_cache {
+	uint32_t group;
+	uint64_t used;			// last use stamp for LRU, 0 = slot empty
+	uint8_t *data;			// decompressed group
+};
+
 struct e4i_t {
 	char magic[4];
 	uint8_t v_major;
@@ -109,6 +149,15 @@ struct e4i_t {
 	char *img_name;
 	FILE *image;
 	uint32_t cur_pos;
+	uint64_t data_offset;	// position of the first block in the image file
+	struct e4i_t *base;		// base image (for overlays)
+	uint8_t *bitmap;		// blocks present in the overlay
+	uint32_t group_blocks;	// blocks per group (compressed images)
+	uint32_t groups;		// number of groups (compressed images)
+	uint64_t *group_pos;	// group positions in the image file, groups+1 entries
+	struct e4i_group_cache *cache;
+	uint64_t cache_tick;
+	uint8_t *zbuf;			// compressed group read buffer
 };
 
 typedef int (e4i_id_gen_f)(struct e4i_t *e, uint8_t *buf, int id_len, uint32_t block);
@@ -129,6 +178,16 @@ struct e4i_t * e4i_create_seq(char *img_name, uint16_t id_size, uint16_t block_s
 int e4i_init(struct e4i_t *e, e4i_id_gen_f *genf, uint16_t img_type, uint16_t img_utype);
 int e4i_import(struct e4i_t *e, char *src_name, uint16_t img_type, uint16_t img_utype);
 
+// copy-on-write overlays
+struct e4i_t * e4i_create_overlay(char *img_name, char *base_name);
+uint32_t e4i_overlay_blocks(struct e4i_t *e);
+int e4i_overlay_merge(struct e4i_t *e);
+int e4i_overlay_discard(struct e4i_t *e);
+
+// block-compressed images
+int e4i_compress(struct e4i_t *e, char *img_name);
+int e4i_decompress(struct e4i_t *e, char *img_name);
+
 // CHS access
 int e4i_sread(struct e4i_t *e, uint8_t *buf, int cyl, int head, int sect);
 int e4i_swrite(struct e4i_t *e, uint8_t *buf, int cyl, int head, int sect, int bytes);
@@ -143,7 +202,9 @@ int e4i_bwrite_id(struct e4i_t *e, uint8_t *buf, int block);
 
 // sequential access
 int e4i_bget(struct e4i_t *e, uint8_t *buf, int count);
+int e4i_bget_id(struct e4i_t *e, uint8_t *buf, int count);
 int e4i_bappend(struct e4i_t *e, uint8_t *buf, int count);
+int e4i_bseek(struct e4i_t *e, uint32_t block);
 int e4i_rewind(struct e4i_t *e);
 
 #ifdef __cplusplus
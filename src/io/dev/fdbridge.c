@@ -29,12 +29,15 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <errno.h>
+#include <time.h>
 
 #include "log.h"
 #include "utils/serial.h"
 #include "io/dev/fdbridge.h"
 
 #define FDB_BUF_SIZE 64
+#define FDB_LINE_BUF_SIZE 4096
+#define FDB_NS_PER_S 1000000000LL
 
 enum fdb_fds {
 	FDB_FD_CTL_OUT,
@@ -52,8 +55,14 @@ struct fdb {
 	int rdbuf_count;
 	int wrbuf;
 	int type;
-	int sleep_us;
 	int fds[FDB_FD_COUNT];
+	// line pacing (char_ns == 0: unthrottled)
+	int64_t char_ns;
+	char rxq[FDB_LINE_BUF_SIZE];
+	int rxq_r;
+	int rxq_count;
+	int64_t rx_next;
+	int64_t tx_done;
 	struct sockaddr cliaddr;
 	fdb_cb cb;
 	void *user_ctx;
@@ -71,6 +80,14 @@ enum fd_types {
 
 static void * fdb_loop(void *ptr);
 
+// -----------------------------------------------------------------------
+static int64_t fdb_now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t) t.tv_sec * FDB_NS_PER_S + t.tv_nsec;
+}
+
 // -----------------------------------------------------------------------
 int buf_get(struct fdb *fdb)
 {
@@ -191,7 +208,8 @@ int fdb_set_callback(struct fdb *fdb, fdb_cb cb, void *user_ctx)
 // -----------------------------------------------------------------------
 void fdb_set_speed(struct fdb *fdb, int speed)
 {
-	fdb->sleep_us = 10L * 1000 * 1000 / speed;
+	// 8N1: 10 bits per character, speed <= 0 means no pacing
+	fdb->char_ns = speed > 0 ? 10LL * FDB_NS_PER_S / speed : 0;
 }
 
 // -----------------------------------------------------------------------
@@ -299,6 +317,44 @@ struct fdb * fdb_open_stdin()
 	return fdb;
 }
 
+// -----------------------------------------------------------------------
+static void tx_complete(struct fdb *fdb)
+{
+	pthread_mutex_lock(&fdb->data_mutex);
+	fdb->wrbuf = -1;
+	int awaiting_write = fdb->awaiting_write;
+	pthread_mutex_unlock(&fdb->data_mutex);
+	if (awaiting_write) {
+		fdb->cb(fdb->user_ctx, FDB_READY);
+	}
+}
+
+// -----------------------------------------------------------------------
+static void rx_deliver(struct fdb *fdb, unsigned char data)
+{
+	if (buf_append(fdb, data)) {
+		LOG(L_FDBR, "Input data lost (buffer full): %i (#%02x)", data, data);
+		fdb->cb(fdb->user_ctx, FDB_LOST);
+	}
+}
+
+// -----------------------------------------------------------------------
+static void serve_pacing(struct fdb *fdb, int64_t now)
+{
+	// characters waiting on the line arrive one per character time
+	while (fdb->rxq_count && (now >= fdb->rx_next)) {
+		rx_deliver(fdb, fdb->rxq[fdb->rxq_r]);
+		fdb->rxq_r = (fdb->rxq_r + 1) % FDB_LINE_BUF_SIZE;
+		fdb->rxq_count--;
+		fdb->rx_next += fdb->char_ns;
+	}
+
+	if (fdb->tx_done && (now >= fdb->tx_done)) {
+		fdb->tx_done = 0;
+		tx_complete(fdb);
+	}
+}
+
 // -----------------------------------------------------------------------
 static int serve_control(struct fdb *fdb)
 {
@@ -319,15 +375,11 @@ static int serve_control(struct fdb *fdb)
 				} else {
 					LOG(L_FDBR, "Output data lost (endpoint not connected): %i (#%02x)", data, data);
 				}
-				if (fdb->sleep_us > 0) {
-					usleep(fdb->sleep_us);
-				}
-				pthread_mutex_lock(&fdb->data_mutex);
-				fdb->wrbuf = -1;
-				int awaiting_write = fdb->awaiting_write;
-				pthread_mutex_unlock(&fdb->data_mutex);
-				if (awaiting_write) {
-					fdb->cb(fdb->user_ctx, FDB_READY);
+				if (fdb->char_ns) {
+					// transmitter stays busy until the character is on the wire
+					fdb->tx_done = fdb_now() + fdb->char_ns;
+				} else {
+					tx_complete(fdb);
 				}
 				break;
 			default:
@@ -358,23 +410,33 @@ static void serve_conn(struct fdb *fdb)
 // -----------------------------------------------------------------------
 static void serve_data(struct fdb *fdb)
 {
-	unsigned char data;
+	unsigned char data[FDB_LINE_BUF_SIZE];
 	int res;
 
-	res = read(fdb->fds[FDB_FD_FD], &data, 1);
+	// paced line takes whole bursts and queues them, unthrottled one goes char by char
+	int len = fdb->char_ns ? FDB_LINE_BUF_SIZE - fdb->rxq_count : 1;
+
+	res = read(fdb->fds[FDB_FD_FD], data, len);
 	if (res == 0) {
 		LOG(L_FDBR, "Empty read (EOF). Client disconnected.");
 		close(fdb->fds[FDB_FD_FD]);
 		fdb->fds[FDB_FD_FD] = -1;
-	} else {
-		LOG(L_FDBR, "Received data: %i (#%02x)", data, data);
-		if (fdb->sleep_us > 0) {
-			usleep(fdb->sleep_us);
+	} else if (res > 0) {
+		LOG(L_FDBR, "Received data: %i bytes, first: %i (#%02x)", res, data[0], data[0]);
+		if (!fdb->char_ns) {
+			rx_deliver(fdb, data[0]);
+			return;
 		}
-		if (!buf_append(fdb, data)) {
-		} else {
-			LOG(L_FDBR, "Input data lost (buffer full): %i (#%02x)", data, data);
-			fdb->cb(fdb->user_ctx, FDB_LOST);
+		if (!fdb->rxq_count) {
+			// idle line: first character arrives after its transmission time
+			int64_t now = fdb_now();
+			if (fdb->rx_next < now) {
+				fdb->rx_next = now + fdb->char_ns;
+			}
+		}
+		for (int i=0 ; i<res ; i++) {
+			fdb->rxq[(fdb->rxq_r + fdb->rxq_count) % FDB_LINE_BUF_SIZE] = data[i];
+			fdb->rxq_count++;
 		}
 	}
 }
@@ -385,17 +447,33 @@ static void * fdb_loop(void *ptr)
 	struct fdb *fdb = (struct fdb *) ptr;
 	fd_set rfds;
 	int maxfd = 0;
+	struct timeval tv;
 
 	while (1) {
 		FD_ZERO(&rfds);
 		for (int i=0 ; i<FDB_FD_COUNT ; i++) {
 			if ((fdb->fds[i] != -1) && (i != FDB_FD_CTL_IN)) {
+				// line buffer full: leave the data in the kernel until there is room for it
+				if ((i == FDB_FD_FD) && (fdb->rxq_count >= FDB_LINE_BUF_SIZE)) continue;
 				FD_SET(fdb->fds[i], &rfds);
 				if (fdb->fds[i] > maxfd) maxfd = fdb->fds[i];
 			}
 		}
 
-		int retval = select(maxfd+1, &rfds, NULL, NULL, NULL);
+		// wake up for the next paced line event, if any
+		struct timeval *timeout = NULL;
+		int64_t deadline = INT64_MAX;
+		if (fdb->rxq_count) deadline = fdb->rx_next;
+		if (fdb->tx_done && (fdb->tx_done < deadline)) deadline = fdb->tx_done;
+		if (deadline != INT64_MAX) {
+			int64_t wait_ns = deadline - fdb_now();
+			if (wait_ns < 0) wait_ns = 0;
+			tv.tv_sec = wait_ns / FDB_NS_PER_S;
+			tv.tv_usec = (wait_ns % FDB_NS_PER_S) / 1000;
+			timeout = &tv;
+		}
+
+		int retval = select(maxfd+1, &rfds, NULL, NULL, timeout);
 		if (retval > 0) {
 			// fd needs attention
 			for (int i=FDB_FD_CTL_OUT ; i<FDB_FD_COUNT ; i++) {
@@ -419,10 +497,14 @@ static void * fdb_loop(void *ptr)
 				}
 			}
 		} else if (retval == 0) {
-			// timeout - unused
+			// timeout - paced line event is due
 		} else {
 			// error
 		}
+
+		if (fdb->char_ns) {
+			serve_pacing(fdb, fdb_now());
+		}
 	}
 
 loop_quit:
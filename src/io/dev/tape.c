@@ -0,0 +1,463 @@
+//  Copyright (c) 2015 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "log.h"
+#include "io/dev/dev.h"
+#include "io/dev/e4image.h"
+#include "cfg.h"
+
+// Magnetic tape on a sequential e4image. Each tape record occupies one block.
+// The block ID field holds record length (bytes 0-1, big endian) and flags (byte 2).
+#define TAPE_ID_MIN 3
+#define TAPE_F_MARK 1
+
+#define TAPE_BUF_RECORDS 64		// read-ahead/write-behind depth
+#define TAPE_SCAN_CHUNK 1024	// IDs read at once while indexing
+
+enum dev_tape_buf_mode {
+	TAPE_BUF_NONE,
+	TAPE_BUF_READ,
+	TAPE_BUF_WRITE,
+};
+
+struct dev_tape {
+	struct e4i_t *image;
+	unsigned csize;
+	uint32_t pos;			// current tape position (record number)
+
+	// read-ahead holds records [pos-buf_next, pos-buf_next+buf_count),
+	// write-behind holds records [pos-buf_count, pos) not yet in the image
+	uint8_t *buf;
+	int buf_mode;
+	unsigned buf_count;
+	unsigned buf_next;
+
+	// tape mark index, complete for records [0, indexed)
+	uint32_t *marks;
+	unsigned marks_count;
+	unsigned marks_size;
+	uint32_t indexed;
+	uint8_t *scan_buf;
+};
+
+void dev_tape_destroy(void *dev);
+
+// -----------------------------------------------------------------------
+void * dev_tape_create(em400_cfg *cfg, int ch_num, int dev_num)
+{
+	struct dev_tape *tape = (struct dev_tape *) calloc(1, sizeof(struct dev_tape));
+	if (!tape) {
+		LOGERR("Memory allocation error while creating tape drive.");
+		goto cleanup;
+	}
+
+	const char *image = cfg_fgetstr(cfg, "dev%i.%i:image", ch_num, dev_num);
+
+	tape->image = e4i_open(image);
+	if (!tape->image) {
+		LOGERR("Failed to open tape image: \"%s\": %s.", image, e4i_get_err(e4i_err));
+		goto cleanup;
+	}
+
+	if ((tape->image->img_type != E4I_T_MAGNETIC_TAPE) || !(tape->image->flags & E4I_F_APPEND)) {
+		LOGERR("Image \"%s\" is not a sequential magnetic tape image.", image);
+		goto cleanup;
+	}
+
+	if (tape->image->id_size < TAPE_ID_MIN) {
+		LOGERR("Tape image \"%s\" needs at least %i bytes of block ID field.", image, TAPE_ID_MIN);
+		goto cleanup;
+	}
+
+	tape->csize = tape->image->id_size + tape->image->block_size;
+	tape->buf = (uint8_t *) malloc(TAPE_BUF_RECORDS * tape->csize);
+	tape->scan_buf = (uint8_t *) malloc(TAPE_SCAN_CHUNK * tape->image->id_size);
+	if (!tape->buf || !tape->scan_buf) {
+		LOGERR("Memory allocation error while creating tape drive buffers.");
+		goto cleanup;
+	}
+
+	LOG(L_TAPE, "Tape image \"%s\": %i records, max. record length %i bytes", image, tape->image->blocks, tape->image->block_size);
+
+	return tape;
+
+cleanup:
+	dev_tape_destroy(tape);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+static int _e4i_res(int res)
+{
+	switch (res) {
+		case E4I_E_OK:
+			return DEV_CMD_OK;
+		case E4I_E_UNFORMATTED:
+			return DEV_CMD_NOMEDIUM;
+		case E4I_E_NO_SECTOR:
+			return DEV_CMD_EOT;
+		case E4I_E_WRPROTECT:
+			return DEV_CMD_WRPROTECT;
+		case E4I_E_WRITE:
+			return DEV_CMD_WRERR;
+		case E4I_E_READ:
+			return DEV_CMD_RDERR;
+		default:
+			return DEV_CMD_ERR;
+	}
+}
+
+// -----------------------------------------------------------------------
+static int dev_tape_sync(struct dev_tape *tape)
+{
+	int res = E4I_E_OK;
+
+	if ((tape->buf_mode == TAPE_BUF_WRITE) && tape->buf_count) {
+		res = e4i_bappend(tape->image, tape->buf, tape->buf_count);
+	} else {
+		res = e4i_bseek(tape->image, tape->pos);
+	}
+
+	tape->buf_mode = TAPE_BUF_NONE;
+	tape->buf_count = 0;
+	tape->buf_next = 0;
+
+	return _e4i_res(res);
+}
+
+// -----------------------------------------------------------------------
+static void dev_tape_index_add(struct dev_tape *tape, uint32_t rec, int mark)
+{
+	if (rec != tape->indexed) return;
+
+	if (mark) {
+		if (tape->marks_count >= tape->marks_size) {
+			unsigned size = tape->marks_size ? 2 * tape->marks_size : 64;
+			uint32_t *marks = (uint32_t *) realloc(tape->marks, size * sizeof(uint32_t));
+			// without the mark index is incomplete, keep it short of the mark
+			if (!marks) return;
+			tape->marks = marks;
+			tape->marks_size = size;
+		}
+		tape->marks[tape->marks_count++] = rec;
+	}
+	tape->indexed++;
+}
+
+// -----------------------------------------------------------------------
+static void dev_tape_index_truncate(struct dev_tape *tape, uint32_t rec)
+{
+	if (tape->indexed > rec) tape->indexed = rec;
+	while ((tape->marks_count > 0) && (tape->marks[tape->marks_count-1] >= rec)) {
+		tape->marks_count--;
+	}
+}
+
+// -----------------------------------------------------------------------
+static int dev_tape_index_more(struct dev_tape *tape)
+{
+	uint32_t count = tape->image->blocks - tape->indexed;
+	if (count > TAPE_SCAN_CHUNK) count = TAPE_SCAN_CHUNK;
+	if (count == 0) return 0;
+
+	int res = e4i_bseek(tape->image, tape->indexed);
+	if (res == E4I_E_OK) {
+		res = e4i_bget_id(tape->image, tape->scan_buf, count);
+	}
+	if (res != E4I_E_OK) {
+		LOG(L_TAPE, "Tape index scan failed: %s", e4i_get_err(res));
+		return -1;
+	}
+
+	for (uint32_t i=0 ; i<count ; i++) {
+		dev_tape_index_add(tape, tape->indexed, tape->scan_buf[i * tape->image->id_size + 2] & TAPE_F_MARK);
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+static unsigned dev_tape_mark_lower_bound(struct dev_tape *tape, uint32_t rec)
+{
+	// index of the first known mark at or after rec
+	unsigned lo = 0;
+	unsigned hi = tape->marks_count;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (tape->marks[mid] < rec) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// -----------------------------------------------------------------------
+static int dev_tape_is_mark(struct dev_tape *tape, uint32_t rec)
+{
+	while (rec >= tape->indexed) {
+		if (dev_tape_index_more(tape) <= 0) return -1;
+	}
+	unsigned i = dev_tape_mark_lower_bound(tape, rec);
+	return (i < tape->marks_count) && (tape->marks[i] == rec);
+}
+
+// -----------------------------------------------------------------------
+static int64_t dev_tape_next_mark(struct dev_tape *tape, uint32_t rec)
+{
+	while (1) {
+		unsigned i = dev_tape_mark_lower_bound(tape, rec);
+		if (i < tape->marks_count) return tape->marks[i];
+		if (dev_tape_index_more(tape) <= 0) return -1;
+	}
+}
+
+// -----------------------------------------------------------------------
+void dev_tape_destroy(void *dev)
+{
+	if (!dev) return;
+	struct dev_tape *tape = (struct dev_tape *) dev;
+	if (tape->image) {
+		dev_tape_sync(tape);
+		e4i_close(tape->image);
+	}
+	free(tape->buf);
+	free(tape->scan_buf);
+	free(tape->marks);
+	free(tape);
+}
+
+// -----------------------------------------------------------------------
+void dev_tape_reset(void *dev)
+{
+	struct dev_tape *tape = (struct dev_tape *) dev;
+	dev_tape_sync(tape);
+}
+
+// -----------------------------------------------------------------------
+int dev_tape_rec_rd(void *dev, uint8_t *buf, unsigned max_len, unsigned *len)
+{
+	struct dev_tape *tape = (struct dev_tape *) dev;
+	int res;
+
+	*len = 0;
+
+	if (tape->buf_mode != TAPE_BUF_READ) {
+		res = dev_tape_sync(tape);
+		if (res != DEV_CMD_OK) return res;
+		tape->buf_mode = TAPE_BUF_READ;
+	}
+
+	// read ahead as many whole records as possible in one go
+	if (tape->buf_next >= tape->buf_count) {
+		uint32_t count = tape->image->blocks - tape->image->cur_pos;
+		if (count > TAPE_BUF_RECORDS) count = TAPE_BUF_RECORDS;
+		if (count == 0) return DEV_CMD_EOT;
+		res = e4i_bget(tape->image, tape->buf, count);
+		if (res != E4I_E_OK) {
+			tape->buf_mode = TAPE_BUF_NONE;
+			return _e4i_res(res);
+		}
+		tape->buf_count = count;
+		tape->buf_next = 0;
+	}
+
+	uint8_t *rec = tape->buf + tape->buf_next * tape->csize;
+	unsigned rec_len = (rec[0] << 8) | rec[1];
+	int mark = rec[2] & TAPE_F_MARK;
+
+	dev_tape_index_add(tape, tape->pos, mark);
+	tape->buf_next++;
+	tape->pos++;
+
+	if (mark) {
+		return DEV_CMD_TAPEMARK;
+	}
+
+	if (rec_len > tape->image->block_size) {
+		rec_len = tape->image->block_size;
+	}
+
+	if (rec_len > max_len) {
+		memcpy(buf, rec + tape->image->id_size, max_len);
+		*len = max_len;
+		return DEV_CMD_TOOLONG;
+	}
+
+	memcpy(buf, rec + tape->image->id_size, rec_len);
+	*len = rec_len;
+
+	return DEV_CMD_OK;
+}
+
+// -----------------------------------------------------------------------
+static int dev_tape_append(struct dev_tape *tape, uint8_t *buf, unsigned len, int mark)
+{
+	int res;
+
+	if (len > tape->image->block_size) {
+		return DEV_CMD_TOOLONG;
+	}
+	if (tape->image->flags & (E4I_F_WRPROTECT | E4I_F_MASTERCOPY)) {
+		return DEV_CMD_WRPROTECT;
+	}
+
+	if (tape->buf_mode != TAPE_BUF_WRITE) {
+		res = dev_tape_sync(tape);
+		if (res != DEV_CMD_OK) return res;
+		tape->buf_mode = TAPE_BUF_WRITE;
+	}
+
+	// writing erases the rest of the tape
+	dev_tape_index_truncate(tape, tape->pos);
+
+	uint8_t *rec = tape->buf + tape->buf_count * tape->csize;
+	memset(rec, 0, tape->csize);
+	rec[0] = len >> 8;
+	rec[1] = len & 0xff;
+	rec[2] = mark ? TAPE_F_MARK : 0;
+	if (len) {
+		memcpy(rec + tape->image->id_size, buf, len);
+	}
+
+	dev_tape_index_add(tape, tape->pos, mark);
+	tape->buf_count++;
+	tape->pos++;
+
+	// write behind, whole buffer at once
+	if (tape->buf_count >= TAPE_BUF_RECORDS) {
+		res = e4i_bappend(tape->image, tape->buf, tape->buf_count);
+		tape->buf_count = 0;
+		if (res != E4I_E_OK) {
+			tape->buf_mode = TAPE_BUF_NONE;
+			return _e4i_res(res);
+		}
+	}
+
+	return DEV_CMD_OK;
+}
+
+// -----------------------------------------------------------------------
+int dev_tape_rec_wr(void *dev, uint8_t *buf, unsigned len)
+{
+	return dev_tape_append((struct dev_tape *) dev, buf, len, 0);
+}
+
+// -----------------------------------------------------------------------
+int dev_tape_mark_wr(void *dev)
+{
+	return dev_tape_append((struct dev_tape *) dev, NULL, 0, 1);
+}
+
+// -----------------------------------------------------------------------
+int dev_tape_rec_skip(void *dev, int count, int marks, unsigned *skipped)
+{
+	struct dev_tape *tape = (struct dev_tape *) dev;
+	int ret = DEV_CMD_OK;
+
+	*skipped = 0;
+
+	int res = dev_tape_sync(tape);
+	if (res != DEV_CMD_OK) return res;
+
+	while ((ret == DEV_CMD_OK) && (*skipped < abs(count))) {
+		if (count > 0) {
+			if (marks) {
+				// position just past the next tape mark
+				int64_t m = dev_tape_next_mark(tape, tape->pos);
+				if (m < 0) {
+					tape->pos = tape->image->blocks;
+					ret = DEV_CMD_EOT;
+				} else {
+					tape->pos = m + 1;
+					(*skipped)++;
+				}
+			} else {
+				// next record, stop past a tape mark
+				if (tape->pos >= tape->image->blocks) {
+					ret = DEV_CMD_EOT;
+				} else {
+					int m = dev_tape_is_mark(tape, tape->pos);
+					tape->pos++;
+					(*skipped)++;
+					if (m < 0) ret = DEV_CMD_RDERR;
+					else if (m) ret = DEV_CMD_TAPEMARK;
+				}
+			}
+		} else {
+			if (tape->pos == 0) {
+				ret = DEV_CMD_BOT;
+			} else if (marks) {
+				// position just before the previous tape mark (all marks before pos are indexed)
+				unsigned i = dev_tape_mark_lower_bound(tape, tape->pos);
+				if (i == 0) {
+					tape->pos = 0;
+					ret = DEV_CMD_BOT;
+				} else {
+					tape->pos = tape->marks[i-1];
+					(*skipped)++;
+				}
+			} else {
+				// previous record, stop before a tape mark
+				tape->pos--;
+				(*skipped)++;
+				int m = dev_tape_is_mark(tape, tape->pos);
+				if (m < 0) ret = DEV_CMD_RDERR;
+				else if (m) ret = DEV_CMD_TAPEMARK;
+			}
+		}
+	}
+
+	res = e4i_bseek(tape->image, tape->pos);
+	if ((res != E4I_E_OK) && (ret == DEV_CMD_OK)) {
+		ret = _e4i_res(res);
+	}
+
+	LOG(L_TAPE, "Skipped %i %s %s, now at record %i", *skipped, marks ? "files" : "records", count > 0 ? "forward" : "backward", tape->pos);
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------
+int dev_tape_rewind(void *dev)
+{
+	struct dev_tape *tape = (struct dev_tape *) dev;
+
+	int res = dev_tape_sync(tape);
+	tape->pos = 0;
+	e4i_rewind(tape->image);
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+struct dev_drv dev_tape = {
+	.name = "tape",
+	.create = dev_tape_create,
+	.destroy = dev_tape_destroy,
+	.reset = dev_tape_reset,
+	.rec_rd = dev_tape_rec_rd,
+	.rec_wr = dev_tape_rec_wr,
+	.mark_wr = dev_tape_mark_wr,
+	.rec_skip = dev_tape_rec_skip,
+	.rewind = dev_tape_rewind,
+};
+
+// vim: tabstop=4 shiftwidth=4 autoindent
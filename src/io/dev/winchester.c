@@ -21,16 +21,21 @@
 #include "log.h"
 #include "io/dev/dev.h"
 #include "io/dev/e4image.h"
+#include "io/defs.h"
+#include "ectl/metrics.h"
 #include "cfg.h"
 
 struct dev_winch {
 	struct e4i_t *image;
+	// traffic counters [IO_OU/IO_IN], updated by the line thread only
+	unsigned long sectors[2];
+	unsigned long bytes[2];
 };
 
 // -----------------------------------------------------------------------
 void * dev_winch_create(em400_cfg *cfg, int ch_num, int dev_num)
 {
-	struct dev_winch *winch = (struct dev_winch *) malloc(sizeof(struct dev_winch));
+	struct dev_winch *winch = (struct dev_winch *) calloc(1, sizeof(struct dev_winch));
 	if (!winch) {
 		LOGERR("Memory allocation error while creating Winchester.");
 		goto cleanup;
@@ -44,6 +49,13 @@ void * dev_winch_create(em400_cfg *cfg, int ch_num, int dev_num)
 		goto cleanup;
 	}
 
+	for (int dir=IO_OU ; dir<=IO_IN ; dir++) {
+		const char *labels = "chan=\"%i\",unit=\"%i\",drive=\"winchester\",dir=\"%s\"";
+		const char *dir_name = dir == IO_IN ? "read" : "write";
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_disk_sectors_total", "Disk sectors transferred", winch->sectors + dir, labels, ch_num, dev_num, dir_name);
+		ectl_metric_add(ECTL_METRIC_COUNTER, "em400_disk_bytes_total", "Disk bytes transferred", winch->bytes + dir, labels, ch_num, dev_num, dir_name);
+	}
+
 	return winch;
 
 cleanup:
@@ -93,6 +105,10 @@ int dev_winch_sector_rd(void *dev, uint8_t *buf, struct dev_chs *chs)
 	struct dev_winch *winch = (struct dev_winch *) dev;
 
 	res = e4i_sread(winch->image, buf, chs->c, chs->h, chs->s);
+	if (res == E4I_E_OK) {
+		winch->sectors[IO_IN]++;
+		winch->bytes[IO_IN] += 512;
+	}
 
 	return _e4i_res(res);
 }
@@ -104,6 +120,10 @@ int dev_winch_sector_wr(void *dev, uint8_t *buf, struct dev_chs *chs)
 	struct dev_winch *winch = (struct dev_winch *) dev;
 
 	res = e4i_swrite(winch->image, buf, chs->c, chs->h, chs->s, 512);
+	if (res == E4I_E_OK) {
+		winch->sectors[IO_OU]++;
+		winch->bytes[IO_OU] += 512;
+	}
 
 	return _e4i_res(res);
 }
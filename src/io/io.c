@@ -22,10 +22,13 @@
 #include "cpu/cpu.h"
 #include "cpu/interrupts.h"
 #include "io/chan.h"
+#include "io/io.h"
 #include "fpga/iobus.h"
+#include "machine.h"
 
 #include "cfg.h"
 #include "utils/utils.h"
+#include "ectl/metrics.h"
 #include "log.h"
 
 /*
@@ -57,23 +60,29 @@
   `------------' `-------------' `------------' `-----------' `---------'   |
 */
 
-static struct chan *io_chan[IO_MAX_CHAN];
 static const char *io_result_names[] = { "NO DEVICE", "ENGAGED", "OK", "PARITY ERROR" };
-static int fpga;
+static const char *io_result_labels[] = { "no", "en", "ok", "pe" };
 
 // -----------------------------------------------------------------------
-int io_init(em400_cfg *cfg)
+int io_init(struct io *io, struct em400_machine *m, em400_cfg *cfg)
 {
-	fpga = cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA);
+	io->m = m;
+	io->fpga = cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA);
 
 	for (int i=0 ; i<16 ; i++) {
 		const char *ch_name = cfg_fgetstr(cfg, "io:channel_%i", i);
 		if (ch_name) {
 			LOG(L_IO, "Initializing I/O channel %i: %s", i, ch_name);
-			io_chan[i] = chan_make(i, ch_name, cfg);
-			if (!io_chan[i]) {
+			io->chan[i] = chan_make(io, i, ch_name, cfg);
+			if (!io->chan[i]) {
 				return LOGERR("Failed to initialize channel %i: %s.", i, ch_name);
 			}
+			for (int dir=IO_OU ; dir<=IO_IN ; dir++) {
+				for (int res=IO_NO ; res<=IO_PE ; res++) {
+					ectl_metric_add(ECTL_METRIC_COUNTER, "em400_io_dispatch_total", "I/O instructions dispatched to channels", &io->dispatched[i][dir][res],
+						"chan=\"%i\",type=\"%s\",dir=\"%s\",result=\"%s\"", i, ch_name, dir == IO_IN ? "in" : "ou", io_result_labels[res]);
+				}
+			}
 		}
 	}
 
@@ -81,24 +90,24 @@ int io_init(em400_cfg *cfg)
 }
 
 // -----------------------------------------------------------------------
-void io_shutdown()
+void io_shutdown(struct io *io)
 {
 	LOG(L_IO, "Shutdown I/O");
 	for (int c_num=0 ; c_num<IO_MAX_CHAN ; c_num++) {
-		struct chan *chan = io_chan[c_num];
+		struct chan *chan = io->chan[c_num];
 		if (chan) {
 			LOG(L_IO, "Channel %i: %s", c_num, chan->drv->name);
 			chan_destroy(chan);
-			io_chan[c_num] = NULL;
+			io->chan[c_num] = NULL;
 		}
 	}
 }
 
 // -----------------------------------------------------------------------
-void io_reset()
+void io_reset(struct io *io)
 {
 	for (int c_num=0 ; c_num<IO_MAX_CHAN ; c_num++) {
-		struct chan *chan = io_chan[c_num];
+		struct chan *chan = io->chan[c_num];
 		if (chan) {
 			chan->drv->reset(chan->obj);
 		}
@@ -106,15 +115,15 @@ void io_reset()
 }
 
 // -----------------------------------------------------------------------
-void io_get_intspec(int ch, uint16_t *int_spec)
+void io_get_intspec(struct io *io, int pn, int ch, uint16_t *int_spec)
 {
-	if (io_chan[ch]) {
-		io_chan[ch]->drv->cmd(io_chan[ch]->obj, IO_IN, CHAN_CMD_INTSPEC<<10, int_spec);
+	if (io->chan[ch]) {
+		io->chan[ch]->drv->cmd(io->chan[ch]->obj, pn, IO_IN, CHAN_CMD_INTSPEC<<10, int_spec);
 	}
 }
 
 // -----------------------------------------------------------------------
-int io_dispatch(int dir, uint16_t n, uint16_t *r)
+int io_dispatch(struct io *io, int pn, int dir, uint16_t n, uint16_t *r)
 {
 	int is_mem_cmd = n & 1; // 1 = memory configuration, 0 = I/O command
 	char narg[64];
@@ -122,7 +131,7 @@ int io_dispatch(int dir, uint16_t n, uint16_t *r)
 	// software memory configuration
 	if (is_mem_cmd) {
 		if (dir == IO_OU) {
-			return mem_cmd(n, *r);
+			return mem_cmd(&io->m->mem, n, *r);
 		} else {
 			LOG(L_IO, "MEM command shouldn't be IN");
 			return IO_NO;
@@ -130,81 +139,130 @@ int io_dispatch(int dir, uint16_t n, uint16_t *r)
 	// channel/unit command
 	} else {
 		int chan_n = (n & 0b0000000000011110) >> 1;
-		struct chan *chan = io_chan[chan_n];
+		struct chan *chan = io->chan[chan_n];
 		int res;
-		if (LOG_WANTS(L_IO)) {
+		if (LOG_WANTS(L_IO) && LOG_IO_PASS(chan_n, -1)) {
 			int2binf(narg, "cmd: ... .. ...... ch: .... .", n, 16);
-			LOG(L_IO, "I/O %s, chan: %d, n_arg: %s (0x%04x), r_arg: 0x%04x", dir ? "fetch" : "send", chan_n, narg, n, *r);
+			LOG(L_IO, "I/O %s, CPU: %i, chan: %d, n_arg: %s (0x%04x), r_arg: 0x%04x", dir ? "fetch" : "send", pn, chan_n, narg, n, *r);
 		}
 
 		if (chan) {
-			res = chan->drv->cmd(chan->obj, dir, n, r);
+			res = chan->drv->cmd(chan->obj, pn, dir, n, r);
 		} else {
 			res = IO_NO;
 		}
-		LOG(L_IO, "I/O result: %s, r_arg = 0x%04x", io_result_names[res], *r);
+		io->dispatched[chan_n][dir][res]++;
+		LOGIO(L_IO, chan_n, -1, "I/O result: %s, r_arg = 0x%04x", io_result_names[res], *r);
 		return res;
 	}
 }
 
 // -----------------------------------------------------------------------
-void io_int_set_pa()
+void io_int_set_pa(struct io *io)
 {
-	if (fpga) {
+	if (io->fpga) {
 		iob_pa_send();
 	} else {
-		int_set(INT_IFACE_POWER);
+		for (int i=0 ; i<io->m->cpu_count ; i++) {
+			int_set(io->m->cpu + i, INT_IFACE_POWER);
+		}
 	}
 }
 
 // -----------------------------------------------------------------------
-void io_int_set(int x)
+void io_int_set(struct io *io, int x)
 {
-	if (fpga) {
+	io_int_set_pn(io, x, 0);
+}
+
+// -----------------------------------------------------------------------
+void io_int_set_pn(struct io *io, int x, int pn)
+{
+	// pn: CPU the interrupting unit is allocated to (always 0 with FPGA CPU)
+	if (io->fpga) {
 		iob_int_send(x & 0b1111);
 	} else {
-		int_set((x & 0b1111) + 12);
+		int_set(io->m->cpu + pn, (x & 0b1111) + 12);
 	}
 }
 
 // -----------------------------------------------------------------------
-bool io_mem_read_1(int nb, uint16_t addr, uint16_t *data)
+static void io_cpu_wake(struct io *io)
 {
-	if (fpga) {
+	// memory is shared, CPUs polling it may need to be woken up
+	for (int i=0 ; i<io->m->cpu_count ; i++) {
+		cpu_idle_wake(io->m->cpu + i);
+	}
+}
+
+// -----------------------------------------------------------------------
+bool io_mem_read_1(struct io *io, int nb, uint16_t addr, uint16_t *data)
+{
+	if (io->fpga) {
 		return iob_mem_read_1(nb, addr, data);
 	} else {
-		return mem_read_1(nb, addr, data);
+		return mem_read_1(&io->m->mem, nb, addr, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-bool io_mem_write_1(int nb, uint16_t addr, uint16_t data)
+bool io_mem_write_1(struct io *io, int nb, uint16_t addr, uint16_t data)
 {
-	if (fpga) {
+	io_cpu_wake(io);
+	if (io->fpga) {
 		return iob_mem_write_1(nb, addr, data);
 	} else {
-		return mem_write_1(nb, addr, data);
+		return mem_write_1(&io->m->mem, nb, addr, data);
 	}
 }
 
 // -----------------------------------------------------------------------
-bool io_mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count)
+bool io_mem_read_n(struct io *io, int nb, uint16_t saddr, uint16_t *dest, int count)
 {
-	if (fpga) {
+	if (io->fpga) {
 		return iob_mem_read_n(nb, saddr, dest, count);
 	} else {
-		return mem_read_n(nb, saddr, dest, count);
+		return mem_read_n(&io->m->mem, nb, saddr, dest, count);
 	}
 }
 
 // -----------------------------------------------------------------------
-bool io_mem_write_n(int nb, uint16_t saddr, uint16_t *src, int count)
+bool io_mem_write_n(struct io *io, int nb, uint16_t saddr, uint16_t *src, int count)
 {
-	if (fpga) {
-		return iob_mem_read_n(nb, saddr, src, count);
+	io_cpu_wake(io);
+	if (io->fpga) {
+		return iob_mem_write_n(nb, saddr, src, count);
 	} else {
-		return mem_write_n(nb, saddr, src, count);
+		return mem_write_n(&io->m->mem, nb, saddr, src, count);
 	}
 }
 
+// -----------------------------------------------------------------------
+uint64_t io_emu_time(struct io *io)
+{
+	// machine time is the time of its most advanced CPU
+	uint64_t t = cpu_emu_time(io->m->cpu);
+	for (int i=1 ; i<io->m->cpu_count ; i++) {
+		uint64_t tc = cpu_emu_time(io->m->cpu + i);
+		if (tc > t) t = tc;
+	}
+	return t;
+}
+
+// -----------------------------------------------------------------------
+unsigned long io_cpu_instructions(struct io *io)
+{
+	unsigned long count = 0;
+	for (int i=0 ; i<io->m->cpu_count ; i++) {
+		count += atom_load_acquire(&io->m->cpu[i].ips_counter);
+	}
+	return count;
+}
+
+// -----------------------------------------------------------------------
+int io_cpu_count(struct io *io)
+{
+	return io->m->cpu_count;
+}
+
 // vim: tabstop=4 shiftwidth=4 autoindent
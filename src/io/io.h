@@ -21,20 +21,35 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+#include "io/defs.h"
 #include "cfg.h"
 
-int io_init(em400_cfg *cfg);
-void io_shutdown();
-void io_reset();
-void io_get_intspec(int ch, uint16_t *int_spec);
-int io_dispatch(int dir, uint16_t n, uint16_t *r);
-
-void io_int_set(int x);
-void io_int_set_pa();
-bool io_mem_read_1(int nb, uint16_t addr, uint16_t *data);
-bool io_mem_write_1(int nb, uint16_t addr, uint16_t data);
-bool io_mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count);
-bool io_mem_write_n(int nb, uint16_t saddr, uint16_t *src, int count);
+struct em400_machine;
+struct chan;
+
+struct io {
+	struct em400_machine *m;	// machine the I/O belongs to
+	struct chan *chan[IO_MAX_CHAN];
+	unsigned long dispatched[IO_MAX_CHAN][2][4]; // [chan][dir][result], updated by the CPU thread only
+	bool fpga;
+};
+
+int io_init(struct io *io, struct em400_machine *m, em400_cfg *cfg);
+void io_shutdown(struct io *io);
+void io_reset(struct io *io);
+void io_get_intspec(struct io *io, int pn, int ch, uint16_t *int_spec);
+int io_dispatch(struct io *io, int pn, int dir, uint16_t n, uint16_t *r);
+
+void io_int_set(struct io *io, int x);
+void io_int_set_pn(struct io *io, int x, int pn);
+void io_int_set_pa(struct io *io);
+bool io_mem_read_1(struct io *io, int nb, uint16_t addr, uint16_t *data);
+bool io_mem_write_1(struct io *io, int nb, uint16_t addr, uint16_t data);
+bool io_mem_read_n(struct io *io, int nb, uint16_t saddr, uint16_t *dest, int count);
+bool io_mem_write_n(struct io *io, int nb, uint16_t saddr, uint16_t *src, int count);
+uint64_t io_emu_time(struct io *io);
+unsigned long io_cpu_instructions(struct io *io);
+int io_cpu_count(struct io *io);
 
 #endif
 
@@ -23,15 +23,20 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
 
 #include "log.h"
 #include "atomic.h"
 #include "io/io.h"
 #include "io/chan.h"
 #include "utils/elst.h"
+#include "ectl/metrics.h"
 #include "cfg.h"
 
 #define INIT_DELAY_US 200000
+#define LOAD_TICK_MAX_NS 100000000L
+#define NS_PER_S 1000000000L
 
 enum it_event_types { EV_CMD, EV_RESET, EV_QUIT, };
 
@@ -58,14 +63,38 @@ enum it_commands {
 };
 
 struct iotester {
+	struct io *io;
 	pthread_t thread;
 	ELST evq;
 
 	int chnum;
 	uint16_t intspec;
+
+	// load generator
+	pthread_t load_thread;
+	bool load;
+	bool load_quit;
+	int int_rate;
+	uint16_t int_spec;
+	int en_ratio;
+	int latency_us;
+	int dma_rate;
+	int dma_words;
+	int dma_nb;
+	uint16_t dma_addr;
+	int baseline;
+	int report;
+
+	unsigned long ints;
+	unsigned long dma_bursts;
+	unsigned long dma_failed;
+	unsigned long dma_words_total;
+	unsigned long answers[2][IO_PE+1];
 };
 
+void it_shutdown(void *ch);
 static void * it_cmdproc(void *ptr);
+static void * it_loadgen(void *ptr);
 
 // -----------------------------------------------------------------------
 void it_event_destructor(void *ptr)
@@ -74,7 +103,78 @@ void it_event_destructor(void *ptr)
 }
 
 // -----------------------------------------------------------------------
-void * it_create(int num, em400_cfg *cfg)
+static int it_cfg_int(em400_cfg *cfg, int chnum, const char *key, int def)
+{
+	if (!cfg_fcontains(cfg, "iotester%i:%s", chnum, key)) {
+		return def;
+	}
+	return cfg_fgetint(cfg, "iotester%i:%s", chnum, key);
+}
+
+// -----------------------------------------------------------------------
+static void it_metrics_register(struct iotester *it)
+{
+	static const char *dir_names[] = { "ou", "in" };
+	static const char *res_names[] = { "no", "en", "ok", "pe" };
+
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_iotester_interrupts_total", "Interrupts generated by the I/O load generator", &it->ints, "chan=\"%i\"", it->chnum);
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_iotester_dma_bursts_total", "DMA bursts done by the I/O load generator", &it->dma_bursts, "chan=\"%i\"", it->chnum);
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_iotester_dma_words_total", "Words written by the I/O load generator", &it->dma_words_total, "chan=\"%i\"", it->chnum);
+	for (int dir=IO_OU ; dir<=IO_IN ; dir++) {
+		for (int res=IO_NO ; res<=IO_PE ; res++) {
+			ectl_metric_add(ECTL_METRIC_COUNTER, "em400_iotester_answers_total", "I/O commands answered by the I/O tester", &it->answers[dir][res], "chan=\"%i\",dir=\"%s\",result=\"%s\"", it->chnum, dir_names[dir], res_names[res]);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+static int it_load_configure(struct iotester *it, em400_cfg *cfg)
+{
+	it->int_rate = it_cfg_int(cfg, it->chnum, "int_rate", CFG_DEFAULT_IOTESTER_INT_RATE);
+	it->int_spec = it_cfg_int(cfg, it->chnum, "int_spec", CFG_DEFAULT_IOTESTER_INT_SPEC);
+	it->en_ratio = it_cfg_int(cfg, it->chnum, "en_ratio", CFG_DEFAULT_IOTESTER_EN_RATIO);
+	it->latency_us = it_cfg_int(cfg, it->chnum, "latency", CFG_DEFAULT_IOTESTER_LATENCY);
+	it->dma_rate = it_cfg_int(cfg, it->chnum, "dma_rate", CFG_DEFAULT_IOTESTER_DMA_RATE);
+	it->dma_words = it_cfg_int(cfg, it->chnum, "dma_words", CFG_DEFAULT_IOTESTER_DMA_WORDS);
+	it->dma_nb = it_cfg_int(cfg, it->chnum, "dma_nb", CFG_DEFAULT_IOTESTER_DMA_NB);
+	it->dma_addr = it_cfg_int(cfg, it->chnum, "dma_addr", CFG_DEFAULT_IOTESTER_DMA_ADDR);
+	it->baseline = it_cfg_int(cfg, it->chnum, "baseline", CFG_DEFAULT_IOTESTER_BASELINE);
+	it->report = it_cfg_int(cfg, it->chnum, "report", CFG_DEFAULT_IOTESTER_REPORT);
+
+	if ((it->int_rate < 0) || (it->dma_rate < 0) || (it->latency_us < 0) || (it->baseline < 0) || (it->report < 0)) {
+		return LOGERR("I/O tester: rates, latency and times must not be negative.");
+	}
+	if ((it->en_ratio < 0) || (it->en_ratio > 100)) {
+		return LOGERR("I/O tester: EN ratio must be in 0..100%% range, not %i.", it->en_ratio);
+	}
+	if ((it->dma_words < 1) || (it->dma_words > 0x10000)) {
+		return LOGERR("I/O tester: DMA burst size must be 1..65536 words, not %i.", it->dma_words);
+	}
+	if ((it->dma_nb < 0) || (it->dma_nb > 15)) {
+		return LOGERR("I/O tester: wrong DMA memory block: %i.", it->dma_nb);
+	}
+
+	if (!it->int_rate && !it->dma_rate) {
+		return E_OK;
+	}
+
+	LOG(L_IO, "I/O load generator: %i int/s (intspec 0x%04x), %i DMA bursts/s (%i words to %i:0x%04x), %i%% EN, %ius latency",
+		it->int_rate, it->int_spec, it->dma_rate, it->dma_words, it->dma_nb, it->dma_addr, it->en_ratio, it->latency_us);
+
+	if (pthread_create(&it->load_thread, NULL, it_loadgen, it)) {
+		return LOGERR("Failed to spawn I/O load generator thread.");
+	}
+	it->load = true;
+
+	char name[16];
+	sprintf(name, "itload%02i", it->chnum);
+	pthread_setname_np(it->load_thread, name);
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void * it_create(struct io *io, int num, em400_cfg *cfg)
 {
 	struct iotester *it = (struct iotester *) calloc(1, sizeof(struct iotester));
 	if (!it) {
@@ -82,6 +182,7 @@ void * it_create(int num, em400_cfg *cfg)
 		return NULL;
 	}
 
+	it->io = io;
 	it->chnum = num;
 	srand(time(NULL));
 
@@ -111,6 +212,13 @@ void * it_create(int num, em400_cfg *cfg)
 	sprintf(name, "iotest%02i", it->chnum);
 	pthread_setname_np(it->thread, name);
 
+	if (it_load_configure(it, cfg) != E_OK) {
+		it_shutdown(it);
+		return NULL;
+	}
+
+	it_metrics_register(it);
+
 	LOG(L_IO, "I/O tester created");
 
 	return it;
@@ -136,6 +244,11 @@ void it_shutdown(void *ch)
 
 	LOG(L_IO, "I/O tester shutting down");
 
+	if (it->load) {
+		atom_store_release(&it->load_quit, true);
+		pthread_join(it->load_thread, NULL);
+	}
+
 	elst_insert(it->evq, it_event_new(EV_QUIT, 0, 0), 0);
 	pthread_join(it->thread, NULL);
 	elst_destroy(it->evq);
@@ -184,7 +297,7 @@ static void * it_cmdproc(void *ptr)
 					usleep(INIT_DELAY_US);
 					LOG(L_IO, "Reset done, sending interrupt with intspec 0xffff");
 					atom_store_release(&it->intspec, 0xffff);
-					io_int_set(it->chnum);
+					io_int_set(it->io, it->chnum);
 				}
 				break;
 			case EV_CMD:
@@ -194,58 +307,58 @@ static void * it_cmdproc(void *ptr)
 						LOG(L_IO, "NB = %i", r & 0b1111);
 						nb = r & 0b1111;
 						atom_store_release(&it->intspec, 0);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_WAM:
 						LOG(L_IO, "AM = 0x%04x", r);
 						am = r;
 						atom_store_release(&it->intspec, 0);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_WAB:
 						LOG(L_IO, "AB = 0x%04x", r);
 						ab = r;
 						atom_store_release(&it->intspec, 0);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_WM:
 						LOG(L_IO, "single: buf[0x%04x] -> [%i:0x%04x], %i words", ab, nb, am, r);
 						for (int i=0 ; i<r ; i++) {
-							res = io_mem_write_1(nb, am+i, buf[ab+i]);
+							res = io_mem_write_1(it->io, nb, am+i, buf[ab+i]);
 							if (!res) break;
 						}
 						atom_store_release(&it->intspec, res);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_RM:
 						LOG(L_IO, "single: [%i:0x%04x] -> buf[0x%04x], %i words", nb, am, ab, r);
 						for (int i=0 ; i<r ; i++) {
-							res = io_mem_read_1(nb, am+i, buf+ab+i);
+							res = io_mem_read_1(it->io, nb, am+i, buf+ab+i);
 							if (!res) break;
 						}
 						atom_store_release(&it->intspec, res);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_WMM:
 						LOG(L_IO, "multi: buf[0x%04x] -> [%i:0x%04x], %i words", ab, nb, am, r);
-						res = io_mem_write_n(nb, am, buf+ab, r);
+						res = io_mem_write_n(it->io, nb, am, buf+ab, r);
 						atom_store_release(&it->intspec, res);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_RMM:
 						LOG(L_IO, "multi: [%i:0x%04x] -> buf[0x%04x], %i words", nb, am, ab, r);
-						res = io_mem_read_n(nb, am, buf+ab, r);
+						res = io_mem_read_n(it->io, nb, am, buf+ab, r);
 						atom_store_release(&it->intspec, res);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_IRQ:
 						LOG(L_IO, "Sending interrupt (intspec set to 0x%04x)", r);
 						atom_store_release(&it->intspec, r);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 					case CMD_PA:
 						LOG(L_IO, "Sending Power Alarm interrupt");
-						io_int_set_pa();
+						io_int_set_pa(it->io);
 						break;
 					case CMD_ERI:
 						reset_int = 1;
@@ -254,7 +367,7 @@ static void * it_cmdproc(void *ptr)
 					default:
 						LOG(L_IO, "Unknown 'SEND' command: %i", ev->cmd);
 						atom_store_release(&it->intspec, 0);
-						io_int_set(it->chnum);
+						io_int_set(it->io, it->chnum);
 						break;
 				}
 				break;
@@ -269,10 +382,128 @@ static void * it_cmdproc(void *ptr)
 }
 
 // -----------------------------------------------------------------------
-int it_cmd(void *ch, int dir, uint16_t n_arg, uint16_t *r_arg)
+static int64_t it_now_ns()
 {
-	struct iotester *it = (struct iotester *) ch;
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t) t.tv_sec * NS_PER_S + t.tv_nsec;
+}
+
+// -----------------------------------------------------------------------
+static void it_sleep_until(int64_t deadline)
+{
+	struct timespec t = { .tv_sec = deadline / NS_PER_S, .tv_nsec = deadline % NS_PER_S };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL));
+}
+
+// -----------------------------------------------------------------------
+static double it_ips(struct io *io, unsigned long *count, int64_t *t)
+{
+	unsigned long c = io_cpu_instructions(io);
+	int64_t now = it_now_ns();
+	double ips = (double) (c - *count) * NS_PER_S / (now - *t);
+	*count = c;
+	*t = now;
+	return ips;
+}
 
+// -----------------------------------------------------------------------
+static void it_load_report(struct iotester *it, const char *when, double ips, double baseline_ips, double elapsed_s)
+{
+	unsigned long en = it->answers[IO_OU][IO_EN] + it->answers[IO_IN][IO_EN];
+	unsigned long ok = it->answers[IO_OU][IO_OK] + it->answers[IO_IN][IO_OK];
+
+	if (baseline_ips > 0) {
+		LOG(L_IO, "I/O load %s: %.0f int/s, %.0f DMA words/s (%lu failed bursts), %lu EN / %lu OK answers, CPU %.0f IPS (%+.1f%% vs. %.0f IPS baseline)",
+			when, it->ints / elapsed_s, it->dma_words_total / elapsed_s, it->dma_failed, en, ok, ips, 100.0 * (ips - baseline_ips) / baseline_ips, baseline_ips);
+	} else {
+		LOG(L_IO, "I/O load %s: %.0f int/s, %.0f DMA words/s (%lu failed bursts), %lu EN / %lu OK answers, CPU %.0f IPS",
+			when, it->ints / elapsed_s, it->dma_words_total / elapsed_s, it->dma_failed, en, ok, ips);
+	}
+}
+
+// -----------------------------------------------------------------------
+static void * it_loadgen(void *ptr)
+{
+	struct iotester *it = (struct iotester *) ptr;
+
+	uint16_t *dma_buf = malloc(it->dma_words * sizeof(uint16_t));
+	if (!dma_buf) {
+		LOGERR("I/O load generator: memory allocation error.");
+		pthread_exit(NULL);
+	}
+	for (int i=0 ; i<it->dma_words ; i++) {
+		dma_buf[i] = i;
+	}
+
+	unsigned long ips_count = io_cpu_instructions(it->io);
+	int64_t ips_t = it_now_ns();
+	double baseline_ips = 0;
+
+	// measure unloaded CPU speed first
+	if (it->baseline) {
+		int64_t deadline = ips_t + (int64_t) it->baseline * NS_PER_S;
+		while (!atom_load_acquire(&it->load_quit) && (it_now_ns() < deadline)) {
+			it_sleep_until(it_now_ns() + LOAD_TICK_MAX_NS);
+		}
+		baseline_ips = it_ips(it->io, &ips_count, &ips_t);
+		LOG(L_IO, "I/O load baseline: %.0f IPS", baseline_ips);
+	}
+
+	const int64_t int_period = it->int_rate ? NS_PER_S / it->int_rate : 0;
+	const int64_t dma_period = it->dma_rate ? NS_PER_S / it->dma_rate : 0;
+	const int64_t start = it_now_ns();
+	const unsigned long ips_start = io_cpu_instructions(it->io);
+	int64_t next_int = start + int_period;
+	int64_t next_dma = start + dma_period;
+	int64_t next_report = it->report ? start + (int64_t) it->report * NS_PER_S : INT64_MAX;
+
+	while (!atom_load_acquire(&it->load_quit)) {
+		int64_t now = it_now_ns();
+
+		if (int_period && (now >= next_int)) {
+			atom_store_release(&it->intspec, it->int_spec);
+			io_int_set(it->io, it->chnum);
+			it->ints++;
+			// don't try to catch up on missed periods, just keep the rate
+			next_int = (now - next_int > int_period) ? now + int_period : next_int + int_period;
+		}
+
+		if (dma_period && (now >= next_dma)) {
+			if (io_mem_write_n(it->io, it->dma_nb, it->dma_addr, dma_buf, it->dma_words)) {
+				it->dma_bursts++;
+				it->dma_words_total += it->dma_words;
+			} else {
+				it->dma_failed++;
+			}
+			next_dma = (now - next_dma > dma_period) ? now + dma_period : next_dma + dma_period;
+		}
+
+		if (now >= next_report) {
+			it_load_report(it, "status", it_ips(it->io, &ips_count, &ips_t), baseline_ips, (now - start) / (double) NS_PER_S);
+			next_report += (int64_t) it->report * NS_PER_S;
+		}
+
+		int64_t next = now + LOAD_TICK_MAX_NS;
+		if (int_period && (next_int < next)) next = next_int;
+		if (dma_period && (next_dma < next)) next = next_dma;
+		if (next_report < next) next = next_report;
+		it_sleep_until(next);
+	}
+
+	// averages over the whole loaded run
+	ips_count = ips_start;
+	ips_t = start;
+	double ips = it_ips(it->io, &ips_count, &ips_t);
+	it_load_report(it, "summary", ips, baseline_ips, (ips_t - start) / (double) NS_PER_S);
+
+	free(dma_buf);
+	pthread_exit(NULL);
+}
+
+// -----------------------------------------------------------------------
+static int it_cmd_process(struct iotester *it, int dir, uint16_t n_arg, uint16_t *r_arg)
+{
 	int echo = (n_arg & 0b1000000000000000) >> 15;
 	int cmd =  (n_arg & 0b0111100000000000) >> 11;
 	int rmd =  (n_arg & 0b0000011111100000) >> 5;
@@ -309,6 +540,27 @@ int it_cmd(void *ch, int dir, uint16_t n_arg, uint16_t *r_arg)
 	return IO_OK;
 }
 
+// -----------------------------------------------------------------------
+int it_cmd(void *ch, int pn, int dir, uint16_t n_arg, uint16_t *r_arg)
+{
+	struct iotester *it = (struct iotester *) ch;
+	int res;
+
+	if (it->latency_us) {
+		usleep(it->latency_us);
+	}
+
+	if (it->en_ratio && (random() % 100 < it->en_ratio)) {
+		LOG(L_IO, "Load generator: answering EN");
+		res = IO_EN;
+	} else {
+		res = it_cmd_process(it, dir, n_arg, r_arg);
+	}
+
+	it->answers[dir][res]++;
+	return res;
+}
+
 // -----------------------------------------------------------------------
 const struct chan_drv it_chan_driver = {
 	.name = "iotester",
@@ -24,6 +24,7 @@ const char *mx_event_type_names[] = {
 	"COMMAND",
 	"INT_PUSH",
 	"RESET",
+	"SYNC",
 	"QUIT",
 	"[invalid-event]"
 };
@@ -25,6 +25,7 @@ enum mx_event_types {
 	MX_EV_CMD,
 	MX_EV_INT_PUSH,
 	MX_EV_RESET,
+	MX_EV_SYNC,
 	MX_EV_QUIT, // highest priority
 	MX_EV_CNT
 };
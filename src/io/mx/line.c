@@ -227,14 +227,14 @@ static void mx_line_process_cmd(struct mx_line *line, struct mx_event *ev)
 	int irq;
 	const struct mx_cmd *cmd = line->proto->cmd + ev->cmd;
 
-	LOG(L_MX, "(EV%04x) Line %i (%s) got cmd %s", ev->id, line->log_n, line->proto->name, mx_get_cmd_name(ev->cmd));
+	LOGIO(L_MX, line->multix->chnum, line->log_n, "(EV%04x) Line %i (%s) got cmd %s", ev->id, line->log_n, line->proto->name, mx_get_cmd_name(ev->cmd));
 
 	uint16_t cmd_data_addr = ev->arg;
 	uint16_t cmd_data[MAX_CMD_DATA_LEN];
 
 	// check for emulation errors
 	if (cmd->input_flen + cmd->output_flen > MAX_CMD_DATA_LEN) {
-		LOG(L_MX, "(EV%04x) ERROR protocol data (%i words) won't fit in the data buffer (%i words)", cmd->input_flen + cmd->output_flen, MAX_CMD_DATA_LEN);
+		LOGIO(L_MX, line->multix->chnum, line->log_n, "(EV%04x) ERROR protocol data (%i words) won't fit in the data buffer (%i words)", cmd->input_flen + cmd->output_flen, MAX_CMD_DATA_LEN);
 		irq = MX_IRQ_INPAO;
 		goto fin;
 	}
@@ -271,32 +271,45 @@ fin:
 	pthread_mutex_unlock(&line->status_mutex);
 }
 
+// -----------------------------------------------------------------------
+static void mx_line_sync_ack(struct mx_line *line)
+{
+	pthread_mutex_lock(&line->status_mutex);
+	line->sync_count++;
+	pthread_cond_broadcast(&line->sync_cond);
+	pthread_mutex_unlock(&line->status_mutex);
+}
+
 // -----------------------------------------------------------------------
 void * mx_line_thread(void *ptr)
 {
 	int quit = 0;
 	struct mx_line *line = (struct mx_line *) ptr;
 
-	LOG(L_MX, "Entering line %i protocol loop, device: %s", line->log_n, line->proto->name);
+	// thread belongs to the physical line and outlives logical line configurations
+	LOGIO(L_MX, line->multix->chnum, line->log_n, "Entering physical line %i protocol loop", line->phy_n);
 
 	while (!quit) {
-		LOG(L_MX, "Line %i (%s) waiting for event", line->log_n, line->proto->name);
+		LOGIO(L_MX, line->multix->chnum, line->log_n, "Physical line %i waiting for event", line->phy_n);
 		struct mx_event *ev = (struct mx_event *) elst_wait_pop(line->protoq, 0);
 		switch (ev->type) {
 			case MX_EV_QUIT:
 				quit = 1;
 				break;
+			case MX_EV_SYNC:
+				mx_line_sync_ack(line);
+				break;
 			case MX_EV_CMD:
 				mx_line_process_cmd(line, ev);
 				break;
 			default:
-				LOG(L_MX, "(EV%04x) Line %i (%s) protocol thread got unknown event type %i. Ignored.", ev->id, line->log_n, line->proto->name, ev->type);
+				LOGIO(L_MX, line->multix->chnum, line->log_n, "(EV%04x) Physical line %i protocol thread got unknown event type %i. Ignored.", ev->id, line->phy_n, ev->type);
 				break;
 		}
 		free(ev);
 	}
 
-	LOG(L_MX, "Left line %i loop, device: %s", line->log_n, line->proto->name);
+	LOGIO(L_MX, line->multix->chnum, line->log_n, "Left physical line %i protocol loop", line->phy_n);
 
 	pthread_exit(NULL);
 }
@@ -304,7 +317,7 @@ void * mx_line_thread(void *ptr)
 // -----------------------------------------------------------------------
 void log_line_status(const char *txt, int log_n, uint32_t status, unsigned evid)
 {
-	LOG(L_MX, "(EV%04x) %s: line %i status: 0x%08x: %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s",
+	LOGIO(L_MX, -1, log_n, "(EV%04x) %s: line %i status: 0x%08x: %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s",
 		evid,
 		txt,
 		log_n,
@@ -334,10 +347,10 @@ void * mx_line_status_thread(void *ptr)
 	int quit = 0;
 	struct mx_line *line = (struct mx_line *) ptr;
 
-	LOG(L_MX, "Entering line %i status loop", line->log_n);
+	LOGIO(L_MX, line->multix->chnum, line->log_n, "Entering physical line %i status loop", line->phy_n);
 
 	while (!quit) {
-		LOG(L_MX, "Line %i waiting for status event", line->log_n);
+		LOGIO(L_MX, line->multix->chnum, line->log_n, "Physical line %i waiting for status event", line->phy_n);
 		struct mx_event *ev = (struct mx_event *) elst_wait_pop(line->statusq, 0);
 		if ((ev->type == MX_EV_CMD) && (ev->cmd == MX_CMD_STATUS)) {
 			pthread_mutex_lock(&line->status_mutex);
@@ -350,15 +363,17 @@ void * mx_line_status_thread(void *ptr)
 			}
 			line->status &= ~mx_cmd_state(ev->cmd);
 			pthread_mutex_unlock(&line->status_mutex);
+		} else if (ev->type == MX_EV_SYNC) {
+			mx_line_sync_ack(line);
 		} else if (ev->type == MX_EV_QUIT) {
 			quit = 1;
 		} else {
-			LOG(L_MX, "(EV%04x) Line %i (%s) status thread got unknown event type %i. Ignored.", ev->id, line->log_n, line->proto->name, ev->type);
+			LOGIO(L_MX, line->multix->chnum, line->log_n, "(EV%04x) Physical line %i status thread got unknown event type %i. Ignored.", ev->id, line->phy_n, ev->type);
 		}
 		free(ev);
 	}
 
-	LOG(L_MX, "Left line %i status loop", line->log_n);
+	LOGIO(L_MX, line->multix->chnum, line->log_n, "Left physical line %i status loop", line->phy_n);
 
 	pthread_exit(NULL);
 }
@@ -34,6 +34,7 @@
 #include "io/mx/irq.h"
 #include "io/mx/event.h"
 #include "io/mx/line.h"
+#include "ectl/metrics.h"
 #include "cfg.h"
 
 // Doing asynchronous reset that mimics hardware is hard in multithreaded software.
@@ -48,10 +49,11 @@ enum mx_condition { MX_UNINITIALIZED, MX_INITIALIZED, MX_CONFIGURED, MX_QUIT };
 
 // Real multix boots up in probably just under a second
 // (~500ms for ROM/RAM check + ~185ms for RAM cleanup).
-// Here we need just a reasonable delay - big enough for
-// OS scheduler to switch threads between MULTIX and CPU,
-// so we don't finish MULTIX' job before switching back to CPU thread.
-#define MX_INIT_TIME_MSEC 150
+// Here we need just a reasonable delay, counted in emulated CPU time,
+// so the CPU always gets to run before MULTIX' job is finished.
+// Time doesn't pass while the CPU is stopped, CPU waiting counts in full.
+#define MX_INIT_TIME_NS (150 * 1000000ULL)
+#define MX_INIT_POLL_MSEC 1
 
 typedef int (*mx_cmd_fun)(struct mx *multix, int log_n, uint16_t arg);
 
@@ -67,7 +69,29 @@ void mx_event_destructor(void *ptr)
 }
 
 // -----------------------------------------------------------------------
-void * mx_create(int ch_num, em400_cfg *cfg)
+static unsigned long mx_queue_depth(void *arg)
+{
+	return elst_count((ELST) arg);
+}
+
+// -----------------------------------------------------------------------
+static void mx_metrics_register(struct mx *multix)
+{
+	const char *name = "em400_mx_queue_depth";
+	const char *help = "Events waiting in MULTIX queues";
+
+	ectl_metric_add_fn(ECTL_METRIC_GAUGE, name, help, mx_queue_depth, multix->intq, "chan=\"%i\",queue=\"int\"", multix->chnum);
+	ectl_metric_add_fn(ECTL_METRIC_GAUGE, name, help, mx_queue_depth, multix->eventq, "chan=\"%i\",queue=\"event\"", multix->chnum);
+	for (int i=0 ; i<MX_LINE_CNT ; i++) {
+		struct mx_line *pline = multix->plines + i;
+		if (!pline->dev) continue;
+		ectl_metric_add_fn(ECTL_METRIC_GAUGE, name, help, mx_queue_depth, pline->protoq, "chan=\"%i\",queue=\"proto\",line=\"%i\"", multix->chnum, i);
+		ectl_metric_add_fn(ECTL_METRIC_GAUGE, name, help, mx_queue_depth, pline->statusq, "chan=\"%i\",queue=\"status\",line=\"%i\"", multix->chnum, i);
+	}
+}
+
+// -----------------------------------------------------------------------
+void * mx_create(struct io *io, int ch_num, em400_cfg *cfg)
 {
 	LOG(L_MX, "Creating new MULTIX");
 
@@ -79,6 +103,7 @@ void * mx_create(int ch_num, em400_cfg *cfg)
 		goto cleanup;
 	}
 	// initialize multix structure
+	multix->io = io;
 	multix->chnum = ch_num;
 	atom_store_release(&multix->state, MX_UNINITIALIZED);
 	for (int i=0 ; i<MX_LINE_CNT ; i++) {
@@ -91,6 +116,10 @@ void * mx_create(int ch_num, em400_cfg *cfg)
 			LOGERR("Failed to initialize line %i status mutex.", i);
 			goto cleanup;
 		}
+		if (pthread_cond_init(&pline->sync_cond, NULL)) {
+			LOGERR("Failed to initialize line %i sync condition.", i);
+			goto cleanup;
+		}
 	}
 
 	// --- create interrupt system (devices need it)
@@ -135,6 +164,8 @@ void * mx_create(int ch_num, em400_cfg *cfg)
 	snprintf(name, 15, "mxev%02i", multix->chnum);
 	pthread_setname_np(multix->ev_thread, name);
 
+	mx_metrics_register(multix);
+
 	LOG(L_MX, "MULTIX created");
 
 	return multix;
@@ -159,6 +190,7 @@ cleanup:
 			elst_destroy(pline->protoq);
 			elst_destroy(pline->statusq);
 			pthread_mutex_destroy(&pline->status_mutex);
+			pthread_cond_destroy(&pline->sync_cond);
 		}
 		free(multix);
 	}
@@ -166,36 +198,72 @@ cleanup:
 	return NULL;
 }
 
+// -----------------------------------------------------------------------
+static void mx_line_threads_stop(struct mx_line *pline)
+{
+	pthread_cancel(pline->proto_th);
+	pthread_join(pline->proto_th, NULL);
+	pthread_cancel(pline->status_th);
+	pthread_join(pline->status_th, NULL);
+	pline->threads = false;
+}
+
+// -----------------------------------------------------------------------
+static int mx_line_threads_send(struct mx_line *pline, int type)
+{
+	ELST queues[] = { pline->protoq, pline->statusq };
+
+	for (int i=0 ; i<2 ; i++) {
+		struct mx_event *ev = (struct mx_event *) calloc(1, sizeof(struct mx_event));
+		if (!ev) return E_ERR;
+		ev->type = type;
+		// type is also the priority
+		if (elst_insert(queues[i], ev, type) <= 0) {
+			free(ev);
+			return E_ERR;
+		}
+	}
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+static void mx_line_threads_sync(struct mx_line *pline)
+{
+	// drop whatever is still queued and wait until both line threads
+	// are done with the event they're processing (if any)
+	elst_clear(pline->protoq);
+	elst_clear(pline->statusq);
+
+	pthread_mutex_lock(&pline->status_mutex);
+	unsigned target = pline->sync_count + 2;
+	pthread_mutex_unlock(&pline->status_mutex);
+
+	if (mx_line_threads_send(pline, MX_EV_SYNC) != E_OK) {
+		LOG(L_MX, "Failed to send SYNC event to physical line %i threads, terminating them", pline->phy_n);
+		mx_line_threads_stop(pline);
+		return;
+	}
+
+	pthread_mutex_lock(&pline->status_mutex);
+	while (pline->sync_count < target) {
+		pthread_cond_wait(&pline->sync_cond, &pline->status_mutex);
+	}
+	pthread_mutex_unlock(&pline->status_mutex);
+}
+
 // -----------------------------------------------------------------------
 static void mx_lines_deinit(struct mx *multix)
 {
 	LOG(L_MX, "Deinitializing logical lines");
 
-	// send QUIT event to all line threads
+	// line threads stay around for the next configuration,
+	// but they need to be idle before protocols are destroyed
 	for (int i=0 ; i<MX_LINE_CNT ; i++) {
 		struct mx_line *lline = multix->llines[i];
 		if (lline) {
-			// quit the protocol thread
-			struct mx_event *ev = (struct mx_event *) malloc(sizeof(struct mx_event));
-			if (ev) {
-				ev->type = MX_EV_QUIT;
-				if (elst_insert(lline->protoq, ev, MX_EV_QUIT) > 0) {
-					pthread_join(lline->proto_th, NULL);
-				} else {
-					LOG(L_MX, "Failed to send QUIT event to %s protocol queue on line %i, terminating event thread", lline->proto->name, lline->log_n );
-					pthread_cancel(lline->proto_th);
-				}
-			}
-			// quit the status thread
-			struct mx_event *ev2 = (struct mx_event *) malloc(sizeof(struct mx_event));
-			if (ev2) {
-				ev2->type = MX_EV_QUIT;
-				if (elst_insert(lline->statusq, ev2, MX_EV_QUIT) > 0) {
-					pthread_join(lline->status_th, NULL);
-				} else {
-					LOG(L_MX, "Failed to send QUIT event to %s status queue on line %i, terminating event thread", lline->proto->name, lline->log_n );
-					pthread_cancel(lline->status_th);
-				}
+			if (lline->threads) {
+				mx_line_threads_sync(lline);
 			}
 			lline->log_n = -1;
 			lline->status = MX_LSTATE_NONE;
@@ -218,6 +286,25 @@ static void mx_lines_deinit(struct mx *multix)
 	}
 }
 
+// -----------------------------------------------------------------------
+static void mx_lines_quit(struct mx *multix)
+{
+	LOG(L_MX, "Stopping line threads");
+
+	for (int i=0 ; i<MX_LINE_CNT ; i++) {
+		struct mx_line *pline = multix->plines + i;
+		if (!pline->threads) continue;
+		if (mx_line_threads_send(pline, MX_EV_QUIT) == E_OK) {
+			pthread_join(pline->proto_th, NULL);
+			pthread_join(pline->status_th, NULL);
+			pline->threads = false;
+		} else {
+			LOG(L_MX, "Failed to send QUIT event to physical line %i threads, terminating them", pline->phy_n);
+			mx_line_threads_stop(pline);
+		}
+	}
+}
+
 // -----------------------------------------------------------------------
 void mx_shutdown(void *ch)
 {
@@ -240,6 +327,7 @@ void mx_shutdown(void *ch)
 	// --- deinit lines, destroy devices
 
 	mx_lines_deinit(multix);
+	mx_lines_quit(multix);
 
 	// --- destroy interrupt system
 
@@ -258,6 +346,7 @@ void mx_shutdown(void *ch)
 		elst_destroy(pline->protoq);
 		elst_destroy(pline->statusq);
 		pthread_mutex_destroy(&pline->status_mutex);
+		pthread_cond_destroy(&pline->sync_cond);
 	}
 	free(multix);
 	LOG(L_MX, "Shutdown complete");
@@ -271,7 +360,7 @@ bool mx_mem_read(struct mx *multix, int nb, uint16_t addr, uint16_t *data, int l
 		return true;
 	}
 
-	return io_mem_read_n(nb, addr, data, len);
+	return io_mem_read_n(multix->io, nb, addr, data, len);
 }
 
 // -----------------------------------------------------------------------
@@ -282,7 +371,7 @@ bool mx_mem_write(struct mx *multix, int nb, uint16_t addr, uint16_t *data, int
 		return true;
 	}
 
-	return io_mem_write_n(nb, addr, data, len);
+	return io_mem_write_n(multix->io, nb, addr, data, len);
 }
 
 // -----------------------------------------------------------------------
@@ -293,7 +382,8 @@ static void mx_int_set(struct mx *multix)
 		return;
 	}
 
-	io_int_set(multix->chnum);
+	// there is a single interrupt queue, served by CPU 0 (no 2-CPU queue)
+	io_int_set(multix->io, multix->chnum);
 }
 
 // -----------------------------------------------------------------------
@@ -321,7 +411,7 @@ static void mx_int_push(struct mx *multix)
 // -----------------------------------------------------------------------
 int mx_int_enqueue(struct mx *multix, int intr, int line)
 {
-	LOG(L_MX, "Enqueue interrupt %i (%s), line %i", intr, mx_irq_name(intr), line);
+	LOGIO(L_MX, multix->chnum, line, "Enqueue interrupt %i (%s), line %i", intr, mx_irq_name(intr), line);
 
 	// TODO: this is silly
 	uint16_t *i = (uint16_t *) malloc(sizeof(uint16_t));
@@ -346,7 +436,7 @@ static uint16_t mx_int_get_spec(struct mx *multix)
 	multix->intspec = MX_IRQ_INIEA;
 	pthread_mutex_unlock(&multix->int_mutex);
 
-	LOG(L_MX, "Sending intspec to CPU: 0x%04x (%s, line %i)", lintspec, mx_irq_name(lintspec>>8), lintspec & 0xFF);
+	LOGIO(L_MX, multix->chnum, lintspec & 0xFF, "Sending intspec to CPU: 0x%04x (%s, line %i)", lintspec, mx_irq_name(lintspec>>8), lintspec & 0xFF);
 
 	return lintspec;
 }
@@ -466,17 +556,23 @@ static int mx_line_conf_log(struct mx *multix, int phy_n, int log_n, uint16_t *d
 
 	elst_clear(pline->protoq);
 
+	// line threads are spawned once and reused across MULTIX resets
+	if (!pline->threads) {
+		if (pthread_create(&pline->proto_th, NULL, mx_line_thread, pline)) {
+			return MX_SC_E_NOMEM;
+		}
+		if (pthread_create(&pline->status_th, NULL, mx_line_status_thread, pline)) {
+			pthread_cancel(pline->proto_th);
+			pthread_join(pline->proto_th, NULL);
+			return MX_SC_E_NOMEM;
+		}
+		pline->threads = true;
+	}
+
 	char thname[16];
 	snprintf(thname, 15, "mxl%02i:%02i", multix->chnum, pline->log_n);
-	if (pthread_create(&pline->proto_th, NULL, mx_line_thread, pline)) {
-		return MX_SC_E_NOMEM;
-	}
 	pthread_setname_np(pline->proto_th, thname);
-
 	snprintf(thname, 15, "mxs%02i:%02i", multix->chnum, pline->log_n);
-	if (pthread_create(&pline->status_th, NULL, mx_line_status_thread, pline)) {
-		return MX_SC_E_NOMEM;
-	}
 	pthread_setname_np(pline->status_th, thname);
 
 	return MX_SC_E_OK;
@@ -753,13 +849,14 @@ static void log_event(const char *text, struct mx_event *ev)
 bool mx_init_dummy(struct mx *multix)
 {
 	bool quit = false;
-	int timeout = MX_INIT_TIME_MSEC;
+	uint64_t deadline = io_emu_time(multix->io) + MX_INIT_TIME_NS;
 
-	LOG(L_MX, "Initialization delay: %i ms", timeout);
+	LOG(L_MX, "Initialization delay: %llu ms of CPU time", MX_INIT_TIME_NS / 1000000);
 
 	while (!quit) {
-		struct mx_event *ev = (struct mx_event *) elst_wait_pop(multix->eventq, timeout);
+		struct mx_event *ev = (struct mx_event *) elst_wait_pop(multix->eventq, MX_INIT_POLL_MSEC);
 		if (!ev) {
+			if (io_emu_time(multix->io) < deadline) continue;
 			atom_store_release(&multix->state, MX_INITIALIZED);
 			LOG(L_MX, "Multix is now initialized");
 			mx_int_enqueue(multix, MX_IRQ_IWYZE, 0);
@@ -768,6 +865,7 @@ bool mx_init_dummy(struct mx *multix)
 			log_event("Got new event while still initializing", ev);
 			if (ev->type == MX_EV_RESET) {
 				// another reset, rinse and repeat
+				deadline = io_emu_time(multix->io) + MX_INIT_TIME_NS;
 			} else if (ev->type == MX_EV_QUIT) {
 				quit = true;
 			} else {
@@ -868,7 +966,7 @@ void mx_cmd_reset(void *ch)
 }
 
 // -----------------------------------------------------------------------
-int mx_cmd(void *ch, int dir, uint16_t n_arg, uint16_t *r_arg)
+int mx_cmd(void *ch, int pn, int dir, uint16_t n_arg, uint16_t *r_arg)
 {
 	struct mx *multix = (struct mx *) ch;
 
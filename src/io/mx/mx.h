@@ -30,6 +30,7 @@
 
 struct mx_line;
 struct mx;
+struct io;
 
 typedef int (*mx_proto_init_fun)(struct mx_line *pline, uint16_t *data);
 typedef void (*mx_proto_destroy_fun)(struct mx_line *pline);
@@ -77,9 +78,14 @@ struct mx_line {
 
 	ELST statusq;					// status event queue
 	pthread_t status_th;			// status thread
+
+	bool threads;					// line threads are running (they outlive line configuration)
+	pthread_cond_t sync_cond;		// signalled when a line thread acknowledges SYNC
+	unsigned sync_count;			// SYNC events acknowledged so far (guarded by status_mutex)
 };
 
 struct mx {
+	struct io *io;					// I/O the multix is connected to
 	int chnum;						// Multix' channel number
 	int state;						// multix state (uninitialized, initialized, configured)
 
@@ -18,15 +18,91 @@
 #include <stdlib.h>
 #include <inttypes.h>
 
+#include "log.h"
+#include "utils/utils.h"
 #include "io/mx/mx.h"
 #include "io/mx/line.h"
+#include "io/mx/irq.h"
+#include "io/dev/dev.h"
 #include "io/mx/proto_common.h"
 
-#include "log.h"
+// Only the transmit field sizes (3 words in, 2 words out) come from MULTIX.
+// No documentation or software using MULTIX tape protocol is at hand,
+// so the layout of those words, operation codes and status bits below are
+// provisional: modelled after the winchester protocol, self-consistent,
+// but not verified against anything real.
+
+// Transmit operations
+enum mx_proto_tape_ops {
+	MX_TAPE_OP_READ			= 0,
+	MX_TAPE_OP_WRITE		= 1,
+	MX_TAPE_OP_WRITE_MARK	= 2,
+	MX_TAPE_OP_SKIP_FWD		= 3,
+	MX_TAPE_OP_SKIP_BACK	= 4,
+	MX_TAPE_OP_FILE_FWD		= 5,
+	MX_TAPE_OP_FILE_BACK	= 6,
+	MX_TAPE_OP_REWIND		= 7,
+};
+
+static const char * tape_op_names[] = {
+	"read",
+	"write",
+	"write tape mark",
+	"skip records forward",
+	"skip records backward",
+	"skip files forward",
+	"skip files backward",
+	"rewind"
+};
+
+// Tape return field (state word) flags
+enum mx_tape_t_status {
+	MX_TS_MARK			= 1 << 15,	// tape mark encountered
+	MX_TS_NOT_READY		= 1 << 14,	// no tape loaded
+	MX_TS_WRPROTECT		= 1 << 13,	// write ring missing
+	MX_TS_BOT			= 1 << 12,	// beginning of tape
+	MX_TS_EOT			= 1 << 11,	// end of recorded tape
+	MX_TS_TOO_LONG		= 1 << 10,	// record longer than requested transfer
+	MX_TS_ERR			= 1 << 8,	// read/write error
+};
+
+// transmit: read/write a record, skip records/files
+struct mx_tape_cf_transmit {
+	unsigned cpu;
+	unsigned nb;
+	uint16_t addr;
+	unsigned len;
+};
+
+struct proto_tape_data {
+	unsigned op;
+	struct mx_tape_cf_transmit transmit;
+	uint16_t ret_len;
+	uint16_t ret_status;
+	uint16_t *buf;
+};
+
+#define MX_TAPE_BUF_WORDS 65536
 
 // -----------------------------------------------------------------------
 int mx_tape_init(struct mx_line *pline, uint16_t *data)
 {
+	struct proto_tape_data *proto_data = (struct proto_tape_data *) calloc(1, sizeof(struct proto_tape_data));
+	if (!proto_data) {
+		return MX_SC_E_NOMEM;
+	}
+
+	// whole records are transferred at once, largest one is 64k words
+	proto_data->buf = (uint16_t *) malloc(MX_TAPE_BUF_WORDS * sizeof(uint16_t));
+	if (!proto_data->buf) {
+		free(proto_data);
+		return MX_SC_E_NOMEM;
+	}
+
+	pline->proto_data = proto_data;
+
+	LOG(L_TAPE, "Using provisional tape transmit field layout, not verified against MULTIX software");
+
 	return MX_SC_E_OK;
 }
 
@@ -34,6 +110,186 @@ int mx_tape_init(struct mx_line *pline, uint16_t *data)
 void mx_tape_destroy(struct mx_line *pline)
 {
 	if (!pline || !pline->proto_data) return;
+	struct proto_tape_data *proto_data = (struct proto_tape_data *) pline->proto_data;
+	free(proto_data->buf);
+	free(proto_data);
+	pline->proto_data = NULL;
+}
+
+// -----------------------------------------------------------------------
+int mx_tape_trans_decode(uint16_t *data, void *proto_data)
+{
+	struct proto_tape_data *pd = (struct proto_tape_data *) proto_data;
+
+	pd->op = (data[0] & 0b0000011100000000) >> 8;
+	pd->transmit.cpu  = (data[0] & 0b0000000000010000) >> 4;
+	pd->transmit.nb   = (data[0] & 0b0000000000001111);
+	pd->transmit.addr = data[1];
+	// words to transfer for read/write, records or files to skip otherwise
+	pd->transmit.len  = data[2] + 1;
+
+	LOG(L_TAPE, "%s, count: %i, memory address %i:0x%04x",
+		tape_op_names[pd->op],
+		pd->transmit.len,
+		pd->transmit.nb,
+		pd->transmit.addr
+	);
+
+	pd->ret_len = 0;
+	pd->ret_status = 0;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+void mx_tape_transmit_encode(uint16_t *data, void *proto_data)
+{
+	struct proto_tape_data *pd = (struct proto_tape_data *) proto_data;
+
+	LOG(L_TAPE, "Transmission result: len=%i, status=0x%04x", pd->ret_len, pd->ret_status);
+	data[0] = pd->ret_len;
+	data[1] = pd->ret_status;
+}
+
+// -----------------------------------------------------------------------
+static uint16_t mx_tape_status(int res)
+{
+	switch (res) {
+		case DEV_CMD_OK:
+			return 0;
+		case DEV_CMD_TAPEMARK:
+			return MX_TS_MARK;
+		case DEV_CMD_BOT:
+			return MX_TS_BOT;
+		case DEV_CMD_EOT:
+			return MX_TS_EOT;
+		case DEV_CMD_TOOLONG:
+			return MX_TS_TOO_LONG;
+		case DEV_CMD_WRPROTECT:
+			return MX_TS_WRPROTECT;
+		case DEV_CMD_NOMEDIUM:
+			return MX_TS_NOT_READY;
+		default:
+			return MX_TS_ERR;
+	}
+}
+
+// -----------------------------------------------------------------------
+static int mx_tape_read(struct mx *multix, struct mx_line *line, struct proto_tape_data *proto_data)
+{
+	unsigned len;
+
+	int res = line->dev->rec_rd(line->dev_data, (uint8_t *) proto_data->buf, 2 * proto_data->transmit.len, &len);
+	proto_data->ret_status = mx_tape_status(res);
+
+	if ((res != DEV_CMD_OK) && (res != DEV_CMD_TOOLONG)) {
+		return (res == DEV_CMD_TAPEMARK) ? MX_IRQ_IETRA : MX_IRQ_ITRER;
+	}
+
+	// odd byte count: last word is padded with zero
+	if (len & 1) {
+		((uint8_t *) proto_data->buf)[len] = 0;
+	}
+	len = (len + 1) / 2;
+
+	// whole record goes to system memory at once, swapping byte order
+	endianswap(proto_data->buf, len);
+	if (!mx_mem_write(multix, proto_data->transmit.nb, proto_data->transmit.addr, proto_data->buf, len)) {
+		return MX_IRQ_INPAO;
+	}
+	proto_data->ret_len = len;
+
+	return (res == DEV_CMD_OK) ? MX_IRQ_IETRA : MX_IRQ_ITRER;
+}
+
+// -----------------------------------------------------------------------
+static int mx_tape_write(struct mx *multix, struct mx_line *line, struct proto_tape_data *proto_data)
+{
+	unsigned len = proto_data->transmit.len;
+
+	if (!mx_mem_read(multix, proto_data->transmit.nb, proto_data->transmit.addr, proto_data->buf, len)) {
+		return MX_IRQ_INPAO;
+	}
+	endianswap(proto_data->buf, len);
+
+	int res = line->dev->rec_wr(line->dev_data, (uint8_t *) proto_data->buf, 2 * len);
+	proto_data->ret_status = mx_tape_status(res);
+	if (res != DEV_CMD_OK) {
+		return MX_IRQ_ITRER;
+	}
+	proto_data->ret_len = len;
+
+	return MX_IRQ_IETRA;
+}
+
+// -----------------------------------------------------------------------
+static int mx_tape_skip(struct mx_line *line, struct proto_tape_data *proto_data, int count, int marks)
+{
+	unsigned skipped;
+
+	int res = line->dev->rec_skip(line->dev_data, count, marks, &skipped);
+	proto_data->ret_len = skipped;
+	proto_data->ret_status = mx_tape_status(res);
+
+	// hitting a tape mark while skipping records is a regular stop condition
+	if ((res == DEV_CMD_OK) || (res == DEV_CMD_TAPEMARK)) {
+		return MX_IRQ_IETRA;
+	}
+	return MX_IRQ_ITRER;
+}
+
+// -----------------------------------------------------------------------
+int mx_tape_transmit(struct mx_line *line, uint16_t *cmd_data)
+{
+	int irq;
+	int res;
+
+	struct proto_tape_data *proto_data = (struct proto_tape_data *) line->proto_data;
+
+	// check if there is a tape drive connected
+	if (!line->dev || !line->dev_data || !line->dev->rec_rd) {
+		proto_data->ret_len = 0;
+		proto_data->ret_status = MX_TS_NOT_READY;
+		return MX_IRQ_ITRER;
+	}
+
+	LOG(L_TAPE, "Transmit operation %i: %s", proto_data->op, tape_op_names[proto_data->op]);
+
+	switch (proto_data->op) {
+		case MX_TAPE_OP_READ:
+			irq = mx_tape_read(line->multix, line, proto_data);
+			break;
+		case MX_TAPE_OP_WRITE:
+			irq = mx_tape_write(line->multix, line, proto_data);
+			break;
+		case MX_TAPE_OP_WRITE_MARK:
+			res = line->dev->mark_wr(line->dev_data);
+			proto_data->ret_status = mx_tape_status(res);
+			irq = (res == DEV_CMD_OK) ? MX_IRQ_IETRA : MX_IRQ_ITRER;
+			break;
+		case MX_TAPE_OP_SKIP_FWD:
+			irq = mx_tape_skip(line, proto_data, proto_data->transmit.len, 0);
+			break;
+		case MX_TAPE_OP_SKIP_BACK:
+			irq = mx_tape_skip(line, proto_data, -proto_data->transmit.len, 0);
+			break;
+		case MX_TAPE_OP_FILE_FWD:
+			irq = mx_tape_skip(line, proto_data, proto_data->transmit.len, 1);
+			break;
+		case MX_TAPE_OP_FILE_BACK:
+			irq = mx_tape_skip(line, proto_data, -proto_data->transmit.len, 1);
+			break;
+		case MX_TAPE_OP_REWIND:
+			res = line->dev->rewind(line->dev_data);
+			proto_data->ret_status = mx_tape_status(res) | MX_TS_BOT;
+			irq = (res == DEV_CMD_OK) ? MX_IRQ_IETRA : MX_IRQ_ITRER;
+			break;
+		default:
+			irq = MX_IRQ_INTRA;
+			break;
+	}
+
+	return irq;
 }
 
 // -----------------------------------------------------------------------
@@ -45,7 +301,7 @@ const struct mx_proto mx_drv_tape = {
 	.destroy = mx_tape_destroy,
 	.cmd = {
 		[MX_CMD_ATTACH] = { 0, 0, NULL, NULL, mx_dummy_attach },
-		[MX_CMD_TRANSMIT] = { 3, 2, NULL, NULL, NULL },
+		[MX_CMD_TRANSMIT] = { 3, 2, mx_tape_trans_decode, mx_tape_transmit_encode, mx_tape_transmit },
 		[MX_CMD_DETACH] = { 0, 0, NULL, NULL, mx_dummy_detach },
 		[MX_CMD_ABORT] = { 0, 0, NULL, NULL, NULL },
 	}
@@ -27,6 +27,7 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
 #include <inttypes.h>
 #include <stdbool.h>
@@ -38,6 +39,7 @@
 #include "log_crk.h"
 #include "atomic.h"
 #include "utils/utils.h"
+#include "ectl/metrics.h"
 #include "cfg.h"
 
 // low-level stuff
@@ -51,7 +53,8 @@ static const char * log_component_names[] = {
 	"TERM", "9425", "WNCH", "FLOP", "PNCH", "PNRD","TAPE",
 };
 
-unsigned log_components_enabled;
+unsigned log_components_enabled;	// components enabled by the user (nonzero when logging is on)
+unsigned log_components_wanted;		// enabled components that pass the current filters
 static unsigned log_components_selected;
 
 static pthread_t log_flusher_th;
@@ -66,14 +69,37 @@ static void * log_flusher(void *ptr);
 
 static bool line_buffered;
 
+// filters
+
+static bool log_filters_cpu;
+static bool log_cpu_ctx_pass = true;
+static int log_filter_nb = -1;
+static int log_filter_ic_start = -1;
+static int log_filter_ic_end = -1;
+static char *log_filter_process;
+static bool log_filter_process_pass = true;
+int log_filter_chan = -1;
+int log_filter_line = -1;
+
+// rate limits (messages per second, per component)
+
+static bool log_rate_limited;
+static unsigned log_rate_limit[L_COUNT];
+static unsigned log_rate_count[L_COUNT];
+static unsigned log_rate_dropped[L_COUNT];
+static time_t log_rate_window;
+
 // high-level stuff
 
 #define LOG_F_COMP "%4s | %8s | "
 #define LOG_F_FUN "%24s() | "
 #define LOG_F_CPU "%x:0x%04x %-6s            | %s"
 
-static uint16_t log_cycle_sr;
-static uint16_t log_cycle_ic;
+#define LOG_SR_NB(sr) (((sr) & 0b0000000000100000) ? ((sr) & 0b0000000000001111) : 0)
+
+// cycle state of the CPU running on the logging thread
+static _Thread_local uint16_t log_cycle_sr;
+static _Thread_local uint16_t log_cycle_ic;
 
 #define LOG_INT_INDENT_MAX (4*8)
 static int log_int_level = LOG_INT_INDENT_MAX;
@@ -81,10 +107,23 @@ static const char *log_int_indent = "--> --> --> --> --> --> --> --> ";
 
 static struct emdas *emd;
 static char *dasm_buf;
+static pthread_mutex_t dasm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mem *dasm_mem; // memory of the CPU being deassembled, set with dasm_mutex locked
+
+// log traffic counters, updated with log_mutex locked
+static unsigned long log_messages;
+static unsigned long log_bytes;
+static unsigned long log_dropped;
 
 static void log_log_timestamp(unsigned component, const char *msg, const char *func);
 static void log_components_update();
 
+// -----------------------------------------------------------------------
+static int log_dasm_mem_get(int nb, uint16_t addr, uint16_t *data)
+{
+	return mem_read_1(dasm_mem, nb, addr, data);
+}
+
 // -----------------------------------------------------------------------
 int log_init(em400_cfg *cfg)
 {
@@ -104,9 +143,15 @@ int log_init(em400_cfg *cfg)
 		goto cleanup;
 	}
 
+	// set up log filters and rate limits
+	if (log_setup_filters(cfg) != E_OK) {
+		LOGERR("Failed to set up log filters.");
+		goto cleanup;
+	}
+
 	// initialize deassembler
 	int cpu_mod = cfg_getbool(cfg, "cpu:modifications", CFG_DEFAULT_CPU_MODIFICATIONS);
-	emd = emdas_create(cpu_mod ? EMD_ISET_MX16 : EMD_ISET_MERA400, (emdas_getfun) mem_read_1);
+	emd = emdas_create(cpu_mod ? EMD_ISET_MX16 : EMD_ISET_MERA400, log_dasm_mem_get);
 	if (!emd) {
 		LOGERR("Log deassembler initialization failed.");
 		goto cleanup;
@@ -119,6 +164,10 @@ int log_init(em400_cfg *cfg)
 
 	pthread_mutex_init(&log_mutex, NULL);
 
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_log_messages_total", "Log messages written", &log_messages, NULL);
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_log_bytes_total", "Bytes written to the log file", &log_bytes, NULL);
+	ectl_metric_add(ECTL_METRIC_COUNTER, "em400_log_dropped_total", "Log messages dropped due to rate limits", &log_dropped, NULL);
+
 	line_buffered = cfg_getbool(cfg, "log:line_buffered", CFG_DEFAULT_LOG_LINE_BUFFERED);
 
 	int log_enabled = cfg_getbool(cfg, "log:enabled", CFG_DEFAULT_LOG_ENABLED);
@@ -159,6 +208,8 @@ void log_shutdown()
 	log_crk_shutdown();
 	free(log_file);
 	log_file = NULL;
+	free(log_filter_process);
+	log_filter_process = NULL;
 }
 
 // -----------------------------------------------------------------------
@@ -189,6 +240,7 @@ void log_disable()
 
 	log_log_timestamp(L_EM4H, "EM400 version " EM400_VERSION " closing log file", __func__);
 	atom_store_release(&log_components_enabled, 0);
+	atom_store_release(&log_components_wanted, 0);
 	log_flusher_exit();
 	if (log_f) {
 		fclose(log_f);
@@ -230,10 +282,18 @@ unsigned log_is_enabled()
 	return atom_load_acquire(&log_components_enabled);
 }
 
+// -----------------------------------------------------------------------
+static unsigned log_filter_mask()
+{
+	return log_cpu_ctx_pass ? ~0U : ~LOG_CPU_CTX_MASK;
+}
+
 // -----------------------------------------------------------------------
 static void log_components_update()
 {
-	atom_store_release(&log_components_enabled, log_components_selected);
+	unsigned selected = atom_load_acquire(&log_components_selected);
+	atom_store_release(&log_components_enabled, selected);
+	atom_store_release(&log_components_wanted, selected & log_filter_mask());
 }
 
 // -----------------------------------------------------------------------
@@ -315,6 +375,160 @@ int log_setup_components(const char *components)
 	return 0;
 }
 
+// -----------------------------------------------------------------------
+static int log_parse_ic_range(const char *range)
+{
+	char *end;
+
+	long start = strtol(range, &end, 0);
+	long stop = start;
+	if (*end == '-') {
+		stop = strtol(end+1, &end, 0);
+	}
+	if (*end || (start < 0) || (stop > 0xffff) || (start > stop)) {
+		return E_ERR;
+	}
+
+	log_filter_ic_start = start;
+	log_filter_ic_end = stop;
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+int log_setup_rate_limits(const char *limits)
+{
+	int res = E_OK;
+	char *lim = strdup(limits);
+	if (!lim) {
+		return E_ERR;
+	}
+
+	char *c = strtok(lim, ", ");
+	while (c && *c) {
+		int comp = L_ALL;
+		char *val = c;
+		char *colon = strchr(c, ':');
+		if (colon) {
+			*colon = '\0';
+			comp = log_get_component_id(c);
+			val = colon+1;
+		}
+		char *end;
+		long limit = strtol(val, &end, 10);
+		if ((comp < 0) || !*val || *end || (limit < 0)) {
+			res = E_ERR;
+			break;
+		}
+		for (unsigned i=0 ; i<L_COUNT ; i++) {
+			if ((comp == L_ALL) || (comp == i)) {
+				log_rate_limit[i] = limit;
+			}
+		}
+		c = strtok(NULL, ", ");
+	}
+	free(lim);
+
+	log_rate_limited = false;
+	for (unsigned i=0 ; i<L_COUNT ; i++) {
+		if (log_rate_limit[i]) log_rate_limited = true;
+	}
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int log_setup_filters(em400_cfg *cfg)
+{
+	log_filter_nb = cfg_getint(cfg, "log:filter_nb", CFG_DEFAULT_LOG_FILTER_NB);
+	if (log_filter_nb > 15) {
+		return LOGERR("Wrong NB for log filter: %i. Should be 0-15.", log_filter_nb);
+	}
+
+	const char *ic_range = cfg_getstr(cfg, "log:filter_ic", CFG_DEFAULT_LOG_FILTER_IC);
+	if (ic_range && (log_parse_ic_range(ic_range) != E_OK)) {
+		return LOGERR("Wrong IC range for log filter: \"%s\". Should be: addr or start-end.", ic_range);
+	}
+
+	const char *process = cfg_getstr(cfg, "log:filter_process", CFG_DEFAULT_LOG_FILTER_PROCESS);
+	if (process && *process) {
+		log_filter_process = strdup(process);
+		if (!log_filter_process) {
+			return LOGERR("Memory allocation error.");
+		}
+		log_filter_process_pass = false;
+	}
+
+	log_filter_chan = cfg_getint(cfg, "log:filter_chan", CFG_DEFAULT_LOG_FILTER_CHAN);
+	log_filter_line = cfg_getint(cfg, "log:filter_line", CFG_DEFAULT_LOG_FILTER_LINE);
+
+	log_filters_cpu = (log_filter_nb >= 0) || (log_filter_ic_start >= 0) || log_filter_process;
+	log_cpu_ctx_pass = !log_filters_cpu;
+
+	const char *rate_limits = cfg_getstr(cfg, "log:rate_limit", CFG_DEFAULT_LOG_RATE_LIMIT);
+	if (rate_limits && (log_setup_rate_limits(rate_limits) != E_OK)) {
+		return LOGERR("Failed to parse log rate limits: \"%s\".", rate_limits);
+	}
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+// called on CROOK-5 process change
+void log_filter_process_update(const char *name)
+{
+	if (!log_filter_process) return;
+
+	log_filter_process_pass = name && !strcasecmp(name, log_filter_process);
+}
+
+// -----------------------------------------------------------------------
+static inline void log_account(int bytes)
+{
+	// called with log_mutex locked
+	log_messages++;
+	if (bytes > 0) log_bytes += bytes;
+}
+
+// -----------------------------------------------------------------------
+static bool log_rate_pass(unsigned component, const char *thname)
+{
+	// called with log_mutex locked
+	struct timespec ts;
+
+	if (!log_rate_limited) return true;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+	// new window: report what has been dropped in the previous one
+	if (ts.tv_sec != log_rate_window) {
+		log_rate_window = ts.tv_sec;
+		for (unsigned i=0 ; i<L_COUNT ; i++) {
+			if (log_rate_dropped[i]) {
+				fprintf(log_f, LOG_F_COMP LOG_F_FUN "%u messages dropped due to rate limit (%u/s)\n",
+					log_component_names[i], thname, __func__, log_rate_dropped[i], log_rate_limit[i]);
+			}
+			log_rate_count[i] = 0;
+			log_rate_dropped[i] = 0;
+		}
+	}
+
+	if (!log_rate_limit[component]) return true;
+
+	if (log_rate_count[component] >= log_rate_limit[component]) {
+		log_rate_dropped[component]++;
+		log_dropped++;
+		return false;
+	}
+
+	log_rate_count[component]++;
+	return true;
+}
+
 // -----------------------------------------------------------------------
 int log_err(const char *func, const char *msgfmt, ...)
 {
@@ -332,10 +546,11 @@ int log_err(const char *func, const char *msgfmt, ...)
 	if (log_is_enabled()) {
 		va_start(vl, msgfmt);
 		pthread_mutex_lock(&log_mutex);
-		fprintf(log_f, LOG_F_COMP LOG_F_FUN, log_component_names[L_EM4H], thname, func);
-		fprintf(log_f, "ERROR: ");
-		vfprintf(log_f, msgfmt, vl);
-		fprintf(log_f, "\n");
+		int len = fprintf(log_f, LOG_F_COMP LOG_F_FUN, log_component_names[L_EM4H], thname, func);
+		len += fprintf(log_f, "ERROR: ");
+		len += vfprintf(log_f, msgfmt, vl);
+		len += fprintf(log_f, "\n");
+		log_account(len);
 		pthread_mutex_unlock(&log_mutex);
 
 		if (line_buffered) fflush(log_f);
@@ -355,9 +570,15 @@ void log_log(unsigned component, const char *func, const char *msgfmt, ...)
 	pthread_getname_np(pthread_self(), thname, 16);
 
 	pthread_mutex_lock(&log_mutex);
-	fprintf(log_f, LOG_F_COMP LOG_F_FUN, log_component_names[component], thname, func);
-	vfprintf(log_f, msgfmt, vl);
-	fprintf(log_f, "\n");
+	if (!log_rate_pass(component, thname)) {
+		pthread_mutex_unlock(&log_mutex);
+		va_end(vl);
+		return;
+	}
+	int len = fprintf(log_f, LOG_F_COMP LOG_F_FUN, log_component_names[component], thname, func);
+	len += vfprintf(log_f, msgfmt, vl);
+	len += fprintf(log_f, "\n");
+	log_account(len);
 	pthread_mutex_unlock(&log_mutex);
 
 	if (line_buffered) fflush(log_f);
@@ -374,16 +595,22 @@ void log_log_cpu(unsigned component, const char *msgfmt, ...)
 	pthread_getname_np(pthread_self(), thname, 16);
 
 	pthread_mutex_lock(&log_mutex);
-	fprintf(log_f, LOG_F_COMP LOG_F_CPU,
+	if (!log_rate_pass(component, thname)) {
+		pthread_mutex_unlock(&log_mutex);
+		va_end(vl);
+		return;
+	}
+	int len = fprintf(log_f, LOG_F_COMP LOG_F_CPU,
 		log_component_names[component],
 		thname,
-		(log_cycle_sr & 0b0000000000100000) ? (log_cycle_sr & 0b0000000000001111) : 0,
+		LOG_SR_NB(log_cycle_sr),
 		log_cycle_ic,
 		log_get_current_process(),
 		log_int_indent + log_int_level
 	);
-	vfprintf(log_f, msgfmt, vl);
-	fprintf(log_f, "\n");
+	len += vfprintf(log_f, msgfmt, vl);
+	len += fprintf(log_f, "\n");
+	log_account(len);
 	pthread_mutex_unlock(&log_mutex);
 
 	if (line_buffered) fflush(log_f);
@@ -401,7 +628,12 @@ void log_splitlog(unsigned component, const char *func, const char *text)
 
 	pthread_mutex_lock(&log_mutex);
 
-	fprintf(log_f,
+	if (!log_rate_pass(component, thname)) {
+		pthread_mutex_unlock(&log_mutex);
+		return;
+	}
+
+	int len = fprintf(log_f,
 		LOG_F_COMP LOG_F_FUN ".-------------------------------------------------------------------\n",
 		log_component_names[component],
 		thname,
@@ -411,7 +643,7 @@ void log_splitlog(unsigned component, const char *func, const char *text)
 		p = (char *) strchr(start, '\n');
 		if (p) {
 			*p = '\0';
-			fprintf(log_f,
+			len += fprintf(log_f,
 				LOG_F_COMP LOG_F_FUN "| %s\n",
 				log_component_names[component],
 				thname,
@@ -423,12 +655,13 @@ void log_splitlog(unsigned component, const char *func, const char *text)
 			start = NULL;
 		}
 	}
-	fprintf(log_f,
+	len += fprintf(log_f,
 		LOG_F_COMP LOG_F_FUN "`-------------------------------------------------------------------\n",
 		log_component_names[component],
 		thname,
 		func
 	);
+	log_account(len);
 
 	pthread_mutex_unlock(&log_mutex);
 
@@ -450,6 +683,24 @@ void log_store_cycle_state(uint16_t sr, uint16_t ic)
 {
 	log_cycle_sr = sr;
 	log_cycle_ic = ic;
+
+	if (!log_filters_cpu) return;
+
+	// evaluate CPU context filters
+	bool pass = log_filter_process_pass;
+	if (log_filter_nb >= 0) {
+		pass = pass && (LOG_SR_NB(sr) == log_filter_nb);
+	}
+	if (log_filter_ic_start >= 0) {
+		pass = pass && (ic >= log_filter_ic_start) && (ic <= log_filter_ic_end);
+	}
+
+	log_cpu_ctx_pass = pass;
+
+	unsigned wanted = LOG_ENABLED & log_filter_mask();
+	if (wanted != atom_load_acquire(&log_components_wanted)) {
+		atom_store_release(&log_components_wanted, wanted);
+	}
 }
 
 // -----------------------------------------------------------------------
@@ -475,16 +726,19 @@ void log_intlevel_inc()
 }
 
 // -----------------------------------------------------------------------
-void log_log_dasm(int arg, int16_t ac, const char *comment)
+void log_log_dasm(struct mem *mem, int arg, int16_t ac, const char *comment)
 {
-	const int nb = (log_cycle_sr & 0b0000000000100000) ? (log_cycle_sr & 0b0000000000001111) : 0;
-	emdas_dasm(emd, nb, log_cycle_ic);
+	// deassembler is shared between CPUs
+	pthread_mutex_lock(&dasm_mutex);
+	dasm_mem = mem;
+	emdas_dasm(emd, LOG_SR_NB(log_cycle_sr), log_cycle_ic);
 
 	if (arg) {
 		log_log_cpu(L_CPU, "    %s%-20s AC = 0x%04x = %i", comment, dasm_buf, (uint16_t) ac, ac);
 	} else {
 		log_log_cpu(L_CPU, "    %s%-20s", comment, dasm_buf);
 	}
+	pthread_mutex_unlock(&dasm_mutex);
 }
 
 // vim: tabstop=4 shiftwidth=4 autoindent
@@ -34,7 +34,12 @@
 extern "C" {
 #endif
 
+struct mem;
+
 extern unsigned log_components_enabled;
+extern unsigned log_components_wanted;
+extern int log_filter_chan;
+extern int log_filter_line;
 
 int log_init(em400_cfg *cfg);
 void log_shutdown();
@@ -55,20 +60,36 @@ int log_err(const char *func, const char *msgfmt, ...);
 void log_log(unsigned component, const char *func, const char *format, ...);
 void log_splitlog(unsigned component, const char *func, const char *text);
 
+int log_setup_filters(em400_cfg *cfg);
+int log_setup_rate_limits(const char *limits);
+void log_filter_process_update(const char *name);
+
 void log_store_cycle_state(uint16_t sr, uint16_t ic);
 void log_intlevel_reset();
 void log_intlevel_dec();
 void log_intlevel_inc();
 
-void log_log_dasm(int arg, int16_t n, const char *comment);
+void log_log_dasm(struct mem *mem, int arg, int16_t n, const char *comment);
 void log_log_cpu(unsigned component, const char *msgfmt, ...);
 
+// components logging in the CPU context (subject to NB, IC and process filters)
+#define LOG_CPU_CTX_MASK ((1 << L_MEM) | (1 << L_CPU) | (1 << L_OP) | (1 << L_INT) | (1 << L_CRK5))
+
 #define LOG_ENABLED atom_load_acquire(&log_components_enabled)
-#define LOG_WANTS(component) (LOG_ENABLED & (1 << (component)))
+#define LOG_WANTS(component) (atom_load_acquire(&log_components_wanted) & (1 << (component)))
+#define LOG_CYCLE_WANTED (LOG_ENABLED & LOG_CPU_CTX_MASK)
+
+// I/O channel and line filters (negative values mean "any" or "unknown")
+#define LOG_IO_PASS(chan, line) \
+	(((log_filter_chan < 0) || ((chan) < 0) || ((chan) == log_filter_chan)) \
+	&& ((log_filter_line < 0) || ((line) < 0) || ((line) == log_filter_line)))
 
 #define LOG(component, format, ...) \
 	if (LOG_WANTS(component)) log_log(component, __func__, format, ##__VA_ARGS__)
 
+#define LOGIO(component, chan, line, format, ...) \
+	if (LOG_WANTS(component) && LOG_IO_PASS(chan, line)) log_log(component, __func__, format, ##__VA_ARGS__)
+
 #define LOGCPU(component, format, ...) \
 	if (LOG_WANTS(component)) log_log_cpu(component, format, ##__VA_ARGS__)
 
@@ -78,8 +99,8 @@ void log_log_cpu(unsigned component, const char *msgfmt, ...);
 #define LOGBLOB(component, txt) \
 	log_splitlog(component, __func__, txt)
 
-#define LOGDASM(arg, ac, comment) \
-	if (LOG_WANTS(L_CPU)) log_log_dasm(arg, ac, comment);
+#define LOGDASM(mem, arg, ac, comment) \
+	if (LOG_WANTS(L_CPU)) log_log_dasm(mem, arg, ac, comment);
 
 #ifdef __cplusplus
 }
@@ -31,7 +31,18 @@
 #include "log.h"
 #include "utils/utils.h"
 
+// unpacked process descriptors, keyed by descriptor address (direct-mapped)
+#define LOG_CRK_CACHE_SIZE 64
+
+struct log_crk_proc {
+	uint16_t addr;
+	uint32_t gen;
+	struct crk5_process *process;
+};
+
+static struct log_crk_proc proc_cache[LOG_CRK_CACHE_SIZE];
 static struct crk5_process *process;
+static uint16_t kimg[2*4096];
 
 static int log_exl_number = -1;
 static int log_exl_nb;
@@ -40,17 +51,31 @@ static int log_exl_r4;
 
 struct crk5_kern_result *kernel;
 
+static struct mem *crk_mem; // memory of the machine with the OS being tracked
+
 // -----------------------------------------------------------------------
-void log_crk_init()
+void log_crk_init(struct mem *mem)
 {
+	crk_mem = mem;
+}
 
+// -----------------------------------------------------------------------
+static void log_proc_cache_flush()
+{
+	for (int i=0 ; i<LOG_CRK_CACHE_SIZE ; i++) {
+		crk5_process_delete(proc_cache[i].process);
+		proc_cache[i].process = NULL;
+	}
+	process = NULL;
+	if (crk_mem) mem_watch_clear(crk_mem);
 }
 
 // -----------------------------------------------------------------------
 void log_crk_shutdown()
 {
-	crk5_process_delete(process);
+	log_proc_cache_flush();
 	crk5_kern_res_drop(kernel);
+	kernel = NULL;
 }
 
 // -----------------------------------------------------------------------
@@ -299,7 +324,7 @@ static int log_print_mem(char *b, int nb, uint16_t addr, int max_len, int termin
 		if (chars >= max_len) break;
 		if (need) {
 			need = 0;
-			if (!mem_read_1(nb, addr, &word)) break;
+			if (!mem_read_1(crk_mem, nb, addr, &word)) break;
 			addr++;
 			ch = word >> 8;
 		} else {
@@ -532,18 +557,12 @@ static char * log_exl_decode(int nb, uint16_t addr, uint16_t r4_curr, int exl_nu
 	} else {
 		pos += sprintf(b+pos, "EXL %i (%s - %s), arg @ %i:0x%04x\n", exl_num, exl->name, exl->desc, nb, addr);
 
-		uint16_t *data = (uint16_t *) malloc(sizeof(uint16_t) * exl->size);
-		if (!data) {
-			return buf;
-		}
-
-		if (!mem_read_n(nb, addr, data, exl->size)) {
+		uint16_t data[exl->size];
+		if (!mem_read_n(crk_mem, nb, addr, data, exl->size)) {
 			return buf;
 		}
 
 		pos += exldecs[exl->type](b+pos, data, exl_num, exl_ret);
-
-		free(data);
 	}
 
 	return buf;
@@ -590,8 +609,33 @@ void log_handle_syscall_ret(unsigned component, uint16_t ic, uint16_t sr, uint16
 // -----------------------------------------------------------------------
 void log_reset_process()
 {
-	crk5_process_delete(process);
 	process = NULL;
+	log_filter_process_update(NULL);
+}
+
+// -----------------------------------------------------------------------
+static struct crk5_process * log_proc_lookup(uint16_t bprog)
+{
+	struct log_crk_proc *e = proc_cache + ((bprog ^ (bprog >> 6)) & (LOG_CRK_CACHE_SIZE-1));
+
+	// descriptor is cached and nobody wrote to it since it was unpacked
+	uint32_t gen = mem_watch_gen(crk_mem, bprog, CRK5P_PROCESS_SIZE);
+	if (e->process && (e->addr == bprog) && (e->gen == gen)) {
+		return e->process;
+	}
+
+	uint16_t buf[CRK5P_PROCESS_SIZE];
+	if (!mem_read_n(crk_mem, 0, bprog, buf, CRK5P_PROCESS_SIZE)) {
+		return NULL;
+	}
+
+	crk5_process_delete(e->process);
+	e->process = crk5_process_unpack(buf, bprog, kernel->mod);
+	e->addr = bprog;
+	e->gen = gen;
+	mem_watch_add(crk_mem, bprog, CRK5P_PROCESS_SIZE);
+
+	return e->process;
 }
 
 // -----------------------------------------------------------------------
@@ -599,42 +643,41 @@ void log_reset_process()
 void log_update_process()
 {
 	uint16_t bprog;
-	uint16_t buf[CRK5P_PROCESS_SIZE];
 
 	log_reset_process();
 
 	if (!kernel) return;
 
-	if (!mem_read_1(0, CRK5_BPROG, &bprog)) {
-		return;
-	}
-
-	if (!mem_read_n(0, bprog, buf, CRK5P_PROCESS_SIZE)) {
+	if (!mem_read_1(crk_mem, 0, CRK5_BPROG, &bprog)) {
 		return;
 	}
 
-	process = crk5_process_unpack(buf, bprog, kernel->mod);
+	process = log_proc_lookup(bprog);
+	log_filter_process_update(process ? process->name : NULL);
 }
 
 // -----------------------------------------------------------------------
 // called at every software reset (MCL)
 void log_check_os()
 {
-	crk5_kern_res_drop(kernel);
-	kernel = NULL;
+	uint16_t img[2*4096];
 
-	uint16_t *kimg = (uint16_t *) malloc(sizeof(uint16_t) * 2*4096);
-	if (!kimg) {
-		goto cleanup;
+	if (!mem_read_n(crk_mem, 0, 0, img, 2*4096)) {
+		memset(img, 0, sizeof(img));
 	}
 
-	if (!mem_read_n(0, 0, kimg, 2*4096)) {
-		goto cleanup;
+	// kernel image didn't change since last check, keep what we know
+	if (!memcmp(img, kimg, sizeof(img))) {
+		return;
 	}
 
+	memcpy(kimg, img, sizeof(img));
+	log_proc_cache_flush();
+	crk5_kern_res_drop(kernel);
+
 	kernel = crk5_kern_find(kimg, 2*4096);
 	if (!kernel) {
-		goto cleanup;
+		return;
 	}
 
 	LOG(L_CRK5, "running CROOK for %s CPU, entry point @ 0x%04x, checksum: 0x%04x (%s)",
@@ -643,9 +686,6 @@ void log_check_os()
 		kernel->cksum_addr,
 		kernel->cksum_stored == kernel->cksum_computed ? "OK" : "incorrect"
 	);
-
-cleanup:
-	free(kimg);
 }
 
 // vim: tabstop=4 shiftwidth=4 autoindent
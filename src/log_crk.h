@@ -21,7 +21,9 @@
 #include <inttypes.h>
 #include <emcrk/process.h>
 
-void log_crk_init();
+struct mem;
+
+void log_crk_init(struct mem *mem);
 void log_crk_shutdown();
 
 void log_reset_process();
@@ -0,0 +1,266 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "machine.h"
+#include "cpu/sched.h"
+#include "ectl/shm.h"
+#include "ectl/metrics.h"
+
+#include "log.h"
+#include "log_crk.h"
+#include "cfg.h"
+
+struct em400_machine machines[MACHINE_MAX];
+int machine_count;
+
+static int machine_workers;
+static unsigned machine_quantum;
+
+// -----------------------------------------------------------------------
+static em400_cfg * machine_cfg_load(em400_cfg *cfg, int num)
+{
+	const char *file = cfg_fgetstr(cfg, "machines:config_%i", num);
+	em400_cfg *mcfg = file ? cfg_load(file) : dictionary_new(0);
+	if (!mcfg) {
+		LOGERR("Failed to load configuration for machine %i: \"%s\".", num, file ? file : "");
+		return NULL;
+	}
+
+	// Settings missing in the machine configuration come from the main one,
+	// except for I/O: channels and devices are never shared between machines.
+	for (ssize_t i=0 ; i<cfg->size ; i++) {
+		const char *key = cfg->key[i];
+		if (!key) continue;
+		if (!strcmp(key, "io") || !strncmp(key, "io:", 3) || !strncmp(key, "dev", 3)) continue;
+		if (cfg_contains(mcfg, key)) continue;
+		cfg_set(mcfg, key, cfg->val[i]);
+	}
+
+	return mcfg;
+}
+
+// -----------------------------------------------------------------------
+static int machine_cpus_init(struct em400_machine *m)
+{
+	for (int i=0 ; i<m->cpu_count ; i++) {
+		ectl_metrics_scope("machine=\"%i\",cpu=\"%i\"", m->num, i);
+		int res = cpu_init(m->cpu + i, m, i, m->cfg);
+		ectl_metrics_scope("machine=\"%i\"", m->num);
+		if (res != E_OK) {
+			return LOGERR("Failed to initialize CPU %i.", i);
+		}
+	}
+
+	// GIU/GIL and memory writes reach the other CPU
+	if (m->cpu_count > 1) {
+		m->cpu[0].peer = m->cpu + 1;
+		m->cpu[1].peer = m->cpu + 0;
+	}
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int machine_init(struct em400_machine *m, int num, em400_cfg *cfg)
+{
+	int res = E_ERR;
+
+	LOG(L_EM4H, "Initializing machine %i", num);
+
+	m->num = num;
+	m->cfg = num ? machine_cfg_load(cfg, num) : cfg;
+	if (!m->cfg) {
+		return E_ERR;
+	}
+
+	int cpu_count = cfg_getint(m->cfg, "cpu:count", CFG_DEFAULT_CPU_COUNT);
+	if ((cpu_count < 1) || (cpu_count > MACHINE_CPUS)) {
+		return LOGERR("CPU count (%i) out of range 1-%i.", cpu_count, MACHINE_CPUS);
+	}
+	if ((cpu_count > 1) && cfg_getbool(m->cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA)) {
+		return LOGERR("FPGA CPU can be used only in a single-CPU configuration.");
+	}
+	m->cpu_count = cpu_count;
+
+	ectl_metrics_scope("machine=\"%i\"", num);
+	// only the first CPU of the first machine exports memory and state
+	if (mem_init(&m->mem, m->cfg, num == 0) != E_OK) {
+		LOGERR("Failed to initialize memory.");
+	} else if (machine_cpus_init(m) != E_OK) {
+		LOGERR("Failed to initialize CPU.");
+	} else if (io_init(&m->io, m, m->cfg) != E_OK) {
+		LOGERR("Failed to initialize I/O.");
+	} else {
+		res = E_OK;
+		for (int i=0 ; i<m->cpu_count ; i++) {
+			if (ectl_shm_init(m->cpu + i, m->cfg, (num == 0) && (i == 0)) != E_OK) {
+				res = LOGERR("Failed to set up shared memory export.");
+				break;
+			}
+		}
+	}
+	ectl_metrics_scope(NULL);
+
+	// OS tracking in logs follows the first machine
+	if ((res == E_OK) && (num == 0)) {
+		log_crk_init(&m->mem);
+	}
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int machines_init(em400_cfg *cfg)
+{
+	int count = cfg_getint(cfg, "machines:count", CFG_DEFAULT_MACHINES_COUNT);
+	if ((count < 1) || (count > MACHINE_MAX)) {
+		return LOGERR("Machine count (%i) out of range 1-%i.", count, MACHINE_MAX);
+	}
+	if ((count > 1) && cfg_getbool(cfg, "cpu:fpga", CFG_DEFAULT_CPU_FPGA)) {
+		return LOGERR("FPGA CPU can be used only with a single machine.");
+	}
+
+	machine_workers = cfg_getint(cfg, "machines:workers", CFG_DEFAULT_MACHINES_WORKERS);
+	int quantum = cfg_getint(cfg, "machines:quantum", CFG_DEFAULT_MACHINES_QUANTUM);
+	if (quantum < 1) {
+		return LOGERR("Machine scheduling quantum needs to be at least 1 instruction.");
+	}
+	machine_quantum = quantum;
+
+	int cpus = 0;
+	int cpus_max = 0;
+	for (int i=0 ; i<count ; i++) {
+		machine_count++;
+		if (machine_init(machines + i, i, cfg) != E_OK) {
+			return LOGERR("Failed to initialize machine %i.", i);
+		}
+		cpus += machines[i].cpu_count;
+		if (machines[i].cpu_count > cpus_max) {
+			cpus_max = machines[i].cpu_count;
+		}
+	}
+
+	// by default CPUs of one machine get a worker each, so they can run in parallel
+	if (machine_workers <= 0) {
+		machine_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if (machine_workers < cpus_max) {
+			machine_workers = cpus_max;
+		}
+	}
+	if (machine_workers > cpus) {
+		machine_workers = cpus;
+	}
+	if (machine_workers < 1) {
+		machine_workers = 1;
+	}
+
+	if (cpus > 1) {
+		if (machine_workers >= cpus) {
+			LOG(L_EM4H, "%i machine(s) with %i CPUs initialized, each CPU running on its own thread", machine_count, cpus);
+		} else {
+			LOG(L_EM4H, "%i machine(s) with %i CPUs initialized, running on %i worker thread(s), quantum: %u instructions", machine_count, cpus, machine_workers, machine_quantum);
+		}
+	}
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void machines_shutdown()
+{
+	for (int i=machine_count-1 ; i>=0 ; i--) {
+		struct em400_machine *m = machines + i;
+		LOG(L_EM4H, "Shutting down machine %i", i);
+		for (int c=m->cpu_count-1 ; c>=0 ; c--) {
+			ectl_shm_shutdown(m->cpu + c);
+		}
+		io_shutdown(&m->io);
+		for (int c=m->cpu_count-1 ; c>=0 ; c--) {
+			cpu_shutdown(m->cpu + c);
+		}
+		mem_shutdown(&m->mem);
+		if (m->cfg && (i > 0)) {
+			cfg_free(m->cfg);
+		}
+		m->cfg = NULL;
+	}
+	machine_count = 0;
+}
+
+// -----------------------------------------------------------------------
+static void * machine_cpu_thread(void *ptr)
+{
+	cpu_loop((struct cpu *) ptr);
+	pthread_exit(NULL);
+}
+
+// -----------------------------------------------------------------------
+static void machine_threads_run(struct cpu **cpus, int count)
+{
+	pthread_t threads[MACHINE_MAX * MACHINE_CPUS];
+	int started = 0;
+
+	// first CPU runs on the calling thread
+	for (int i=1 ; i<count ; i++) {
+		if (pthread_create(threads + started, NULL, machine_cpu_thread, cpus[i])) {
+			LOGERR("Failed to spawn CPU thread, CPU %i of machine %i won't run.", cpus[i]->num, cpus[i]->m->num);
+			continue;
+		}
+		pthread_setname_np(threads[started], "cpu");
+		started++;
+	}
+
+	cpu_loop(cpus[0]);
+
+	for (int i=0 ; i<started ; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+// -----------------------------------------------------------------------
+void machines_run()
+{
+	struct cpu *cpus[MACHINE_MAX * MACHINE_CPUS];
+	int count = 0;
+
+	for (int i=0 ; i<machine_count ; i++) {
+		for (int c=0 ; c<machines[i].cpu_count ; c++) {
+			cpus[count++] = machines[i].cpu + c;
+		}
+	}
+
+	if (count == 1) {
+		// single CPU doesn't need scheduling, it runs on the calling thread
+		cpu_loop(cpus[0]);
+	} else if (machine_workers >= count) {
+		// every CPU gets its own thread, no scheduling either
+		machine_threads_run(cpus, count);
+	} else {
+		sched_run(cpus, count, machine_workers, machine_quantum);
+	}
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
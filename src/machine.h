@@ -0,0 +1,51 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "cpu/cpu.h"
+#include "mem/mem.h"
+#include "io/io.h"
+#include "cfg.h"
+
+#define MACHINE_MAX 16
+#define MACHINE_CPUS 2
+
+// Emulated machine: CPU(s) with memory and I/O. Everything a CPU
+// touches while running is reached through the machine it belongs to,
+// so any number of machines may run side by side.
+// In a 2-CPU machine both CPUs share memory and I/O channels.
+struct em400_machine {
+	struct cpu cpu[MACHINE_CPUS];
+	int cpu_count;
+	struct mem mem;
+	struct io io;
+	int num;
+	em400_cfg *cfg;		// machine configuration
+};
+
+extern struct em400_machine machines[MACHINE_MAX];
+extern int machine_count;
+
+int machines_init(em400_cfg *cfg);
+void machines_shutdown();
+void machines_run();
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
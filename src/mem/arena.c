@@ -0,0 +1,194 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mem/mem.h"
+#include "mem/arena.h"
+
+#include "log.h"
+
+// all physical memory segments live in one arena, aligned for (transparent) huge pages
+#define MEM_ARENA_ALIGN (2 * 1024 * 1024)
+
+// -----------------------------------------------------------------------
+static size_t mem_arena_align(size_t size)
+{
+	return (size + MEM_ARENA_ALIGN - 1) & ~((size_t) MEM_ARENA_ALIGN - 1);
+}
+
+// -----------------------------------------------------------------------
+static void * mem_arena_map_hugetlb(size_t size)
+{
+#ifdef MAP_HUGETLB
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr != MAP_FAILED) {
+		return ptr;
+	}
+#endif
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+static void * mem_arena_map_aligned(size_t size)
+{
+	// over-allocate, then trim both ends so the arena starts at a huge page boundary
+	size_t len = size + MEM_ARENA_ALIGN;
+	uint8_t *ptr = (uint8_t *) mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+
+	uint8_t *aligned = (uint8_t *) (((uintptr_t) ptr + MEM_ARENA_ALIGN - 1) & ~((uintptr_t) MEM_ARENA_ALIGN - 1));
+	size_t head = aligned - ptr;
+	size_t tail = len - head - size;
+	if (head) munmap(ptr, head);
+	if (tail) munmap(aligned + size, tail);
+
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+	return aligned;
+}
+
+// -----------------------------------------------------------------------
+static void * mem_arena_map_shm(struct mem_arena *arena, const char *name, size_t size)
+{
+	snprintf(arena->shm, sizeof(arena->shm), "/%s.mem", name);
+
+	int fd = shm_open(arena->shm, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		LOGERR("Failed to create shared memory object: %s.", arena->shm);
+		goto fail;
+	}
+	if (ftruncate(fd, size)) {
+		LOGERR("Failed to set size of shared memory object: %s.", arena->shm);
+		close(fd);
+		goto fail;
+	}
+
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		LOGERR("Failed to map shared memory object: %s.", arena->shm);
+		goto fail;
+	}
+
+#ifdef MADV_HUGEPAGE
+	madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+	return ptr;
+
+fail:
+	shm_unlink(arena->shm);
+	arena->shm[0] = '\0';
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+int mem_arena_init(struct mem_arena *arena, int segments, bool hugetlb, bool lock, const char *shm_name)
+{
+	void *ptr = NULL;
+
+	arena->segs = segments;
+	arena->used = 0;
+	arena->size = (size_t) segments * MEM_SEGMENT_SIZE * sizeof(uint16_t);
+	arena->mapped = mem_arena_align(arena->size);
+
+	if (shm_name) {
+		ptr = mem_arena_map_shm(arena, shm_name, arena->mapped);
+		if (!ptr) {
+			return LOGERR("Failed to export memory arena as shared memory.");
+		}
+		if (hugetlb) {
+			LOG(L_MEM, "Memory arena is exported as shared memory, not using hugetlb pages");
+		}
+	} else if (hugetlb) {
+		ptr = mem_arena_map_hugetlb(arena->mapped);
+		if (ptr) {
+			LOG(L_MEM, "Memory arena backed by hugetlb pages");
+		} else {
+			LOG(L_MEM, "Failed to map memory arena using hugetlb pages, falling back to regular pages");
+		}
+	}
+
+	if (!ptr) {
+		ptr = mem_arena_map_aligned(arena->mapped);
+		if (!ptr) {
+			return LOGERR("Failed to map %zu bytes of memory arena.", arena->mapped);
+		}
+	}
+
+	arena->base = (uint16_t *) ptr;
+
+	if (lock) {
+		if (mlock(arena->base, arena->mapped)) {
+			LOG(L_MEM, "Failed to lock memory arena in RAM");
+		} else {
+			arena->locked = true;
+		}
+	}
+
+	LOG(L_MEM, "Memory arena: %i segments, %zu bytes at %p%s%s%s", segments, arena->size, arena->base,
+		arena->locked ? ", locked" : "",
+		arena->shm[0] ? ", exported as " : "",
+		arena->shm);
+
+	return E_OK;
+}
+
+// -----------------------------------------------------------------------
+void mem_arena_shutdown(struct mem_arena *arena)
+{
+	if (!arena->base) return;
+
+	if (arena->locked) {
+		munlock(arena->base, arena->mapped);
+		arena->locked = false;
+	}
+	munmap(arena->base, arena->mapped);
+	if (arena->shm[0]) {
+		shm_unlink(arena->shm);
+		arena->shm[0] = '\0';
+	}
+	arena->base = NULL;
+	arena->size = 0;
+	arena->segs = arena->used = 0;
+}
+
+// -----------------------------------------------------------------------
+uint16_t * mem_arena_seg_alloc(struct mem_arena *arena)
+{
+	if (!arena->base || (arena->used >= arena->segs)) {
+		return NULL;
+	}
+
+	return arena->base + (size_t) MEM_SEGMENT_SIZE * arena->used++;
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -0,0 +1,42 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef MEM_ARENA_H
+#define MEM_ARENA_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// all physical memory segments of a machine
+struct mem_arena {
+	uint16_t *base;			// arena start
+	size_t size;			// arena size (bytes)
+	size_t mapped;			// size of the mapping backing the arena
+	int segs;				// segments in the arena
+	int used;				// segments already handed out
+	bool locked;
+	char shm[256];			// name of the shared memory object backing the arena, if any
+};
+
+int mem_arena_init(struct mem_arena *arena, int segments, bool hugetlb, bool lock, const char *shm_name);
+void mem_arena_shutdown(struct mem_arena *arena);
+uint16_t * mem_arena_seg_alloc(struct mem_arena *arena);
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
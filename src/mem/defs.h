@@ -0,0 +1,34 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef MEM_DEFS_H
+#define MEM_DEFS_H
+
+#define MEM_SEGMENT_SIZE (4 * 1024)	// segment size (16-bit words)
+#define MEM_MAX_MODULES 16			// physical memory modules
+#define MEM_MAX_SEGMENTS 16			// max physical segments in a module
+#define MEM_MAX_NB 16				// logical blocks
+#define MEM_MAX_AB 16				// logical segments in a logical block
+
+#define MEM_WATCH_SHIFT 5			// write-watch granularity (32 words)
+#define MEM_WATCH_PAGES (0x10000 >> MEM_WATCH_SHIFT)
+
+#define MEM_SCAN_LANES 8			// words compared at once by memory search
+
+#endif
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -20,26 +20,22 @@
 
 #include "io/defs.h"
 #include "mem/elwro.h"
+#include "mem/arena.h"
 
 #include "log.h"
 
 #define RAL(nb, ab) (((nb)<<4) + (ab))
 
-uint16_t *mem_elwro[MEM_MAX_MODULES][MEM_MAX_ELWRO_SEGMENTS];	// physical memory segments
-int mem_elwro_ral[MEM_MAX_MODULES][MEM_MAX_ELWRO_SEGMENTS];		// internal physical->logical mapping
-int mem_elwro_os_segments;										// segments hardwired for OS
-int mem_elwro_mp_start, mem_elwro_mp_end;						// modules allocated for Elwro
-
 // -----------------------------------------------------------------------
-void mem_elwro_os_hardwire()
+static void mem_elwro_os_hardwire(struct mem_elwro *elwro)
 {
-	for (int seg=0 ; seg<mem_elwro_os_segments ; seg++) {
-		mem_elwro_ral[0][seg] = RAL(0, seg);
+	for (int seg=0 ; seg<elwro->os_segments ; seg++) {
+		elwro->ral[0][seg] = RAL(0, seg);
 	}
 }
 
 // -----------------------------------------------------------------------
-int mem_elwro_init(int modc, int seg_os)
+int mem_elwro_init(struct mem_elwro *elwro, struct mem_arena *arena, int modc, int seg_os)
 {
 	int mp, seg;
 
@@ -50,61 +46,62 @@ int mem_elwro_init(int modc, int seg_os)
 		return LOGERR("Wrong number of OS memory segments: %i. Should be 1 or 2.", seg_os);
 	}
 
-	mem_elwro_os_segments = seg_os;
-	mem_elwro_mp_start = 0;
-	mem_elwro_mp_end = modc - 1;
+	elwro->os_segments = seg_os;
+	elwro->mp_start = 0;
+	elwro->mp_end = modc - 1;
 
-	LOG(L_MEM, "Elwro modules: %d-%d, %d segments (%d hardwired OS segments)", mem_elwro_mp_start, mem_elwro_mp_end, MEM_MAX_ELWRO_SEGMENTS, seg_os);
+	LOG(L_MEM, "Elwro modules: %d-%d, %d segments (%d hardwired OS segments)", elwro->mp_start, elwro->mp_end, MEM_MAX_ELWRO_SEGMENTS, seg_os);
 
-	for (mp=mem_elwro_mp_start ; mp<=mem_elwro_mp_end ; mp++) {
+	for (mp=elwro->mp_start ; mp<=elwro->mp_end ; mp++) {
 		for (seg=0 ; seg<MEM_MAX_ELWRO_SEGMENTS ; seg++) {
-			mem_elwro[mp][seg] = (uint16_t *) calloc(sizeof(uint16_t), MEM_SEGMENT_SIZE);
-			if (!mem_elwro[mp][seg]) {
+			elwro->seg[mp][seg] = mem_arena_seg_alloc(arena);
+			if (!elwro->seg[mp][seg]) {
 				return LOGERR("Memory allocation failed for Elwro map.");
 			}
 		}
 	}
 
-	mem_elwro_os_hardwire();
+	mem_elwro_os_hardwire(elwro);
 
 	return E_OK;
 }
 
 // -----------------------------------------------------------------------
-void mem_elwro_shutdown()
+void mem_elwro_shutdown(struct mem_elwro *elwro)
 {
 	int mp, seg;
 
-	for (mp=mem_elwro_mp_start ; mp<=mem_elwro_mp_end ; mp++) {
+	// segments belong to the memory arena
+	for (mp=elwro->mp_start ; mp<=elwro->mp_end ; mp++) {
 		for (seg=0 ; seg<MEM_MAX_ELWRO_SEGMENTS ; seg++) {
-			free(mem_elwro[mp][seg]);
+			elwro->seg[mp][seg] = NULL;
 		}
 	}
 }
 
 // -----------------------------------------------------------------------
-void mem_elwro_reset()
+void mem_elwro_reset(struct mem_elwro *elwro)
 {
 	int mp, seg;
-	for (mp=mem_elwro_mp_start ; mp<=mem_elwro_mp_end ; mp++) {
+	for (mp=elwro->mp_start ; mp<=elwro->mp_end ; mp++) {
 		for (seg=0 ; seg<MEM_MAX_ELWRO_SEGMENTS ; seg++) {
-			mem_elwro_ral[mp][seg] = RAL(0, 0);
+			elwro->ral[mp][seg] = RAL(0, 0);
 		}
 	}
 
-	mem_elwro_os_hardwire();
+	mem_elwro_os_hardwire(elwro);
 }
 
 // -----------------------------------------------------------------------
-uint16_t * mem_elwro_get_seg_ptr(int nb, int ab)
+uint16_t * mem_elwro_get_seg_ptr(struct mem_elwro *elwro, int nb, int ab)
 {
 	int mp, seg;
 
 	// find lowest segment that has nb:ab in its RAL
-	for (mp=mem_elwro_mp_start ; mp<=mem_elwro_mp_end ; mp++) {
+	for (mp=elwro->mp_start ; mp<=elwro->mp_end ; mp++) {
 		for (seg=0 ; seg<MEM_MAX_ELWRO_SEGMENTS ; seg++) {
-			if (mem_elwro_ral[mp][seg] == RAL(nb, ab)) {
-				return mem_elwro[mp][seg];
+			if (elwro->ral[mp][seg] == RAL(nb, ab)) {
+				return elwro->seg[mp][seg];
 			}
 		}
 	}
@@ -112,21 +109,21 @@ uint16_t * mem_elwro_get_seg_ptr(int nb, int ab)
 }
 
 // -----------------------------------------------------------------------
-int mem_elwro_cmd(int nb, int ab, int mp, int seg)
+int mem_elwro_cmd(struct mem_elwro *elwro, int nb, int ab, int mp, int seg)
 {
-	if (!mem_elwro[mp][seg]) {
+	if (!elwro->seg[mp][seg]) {
 		LOG(L_MEM, "Elwro: ignored mapping to a nonexistent physical segment: logical [%d, %d] -> physical [%d, %d]", nb, ab, mp, seg);
 		return IO_NO;
 	}
 
-	if ((mp == 0) && (seg < mem_elwro_os_segments)) {
+	if ((mp == 0) && (seg < elwro->os_segments)) {
 		LOG(L_MEM, "Elwro: ignored mapping to a hardwired segment: logical [%d, %d] -> physical [%d, %2d]", nb, ab, mp, seg);
 		return IO_NO;
 	}
 
 	LOG(L_MEM, "Elwro: adding map: logical [%d, %d] -> physical [%d, %d]", nb, ab, mp, seg);
 
-	mem_elwro_ral[mp][seg] = RAL(nb, ab);
+	elwro->ral[mp][seg] = RAL(nb, ab);
 
 	return IO_OK;
 }
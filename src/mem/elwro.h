@@ -20,17 +20,23 @@
 
 #include <inttypes.h>
 
-#include "mem/mem.h"
+#include "mem/defs.h"
+#include "mem/arena.h"
 
 #define MEM_MAX_ELWRO_SEGMENTS 8
 
-extern uint16_t *mem_elwro[MEM_MAX_MODULES][MEM_MAX_ELWRO_SEGMENTS];
-
-int mem_elwro_init(int modc, int osc);
-void mem_elwro_shutdown();
-void mem_elwro_reset();
-uint16_t * mem_elwro_get_seg_ptr(int nb, int ab);
-int mem_elwro_cmd(int nb, int ab, int mp, int seg);
+struct mem_elwro {
+	uint16_t *seg[MEM_MAX_MODULES][MEM_MAX_ELWRO_SEGMENTS];	// physical memory segments
+	int ral[MEM_MAX_MODULES][MEM_MAX_ELWRO_SEGMENTS];		// internal physical->logical mapping
+	int os_segments;										// segments hardwired for OS
+	int mp_start, mp_end;									// modules allocated for Elwro
+};
+
+int mem_elwro_init(struct mem_elwro *elwro, struct mem_arena *arena, int modc, int osc);
+void mem_elwro_shutdown(struct mem_elwro *elwro);
+void mem_elwro_reset(struct mem_elwro *elwro);
+uint16_t * mem_elwro_get_seg_ptr(struct mem_elwro *elwro, int nb, int ab);
+int mem_elwro_cmd(struct mem_elwro *elwro, int nb, int ab, int mp, int seg);
 
 #endif
 
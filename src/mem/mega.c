@@ -21,19 +21,13 @@
 
 #include "io/defs.h"
 #include "mem/mega.h"
+#include "mem/arena.h"
 #include "utils/utils.h"
 
 #include "log.h"
 
-uint16_t *mem_mega[MEM_MAX_MODULES][MEM_MAX_MEGA_SEGMENTS];	// physical memory segments
-uint16_t *mem_mega_map[MEM_MAX_NB][MEM_MAX_AB];				// internal logical->physical segment mapping
-int mem_mega_mp_start, mem_mega_mp_end;   					// modules allocated for MEGA
-uint16_t *mem_mega_prom;									// PROM contents
-bool mem_mega_prom_hidden;									// is PROM hidden?
-bool mem_mega_init_done;									// is initialization done?
-
 // -----------------------------------------------------------------------
-int mem_mega_init(int modc, const char *prom_image)
+int mem_mega_init(struct mem_mega *mega, struct mem_arena *arena, int modc, const char *prom_image)
 {
 	int res;
 	int mp, seg;
@@ -47,24 +41,24 @@ int mem_mega_init(int modc, const char *prom_image)
 		return LOGERR("Wrong number of MEGA modules: %i. Should be 1-%i", modc, MEM_MAX_MODULES);
 	}
 
-	mem_mega_mp_start = MEM_MAX_MODULES - modc;
-	mem_mega_mp_end = MEM_MAX_MODULES - 1;
+	mega->mp_start = MEM_MAX_MODULES - modc;
+	mega->mp_end = MEM_MAX_MODULES - 1;
 
-	LOG(L_MEM, "MEGA modules: %d-%d, %d segments", mem_mega_mp_start, mem_mega_mp_end, MEM_MAX_MEGA_SEGMENTS);
+	LOG(L_MEM, "MEGA modules: %d-%d, %d segments", mega->mp_start, mega->mp_end, MEM_MAX_MEGA_SEGMENTS);
 
-	for (mp=mem_mega_mp_start ; mp<=mem_mega_mp_end ; mp++) {
+	for (mp=mega->mp_start ; mp<=mega->mp_end ; mp++) {
 		for (seg=0 ; seg<MEM_MAX_MEGA_SEGMENTS ; seg++) {
-			mem_mega[mp][seg] = (uint16_t *) calloc(sizeof(uint16_t), MEM_SEGMENT_SIZE);
-			if (!mem_mega[mp][seg]) {
+			mega->seg[mp][seg] = mem_arena_seg_alloc(arena);
+			if (!mega->seg[mp][seg]) {
 				return LOGERR("Memory allocation failed for MEGA map.");
 			}
 		}
 	}
 
 	// allocate memory for MEGA PROM
-	mem_mega_prom_hidden = false;
-	mem_mega_prom = (uint16_t *) malloc(sizeof(uint16_t) * MEM_SEGMENT_SIZE);
-	if (!mem_mega_prom) {
+	mega->prom_hidden = false;
+	mega->prom = mem_arena_seg_alloc(arena);
+	if (!mega->prom) {
 		return LOGERR("Memory allocation error for MEGA PROM.");
 	}
 
@@ -74,66 +68,67 @@ int mem_mega_init(int modc, const char *prom_image)
 		if (!f) {
 			return LOGERR("Failed to open PROM image: \"%s\".", prom_image);
 		}
-		res = fread(mem_mega_prom, sizeof(uint16_t), MEM_SEGMENT_SIZE, f);
+		res = fread(mega->prom, sizeof(uint16_t), MEM_SEGMENT_SIZE, f);
 		if (res != MEM_SEGMENT_SIZE) {
 			fclose(f);
 			return LOGERR("Read only %i words of MEGA PROM. Expecting %i.", res, MEM_SEGMENT_SIZE);
 		}
 		fclose(f);
-		endianswap(mem_mega_prom, res);
+		endianswap(mega->prom, res);
 		LOG(L_MEM, "Loaded MEGA PROM image: %s (%i words)", prom_image, res);
 	} else {
 		LOG(L_MEM, "Empty MEGA PROM");
 	}
 
-	mem_mega_init_done = false;
+	mega->init_done = false;
 
 	return E_OK;
 }
 
 // -----------------------------------------------------------------------
-void mem_mega_shutdown()
+void mem_mega_shutdown(struct mem_mega *mega)
 {
 	int mp, seg;
 
-	for (mp=mem_mega_mp_start ; mp<=mem_mega_mp_end ; mp++) {
+	// segments belong to the memory arena
+	for (mp=mega->mp_start ; mp<=mega->mp_end ; mp++) {
 		for (seg=0 ; seg<MEM_MAX_MEGA_SEGMENTS ; seg++) {
-			free(mem_mega[mp][seg]);
+			mega->seg[mp][seg] = NULL;
 		}
 	}
-	
-	free(mem_mega_prom);
+
+	mega->prom = NULL;
 }
 
 // -----------------------------------------------------------------------
-void mem_mega_reset()
+void mem_mega_reset(struct mem_mega *mega)
 {
 	int nb, ab;
 	for (nb=0 ; nb<MEM_MAX_NB ; nb++) {
 		for (ab=0 ; ab<MEM_MAX_AB ; ab++) {
-			mem_mega_map[nb][ab] = NULL;
+			mega->map[nb][ab] = NULL;
 		}
 	}
-	mem_mega_prom_hidden = false;
+	mega->prom_hidden = false;
 }
 
 // -----------------------------------------------------------------------
-uint16_t * mem_mega_get_seg_ptr(int nb, int ab)
+uint16_t * mem_mega_get_seg_ptr(struct mem_mega *mega, int nb, int ab)
 {
-	// if PROM is shown, use it, ignore mem_mega_init_done
-	if ((nb == 0) && (ab == 15) && !mem_mega_prom_hidden) {
-		return mem_mega_prom;
+	// if PROM is shown, use it, ignore mega->init_done
+	if ((nb == 0) && (ab == 15) && !mega->prom_hidden) {
+		return mega->prom;
 	// if MEGA configuration is not done, all memory access fails
-	} else if (!mem_mega_init_done) {
+	} else if (!mega->init_done) {
 		return NULL;
 	// otherwise return segment pointer as internal MEGA configuration says
 	} else {
-		return mem_mega_map[nb][ab];
+		return mega->map[nb][ab];
 	}
 }
 
 // -----------------------------------------------------------------------
-int mem_mega_cmd(int nb, int ab, int mp, int seg, int flags)
+int mem_mega_cmd(struct mem_mega *mega, int nb, int ab, int mp, int seg, int flags)
 {
 	LOG(L_MEM, "MEGA: (%2d, %2d) -> (%2d, %2d)  flags: %s%s%s%s%s",
 		nb, ab, mp, seg,
@@ -146,25 +141,25 @@ int mem_mega_cmd(int nb, int ab, int mp, int seg, int flags)
 
 	// 'free'
 	if ((flags & MEM_MEGA_FREE)) {
-		mem_mega_map[nb][ab] = NULL;
+		mega->map[nb][ab] = NULL;
 	// 'alloc'
 	} else {
-		mem_mega_map[nb][ab] = mem_mega[mp][seg];
+		mega->map[nb][ab] = mega->seg[mp][seg];
 	}
 
 	// 'PROM hide'
 	if ((flags & MEM_MEGA_PROM_HIDE)) {
-		mem_mega_prom_hidden = true;
+		mega->prom_hidden = true;
 	}
 
 	// 'PROM show'
 	if ((flags & MEM_MEGA_PROM_SHOW)) {
-		mem_mega_prom_hidden = false;
+		mega->prom_hidden = false;
 	}
 
 	// 'allocation done'
 	if ((flags & MEM_MEGA_ALLOC_DONE)) {
-		mem_mega_init_done = true;
+		mega->init_done = true;
 	}
 
 	return IO_OK;
@@ -20,7 +20,10 @@
 
 #include <inttypes.h>
 
-#include "mem/mem.h"
+#include <stdbool.h>
+
+#include "mem/defs.h"
+#include "mem/arena.h"
 
 #define MEM_MAX_MEGA_SEGMENTS 16	// physical segments in mega module
 
@@ -32,14 +35,20 @@ enum mem_mega_flags {
 	MEM_MEGA_ALLOC_DONE	= 0b1000000,
 };
 
-extern uint16_t *mem_mega[MEM_MAX_MODULES][MEM_MAX_SEGMENTS];
-extern uint16_t *mem_mega_prom;	// this needs to be visible, we check in mem_read() if we can write to segment
+struct mem_mega {
+	uint16_t *seg[MEM_MAX_MODULES][MEM_MAX_MEGA_SEGMENTS];	// physical memory segments
+	uint16_t *map[MEM_MAX_NB][MEM_MAX_AB];					// internal logical->physical segment mapping
+	int mp_start, mp_end;									// modules allocated for MEGA
+	uint16_t *prom;											// PROM contents (mem_write_*() checks it, PROM is read-only)
+	bool prom_hidden;										// is PROM hidden?
+	bool init_done;											// is initialization done?
+};
 
-int mem_mega_init(int modc, const char *prom_image);
-void mem_mega_shutdown();
-void mem_mega_reset();
-uint16_t * mem_mega_get_seg_ptr(int nb, int ab);
-int mem_mega_cmd(int nb, int ab, int mp, int seg, int flags);
+int mem_mega_init(struct mem_mega *mega, struct mem_arena *arena, int modc, const char *prom_image);
+void mem_mega_shutdown(struct mem_mega *mega);
+void mem_mega_reset(struct mem_mega *mega);
+uint16_t * mem_mega_get_seg_ptr(struct mem_mega *mega, int nb, int ab);
+int mem_mega_cmd(struct mem_mega *mega, int nb, int ab, int mp, int seg, int flags);
 
 #endif
 
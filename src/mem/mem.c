@@ -16,86 +16,111 @@
 //  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <stdbool.h>
 
-#include "mem/elwro.h"
-#include "mem/mega.h"
 #include "mem/mem.h"
 #include "io/defs.h"
 
 #include "cfg.h"
+#include "atomic.h"
 
 #include "log.h"
 
-uint16_t * mem_map[MEM_MAX_NB][MEM_MAX_AB]; // final (as seen by emulation) logical->physical segment mapping
-
-static int mega_modules = 0;
-static bool mega_boot = false;
+// -----------------------------------------------------------------------
+static inline void mem_watch_hit(struct mem *mem, int nb, uint16_t addr)
+{
+	if (!nb && mem->watched[addr >> MEM_WATCH_SHIFT]) {
+		atom_add_release(mem->watch_gens + (addr >> MEM_WATCH_SHIFT), 1);
+	}
+}
 
 // -----------------------------------------------------------------------
-static uint16_t *mem_ptr(int nb, uint16_t addr)
+static inline uint16_t *mem_ptr(struct mem *mem, int nb, uint16_t addr)
 {
-	uint16_t *seg_ptr = mem_map[nb][addr >> 12];
+	uint16_t *seg_ptr = atom_load_acquire(&mem->map[nb][addr >> 12]);
 	return seg_ptr ? seg_ptr + (addr & 0b0000111111111111) : NULL;
 }
 
 // -----------------------------------------------------------------------
-void mem_update_map()
+static void mem_update_map(struct mem *mem)
 {
+	// map is read without locking by all CPUs and I/O threads of the machine
 	for (int nb=0 ; nb<MEM_MAX_NB ; nb++) {
 		for (int ab=0 ; ab<MEM_MAX_AB ; ab++) {
-			mem_map[nb][ab] = mem_elwro_get_seg_ptr(nb, ab);
-			if (!mem_map[nb][ab]) {
-				mem_map[nb][ab] = mem_mega_get_seg_ptr(nb, ab);
+			uint16_t *seg_ptr = mem_elwro_get_seg_ptr(&mem->elwro, nb, ab);
+			if (!seg_ptr) {
+				seg_ptr = mem_mega_get_seg_ptr(&mem->mega, nb, ab);
 			}
+			atom_store_release(&mem->map[nb][ab], seg_ptr);
 		}
 	}
 }
 
 // -----------------------------------------------------------------------
-int mem_init(em400_cfg *cfg)
+int mem_init(struct mem *mem, em400_cfg *cfg, bool shm_export)
 {
 	int res;
 
+	pthread_mutex_init(&mem->cmd_mutex, NULL);
+
 	const int cfg_elwro = cfg_getint(cfg, "memory:elwro_modules", CFG_DEFAULT_MEMORY_ELWRO_MODULES);
-	mega_modules = cfg_getint(cfg, "memory:mega_modules", CFG_DEFAULT_MEMORY_MEGA_MODULES);
+	mem->mega_modules = cfg_getint(cfg, "memory:mega_modules", CFG_DEFAULT_MEMORY_MEGA_MODULES);
 	const int cfg_os = cfg_getint(cfg, "memory:hardwired_segments", CFG_DEFAULT_MEMORY_HARDWIRED_SEGMENTS);
 	const char *mega_modules_prom = cfg_getstr(cfg, "memory:mega_prom", CFG_DEFAULT_MEMORY_MEGA_PROM);
-	mega_boot = cfg_getbool(cfg, "memory:mega_boot", CFG_DEFAULT_MEMORY_MEGA_BOOT);
+	mem->mega_boot = cfg_getbool(cfg, "memory:mega_boot", CFG_DEFAULT_MEMORY_MEGA_BOOT);
+	const bool cfg_hugetlb = cfg_getbool(cfg, "memory:hugetlb", CFG_DEFAULT_MEMORY_HUGETLB);
+	const bool cfg_lock = cfg_getbool(cfg, "memory:lock", CFG_DEFAULT_MEMORY_LOCK);
+	// only one machine may export its memory, others would use the same name
+	const char *cfg_shm = shm_export ? cfg_getstr(cfg, "memory:shm_name", CFG_DEFAULT_MEMORY_SHM_NAME) : NULL;
 
-	if (cfg_elwro + mega_modules > MEM_MAX_MODULES+1) {
+	if (cfg_elwro + mem->mega_modules > MEM_MAX_MODULES+1) {
 		return LOGERR("Sum of Elwro and MEGA memory modules is greater than allowed %i.", MEM_MAX_MODULES+1);
 	}
 
-	res = mem_elwro_init(cfg_elwro, cfg_os);
+	// one arena for all Elwro and MEGA segments plus MEGA PROM
+	// (module counts are verified by Elwro and MEGA initialization)
+	int arena_segs = 0;
+	if (cfg_elwro > 0) arena_segs += cfg_elwro * MEM_MAX_ELWRO_SEGMENTS;
+	if (mem->mega_modules > 0) arena_segs += mem->mega_modules * MEM_MAX_MEGA_SEGMENTS + 1;
+	if (arena_segs > 0) {
+		res = mem_arena_init(&mem->arena, arena_segs, cfg_hugetlb, cfg_lock, cfg_shm);
+		if (res != E_OK) {
+			return LOGERR("Failed to initialize memory arena.");
+		}
+	}
+
+	res = mem_elwro_init(&mem->elwro, &mem->arena, cfg_elwro, cfg_os);
 	if (res != E_OK) {
 		return LOGERR("Failed to initialize Elwro memory.");
 	}
 
-	res = mem_mega_init(mega_modules, mega_modules_prom);
+	res = mem_mega_init(&mem->mega, &mem->arena, mem->mega_modules, mega_modules_prom);
 	if (res != E_OK) {
 		return LOGERR("Failed to initialize MEGA memory.");
 	}
 
-	mem_update_map();
+	mem_update_map(mem);
 
-	LOG(L_MEM, "Memory initialized. Elwro modules: %d, MEGA modules: %d, hardwired OS segments: %d, MEGA prom: %s, MEGA boot: %s", cfg_elwro, mega_modules, cfg_os, mega_modules_prom, mega_boot ? "true" : "false");
+	LOG(L_MEM, "Memory initialized. Elwro modules: %d, MEGA modules: %d, hardwired OS segments: %d, MEGA prom: %s, MEGA boot: %s", cfg_elwro, mem->mega_modules, cfg_os, mega_modules_prom, mem->mega_boot ? "true" : "false");
 
 	return E_OK;
 }
 
 // -----------------------------------------------------------------------
-void mem_shutdown()
+void mem_shutdown(struct mem *mem)
 {
 	LOG(L_MEM, "Shutdown memory");
 
-	mem_mega_shutdown();
-	mem_elwro_shutdown();
+	mem_mega_shutdown(&mem->mega);
+	mem_elwro_shutdown(&mem->elwro);
+	mem_arena_shutdown(&mem->arena);
+	pthread_mutex_destroy(&mem->cmd_mutex);
 }
 
 // -----------------------------------------------------------------------
-int mem_cmd(uint16_t n, uint16_t r)
+int mem_cmd(struct mem *mem, uint16_t n, uint16_t r)
 {
 	int res;
 	int nb		= (r & 0b0000000000001111);
@@ -104,40 +129,47 @@ int mem_cmd(uint16_t n, uint16_t r)
 	int seg		= (n & 0b0000000111100000) >> 5;
 	int flags	= (n & 0b1111111000000000) >> 9;
 
+	pthread_mutex_lock(&mem->cmd_mutex);
 	// if MEGA is present and MEM_MEGA_ALLOC is set => command for MEGA
-	if ((mega_modules > 0) && (flags & MEM_MEGA_ALLOC)) {
-		res = mem_mega_cmd(nb, ab, mp, seg, flags);
+	if ((mem->mega_modules > 0) && (flags & MEM_MEGA_ALLOC)) {
+		res = mem_mega_cmd(&mem->mega, nb, ab, mp, seg, flags);
 	// Elwro otherwise (but mask segment number to 3 bits)
 	} else {
-		res = mem_elwro_cmd(nb, ab, mp, seg & 0b0111);
+		res = mem_elwro_cmd(&mem->elwro, nb, ab, mp, seg & 0b0111);
 	}
 	if (res == IO_OK) {
-		mem_update_map();
+		mem_update_map(mem);
+		// remapping may change what is seen under any watched address
+		if (!nb) atom_add_release(&mem->watch_remaps, 1);
 	}
+	pthread_mutex_unlock(&mem->cmd_mutex);
 	return res;
 }
 
 // -----------------------------------------------------------------------
-void mem_reset()
+void mem_reset(struct mem *mem)
 {
-	mem_elwro_reset();
-	mem_mega_reset();
-	mem_update_map();
+	pthread_mutex_lock(&mem->cmd_mutex);
+	mem_elwro_reset(&mem->elwro);
+	mem_mega_reset(&mem->mega);
+	mem_update_map(mem);
+	atom_add_release(&mem->watch_remaps, 1);
+	pthread_mutex_unlock(&mem->cmd_mutex);
 }
 
 // -----------------------------------------------------------------------
-bool mem_mega_boot()
+bool mem_mega_boot(struct mem *mem)
 {
-	if (mega_boot && mem_mega_prom && (mem_map[0][15] == mem_mega_prom)) {
+	if (mem->mega_boot && mem->mega.prom && (atom_load_acquire(&mem->map[0][15]) == mem->mega.prom)) {
 		return true;
 	}
 	return false;
 }
 
 // -----------------------------------------------------------------------
-bool mem_read_1(int nb, uint16_t addr, uint16_t *data)
+bool mem_read_1(struct mem *mem, int nb, uint16_t addr, uint16_t *data)
 {
-	uint16_t *ptr = mem_ptr(nb, addr);
+	uint16_t *ptr = mem_ptr(mem, nb, addr);
 	if (ptr) {
 		*data = *ptr;
 	} else {
@@ -147,12 +179,13 @@ bool mem_read_1(int nb, uint16_t addr, uint16_t *data)
 }
 
 // -----------------------------------------------------------------------
-bool mem_write_1(int nb, uint16_t addr, uint16_t data)
+bool mem_write_1(struct mem *mem, int nb, uint16_t addr, uint16_t data)
 {
-	uint16_t *ptr = mem_ptr(nb, addr);
+	uint16_t *ptr = mem_ptr(mem, nb, addr);
 	if (ptr) {
-		if (!mem_mega_prom || (mem_map[nb][addr>>12] != mem_mega_prom)) {
+		if (!mem->mega.prom || (atom_load_acquire(&mem->map[nb][addr>>12]) != mem->mega.prom)) {
 			*ptr = data;
+			if (mem->watch_active) mem_watch_hit(mem, nb, addr);
 		}
 	} else {
 		return false;
@@ -161,10 +194,10 @@ bool mem_write_1(int nb, uint16_t addr, uint16_t data)
 }
 
 // -----------------------------------------------------------------------
-bool mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count)
+bool mem_read_n(struct mem *mem, int nb, uint16_t saddr, uint16_t *dest, int count)
 {
 	for ( ; count>0 ; count--, saddr++, dest++) {
-		uint16_t *ptr = mem_ptr(nb, saddr);
+		uint16_t *ptr = mem_ptr(mem, nb, saddr);
 		if (ptr) {
 			*dest = *ptr;
 		} else {
@@ -175,13 +208,14 @@ bool mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count)
 }
 
 // -----------------------------------------------------------------------
-bool mem_write_n(int nb, uint16_t saddr, uint16_t *src, int count)
+bool mem_write_n(struct mem *mem, int nb, uint16_t saddr, uint16_t *src, int count)
 {
 	for ( ; count>0 ; count--, saddr++, src++) {
-		uint16_t *ptr = mem_ptr(nb, saddr);
+		uint16_t *ptr = mem_ptr(mem, nb, saddr);
 		if (ptr) {
-			if (!mem_mega_prom || (mem_map[nb][saddr>>12] != mem_mega_prom)) {
+			if (!mem->mega.prom || (atom_load_acquire(&mem->map[nb][saddr>>12]) != mem->mega.prom)) {
 				*ptr = *src;
+				if (mem->watch_active) mem_watch_hit(mem, nb, saddr);
 			}
 		} else {
 			return false;
@@ -191,15 +225,117 @@ bool mem_write_n(int nb, uint16_t saddr, uint16_t *src, int count)
 }
 
 // -----------------------------------------------------------------------
-uint16_t mem_get_map(int seg)
+static bool mem_scan_match(uint16_t * const *segs, unsigned addr, const uint16_t *pattern, const uint16_t *mask, unsigned len)
+{
+	for (unsigned i=1 ; i<len ; i++) {
+		unsigned a = addr + i;
+		if (a > 0xffff) return false;
+		uint16_t *seg = segs[a >> 12];
+		if (!seg) return false;
+		if ((seg[a & 0b0000111111111111] ^ pattern[i]) & (mask ? mask[i] : 0xffff)) return false;
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------
+int mem_scan(uint16_t * const *segs, uint32_t tag, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max)
+{
+	// first pattern word is compared MEM_SCAN_LANES words at a time,
+	// candidates are then verified word by word (across segment boundaries)
+	typedef uint16_t vu16 __attribute__ ((vector_size (MEM_SCAN_LANES * sizeof(uint16_t))));
+
+	const uint16_t m0 = mask ? mask[0] : 0xffff;
+	const uint16_t p0 = pattern[0] & m0;
+	const vu16 vm = m0 - (vu16) {0};
+	const vu16 vp = p0 - (vu16) {0};
+	int count = 0;
+
+	for (unsigned ab=0 ; ab<MEM_MAX_AB ; ab++) {
+		const uint16_t *seg = segs[ab];
+		if (!seg) continue;
+		for (unsigned i=0 ; i<MEM_SEGMENT_SIZE ; i+=MEM_SCAN_LANES) {
+			vu16 w, eq;
+			uint64_t any[sizeof(vu16) / sizeof(uint64_t)];
+			uint64_t hit = 0;
+			memcpy(&w, seg+i, sizeof(w));
+			eq = (vu16) ((w & vm) == vp);
+			memcpy(any, &eq, sizeof(any));
+			for (unsigned j=0 ; j<sizeof(any)/sizeof(uint64_t) ; j++) {
+				hit |= any[j];
+			}
+			if (!hit) continue;
+			for (unsigned j=0 ; j<MEM_SCAN_LANES ; j++) {
+				unsigned addr = (ab << 12) + i + j;
+				if (((seg[i+j] & m0) == p0) && mem_scan_match(segs, addr, pattern, mask, len)) {
+					if ((unsigned) count < max) {
+						found[count] = tag | addr;
+					}
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+int mem_find(struct mem *mem, int nb, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max)
+{
+	int count = 0;
+	int nb_first = nb < 0 ? 0 : nb;
+	int nb_last = nb < 0 ? MEM_MAX_NB-1 : nb;
+
+	if ((len < 1) || (nb >= MEM_MAX_NB)) return -1;
+
+	for (nb=nb_first ; nb<=nb_last ; nb++) {
+		unsigned stored = (unsigned) count < max ? (unsigned) count : max;
+		count += mem_scan(mem->map[nb], (uint32_t) nb << 16, pattern, mask, len, found + stored, max - stored);
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+uint16_t mem_get_map(struct mem *mem, int seg)
 {
 	uint16_t map = 0;
 	for (int page=0 ; page<MEM_MAX_AB ; page++) {
-		if (mem_map[seg][page]) {
+		if (atom_load_acquire(&mem->map[seg][page])) {
 			map |= 1 << page;
 		}
 	}
 	return map;
 }
 
+// -----------------------------------------------------------------------
+void mem_watch_add(struct mem *mem, uint16_t addr, int count)
+{
+	// range wraps around the end of address space, just as mem_read_n() does
+	for (int page=addr>>MEM_WATCH_SHIFT ; page<=(addr+count-1)>>MEM_WATCH_SHIFT ; page++) {
+		mem->watched[page % MEM_WATCH_PAGES] = true;
+	}
+	mem->watch_active = true;
+}
+
+// -----------------------------------------------------------------------
+uint32_t mem_watch_gen(struct mem *mem, uint16_t addr, int count)
+{
+	// sum of generations of all pages in the range (and OS block remaps)
+	uint32_t gen = atom_load_acquire(&mem->watch_remaps);
+	for (int page=addr>>MEM_WATCH_SHIFT ; page<=(addr+count-1)>>MEM_WATCH_SHIFT ; page++) {
+		gen += atom_load_acquire(mem->watch_gens + (page % MEM_WATCH_PAGES));
+	}
+	return gen;
+}
+
+// -----------------------------------------------------------------------
+void mem_watch_clear(struct mem *mem)
+{
+	mem->watch_active = false;
+	for (int page=0 ; page<MEM_WATCH_PAGES ; page++) {
+		mem->watched[page] = false;
+	}
+}
+
 // vim: tabstop=4 shiftwidth=4 autoindent
@@ -20,29 +20,50 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <pthread.h>
+
+#include "mem/defs.h"
+#include "mem/arena.h"
+#include "mem/elwro.h"
+#include "mem/mega.h"
 
 #include "cfg.h"
 
-#define MEM_SEGMENT_SIZE 4 * 1024	// segment size (16-bit words)
-#define MEM_MAX_MODULES 16			// physical memory modules
-#define MEM_MAX_SEGMENTS 16			// max physical segments in a module
-#define MEM_MAX_NB 16				// logical blocks
-#define MEM_MAX_AB 16				// logical segments in a logical block
+// memory of a single machine
+struct mem {
+	uint16_t * map[MEM_MAX_NB][MEM_MAX_AB]; // final (as seen by emulation) logical->physical segment mapping
+	struct mem_arena arena;
+	struct mem_elwro elwro;
+	struct mem_mega mega;
+	int mega_modules;
+	bool mega_boot;
+	pthread_mutex_t cmd_mutex; // configuration changes may come from both CPUs of the machine
+
+	// OS block write-watch: writes to watched pages bump page generation counters
+	bool watch_active;
+	bool watched[MEM_WATCH_PAGES];
+	uint32_t watch_gens[MEM_WATCH_PAGES];
+	uint32_t watch_remaps;
+};
 
-extern uint16_t * mem_map[MEM_MAX_NB][MEM_MAX_AB];
+int mem_init(struct mem *mem, em400_cfg *cfg, bool shm_export);
+void mem_shutdown(struct mem *mem);
+int mem_cmd(struct mem *mem, uint16_t n, uint16_t r);
+void mem_reset(struct mem *mem);
+bool mem_mega_boot(struct mem *mem);
 
-int mem_init(em400_cfg *cfg);
-void mem_shutdown();
-int mem_cmd(uint16_t n, uint16_t r);
-void mem_reset();
-bool mem_mega_boot();
+bool mem_read_1(struct mem *mem, int nb, uint16_t addr, uint16_t *data);
+bool mem_write_1(struct mem *mem, int nb, uint16_t addr, uint16_t data);
+bool mem_read_n(struct mem *mem, int nb, uint16_t saddr, uint16_t *dest, int count);
+bool mem_write_n(struct mem *mem, int nb, uint16_t saddr, uint16_t *src, int count);
+int mem_scan(uint16_t * const *segs, uint32_t tag, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max);
+int mem_find(struct mem *mem, int nb, const uint16_t *pattern, const uint16_t *mask, unsigned len, uint32_t *found, unsigned max);
 
-bool mem_read_1(int nb, uint16_t addr, uint16_t *data);
-bool mem_write_1(int nb, uint16_t addr, uint16_t data);
-bool mem_read_n(int nb, uint16_t saddr, uint16_t *dest, int count);
-bool mem_write_n(int nb, uint16_t saddr, uint16_t *src, int count);
+uint16_t mem_get_map(struct mem *mem, int seg);
 
-uint16_t mem_get_map(int seg);
+void mem_watch_add(struct mem *mem, uint16_t addr, int count);
+uint32_t mem_watch_gen(struct mem *mem, uint16_t addr, int count);
+void mem_watch_clear(struct mem *mem);
 
 #endif
 
@@ -26,6 +26,9 @@
 #include "ui/cmd/commands.h"
 #include "ui/cmd/utils.h"
 
+#define UI_CMD_FIND_MAX_WORDS 32
+#define UI_CMD_FIND_MAX_RESULTS 1024
+
 void ui_cmd_state(FILE *out, char *args);
 void ui_cmd_reg(FILE *out, char *args);
 void ui_cmd_int(FILE *out, char *args);
@@ -36,7 +39,9 @@ void ui_cmd_ips(FILE *out, char *args);
 void ui_cmd_load(FILE *out, char *args);
 void ui_cmd_clock(FILE *out, char *args);
 void ui_cmd_oprq(FILE *out, char *args);
+void ui_cmd_intlat(FILE *out, char *args);
 void ui_cmd_memw(FILE *out, char *args);
+void ui_cmd_find(FILE *out, char *args);
 void ui_cmd_cycle(FILE *out, char *args);
 void ui_cmd_start(FILE *out, char *args);
 void ui_cmd_stop(FILE *out, char *args);
@@ -51,6 +56,8 @@ void ui_cmd_help(FILE *out, char *args);
 void ui_cmd_brk(FILE *out, char *args);
 void ui_cmd_brkdel(FILE *out, char *args);
 void ui_cmd_stopn(FILE *out, char *args);
+void ui_cmd_machine(FILE *out, char *args);
+void ui_cmd_cpu(FILE *out, char *args);
 
 struct ui_cmd_command commands[] = {
 	{ UI_CMD_FLAG_NONE, "state",	"",							"Get CPU state",					ui_cmd_state },
@@ -66,7 +73,9 @@ struct ui_cmd_command commands[] = {
 	{ UI_CMD_FLAG_NONE, "stopn",	"<addr>|off",				"Stop CPU on address",				ui_cmd_stopn },
 	{ UI_CMD_FLAG_NONE, "clock",	"[on|off]",					"Manipulate clock state",			ui_cmd_clock },
 	{ UI_CMD_FLAG_NONE, "oprq",		"",							"Send operator request",			ui_cmd_oprq },
+	{ UI_CMD_FLAG_NONE, "intlat",	"<int> [ns|ins]|reset",		"Get interrupt latency histogram",	ui_cmd_intlat },
 	{ UI_CMD_FLAG_NONE, "memw",		"<seg> <addr> <val> ...",	"Set memory contents",				ui_cmd_memw },
+	{ UI_CMD_FLAG_NONE, "find",		"<seg>|all <val>[&m] ...",	"Search memory for a word pattern",	ui_cmd_find },
 	{ UI_CMD_FLAG_NONE, "cycle",	"",							"Execute one CPU cycle",			ui_cmd_cycle },
 	{ UI_CMD_FLAG_NONE, "start",	"",							"Start CPU",						ui_cmd_start },
 	{ UI_CMD_FLAG_NONE, "stop",		"",							"Stop CPU",							ui_cmd_stop },
@@ -76,6 +85,8 @@ struct ui_cmd_command commands[] = {
 	{ UI_CMD_FLAG_NONE, "log",		"[on|off]",					"Manipulate logging state",			ui_cmd_log },
 	{ UI_CMD_FLAG_NONE, "logc",		"[component [state]]",		"Manipulate log compoment state",	ui_cmd_logc },
 	{ UI_CMD_FLAG_NONE, "info",		"",							"Get emulator info",				ui_cmd_info },
+	{ UI_CMD_FLAG_NONE, "machine",	"[num]",					"Get or select controlled machine",	ui_cmd_machine },
+	{ UI_CMD_FLAG_NONE, "cpu",		"[num]",					"Get or select controlled CPU",		ui_cmd_cpu },
 	{ UI_CMD_FLAG_QUIT, "quit",		"",							"Quit emulation",					ui_cmd_quit },
 	{ UI_CMD_FLAG_NONE, "help",		"",							"Get help",							ui_cmd_help },
 	{ UI_CMD_FLAG_NONE, NULL, NULL, NULL, NULL },
@@ -216,6 +227,48 @@ void ui_cmd_info(FILE *out, char *args)
 	fprintf(out, "\n");
 }
 
+// -----------------------------------------------------------------------
+void ui_cmd_machine(FILE *out, char *args)
+{
+	char *tok_num, *remainder;
+
+	int num = ui_cmd_gettok_int(args, &tok_num, &remainder);
+
+	// show selected machine
+	if (!tok_num) {
+		ui_cmd_resp(out, RESP_OK, UI_EOL, "%i/%i", ectl_machine_get(), ectl_machine_count());
+		return;
+	}
+
+	if (ectl_machine_select(num)) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Wrong machine number: %s", tok_num);
+		return;
+	}
+
+	ui_cmd_resp(out, RESP_OK, UI_EOL, "%i", num);
+}
+
+// -----------------------------------------------------------------------
+void ui_cmd_cpu(FILE *out, char *args)
+{
+	char *tok_num, *remainder;
+
+	int num = ui_cmd_gettok_int(args, &tok_num, &remainder);
+
+	// show selected CPU of the selected machine
+	if (!tok_num) {
+		ui_cmd_resp(out, RESP_OK, UI_EOL, "%i/%i", ectl_cpu_get(), ectl_cpu_count());
+		return;
+	}
+
+	if (ectl_cpu_select(num)) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Wrong CPU number: %s", tok_num);
+		return;
+	}
+
+	ui_cmd_resp(out, RESP_OK, UI_EOL, "%i", num);
+}
+
 // -----------------------------------------------------------------------
 void ui_cmd_clock(FILE *out, char *args)
 {
@@ -385,6 +438,73 @@ void ui_cmd_memw(FILE *out, char *args)
 	ui_cmd_resp(out, RESP_OK, UI_EOL, "%i words written", processed);
 }
 
+// -----------------------------------------------------------------------
+void ui_cmd_find(FILE *out, char *args)
+{
+	char *tok_seg, *tok_val, *remainder;
+	int seg;
+
+	ui_cmd_gettok_str(args, &tok_seg, &remainder);
+	if (!tok_seg) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Missing argument (memory segment)");
+		return;
+	}
+	if (!strcasecmp(tok_seg, "all")) {
+		seg = -1;
+	} else {
+		char *strerr;
+		seg = strtol(tok_seg, &strerr, 0);
+		if ((*strerr != '\0') || (seg < 0) || (seg > 15)) {
+			ui_cmd_resp(out, RESP_ERR, UI_EOL, "Wrong segment number: %s", tok_seg);
+			return;
+		}
+	}
+
+	uint16_t pattern[UI_CMD_FIND_MAX_WORDS];
+	uint16_t mask[UI_CMD_FIND_MAX_WORDS];
+	unsigned len = 0;
+
+	while (1) {
+		ui_cmd_gettok_str(remainder, &tok_val, &remainder);
+		if (!tok_val) break;
+		if (len >= UI_CMD_FIND_MAX_WORDS) {
+			ui_cmd_resp(out, RESP_ERR, UI_EOL, "Pattern too long (max %i words)", UI_CMD_FIND_MAX_WORDS);
+			return;
+		}
+		char *strerr;
+		long val = strtol(tok_val, &strerr, 0);
+		long m = 0xffff;
+		if (*strerr == '&') {
+			m = strtol(strerr+1, &strerr, 0);
+		}
+		if ((*strerr != '\0') || (val < 0) || (val > 0xffff) || (m < 0) || (m > 0xffff)) {
+			ui_cmd_resp(out, RESP_ERR, UI_EOL, "Word on position %i is not a valid 16-bit value[&mask]: %s", len, tok_val);
+			return;
+		}
+		pattern[len] = val;
+		mask[len] = m;
+		len++;
+	}
+
+	if (len < 1) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Missing argument (value)");
+		return;
+	}
+
+	uint32_t found[UI_CMD_FIND_MAX_RESULTS];
+	int count = ectl_mem_find(seg, pattern, mask, len, found, UI_CMD_FIND_MAX_RESULTS);
+	if (count < 0) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Memory search failed");
+		return;
+	}
+
+	ui_cmd_resp(out, RESP_OK, UI_NOEOL, " %i", count);
+	for (int i=0 ; (i<count) && (i<UI_CMD_FIND_MAX_RESULTS) ; i++) {
+		fprintf(out, " %i:0x%04x", found[i] >> 16, found[i] & 0xffff);
+	}
+	fprintf(out, "\n");
+}
+
 // -----------------------------------------------------------------------
 void ui_cmd_load(FILE *out, char *args)
 {
@@ -527,6 +647,63 @@ void ui_cmd_int(FILE *out, char *args)
 	}
 }
 
+// -----------------------------------------------------------------------
+void ui_cmd_intlat(FILE *out, char *args)
+{
+	char *tok_int, *tok_unit, *remainder;
+
+	ui_cmd_gettok_str(args, &tok_int, &remainder);
+	if (!tok_int) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Missing argument (interrupt)");
+		return;
+	}
+
+	if (!strcasecmp(tok_int, "reset")) {
+		ectl_int_latency_reset();
+		ui_cmd_resp(out, RESP_OK, UI_EOL, "Interrupt latency histograms cleared");
+		return;
+	}
+
+	char *strerr;
+	int interrupt = strtol(tok_int, &strerr, 0);
+	if ((*strerr != '\0') || (interrupt < 0) || (interrupt > 31)) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Wrong interrupt number: %s", tok_int);
+		return;
+	}
+
+	unsigned unit = ECTL_INT_LAT_NS;
+	ui_cmd_gettok_str(remainder, &tok_unit, &remainder);
+	if (tok_unit) {
+		if (!strcasecmp(tok_unit, "ins")) {
+			unit = ECTL_INT_LAT_INSTRUCTIONS;
+		} else if (strcasecmp(tok_unit, "ns")) {
+			ui_cmd_resp(out, RESP_ERR, UI_EOL, "Unknown latency unit: %s", tok_unit);
+			return;
+		}
+	}
+
+	unsigned long hist[ECTL_INT_LAT_BUCKETS];
+	unsigned long sum;
+	if (ectl_int_latency_get(interrupt, unit, hist, &sum)) {
+		ui_cmd_resp(out, RESP_ERR, UI_EOL, "Cannot get latency for interrupt %i", interrupt);
+		return;
+	}
+
+	unsigned long count = 0;
+	for (int i=0 ; i<ECTL_INT_LAT_BUCKETS ; i++) {
+		count += hist[i];
+	}
+
+	// bucket lower bounds with sample counts, empty buckets skipped
+	ui_cmd_resp(out, RESP_OK, UI_NOEOL, " count=%lu avg=%lu", count, count ? sum / count : 0);
+	for (int i=0 ; i<ECTL_INT_LAT_BUCKETS ; i++) {
+		if (hist[i]) {
+			fprintf(out, " %lu:%lu", i ? 1UL << (i-1) : 0, hist[i]);
+		}
+	}
+	fprintf(out, "\n");
+}
+
 // -----------------------------------------------------------------------
 void ui_cmd_oprq(FILE *out, char *args)
 {
@@ -56,7 +56,7 @@ struct cmd_t dbg_commands[] = {
 	{ "log",	F_LOG,		"Manipulate logging", "  log\n  log on|off\n  log <component> on|off" },
 	{ "watch",	F_WATCH,	"Manipulate expression watches", "  watch add <expression>\n  watch del <watch_number>\n  watch" },
 	{ "decode",	F_DECODE,	"Decode memory structures", "  decode\n  decode <decoder> <address>" },
-	{ "find",	F_FIND,		"Search memory for a value", "  find <block> <value>" },
+	{ "find",	F_FIND,		"Search memory for a value or a word pattern", "  find <block> <value>\n  find <block>|*: <word>[&<mask>] ..." },
 	{ NULL,		0,			NULL, NULL }
 };
 
@@ -685,29 +685,34 @@ void dbg_c_decode(int wid, char *name, uint16_t addr, int arg)
 }
 
 // -----------------------------------------------------------------------
-void dbg_c_find(int wid, uint16_t block, uint16_t value)
+void dbg_c_find(int wid, int block, const uint16_t *pattern, const uint16_t *mask, unsigned len)
 {
-	int found = 0;
-	uint16_t data[4096];
+	uint32_t found[DBG_FIND_MAX_RESULTS];
 
-	for (int seg=0 ; seg<16 ; seg++) {
-		const int words = 4096;
-		ectl_mem_read_n(block, seg*words, data, words);
-		for (int word=0 ; word<words ; word++) {
-			if (data[word] == value) {
-				found++;
-				awtbprint(wid, C_DATA, "0x%04x ", (seg<<12)+word);
-				if (found >= 8) {
-					awtbprint(wid, C_DATA, "\n");
-					found = 0;
-				}
-			}
+	int count = ectl_mem_find(block, pattern, mask, len, found, DBG_FIND_MAX_RESULTS);
+	if (count < 0) {
+		awtbprint(wid, C_ERROR, "Wrong search parameters\n");
+		return;
+	}
+
+	int shown = count < DBG_FIND_MAX_RESULTS ? count : DBG_FIND_MAX_RESULTS;
+	for (int i=0 ; i<shown ; i++) {
+		if (block < 0) {
+			awtbprint(wid, C_DATA, "%2i:0x%04x ", found[i] >> 16, found[i] & 0xffff);
+		} else {
+			awtbprint(wid, C_DATA, "0x%04x ", found[i] & 0xffff);
+		}
+		if ((i % 8) == 7) {
+			awtbprint(wid, C_DATA, "\n");
 		}
 	}
 
-	if (found != 0) {
+	if ((shown % 8) != 0) {
 		awtbprint(wid, C_DATA, "\n");
 	}
+	if (count > shown) {
+		awtbprint(wid, C_LABEL, "(%i more matches not shown)\n", count - shown);
+	}
 }
 
 // -----------------------------------------------------------------------
@@ -22,6 +22,8 @@
 #include "ui/curses/eval.h"
 
 #define MEMDUMP_COLS 16
+#define DBG_FIND_MAX_WORDS 32
+#define DBG_FIND_MAX_RESULTS 256
 
 struct cmd_t {
 	const char *cmd;
@@ -62,7 +64,7 @@ void dbg_c_watch_list(int wid, int count);
 void dbg_c_watch_del(int wid, int nr);
 void dbg_c_list_decoders(int wid);
 void dbg_c_decode(int wid, char *name, uint16_t addr, int arg);
-void dbg_c_find(int wid, uint16_t block, uint16_t value);
+void dbg_c_find(int wid, int block, const uint16_t *pattern, const uint16_t *mask, unsigned len);
 void dbg_c_memdump(int wid, int block, char *name);
 
 #endif
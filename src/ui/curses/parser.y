@@ -17,6 +17,7 @@
 //  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "ectl.h"
 
@@ -29,6 +30,11 @@ void reset_scanner();
 void yyerror(char *s, ...);
 int yylex(void);
 char verr[128];
+
+static uint16_t find_pattern[DBG_FIND_MAX_WORDS];
+static uint16_t find_mask[DBG_FIND_MAX_WORDS];
+static unsigned find_len;
+static bool find_push(uint16_t value, uint16_t mask);
 %}
 
 %code requires {#include <inttypes.h>}
@@ -203,12 +209,28 @@ command:
 	| F_WATCH DEL VALUE	{ dbg_c_watch_del(W_CMD, $3); }
 	| F_DECODE			{ dbg_c_list_decoders(W_CMD); }
 	| F_DECODE NAME expr{ dbg_c_decode(W_CMD, $2, n_eval($3), 0); }
-	| F_FIND VALUE expr	{ dbg_c_find(W_CMD, $2, n_eval($3)); }
+	| ffind VALUE expr	{ find_pattern[0] = n_eval($3); dbg_c_find(W_CMD, $2, find_pattern, NULL, 1); }
+	| ffind VALUE ':' fpattern	{ dbg_c_find(W_CMD, $2, find_pattern, find_mask, find_len); }
+	| ffind '*' ':' fpattern	{ dbg_c_find(W_CMD, -1, find_pattern, find_mask, find_len); }
 	| F_CLOCK ON 		{ ectl_clock_set(1); }
 	| F_CLOCK OFF		{ ectl_clock_set(0); }
 	| F_MEMDUMP VALUE NAME { dbg_c_memdump(W_CMD, $2, $3); }
 	;
 
+ffind:
+	F_FIND				{ find_len = 0; }
+	;
+
+fpattern:
+	fword
+	| fpattern fword
+	;
+
+fword:
+	VALUE				{ if (!find_push($1, 0xffff)) YYABORT; }
+	| VALUE '&' VALUE	{ if (!find_push($1, $3)) YYABORT; }
+	;
+
 %%
 
 // -----------------------------------------------------------------------
@@ -224,4 +246,17 @@ void yyerror(char *format, ...)
 	reset_scanner();
 }
 
+// -----------------------------------------------------------------------
+static bool find_push(uint16_t value, uint16_t mask)
+{
+	if (find_len >= DBG_FIND_MAX_WORDS) {
+		yyerror("search pattern too long (max %i words)", DBG_FIND_MAX_WORDS);
+		return false;
+	}
+	find_pattern[find_len] = value;
+	find_mask[find_len] = mask;
+	find_len++;
+	return true;
+}
+
 // vim: tabstop=4 shiftwidth=4 autoindent
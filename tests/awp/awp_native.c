@@ -0,0 +1,202 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+// Differential test: native AWP operations vs. emawp.
+// Arguments are generated from a fixed seed, so every run checks the same
+// operations. Each case that native code doesn't leave for emawp
+// needs to give bit-exact registers and the same result code.
+//
+// usage: awp-native [operations per AWP op] [seed]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <emawp.h>
+
+#include "cpu/awp_native.h"
+#include "cpu/alu.h"
+
+#define DEFAULT_COUNT 4000000
+#define DEFAULT_SEED 0x4d455241
+
+static const char *op_names[] = {
+	"NRF0", "NRF1", "NRF2", "NRF3",
+	"AD", "SD", "MW", "DW",
+	"AF", "SF", "MF", "DF",
+};
+
+static uint32_t seed;
+
+// -----------------------------------------------------------------------
+static uint32_t rnd()
+{
+	// xorshift32
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+// -----------------------------------------------------------------------
+static uint16_t rnd_word()
+{
+	static const uint16_t corners[] = {
+		0x0000, 0x0001, 0x7fff, 0x8000, 0x8001, 0xffff, 0x4000, 0xc000,
+	};
+
+	// corner values often enough to hit overflows and zero results
+	if ((rnd() & 7) == 0) {
+		return corners[rnd() % (sizeof(corners) / sizeof(*corners))];
+	}
+	return rnd();
+}
+
+// -----------------------------------------------------------------------
+static void rnd_float(uint16_t *d)
+{
+	uint64_t m = ((uint64_t) rnd() << 32) | rnd();
+	int r = rnd() & 15;
+
+	if (r == 0) {
+		// anything, including zero and denormalized
+		m = ((uint64_t) rnd_word() << 32) | ((uint64_t) rnd_word() << 16) | rnd_word();
+	} else {
+		// normalized mantissa
+		m &= 0x7fffffffffULL;
+		m |= 0x4000000000ULL;
+		if (rnd() & 1) {
+			m = ~m;
+		}
+		// trailing zeros, so additions and subtractions don't lose bits when aligning
+		if (r < 8) {
+			m &= ~0ULL << (rnd() % 40);
+		}
+	}
+
+	// exponents close to each other, or anywhere
+	int e = (rnd() & 1) ? (int) (rnd() % 16) - 8 : (int8_t) rnd();
+	if ((rnd() & 31) == 0) {
+		e = (rnd() & 1) ? 127 : -128;
+	}
+
+	d[0] = m >> 24;
+	d[1] = m >> 8;
+	d[2] = (m << 8) | (e & 0xff);
+}
+
+// -----------------------------------------------------------------------
+static int emawp_op(int op, uint16_t *regs, uint16_t *n)
+{
+	switch (op) {
+		case AWP_AD:
+			return awp_dword_add(regs, n);
+		case AWP_SD:
+			return awp_dword_sub(regs, n);
+		case AWP_MW:
+			return awp_dword_mul(regs, n[0]);
+		case AWP_DW:
+			return awp_dword_div(regs, n[0]);
+		case AWP_AF:
+			return awp_float_add(regs, n);
+		case AWP_SF:
+			return awp_float_sub(regs, n);
+		case AWP_MF:
+			return awp_float_mul(regs, n);
+		case AWP_DF:
+			return awp_float_div(regs, n);
+	}
+	return AWP_OK;
+}
+
+// -----------------------------------------------------------------------
+static unsigned check(int op, unsigned count, unsigned *native)
+{
+	unsigned mismatches = 0;
+	bool fp = op >= AWP_AF;
+
+	*native = 0;
+
+	for (unsigned i=0 ; i<count ; i++) {
+		uint16_t regs_n[4];
+		uint16_t regs_e[4];
+		uint16_t n[3];
+
+		regs_n[0] = regs_e[0] = rnd_word();
+		if (fp) {
+			rnd_float(regs_n+1);
+			rnd_float(n);
+			// exponents of both arguments close to each other as well
+			if (rnd() & 1) {
+				n[2] = (n[2] & 0xff00) | ((regs_n[3] + (rnd() % 91) - 45) & 0xff);
+			}
+		} else {
+			for (int j=1 ; j<4 ; j++) regs_n[j] = rnd_word();
+			for (int j=0 ; j<3 ; j++) n[j] = rnd_word();
+		}
+		for (int j=1 ; j<4 ; j++) regs_e[j] = regs_n[j];
+
+		int res_n = awp_native(op, regs_n, n);
+		if (res_n == AWP_FALLBACK) continue;
+		(*native)++;
+
+		int res_e = emawp_op(op, regs_e, n);
+		bool regs_match = true;
+		for (int j=0 ; j<4 ; j++) {
+			if (regs_n[j] != regs_e[j]) regs_match = false;
+		}
+		if ((res_n != res_e) || !regs_match) {
+			if (mismatches < 10) {
+				printf("%s mismatch: n = 0x%04x 0x%04x 0x%04x, native: 0x%04x 0x%04x 0x%04x 0x%04x (res %i), emawp: 0x%04x 0x%04x 0x%04x 0x%04x (res %i)\n",
+					op_names[op], n[0], n[1], n[2],
+					regs_n[0], regs_n[1], regs_n[2], regs_n[3], res_n,
+					regs_e[0], regs_e[1], regs_e[2], regs_e[3], res_e
+				);
+			}
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	unsigned count = DEFAULT_COUNT;
+	seed = DEFAULT_SEED;
+
+	if (argc > 1) count = strtoul(argv[1], NULL, 0);
+	if (argc > 2) seed = strtoul(argv[2], NULL, 0);
+	if (!seed) {
+		printf("Seed can't be 0\n");
+		return 1;
+	}
+
+	unsigned failed = 0;
+	for (int op=AWP_AD ; op<=AWP_DF ; op++) {
+		unsigned native;
+		unsigned mismatches = check(op, count, &native);
+		printf("%-2s: %u operations, %u (%.1f%%) done natively, %u mismatches\n",
+			op_names[op], count, native, count ? 100.0 * native / count : 0.0, mismatches);
+		failed += mismatches;
+	}
+
+	return failed ? 1 : 0;
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -0,0 +1,75 @@
+; OPTS -c configs/m9425.ini
+; PRECMD CLOCK ON
+
+; MERA 9425 on the memory channel: read one track (12 sectors, 3072 words)
+; per transmission, over and over.
+; Instructions executed per transmission are the same as in mx-winch-read.asm,
+; so IPS of both compares the transfer rates.
+
+	.cpu	mx16
+
+	.include cpu.inc
+	.include io.inc
+
+	.const	DISK_CHAN 2
+	.const	DISK_DEV 0
+	.const	DISK DISK_CHAN\IO_CHAN | DISK_DEV\IO_DEV
+
+	.const	CMD_NTR 0b110100\5
+	.const	INT_DONE 035\7 | DISK_DEV\10
+
+	.const	LEN 12*256
+
+	uj	start
+
+msk_0:	.word	IMASK_NONE
+msk_io:	.word	IMASK_CH2_3 | IMASK_GROUP_H
+xlip:	lip
+
+	.org	INTV
+	.res	16, xlip	; dummy interrupt handlers
+	.word	xlip		; dummy EXL handler
+
+	.org	OS_START
+
+; control field: read data, block 0, track 0/0 of the fixed disk
+cf:	.word	7\7 | 0, 0\6, LEN, 0, 0, 0, rdbuf
+
+last_int:
+	.word	0
+tmp_r7:	.res	1
+disk_proc:
+	rw	r7, tmp_r7
+	md	[STACKP]
+	lw	r7, [-1]
+	rw	r7, last_int
+	lw	r7, [tmp_r7]
+	lip
+
+start:
+	lw	r1, stack
+	rw	r1, STACKP
+	lw	r1, disk_proc
+	rw	r1, INTV_CH2
+	im	msk_io
+	lw	r2, cf
+
+loop:
+	rz	last_int
+	ou	r2, DISK | CMD_NTR
+	.word	c_no, c_en, c_ok, c_pe
+c_no:	hlt	041
+c_en:	hlt	042
+c_pe:	hlt	043
+c_ok:	lw	r1, [last_int]
+	cwt	r1, 0
+	jn	c_done
+	hlt
+	ujs	c_ok
+c_done:	cw	r1, INT_DONE
+	jes	loop
+	im	msk_0
+	hlt	044
+
+stack:	.res	8
+rdbuf:
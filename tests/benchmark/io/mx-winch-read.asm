@@ -0,0 +1,113 @@
+; OPTS -c configs/winchester0.ini
+; PRECMD CLOCK ON
+
+; Winchester disk on MULTIX: read 12 sectors (3072 words) per transmission,
+; over and over.
+; Instructions executed per transmission are the same as in m9425-read.asm,
+; so IPS of both compares the transfer rates.
+
+	.cpu	mx16
+
+	.include cpu.inc
+	.include io.inc
+	.include multix.inc
+
+	.const	WINCH_LINE 2
+	.const	WINCH_ADDR 1\IO_CHAN | WINCH_LINE\10
+
+	.const	LEN 12*256
+
+	uj	start
+
+msk_0:	.word	IMASK_NONE
+msk_io:	.word	IMASK_CH0_1 | IMASK_GROUP_H
+xlip:	lip
+
+	.org	INTV
+	.res	16, xlip	; dummy interrupt handlers
+	.word	xlip		; dummy EXL handler
+
+	.org	OS_START
+
+conf:	.word	1\7 | 3\15, 0
+	.word	MX_LDIR_NONE | MX_LINE_USED | MX_LTYPE_WINCH | 3
+	.word	MX_LPROTO_WINCH | 2, 3\7 | MX_SHORT_DISK_ADDR | MX_NO_FORMAT_PROTECT, 0, 0
+	.word	MX_LPROTO_WINCH | 1, 3\7 | MX_SHORT_DISK_ADDR | MX_NO_FORMAT_PROTECT, 0, 0
+	.word	MX_LPROTO_WINCH | 0, 3\7 | MX_SHORT_DISK_ADDR | MX_NO_FORMAT_PROTECT, 0, 0
+
+; transmission field: read, block 0, starting at logical sector 0
+cf:	.word	2\7 | 0, rdbuf, LEN-1, 0, 0, -1, -1
+
+last_int:
+	.word	0
+tmp_r7:	.res	1
+mx_proc:
+	rw	r7, tmp_r7
+	md	[STACKP]
+	lw	r7, [-1]
+	rw	r7, last_int
+	lw	r7, [tmp_r7]
+	lip
+
+; issue a command in r1 with argument in r2, wait for the interrupt, check it against r3
+mx_cmd:	.res	1
+	rz	last_int
+	ou	r2, r1
+	.word	m_no, m_en, m_ok, m_pe
+m_no:	hlt	041
+m_en:	ujs	mx_cmd+1
+m_pe:	hlt	043
+m_ok:	lw	r1, [last_int]
+	cwt	r1, 0
+	jn	m_done
+	hlt
+	ujs	m_ok
+m_done:	cw	r1, r3
+	jes	m_ret
+	im	msk_0
+	hlt	044
+m_ret:	uj	[mx_cmd]
+
+start:
+	lw	r1, stack
+	rw	r1, STACKP
+	lw	r1, mx_proc
+	rw	r1, INTV_CH1
+	im	msk_io
+
+mxinit:	; wait for MULTIX initialization to end
+	lw	r1, [last_int]
+	cw	r1, MX_IWYZE
+	jes	setup
+	hlt
+	ujs	mxinit
+
+setup:
+	lw	r1, MX_CMD_SETCFG | 1\IO_CHAN
+	lw	r2, conf
+	lw	r3, MX_IUKON
+	lj	mx_cmd
+	lw	r1, MX_CMD_ATTACH | WINCH_ADDR
+	lw	r3, MX_IDOLI + WINCH_LINE
+	lj	mx_cmd
+	lw	r2, cf
+
+loop:
+	rz	last_int
+	ou	r2, WINCH_ADDR | MX_CMD_TRANSMIT
+	.word	c_no, c_en, c_ok, c_pe
+c_no:	hlt	041
+c_en:	hlt	042
+c_pe:	hlt	043
+c_ok:	lw	r1, [last_int]
+	cwt	r1, 0
+	jn	c_done
+	hlt
+	ujs	c_ok
+c_done:	cw	r1, MX_IETRA + WINCH_LINE
+	jes	loop
+	im	msk_0
+	hlt	044
+
+stack:	.res	8
+rdbuf:
@@ -0,0 +1,80 @@
+; OPTS -c configs/2cpu.ini
+; PRECMD cpu 1
+; PRECMD stop
+; PRECMD reg ic 0
+; PRECMD start
+; PRECMD cpu 0
+; POSTCMD cpu 1
+; POSTCMD stop
+; POSTCMD cpu 0
+
+; Same loop as add.asm, run by both CPUs at the same time.
+; IPS is measured for CPU 0 and should match add.asm
+; when the host has a core for each emulated CPU.
+
+	lwt	r1, 1
+loop:
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	awt	r2, 1
+	irb	r1, loop
+	ujs	loop
+	hlt	077
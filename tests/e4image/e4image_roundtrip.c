@@ -0,0 +1,340 @@
+//  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+// Round trip test for e4image operations used by emitool.
+// Images are created in a temporary directory, which is removed afterwards.
+//
+// usage: e4image-roundtrip
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "io/dev/e4image.h"
+
+#define BLOCKS 200 // 2 groups when compressed, the last one shorter
+#define BLOCK_SIZE 512
+#define CHANGED_BLOCKS 12 // see changed_block()
+
+static char dir[] = "e4image-roundtrip-XXXXXX";
+static char path[PATH_MAX];
+static unsigned failed;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAILED (line %i): ", __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failed++; \
+		} \
+	} while (0)
+
+// -----------------------------------------------------------------------
+static char * img(const char *name)
+{
+	snprintf(path, PATH_MAX, "%s/%s", dir, name);
+	return path;
+}
+
+// -----------------------------------------------------------------------
+static void pattern(uint8_t *buf, int block, bool changed)
+{
+	for (int i=0 ; i<BLOCK_SIZE ; i++) {
+		buf[i] = (block * 7 + i) & 0xff;
+		if (changed) buf[i] = ~buf[i];
+	}
+}
+
+// -----------------------------------------------------------------------
+static bool changed_block(int block)
+{
+	// a few separate blocks, and a run crossing a bitmap byte
+	return (block == 0) || (block == 5) || ((block >= 13) && (block <= 21)) || (block == BLOCKS-1);
+}
+
+// -----------------------------------------------------------------------
+static unsigned check_contents(struct e4i_t *e, bool with_changes)
+{
+	uint8_t buf[BLOCK_SIZE];
+	uint8_t exp[BLOCK_SIZE];
+	unsigned mismatches = 0;
+
+	for (int b=0 ; b<BLOCKS ; b++) {
+		pattern(exp, b, with_changes && changed_block(b));
+		if ((e4i_bread(e, buf, b) != E4I_E_OK) || memcmp(buf, exp, BLOCK_SIZE)) {
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+// -----------------------------------------------------------------------
+static unsigned write_changes(struct e4i_t *e)
+{
+	uint8_t buf[BLOCK_SIZE];
+	unsigned errors = 0;
+
+	for (int b=0 ; b<BLOCKS ; b++) {
+		if (!changed_block(b)) continue;
+		pattern(buf, b, true);
+		if (e4i_bwrite(e, buf, b, BLOCK_SIZE) != E4I_E_OK) {
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+// -----------------------------------------------------------------------
+static bool create_base(char *name)
+{
+	uint8_t buf[BLOCK_SIZE];
+
+	struct e4i_t *e = e4i_create_lba(name, 0, BLOCK_SIZE, BLOCKS, 0);
+	if (!e) {
+		return false;
+	}
+	bool ok = (e4i_init(e, NULL, E4I_T_HDD, 0) == E4I_E_OK);
+	for (int b=0 ; ok && (b<BLOCKS) ; b++) {
+		pattern(buf, b, false);
+		ok = (e4i_bwrite(e, buf, b, BLOCK_SIZE) == E4I_E_OK);
+	}
+	e4i_close(e);
+
+	return ok;
+}
+
+// -----------------------------------------------------------------------
+static void test_overlay()
+{
+	char base[PATH_MAX];
+	char overlay[PATH_MAX];
+	strcpy(base, img("base.e4i"));
+	strcpy(overlay, img("overlay.e4i"));
+
+	printf("Overlay: create, write, discard, write, reopen, merge\n");
+
+	CHECK(create_base(base), "create base image: %s", e4i_get_err(e4i_err));
+
+	struct e4i_t *o = e4i_create_overlay(overlay, base);
+	CHECK(o, "create overlay: %s", e4i_get_err(e4i_err));
+	if (!o) return;
+
+	// writes go to the overlay, base stays intact
+	CHECK(write_changes(o) == 0, "write to overlay");
+	CHECK(check_contents(o, true) == 0, "overlay contents after write");
+	CHECK(e4i_overlay_blocks(o) == CHANGED_BLOCKS, "blocks in overlay: %u", e4i_overlay_blocks(o));
+	struct e4i_t *b = e4i_open(base);
+	CHECK(b && (check_contents(b, false) == 0), "base contents after overlay write");
+	if (b) e4i_close(b);
+
+	// discard brings base contents back
+	CHECK(e4i_overlay_discard(o) == E4I_E_OK, "discard");
+	CHECK(e4i_overlay_blocks(o) == 0, "blocks in overlay after discard: %u", e4i_overlay_blocks(o));
+	CHECK(check_contents(o, false) == 0, "overlay contents after discard");
+
+	// changes survive reopening the overlay, merge moves them to the base
+	CHECK(write_changes(o) == 0, "write to overlay");
+	e4i_close(o);
+	o = e4i_open(overlay);
+	CHECK(o, "reopen overlay: %s", e4i_get_err(e4i_err));
+	if (!o) return;
+	CHECK(check_contents(o, true) == 0, "overlay contents after reopen");
+	CHECK(e4i_overlay_merge(o) == E4I_E_OK, "merge");
+	CHECK(e4i_overlay_blocks(o) == 0, "blocks in overlay after merge: %u", e4i_overlay_blocks(o));
+	CHECK(check_contents(o, true) == 0, "overlay contents after merge");
+	e4i_close(o);
+
+	b = e4i_open(base);
+	CHECK(b && (check_contents(b, true) == 0), "base contents after merge");
+	if (b) e4i_close(b);
+
+	remove(overlay);
+	remove(base);
+}
+
+// -----------------------------------------------------------------------
+static long file_read(const char *name, uint8_t **data)
+{
+	FILE *f = fopen(name, "rb");
+	if (!f) {
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*data = (uint8_t *) malloc(len);
+	if (!*data || (fread(*data, 1, len, f) != (size_t) len)) {
+		free(*data);
+		len = -1;
+	}
+	fclose(f);
+
+	return len;
+}
+
+// -----------------------------------------------------------------------
+static bool file_write(const char *name, uint8_t *data, long len)
+{
+	FILE *f = fopen(name, "wb");
+	if (!f) {
+		return false;
+	}
+	bool ok = (fwrite(data, 1, len, f) == (size_t) len);
+	fclose(f);
+
+	return ok;
+}
+
+// -----------------------------------------------------------------------
+static bool files_equal(const char *name1, const char *name2)
+{
+	uint8_t *d1, *d2;
+	long len1 = file_read(name1, &d1);
+	long len2 = file_read(name2, &d2);
+	bool equal = (len1 >= 0) && (len1 == len2) && !memcmp(d1, d2, len1);
+	if (len1 >= 0) free(d1);
+	if (len2 >= 0) free(d2);
+
+	return equal;
+}
+
+// -----------------------------------------------------------------------
+static void test_compress()
+{
+	char base[PATH_MAX];
+	char overlay[PATH_MAX];
+	char comp[PATH_MAX];
+	char decomp[PATH_MAX];
+	char damaged[PATH_MAX];
+	strcpy(base, img("base.e4i"));
+	strcpy(overlay, img("overlay.e4i"));
+	strcpy(comp, img("comp.e4i"));
+	strcpy(decomp, img("decomp.e4i"));
+	strcpy(damaged, img("damaged.e4i"));
+
+	printf("Compression: compress, read, decompress, damaged images\n");
+
+	CHECK(create_base(base), "create base image: %s", e4i_get_err(e4i_err));
+
+	// compress -> read -> decompress gives back the same file
+	struct e4i_t *b = e4i_open(base);
+	CHECK(b, "open base: %s", e4i_get_err(e4i_err));
+	if (!b) return;
+	CHECK(e4i_compress(b, comp) == E4I_E_OK, "compress");
+	e4i_close(b);
+
+	struct e4i_t *c = e4i_open(comp);
+	CHECK(c, "open compressed: %s", e4i_get_err(e4i_err));
+	if (!c) return;
+	CHECK(c->flags & E4I_F_COMPRESSED, "compressed flag not set");
+	CHECK(c->groups > 1, "image fits in %u group(s)", c->groups);
+	CHECK(check_contents(c, false) == 0, "compressed contents");
+	CHECK(write_changes(c) == CHANGED_BLOCKS, "compressed image accepts writes");
+	CHECK(e4i_decompress(c, decomp) == E4I_E_OK, "decompress");
+	uint64_t data_start = c->group_pos[0];
+	e4i_close(c);
+	CHECK(files_equal(base, decomp), "decompressed image differs from the original");
+	remove(decomp);
+
+	// overlays are flattened
+	struct e4i_t *o = e4i_create_overlay(overlay, base);
+	CHECK(o, "create overlay: %s", e4i_get_err(e4i_err));
+	if (!o) return;
+	CHECK(write_changes(o) == 0, "write to overlay");
+	CHECK(e4i_compress(o, decomp) == E4I_E_OK, "compress overlay");
+	e4i_close(o);
+	c = e4i_open(decomp);
+	CHECK(c && !(c->flags & E4I_F_OVERLAY) && (check_contents(c, true) == 0), "compressed overlay contents");
+	if (c) e4i_close(c);
+	remove(decomp);
+	remove(overlay);
+
+	// damaged images are rejected
+	uint8_t *data;
+	long len = file_read(comp, &data);
+	CHECK(len > 0, "read compressed image");
+	if (len <= 0) return;
+
+	CHECK(file_write(damaged, data, len - 1), "write truncated image");
+	c = e4i_open(damaged);
+	CHECK(!c && (e4i_err == E4I_E_HEADER_READ), "truncated image accepted");
+	if (c) e4i_close(c);
+
+	CHECK(file_write(damaged, data, data_start - 4), "write truncated image");
+	c = e4i_open(damaged);
+	CHECK(!c && (e4i_err == E4I_E_HEADER_READ), "image with truncated index accepted");
+	if (c) e4i_close(c);
+
+	// second group position before the first one
+	uint8_t save[8];
+	memcpy(save, data + E4I_COMPRESSED_INDEX_POS + 8, 8);
+	memset(data + E4I_COMPRESSED_INDEX_POS + 8, 0, 8);
+	CHECK(file_write(damaged, data, len), "write damaged image");
+	memcpy(data + E4I_COMPRESSED_INDEX_POS + 8, save, 8);
+	c = e4i_open(damaged);
+	CHECK(!c && (e4i_err == E4I_E_HEADER_READ), "image with damaged index accepted");
+	if (c) e4i_close(c);
+
+	// first sequence of the first group starts with a match, there is nothing to match with yet
+	uint8_t buf[BLOCK_SIZE];
+	data[data_start] = 0x00;
+	CHECK(file_write(damaged, data, len), "write damaged image");
+	c = e4i_open(damaged);
+	CHECK(c, "open damaged image: %s", e4i_get_err(e4i_err));
+	if (c) {
+		int res = e4i_bread(c, buf, 0);
+		CHECK(res == E4I_E_DECOMPRESS, "damaged group read: %s", e4i_get_err(res));
+		CHECK(e4i_decompress(c, decomp) == E4I_E_DECOMPRESS, "damaged image decompressed");
+		CHECK(access(decomp, F_OK) != 0, "partially decompressed image left behind");
+		e4i_close(c);
+	}
+
+	free(data);
+	remove(damaged);
+	remove(comp);
+	remove(base);
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	if (!mkdtemp(dir)) {
+		printf("Can't create temporary directory\n");
+		return 1;
+	}
+
+	test_overlay();
+	test_compress();
+
+	if (rmdir(dir)) {
+		printf("Temporary directory %s not empty\n", dir);
+		failed++;
+	}
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+
+	return failed ? 1 : 0;
+}
+
+// vim: tabstop=4 shiftwidth=4 autoindent
@@ -0,0 +1,18 @@
+; PRECMD memw 0 0x0300 0x1357 0x2468 1
+; PRECMD memw 0 0x0fff 0x1357 0x2468 0
+; PRECMD memw 0 0x1fff 0x5a3c
+
+; Memory search. With the minimal configuration only segments 0 and 1
+; of block 0 are mapped: pattern at 0x0fff crosses into the next
+; (mapped) segment, pattern at 0x1fff would cross into an unmapped one.
+
+	hlt	077
+
+; XPCTCMD find 0 0x1357 0x2468 : 2 0:0x0300 0:0x0fff
+; XPCTCMD find all 0x1357 0x2468 : 2 0:0x0300 0:0x0fff
+; XPCTCMD find 0 0x1300&0xff00 0x2468 : 2 0:0x0300 0:0x0fff
+; XPCTCMD find 0 0x1357 0x2468 0 : 1 0:0x0fff
+; XPCTCMD find 0 0x1357 0x2469 : 0
+; XPCTCMD find 0 0x5a3c : 1 0:0x1fff
+; XPCTCMD find 0 0x5a3c 0 : 0
+; XPCTCMD find 1 0 : 0
@@ -0,0 +1,26 @@
+; BATCH 0x3f
+
+; Batch mode run: exit status is the HLT code,
+; registers and memory come from the end-of-run dumps
+
+	.include cpu.inc
+
+	uj	start
+
+	.org	OS_START
+start:
+	lw	r1, 0x1234
+	lw	r2, 0x5678
+	lw	r3, r1
+	aw	r3, r2
+	rw	r3, 0x100
+	lw	r4, 0xbeef
+	rw	r4, 0x101
+	hlt	077
+
+; XPCT r1 : 0x1234
+; XPCT r2 : 0x5678
+; XPCT r3 : 0x68ac
+; XPCT [0x100] : 0x68ac
+; XPCT [0x101] : 0xbeef
+; XPCT ir : 0xec3f
@@ -0,0 +1,19 @@
+; OPTS -O cpu:stop_on_nomem=true
+; BATCH 128
+
+; Batch mode run: access to unconfigured memory stops the CPU,
+; which ends the run with status 128
+
+	.include cpu.inc
+
+	uj	start
+
+	.org	OS_START
+start:
+	lw	r1, 0x4321
+	rw	r1, 0x100
+	lw	r2, [0xf000]
+	hlt	077
+
+; XPCT r1 : 0x4321
+; XPCT [0x100] : 0x4321
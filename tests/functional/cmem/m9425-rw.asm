@@ -0,0 +1,174 @@
+; OPTS -c configs/m9425.ini
+
+; MERA 9425 on the memory channel: write data crossing a sector boundary,
+; read it back, read an address field, then send a bad control field
+
+	.include cpu.inc
+	.include io.inc
+
+	.const	CHAN 2
+	.const	DISK CHAN\IO_CHAN | 0\IO_DEV
+
+	; channel commands
+	.const	CH_STATUS 0b000100\5
+
+	; MERA 9425 commands
+	.const	CMD_SEEK 0b111000\5
+	.const	CMD_NTR 0b110100\5
+	.const	CMD_TSR 0b010000\5
+
+	; interrupt specifications (interrupt, unit 0)
+	.const	INT_SEEK 011\7
+	.const	INT_CF 016\7
+	.const	INT_DONE 035\7
+
+	; control field: operations
+	.const	OP_RD 0b00\6
+	.const	OP_RA 0b01\6
+	.const	OP_WD 0b10\6
+
+	; disk location used by the test, data spans two sectors
+	.const	CYL 5
+	.const	HEAD 1
+	.const	SECTOR 3
+	.const	LEN 300
+
+	.const	wrbuf	prog_end
+	.const	rdbuf	prog_end+LEN
+	.const	idbuf	prog_end+2*LEN
+	.const	stack	prog_end+2*LEN+5
+
+	uj	start
+
+mask:	.word	IMASK_CH2_3
+mask0:	.word	IMASK_NONE
+last_int:
+	.word	0
+tmp:	.res	1
+
+	.org	OS_START
+
+; ------------------------------------------------------------------------
+; memory channel interrupt handler, interrupt specification is on the stack
+mem_proc:
+	rw	r7, tmp
+	md	[STACKP]
+	lw	r7, [-1]
+	rw	r7, last_int
+	lw	r7, [tmp]
+	lip
+
+; ------------------------------------------------------------------------
+; control fields: length/cpu/nb, operation, words, flags/cyl, platter/head/sector, key, address
+cf_wr:	.word	7\7, OP_WD, LEN, CYL, HEAD\7 | SECTOR, 0, wrbuf
+cf_rd:	.word	7\7, OP_RD, LEN, CYL, HEAD\7 | SECTOR, 0, rdbuf
+cf_ra:	.word	7\7, OP_RA, 5, CYL, HEAD\7 | SECTOR, 0, idbuf
+cf_bad:	.word	7\7, OP_RD, LEN, CYL, HEAD\7 | 12, 0, rdbuf
+
+; ------------------------------------------------------------------------
+; send OU command, wait for the interrupt
+; expects:
+;  r1 - command
+;  r2 - argument
+;  r3 - expected interrupt specification
+;  r4 - RJ return address
+cmd:
+	rz	last_int
+	ou	r2, r1
+	.word	c_no, c_en, c_ok, c_pe
+c_no:	hlt	041
+c_en:	hlt	042
+c_pe:	hlt	043
+c_ok:	lw	r1, [last_int]
+	cwt	r1, 0
+	jn	c_ret
+	hlt
+	ujs	c_ok
+c_ret:	cw	r3, r1
+	jes	c_done
+	im	mask0
+	hlt	044
+c_done:	uj	r4
+
+; ------------------------------------------------------------------------
+start:
+	lw	r1, stack
+	rw	r1, STACKP
+	lw	r1, mem_proc
+	rw	r1, INTV_CH2
+	im	mask
+
+	; fill write buffer with a pattern
+	lw	r4, wrbuf
+	lw	r3, LEN
+	lw	r1, 0x1234
+fill:	rw	r1, r4
+	aw	r1, 0x0f1e
+	awt	r4, 1
+	drb	r3, fill
+
+	lw	r1, DISK | CMD_SEEK
+	lw	r2, CYL
+	lw	r3, INT_SEEK
+	rj	r4, cmd
+
+	lw	r1, DISK | CMD_NTR
+	lw	r2, cf_wr
+	lw	r3, INT_DONE
+	rj	r4, cmd
+
+	lw	r1, DISK | CMD_NTR
+	lw	r2, cf_rd
+	lw	r3, INT_DONE
+	rj	r4, cmd
+
+	; all words transmitted
+	in	r5, DISK | CH_STATUS
+	.word	err, err, st_ok, err
+st_ok:
+
+	; compare buffers
+	lw	r3, LEN
+	lw	r1, wrbuf-1
+	lw	r2, rdbuf-1
+cmp:	lw	r4, [r1+r3]
+	cw	r4, [r2+r3]
+	jes	cmp_next
+	im	mask0
+	hlt	050
+cmp_next:
+	drb	r3, cmp
+
+	lw	r1, DISK | CMD_NTR
+	lw	r2, cf_ra
+	lw	r3, INT_DONE
+	rj	r4, cmd
+
+	; sector status field of the last sector
+	in	r6, DISK | CMD_TSR
+	.word	err, err, tsr_ok, err
+tsr_ok:
+
+	lw	r1, DISK | CMD_NTR
+	lw	r2, cf_bad
+	lw	r3, INT_CF
+	rj	r4, cmd
+
+	im	mask0
+	lw	r1, [idbuf]
+	lw	r2, [idbuf+1]
+	lw	r3, [idbuf+2]
+	hlt	077
+
+err:	im	mask0
+	hlt	045
+
+prog_end:
+
+; XPCT r1 : 0x0005
+; XPCT r2 : 0x0103
+; XPCT r3 : 0
+; XPCT r5 : 0
+; XPCT r6 : 0
+; XPCT alarm : 0
+; XPCT ir : 0xec3f
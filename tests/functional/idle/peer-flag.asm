@@ -0,0 +1,72 @@
+; OPTS -c configs/2cpu.ini -O cpu:idle_detect=true -O cpu:idle_park_max=5000000
+; PRECMD cpu 1
+; PRECMD stop
+; PRECMD reg ic 0x200
+; PRECMD start
+; PRECMD cpu 0
+
+; Polling loops that only a memory write by the other CPU can end.
+; CPU 0 waits for a flag set by CPU 1, then CPU 1 waits for acknowledgement.
+; Parked loop has to be woken up by the write, not by the park timeout:
+; CPU 1 gives up waiting for acknowledgement long before it would expire.
+; Results have to be the same with detection disabled
+; (runtests.py -O cpu:idle_detect=false functional/idle).
+
+	.include cpu.inc
+
+	uj	start
+
+flag:	.word	0
+ack:	.word	0
+verdict:.word	0
+
+	.org	OS_START
+
+; ---- CPU 0 -------------------------------------------------------------
+start:
+wait_flag:
+	lw	r1, [flag]
+	cw	r1, 0
+	jes	wait_flag
+
+	rw	r1, ack
+
+wait_verdict:
+	lw	r2, [verdict]
+	cw	r2, 0
+	jes	wait_verdict
+
+	hlt	077
+
+; ---- CPU 1 -------------------------------------------------------------
+	.org	0x200
+
+	; give CPU 0 time to park its loop
+	lwt	r1, 0
+delay:	irb	r1, delay
+
+	lw	r1, 0x1234
+	rw	r1, flag
+
+	; wait for acknowledgement, but not forever
+	lwt	r1, 0
+	lw	r3, -64
+wait_ack:
+	lw	r2, [ack]
+	cw	r2, 0
+	jn	acked
+	irb	r1, wait_ack
+	irb	r3, wait_ack
+
+	lwt	r2, 2		; no acknowledgement, CPU 0 overslept
+	rw	r2, verdict
+	hlt	077
+acked:
+	lwt	r2, 1
+	rw	r2, verdict
+	hlt	077
+
+; XPCT r1 : 0x1234
+; XPCT r2 : 1
+; XPCT alarm : 0
+; XPCT ir : 0xec3f
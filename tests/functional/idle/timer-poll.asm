@@ -0,0 +1,42 @@
+; OPTS -O cpu:idle_detect=true
+; PRECMD CLOCK ON
+
+; Polling loop that only an interrupt can end. With idle loop detection
+; the loop gets parked, timer interrupt has to wake it up.
+; Results have to be the same with detection disabled
+; (runtests.py -O cpu:idle_detect=false functional/idle).
+
+	.include cpu.inc
+
+	.const	TICKS 5
+
+	uj	start
+
+stack:	.res	4
+mask:	.word	IMASK_GROUP_H
+mask0:	.word	IMASK_NONE
+ticks:	.word	0
+
+	.org	OS_START
+
+tim_proc:
+	ib	ticks
+	lip
+
+start:
+	lw	r1, stack
+	rw	r1, STACKP
+	lw	r1, tim_proc
+	rw	r1, INTV_TIMER
+	im	mask
+
+wait:	lw	r1, [ticks]
+	cw	r1, TICKS
+	jls	wait
+
+	im	mask0
+	hlt	077
+
+; XPCT r1 : 5
+; XPCT alarm : 0
+; XPCT ir : 0xec3f
@@ -0,0 +1,34 @@
+; OPTS -c configs/2cpu.ini
+; PRECMD cpu 1
+; PRECMD stop
+; PRECMD reg ic 0x200
+; PRECMD start
+; PRECMD cpu 0
+
+; In a 2-CPU configuration GIU executed on one CPU
+; should raise the 2-CPU high interrupt in the other one.
+
+	.include cpu.inc
+
+	uj	start
+
+	.org	OS_START
+start:
+	lw	r1, proc
+	rw	r1, INTV_CPU_H
+	lw	r1, stack
+	rw	r1, STACKP
+	im	mask
+wait:	hlt
+	ujs	wait
+
+proc:	hlt	077
+
+	.org	0x200
+	giu
+	hlt	077
+
+mask:	.word	IMASK_CPU_H
+stack:
+
+; XPCT ir : 0xec3f
@@ -0,0 +1,23 @@
+; OPTS -c configs/2machines.ini
+; PRECMD reg r2 0x2222
+; PRECMD machine 1
+; PRECMD reg r2 0x1111
+; PRECMD memw 0 0x100 0x5555
+; PRECMD machine 0
+
+; Two machines configured in [machines] have separate registers
+; and memory. Registers and memory of the second machine are set
+; while it is selected with the "machine" command, then the first
+; machine runs the test and sees neither of them.
+
+	.cpu	mera400
+
+	lw	r1, [data]
+	hlt	077
+
+	.org	0x100
+data:	.word	0xaaaa
+
+; XPCT r1 : 0xaaaa
+; XPCT r2 : 0x2222
+; XPCT [0x100] : 0xaaaa
@@ -0,0 +1,267 @@
+; OPTS -c configs/tape.ini
+
+; Write two records and a tape mark, rewind, then read it all back
+
+	.cpu	mx16
+
+	.include cpu.inc
+	.include io.inc
+	.include multix.inc
+
+	; use bit 15 of the register I/O argument for IN/OU selection
+	.const IO_IN 1
+	.const IO_OU 0
+
+	; tape drive address
+	.const	TAPE_LINE 0
+	.const	TAPE_ADDR 1\IO_CHAN | TAPE_LINE\10
+
+	; MULTIX command shortcuts
+	.const	MXCMD_SETCFG	MX_CMD_SETCFG | 1\IO_CHAN | IO_OU
+	.const	MXCMD_ATTACH	MX_CMD_ATTACH | TAPE_ADDR | IO_OU
+	.const	MXCMD_DETACH	MX_CMD_DETACH | TAPE_ADDR | IO_IN
+	.const	MXCMD_TRANSMIT	MX_CMD_TRANSMIT | TAPE_ADDR | IO_OU
+
+	; tape operations
+	.const	OP_READ 0\7
+	.const	OP_WRITE 1\7
+	.const	OP_MARK 2\7
+	.const	OP_REWIND 7\7
+
+	; tape status bits
+	.const	TS_MARK 1\0
+	.const	TS_BOT 1\3
+
+	; record lengths
+	.const	REC1 16
+	.const	REC2 8
+
+	; buffer locations
+	.const	rdbuf	prog_end
+	.const	wrbuf	prog_end+REC1+REC2
+	.const	stack	prog_end+2*(REC1+REC2)
+
+	uj	start
+
+msk_0:	.word	IMASK_NONE
+msk_mx:	.word	IMASK_CH0_1
+xlip:	lip
+
+	.org	INTV
+	.res	16, xlip	; dummy interrupt handlers
+	.word	xlip		; dummy EXL handler
+
+	.org	OS_START
+
+; ------------------------------------------------------------------------
+; MULTIX interrupt handler
+; updates:
+;  mx_last_int
+mx_last_int:
+	.word	0
+tmp_r7:	.res	1
+mx_proc:
+	rw	r7, tmp_r7
+	md	[STACKP]
+	lw	r7, [-1]
+	rw	r7, mx_last_int
+	lw	r7, [tmp_r7]
+	lip
+
+; ------------------------------------------------------------------------
+; I/O handler
+; expects:
+;  r1 - I/O command + IN/OU information on bit 15
+;  r2 - configuration field address
+;  r3 - expected interrupt specification
+;  r4 - RJ return adress
+io_cmd:
+	sxl	r1
+	er	r1, 1
+	rz	mx_last_int
+repeat:	jxs	c_in
+c_ou:	ou	r2, r1
+	.word	c_no, c_en, c_ok, c_pe
+c_in:	in	r2, r1
+	.word	c_no, c_en, c_ok, c_pe
+c_no:	hlt	041	; error
+c_en:	ujs	repeat	; repeat if engaged
+c_pe:	hlt	042	; error
+c_ok:	lw	r1, [mx_last_int]
+	nr	r1, r1
+	bb	r0, ?Z	; multix interrupt ready?
+	ujs	c_ret	; yes
+	hlt		; no -> wait
+	ujs	c_ok
+c_ret:	cw	r3, r1
+	bb	r0, ?E	; intspec as expected?
+	ujs	c_fail
+	uj	r4
+c_fail:
+	im	msk_0
+	hlt	043
+
+; ------------------------------------------------------------------------
+; test data
+conf:	.word	1\7 | 1\15, 0
+	.word	MX_LDIR_NONE | MX_LINE_USED | MX_LTYPE_TAPE | 3
+	.word	MX_LPROTO_TAPE | 0, 0, 0, 0
+
+; transmit fields: operation, address, length-1, returned length, returned status
+write1:	.word	OP_WRITE, wrbuf, REC1-1, -1, -1
+write2:	.word	OP_WRITE, wrbuf+REC1, REC2-1, -1, -1
+mark:	.word	OP_MARK, 0, 0, -1, -1
+rewind:	.word	OP_REWIND, 0, 0, -1, -1
+read1:	.word	OP_READ, rdbuf, REC1+REC2-1, -1, -1	; room for more than the record
+read2:	.word	OP_READ, rdbuf+REC1, REC2-1, -1, -1
+read3:	.word	OP_READ, rdbuf, REC1-1, -1, -1
+
+seq:	; [command, field_addr, exp_irq, check_proc]
+	.word	MXCMD_SETCFG, conf, MX_IUKON, 0
+	.word	MXCMD_ATTACH, -1, MX_IDOLI + TAPE_LINE, 0
+	.word	MXCMD_TRANSMIT, write1, MX_IETRA + TAPE_LINE, chk_wr1
+	.word	MXCMD_TRANSMIT, write2, MX_IETRA + TAPE_LINE, chk_wr2
+	.word	MXCMD_TRANSMIT, mark, MX_IETRA + TAPE_LINE, 0
+	.word	MXCMD_TRANSMIT, rewind, MX_IETRA + TAPE_LINE, chk_rew
+	.word	MXCMD_TRANSMIT, read1, MX_IETRA + TAPE_LINE, chk_rd1
+	.word	MXCMD_TRANSMIT, read2, MX_IETRA + TAPE_LINE, chk_rd2
+	.word	MXCMD_TRANSMIT, read3, MX_IETRA + TAPE_LINE, chk_rd3
+	.word	MXCMD_DETACH, -1, MX_IODLI + TAPE_LINE, 0
+seqe:
+
+; ------------------------------------------------------------------------
+; check transmission result
+; expects:
+;  r1 - transmit field address
+;  r2 - expected length
+;  r3 - expected status
+chkret:
+	.res	1
+	cw	r2, [r1+3]
+	bb	r0, ?E
+	ujs	chkret_fail
+	cw	r3, [r1+4]
+	bb	r0, ?E
+	ujs	chkret_fail
+	uj	[chkret]
+chkret_fail:
+	im	msk_0
+	hlt	050
+
+; ------------------------------------------------------------------------
+; compare rdbuf with wrbuf
+; expects:
+;  r3 - number of words to compare
+cmpbuf:
+	.res	1
+	lw	r1, wrbuf-1
+	lw	r2, rdbuf-1
+cmp_loop:
+	lw	r4, [r1+r3]
+	cw	r4, [r2+r3]
+	bb	r0, ?E
+	ujs	cmp_fail
+	drb	r3, cmp_loop
+	uj	[cmpbuf]
+cmp_fail:
+	im	msk_0
+	hlt	051
+
+; ------------------------------------------------------------------------
+chk_wr1:
+	.res	1
+	lw	r1, write1
+	lw	r2, REC1
+	lwt	r3, 0
+	lj	chkret
+	uj	[chk_wr1]
+chk_wr2:
+	.res	1
+	lw	r1, write2
+	lw	r2, REC2
+	lwt	r3, 0
+	lj	chkret
+	uj	[chk_wr2]
+chk_rew:
+	.res	1
+	lw	r1, rewind
+	lwt	r2, 0
+	lw	r3, TS_BOT
+	lj	chkret
+	uj	[chk_rew]
+chk_rd1:
+	.res	1
+	lw	r1, read1
+	lw	r2, REC1
+	lwt	r3, 0
+	lj	chkret
+	lw	r3, REC1
+	lj	cmpbuf
+	uj	[chk_rd1]
+chk_rd2:
+	.res	1
+	lw	r1, read2
+	lw	r2, REC2
+	lwt	r3, 0
+	lj	chkret
+	lw	r3, REC1+REC2
+	lj	cmpbuf
+	uj	[chk_rd2]
+chk_rd3:	; tape mark
+	.res	1
+	lw	r1, read3
+	lwt	r2, 0
+	lw	r3, TS_MARK
+	lj	chkret
+	uj	[chk_rd3]
+
+; ------------------------------------------------------------------------
+; ---- MAIN --------------------------------------------------------------
+; ------------------------------------------------------------------------
+start:
+	lw	r1, stack
+	rw	r1, STACKP
+	lw	r1, mx_proc
+	rw	r1, INTV_CH1
+	im	msk_mx
+
+fill:	; fill write buffer with a pattern
+	lw	r4, wrbuf
+	lw	r3, REC1+REC2
+	lw	r1, 0x1234
+fill_loop:
+	rw	r1, r4
+	aw	r1, 0x0f1e
+	awt	r4, 1
+	drb	r3, fill_loop
+
+mxinit:	; wait for MX initialization to end
+	lw	r1, [mx_last_int]
+	cw	r1, MX_IWYZE
+	jes	run_tests
+	hlt
+	ujs	mxinit
+
+run_tests:
+	; test loop
+	lw	r7, seq
+next_test:
+	lf	r7
+	rj	r4, io_cmd
+	lw	r1, [r7+3]
+	cw	r1, 0
+	jes	no_check_proc
+	lj	r1
+no_check_proc:
+	awt	r7, 4
+	cw	r7, seqe
+	jn	next_test
+
+	im	msk_0
+	hlt	077
+prog_end:
+
+; XPCT rz[15] : 0
+; XPCT rz[6] : 0
+; XPCT alarm : 0
+; XPCT ir : 0xec3f
@@ -25,6 +25,7 @@ import time
 import subprocess
 import argparse
 import tempfile
+import struct
 
 DEBUG = 0
 
@@ -32,6 +33,11 @@ R_OK = 0
 R_ERR = 1
 R_UNK = 2
 
+# register dump order in batch mode (same as ectl register order)
+BATCH_REGS = [ "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+    "ic", "ac", "ar", "ir", "sr", "rz", "kb", "kb2",
+    "mc", "alarm", "rm", "q", "bs", "nb", "p", "rz_io" ]
+
 # ------------------------------------------------------------------------
 class EM400:
 
@@ -179,7 +185,7 @@ class TestResult:
             ret = "%-60s %s" % (t, pf[self.passed])
             for f in self.checks:
                 if f[1] != f[2]:
-                    ret += " %s=%i!=%i" % (f[0], f[2], f[1])
+                    ret += " %s=%s!=%s" % (f[0], f[2], f[1])
             return ret
 
         return "no result"
@@ -262,8 +268,10 @@ class TestBed:
     def __gerparams(self, source):
         opts = []
         xpct = []
+        xpctcmd = []
         precmd = []
         postcmd = []
+        batch = None
         for l in open(source, "r"):
             # get OPTS directive
             if "OPTS" in l:
@@ -272,8 +280,15 @@ class TestBed:
                     opts += popts
                 except:
                     raise Exception("Malformed OPTS: %s" % l)
+            # get expected command responses
+            if "XPCTCMD" in l:
+                try:
+                    pxpct = re.findall(";[ \t]*XPCTCMD[ \t]+(.+?)[ \t]+:[ \t]+(.*)\n", l)
+                    xpctcmd += [(pxpct[0][0].strip(), pxpct[0][1].strip())]
+                except:
+                    raise Exception("Malformed XPCTCMD: %s" % l)
             # get test result conditions
-            if "XPCT" in l:
+            elif "XPCT" in l:
                 try:
                     pxpct = re.findall(";[ \t]*XPCT[ \t]+(.+):(.+)\n", l)
                     expr = pxpct[0][0].strip()
@@ -295,16 +310,27 @@ class TestBed:
                     postcmd += ppostcmd
                 except:
                     raise Exception("Malformed POSTCMD: %s" % l)
+            # get batch mode exit status
+            if "BATCH" in l:
+                try:
+                    batch = int(re.findall(";[ \t]*BATCH[ \t]+(.+)\n", l)[0].strip(), 0)
+                except:
+                    raise Exception("Malformed BATCH: %s" % l)
 
-        return opts, xpct, precmd, postcmd
+        return opts, xpct, xpctcmd, precmd, postcmd, batch
 
     # --------------------------------------------------------------------
     def run(self, source):
         result = TestResult(source)
 
         try:
-            opts, xpct, precmd, postcmd = self.__gerparams(source)
+            opts, xpct, xpctcmd, precmd, postcmd, batch = self.__gerparams(source)
             aout = self.__assembly(source)
+            if batch is not None:
+                if precmd or postcmd or xpctcmd:
+                    raise Exception("PRECMD/POSTCMD/XPCTCMD can't be used in batch mode")
+                self.__batch(result, aout, opts, xpct, batch)
+                return result
             self.__runemu(["-c", self.default_config] + opts)
             self.e.wait_for_stop()
             self.e.clear()
@@ -315,8 +341,8 @@ class TestBed:
                 for c in precmd:
                     self.e.cmd(c)
 
-            if xpct:
-                self.__passfail(result, xpct)
+            if xpct or xpctcmd:
+                self.__passfail(result, xpct, xpctcmd)
             else:
                 self.__benchmark(result, source)
 
@@ -336,12 +362,56 @@ class TestBed:
         return result
 
     # --------------------------------------------------------------------
-    def __passfail(self, result, xpct):
+    def __passfail(self, result, xpct, xpctcmd):
         self.e.start()
         self.e.wait_for_finish()
         self.e.stop()
         for x in xpct:
             result.add_check(x[0], x[1], self.e.eval(x[0]))
+        for x in xpctcmd:
+            result.add_check(x[0], x[1], " ".join(self.e.cmd(x[0])))
+
+    # --------------------------------------------------------------------
+    def __batch(self, result, aout, opts, xpct, status):
+        # batch mode can only check registers and memory words ([addr]) dumped at the end of the run
+        regs_dump = aout + ".regs"
+        mem_dump = aout + ".mem"
+        addrs = []
+        for x in xpct:
+            m = re.findall(r"^\[(.+)\]$", x[0])
+            if m:
+                addrs.append(int(m[0], 0))
+            elif x[0].lower() not in BATCH_REGS:
+                raise Exception("Can't check '%s' in batch mode" % x[0])
+
+        args = [self.binary, "-b", "-c", self.default_config] + opts
+        if self.log:
+            args += ["-l", self.log]
+        if self.options:
+            for o in self.options:
+                args += ["-O", o]
+        args += ["-p", aout, "-O", "batch:regs_dump=%s" % regs_dump]
+        if addrs:
+            args += ["-O", "batch:mem_dump=%s" % mem_dump, "-O", "batch:mem_ranges=%s" % ",".join(["0:%i:1" % a for a in addrs])]
+
+        if DEBUG:
+            print("Running EM400 in batch mode: %s" % " ".join(args))
+        p = subprocess.run(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, timeout=60)
+        result.add_check("exit", status, p.returncode)
+
+        with open(regs_dump, "rb") as f:
+            regs = struct.unpack(">%iH" % len(BATCH_REGS), f.read())
+        mem = ()
+        if addrs:
+            with open(mem_dump, "rb") as f:
+                mem = struct.unpack(">%iH" % len(addrs), f.read())
+
+        for x in xpct:
+            m = re.findall(r"^\[(.+)\]$", x[0])
+            if m:
+                result.add_check(x[0], x[1], mem[addrs.index(int(m[0], 0))])
+            else:
+                result.add_check(x[0], x[1], regs[BATCH_REGS.index(x[0].lower())])
 
     # --------------------------------------------------------------------
     def __benchmark(self, result, source):
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+
+#  Copyright (c) 2020 Jakub Filipowicz <jakubf@gmail.com>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc.,
+#  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Zero-copy access to memory and CPU state of a running em400
+# configured with memory:shm_name (see src/ectl/shm.h)
+
+import sys
+import mmap
+import struct
+
+SEGMENT_SIZE = 4096
+MAGIC = 0x45343030
+VERSION = 2
+
+# struct ectl_shm_state
+STATE_FMT = "=IIIIQII8H6H4H256i"
+STATE_SIZE = struct.calcsize(STATE_FMT)
+SEQ_OFFSET = 8
+
+# ------------------------------------------------------------------------
+class EM400Shm:
+
+    # --------------------------------------------------------------------
+    def __init__(self, name="em400"):
+        with open("/dev/shm/%s.state" % name, "rb") as f:
+            self.state_map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        with open("/dev/shm/%s.mem" % name, "rb") as f:
+            self.mem_map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.mem = memoryview(self.mem_map).cast("H")
+
+        magic, version = struct.unpack_from("=II", self.state_map, 0)
+        if magic != MAGIC or version != VERSION:
+            raise RuntimeError("Not an em400 state block (magic 0x%08x, version %i)" % (magic, version))
+
+    # --------------------------------------------------------------------
+    def __seq(self):
+        return struct.unpack_from("=I", self.state_map, SEQ_OFFSET)[0]
+
+    # --------------------------------------------------------------------
+    def state(self):
+        # seqlock read: retry until the block didn't change while copying
+        while True:
+            seq = self.__seq()
+            if seq & 1:
+                continue
+            data = self.state_map[:STATE_SIZE]
+            if self.__seq() == seq:
+                break
+
+        v = struct.unpack(STATE_FMT, data)
+        return {
+            "state": v[3],
+            "instructions": v[4],
+            "rz": v[5],
+            "segments": v[6],
+            "r": list(v[7:15]),
+            "ic": v[15], "ir": v[16], "ac": v[17], "ar": v[18], "kb": v[19], "sr": v[20],
+            "mc": v[21], "alarm": v[22], "p": v[23],
+            "mem_map": [list(v[25+nb*16:25+nb*16+16]) for nb in range(16)],
+        }
+
+    # --------------------------------------------------------------------
+    def read(self, nb, addr, count=1, mem_map=None):
+        if mem_map is None:
+            mem_map = self.state()["mem_map"]
+        words = []
+        for a in range(addr, addr+count):
+            a &= 0xffff
+            seg = mem_map[nb][a >> 12]
+            if seg < 0:
+                raise IndexError("Address %i:0x%04x is not mapped" % (nb, a))
+            words.append(self.mem[seg*SEGMENT_SIZE + (a & 0xfff)])
+        return words
+
+# ------------------------------------------------------------------------
+# ---- MAIN --------------------------------------------------------------
+# ------------------------------------------------------------------------
+if __name__ == "__main__":
+    e = EM400Shm(sys.argv[1] if len(sys.argv) > 1 else "em400")
+    s = e.state()
+    print("IC: 0x%04x  IR: 0x%04x  SR: 0x%04x  RZ: 0x%08x  instructions: %i" % (s["ic"], s["ir"], s["sr"], s["rz"], s["instructions"]))
+    print("R0-R7: " + " ".join("0x%04x" % x for x in s["r"]))
+
+# vim: tabstop=4 expandtab shiftwidth=4 softtabstop=4